@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small thread pool for load-time work, so the render thread can keep
+// presenting frames while assets are parsed and uploaded. Jobs run in
+// submission order (one at a time per worker). The heavy steps inside a job
+// (MeshLoader's parse, MeshSimplifier's LOD chain) already use their own
+// threads, so a single worker is usually enough.
+class AssetLoader {
+public:
+  explicit AssetLoader(unsigned threads = 1) {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; i++)
+      _workers.emplace_back([this] { run(); });
+  }
+
+  // Jobs already queued still run; there's no way to abandon a half-parsed
+  // file, so callers shouldn't need one for a queued job either.
+  ~AssetLoader() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _wake.notify_all();
+    for (std::thread &t : _workers)
+      t.join();
+  }
+
+  AssetLoader(const AssetLoader &) = delete;
+  AssetLoader &operator=(const AssetLoader &) = delete;
+
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back(std::move(job));
+    }
+    _wake.notify_one();
+  }
+
+  // Block until every submitted job has finished.
+  void wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _jobs.empty() && _running == 0; });
+  }
+
+  size_t threadCount() const { return _workers.size(); }
+
+private:
+  std::vector<std::thread> _workers;
+  std::deque<std::function<void()>> _jobs;
+  std::mutex _mutex;
+  std::condition_variable _wake, _idle;
+  unsigned _running = 0;
+  bool _stopping = false;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+      _wake.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+      if (_jobs.empty())
+        return; // Stopping, and nothing left to do
+      std::function<void()> job = std::move(_jobs.front());
+      _jobs.pop_front();
+      _running++;
+      lock.unlock();
+      job();
+      lock.lock();
+      _running--;
+      if (_jobs.empty() && _running == 0)
+        _idle.notify_all();
+    }
+  }
+};
+
+// Single-value handoff from a loader thread to the render thread. The loader
+// publish()es a finished value; the render thread take()s it at the start of
+// a frame and swaps it in, so a frame sees either the old value or the
+// whole new one, never a partly built one. Lock-free, so polling it every
+// frame costs one atomic exchange.
+template <typename T> class AssetSlot {
+public:
+  AssetSlot() = default;
+  ~AssetSlot() { delete _value.load(); }
+  AssetSlot(const AssetSlot &) = delete;
+  AssetSlot &operator=(const AssetSlot &) = delete;
+
+  // Replaces (and frees) anything published but not yet taken.
+  void publish(std::unique_ptr<T> value) {
+    delete _value.exchange(value.release(), std::memory_order_acq_rel);
+  }
+
+  // The published value, or null if there's nothing new.
+  std::unique_ptr<T> take() {
+    return std::unique_ptr<T>(
+        _value.exchange(nullptr, std::memory_order_acq_rel));
+  }
+
+  bool ready() const {
+    return _value.load(std::memory_order_acquire) != nullptr;
+  }
+
+private:
+  std::atomic<T *> _value{nullptr};
+};
@@ -0,0 +1,350 @@
+#pragma once
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "RenderBackend.hpp"
+#include "SoftwareRenderer.hpp"
+
+// RenderBackend on SoftwareRenderer, headless, for Linux builds and
+// benchmarks of Renderer's frame logic. It knows Shaders.metal's functions
+// by name, not the Metal code in them:
+//   vertex_main / vertex_main_packed + fragment_main   the scene pass
+//   post_vertex_main + post_fragment_main             SoftwareRenderer's
+//                                                     postProcess()
+//   post_chain_vertex + post_chain_fragment           the desc's
+//                                                     CpuProgram (the
+//                                                     PostPass they were
+//                                                     generated for)
+// Textures are plain arrays, lent to the SoftwareRenderer for the draws
+// that use them, and every target has to be the frame's size. Runs of
+// draws with the same vertex buffer and constants are gathered into one
+// SoftwareRenderer draw at the end of the pass (or at the next state
+// change), so the vertices are transformed once however many ranges the
+// frame is cut into. endFrame() "presents" into lastFrame().
+class CpuBackend : public RenderBackend {
+public:
+  // threads: 0 = all cores, as SoftwareRenderer
+  explicit CpuBackend(int width = 1000, int height = 1000, unsigned threads = 0)
+      : _renderer(width, height, threads) {
+    TextureDesc desc;
+    desc.width = width;
+    desc.height = height;
+    _frameTarget = newTexture(desc);
+  }
+
+  SoftwareRenderer &renderer() { return _renderer; }
+  // BGRA8, what the last endFrame() presented
+  const std::vector<uint32_t> &lastFrame() const { return _presented; }
+  size_t framesPresented() const { return _framesPresented; }
+  // What a live generated pipeline runs, null for any other
+  const CpuProgram *program(PipelineHandle pipeline) const {
+    return pipeline && pipeline.id <= _pipelines.size()
+               ? _pipelines[pipeline.id - 1].program
+               : nullptr;
+  }
+
+  BufferHandle newBuffer(const void *data, size_t bytes) override {
+    std::unique_ptr<uint8_t[]> storage(new uint8_t[bytes]);
+    if (data)
+      memcpy(storage.get(), data, bytes);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffers.push_back(std::move(storage));
+    BufferHandle handle;
+    handle.id = _buffers.size();
+    return handle;
+  }
+
+  void *bufferContents(BufferHandle buffer) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _buffers[buffer.id - 1].get();
+  }
+
+  void releaseBuffer(BufferHandle buffer) override {
+    if (!buffer)
+      return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffers[buffer.id - 1].reset();
+  }
+
+  TextureHandle newTexture(const TextureDesc &desc) override {
+    std::unique_ptr<Texture> texture(new Texture);
+    texture->desc = desc;
+    size_t pixels = size_t(desc.width) * desc.height;
+    if (desc.format == PixelFormat::Depth32Float)
+      texture->depth.resize(pixels);
+    else
+      texture->color.resize(pixels);
+    _textures.push_back(std::move(texture));
+    TextureHandle handle;
+    handle.id = _textures.size();
+    return handle;
+  }
+
+  void releaseTexture(TextureHandle texture) override {
+    if (texture)
+      _textures[texture.id - 1].reset();
+  }
+
+  // BGRA8 or Depth32F pixels of a texture, to read back
+  const uint32_t *colorPixels(TextureHandle texture) const {
+    return _textures[texture.id - 1]->color.data();
+  }
+  const float *depthPixels(TextureHandle texture) const {
+    return _textures[texture.id - 1]->depth.data();
+  }
+
+  PipelineHandle newPipeline(const PipelineDesc &desc) override {
+    Pipeline pipeline;
+    std::string vertex = desc.vertexFunction, fragment = desc.fragmentFunction;
+    if (vertex == "vertex_main" && fragment == "fragment_main") {
+      pipeline.kind = Pipeline::Scene;
+    } else if (vertex == "vertex_main_packed" && fragment == "fragment_main") {
+      pipeline.kind = Pipeline::ScenePacked;
+    } else if (vertex == "post_vertex_main" &&
+               fragment == "post_fragment_main") {
+      pipeline.kind = Pipeline::Post;
+    } else if (vertex == "post_chain_vertex" &&
+               fragment == "post_chain_fragment" && desc.cpuProgram) {
+      pipeline.kind = Pipeline::Chain;
+      pipeline.program = desc.cpuProgram;
+    } else {
+      std::cerr << "CpuBackend has no " << vertex << " + " << fragment
+                << std::endl;
+      return PipelineHandle();
+    }
+    _pipelines.push_back(pipeline);
+    PipelineHandle handle;
+    handle.id = _pipelines.size();
+    return handle;
+  }
+
+  // Drops the pipeline's CpuProgram, which needn't outlive it
+  void releasePipeline(PipelineHandle pipeline) override {
+    if (pipeline && pipeline.id <= _pipelines.size())
+      _pipelines[pipeline.id - 1] = Pipeline();
+  }
+
+  bool beginFrame() override { return true; }
+  TextureHandle frameTarget() override { return _frameTarget; }
+  int frameWidth() const override { return _renderer.width(); }
+  int frameHeight() const override { return _renderer.height(); }
+
+  // Swapped out like a swap chain's image; the next frame's post pass
+  // writes every pixel of whatever the target is left holding
+  void endFrame() override {
+    std::vector<uint32_t> &target = texture(_frameTarget).color;
+    _presented.swap(target);
+    target.resize(_presented.size()); // Empty the first time
+    _framesPresented++;
+  }
+
+  void beginPass(const PassDesc &desc) override {
+    _pass = desc;
+    _lent = _drawn = false;
+    _pipeline = Pipeline();
+    _vertexBuffer = BufferHandle();
+    _textureBinding[0] = _textureBinding[1] = TextureHandle();
+    _valid = fits(desc.color.texture) &&
+             (!desc.depth.texture || fits(desc.depth.texture));
+  }
+
+  // A pass nothing was drawn in still does its clears
+  void endPass() override {
+    if (!_valid)
+      return;
+    flush();
+    if (_lent) {
+      _renderer.swapColor(texture(_pass.color.texture).color);
+      if (_pass.depth.texture)
+        _renderer.swapDepth(texture(_pass.depth.texture).depth);
+      return;
+    }
+    if (_drawn)
+      return;
+    if (_pass.color.load == LoadAction::Clear) {
+      const float *c = _pass.color.clearColor;
+      std::vector<uint32_t> &color = texture(_pass.color.texture).color;
+      std::fill(color.begin(), color.end(),
+                SoftwareRenderer::packColor(c[0], c[1], c[2], c[3]));
+    }
+    if (_pass.depth.texture && _pass.depth.load == LoadAction::Clear) {
+      std::vector<float> &depth = texture(_pass.depth.texture).depth;
+      std::fill(depth.begin(), depth.end(), _pass.depth.clearDepth);
+    }
+  }
+
+  void setPipeline(PipelineHandle pipeline) override {
+    flush();
+    _pipeline = pipeline ? _pipelines[pipeline.id - 1] : Pipeline();
+  }
+
+  void setVertexBuffer(BufferHandle buffer, size_t offset,
+                       int index) override {
+    if (index != 0)
+      return;
+    flush();
+    _vertexBuffer = buffer;
+    _vertexOffset = offset;
+  }
+
+  // [[buffer(1)]] Uniforms, [[buffer(2)]] PackedMeshInfo
+  void setVertexBytes(const void *data, size_t bytes, int index) override {
+    flush();
+    if (index == 1 && bytes == sizeof(Uniforms))
+      memcpy(&_uniforms, data, bytes);
+    else if (index == 2 && bytes == sizeof(PackedMeshInfo))
+      memcpy(&_packedMeshInfo, data, bytes);
+  }
+
+  void setFragmentTexture(TextureHandle texture, int index) override {
+    if (index >= 0 && index < 2)
+      _textureBinding[index] = texture;
+  }
+
+  // Widened to uint32 into the pending run; drawn by flush()
+  void drawIndexed(size_t indexCount, IndexType indexType,
+                   BufferHandle indexBuffer, size_t offset) override {
+    if (!_valid ||
+        (_pipeline.kind != Pipeline::Scene &&
+         _pipeline.kind != Pipeline::ScenePacked) ||
+        !_vertexBuffer)
+      return;
+    const uint8_t *src =
+        static_cast<const uint8_t *>(bufferContents(indexBuffer)) + offset;
+    size_t base = _indices.size();
+    _indices.resize(base + indexCount);
+    if (indexType == IndexType::UInt16) {
+      const uint16_t *src16 = reinterpret_cast<const uint16_t *>(src);
+      for (size_t i = 0; i < indexCount; i++)
+        _indices[base + i] = src16[i];
+    } else {
+      memcpy(&_indices[base], src, indexCount * sizeof(uint32_t));
+    }
+  }
+
+  // A post pass's fullscreen triangle: postProcess() with the output as
+  // the frame and the sampled pair as the colour and depth targets, or a
+  // pipeline's CpuProgram run on them
+  void draw(size_t vertexCount) override {
+    if (!_valid ||
+        (_pipeline.kind != Pipeline::Post &&
+         _pipeline.kind != Pipeline::Chain) ||
+        vertexCount < 3 || !fits(_textureBinding[0]) ||
+        !fits(_textureBinding[1]))
+      return;
+    std::vector<uint32_t> &out = texture(_pass.color.texture).color;
+    std::vector<uint32_t> &color = texture(_textureBinding[0]).color;
+    std::vector<float> &depth = texture(_textureBinding[1]).depth;
+    if (_pipeline.kind == Pipeline::Chain) {
+      _pipeline.program->run(color.data(), depth.data(), out.data(),
+                             _renderer.width(), _renderer.height(),
+                             _renderer.pool());
+      _drawn = true;
+      return;
+    }
+    _drawn = true;
+    _renderer.swapFrame(out);
+    _renderer.swapColor(color);
+    _renderer.swapDepth(depth);
+    _renderer.postProcess();
+    _renderer.swapDepth(depth);
+    _renderer.swapColor(color);
+    _renderer.swapFrame(out);
+  }
+
+private:
+  struct Texture {
+    TextureDesc desc;
+    std::vector<uint32_t> color;
+    std::vector<float> depth;
+  };
+  struct Pipeline {
+    enum Kind { None, Scene, ScenePacked, Post, Chain } kind = None;
+    const CpuProgram *program = nullptr; // Chain's
+  };
+
+  SoftwareRenderer _renderer;
+  std::mutex _mutex; // _buffers, which the loader thread adds to
+  std::vector<std::unique_ptr<uint8_t[]>> _buffers;
+  std::vector<std::unique_ptr<Texture>> _textures;
+  std::vector<Pipeline> _pipelines;
+  TextureHandle _frameTarget;
+  std::vector<uint32_t> _presented;
+  size_t _framesPresented = 0;
+
+  // The pass in flight, its bindings and its pending run of draws
+  PassDesc _pass;
+  bool _valid = false;
+  bool _lent = false;  // Attachments are the renderer's targets
+  bool _drawn = false; // A post pass wrote the colour attachment
+  Pipeline _pipeline;
+  BufferHandle _vertexBuffer;
+  size_t _vertexOffset = 0;
+  Uniforms _uniforms = {};
+  PackedMeshInfo _packedMeshInfo = {};
+  TextureHandle _textureBinding[2];
+  std::vector<uint32_t> _indices;
+
+  Texture &texture(TextureHandle handle) { return *_textures[handle.id - 1]; }
+
+  bool fits(TextureHandle handle) {
+    if (!handle || !_textures[handle.id - 1])
+      return false;
+    const TextureDesc &desc = texture(handle).desc;
+    if (desc.width == _renderer.width() && desc.height == _renderer.height())
+      return true;
+    std::cerr << "CpuBackend: " << desc.width << "x" << desc.height
+              << " target in a " << _renderer.width() << "x"
+              << _renderer.height() << " frame, pass skipped" << std::endl;
+    return false;
+  }
+
+  // Lends the scene pass's attachments to the renderer and applies their
+  // load actions (DontCare loads, as that's free here). Without a depth
+  // attachment, draws still depth test, against a cleared target of the
+  // renderer's own.
+  void lendScene() {
+    if (_lent)
+      return;
+    _lent = true;
+    _renderer.swapColor(texture(_pass.color.texture).color);
+    if (_pass.color.load == LoadAction::Clear) {
+      const float *c = _pass.color.clearColor;
+      _renderer.clearColor(SoftwareRenderer::packColor(c[0], c[1], c[2], c[3]));
+    }
+    if (_pass.depth.texture)
+      _renderer.swapDepth(texture(_pass.depth.texture).depth);
+    if (!_pass.depth.texture || _pass.depth.load == LoadAction::Clear)
+      _renderer.clearDepth(_pass.depth.clearDepth);
+    else
+      _renderer.rebuildHiZ();
+    _renderer.resetStats();
+  }
+
+  // Draws the pending run. The vertex count isn't known to the API; the
+  // highest index says how many vertices the run can reach.
+  void flush() {
+    if (_indices.empty())
+      return;
+    uint32_t maxIndex = 0;
+    for (uint32_t i : _indices)
+      maxIndex = std::max(maxIndex, i);
+    lendScene();
+    const uint8_t *vertices =
+        static_cast<const uint8_t *>(bufferContents(_vertexBuffer)) +
+        _vertexOffset;
+    if (_pipeline.kind == Pipeline::ScenePacked)
+      _renderer.drawIndexed(reinterpret_cast<const PackedVertex *>(vertices),
+                            size_t(maxIndex) + 1, _packedMeshInfo,
+                            _indices.data(), _indices.size(), _uniforms);
+    else
+      _renderer.drawIndexed(reinterpret_cast<const Vertex *>(vertices),
+                            size_t(maxIndex) + 1, _indices.data(),
+                            _indices.size(), _uniforms);
+    _indices.clear();
+  }
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MeshLoader.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Bounds laid out one array per component, so the culler can test four at
+// a time with plain unaligned vector loads.
+struct BoundsSoA {
+  std::vector<float> centerX, centerY, centerZ, radius;
+  std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+  size_t size() const { return radius.size(); }
+
+  void clear() {
+    for (std::vector<float> *v : arrays())
+      v->clear();
+  }
+
+  // Empty bounds go in as a point with radius -inf, which fails every
+  // plane, so nothing has to special-case them later.
+  void push(const Bounds &b) {
+    bool e = b.empty();
+    centerX.push_back(e ? 0.0f : b.center[0]);
+    centerY.push_back(e ? 0.0f : b.center[1]);
+    centerZ.push_back(e ? 0.0f : b.center[2]);
+    radius.push_back(e ? -INFINITY : b.radius);
+    minX.push_back(e ? 0.0f : b.min[0]);
+    minY.push_back(e ? 0.0f : b.min[1]);
+    minZ.push_back(e ? 0.0f : b.min[2]);
+    maxX.push_back(e ? 0.0f : b.max[0]);
+    maxY.push_back(e ? 0.0f : b.max[1]);
+    maxZ.push_back(e ? 0.0f : b.max[2]);
+  }
+
+private:
+  std::vector<std::vector<float> *> arrays() {
+    return {&centerX, &centerY, &centerZ, &radius, &minX,
+            &minY,    &minZ,    &maxX,    &maxY,   &maxZ};
+  }
+};
+
+// The six clip planes of a view-projection matrix, in the space the matrix
+// takes points from (Gribb & Hartmann). A point p is inside when
+// dot(plane.xyz, p) + plane.w >= 0 for every plane. Matrices are column
+// major, m[column][row], as in Renderer's Uniforms and Metal's float4x4.
+// Clip z runs over [0, w] the way Metal has it.
+struct Frustum {
+  float planes[6][4];
+
+  static Frustum fromMatrix(const float m[4][4]) {
+    auto row = [&](int r, float *out) {
+      for (int c = 0; c < 4; c++)
+        out[c] = m[c][r];
+    };
+    float r0[4], r1[4], r2[4], r3[4];
+    row(0, r0);
+    row(1, r1);
+    row(2, r2);
+    row(3, r3);
+    Frustum f;
+    for (int k = 0; k < 4; k++) {
+      f.planes[0][k] = r3[k] + r0[k]; // left
+      f.planes[1][k] = r3[k] - r0[k]; // right
+      f.planes[2][k] = r3[k] + r1[k]; // bottom
+      f.planes[3][k] = r3[k] - r1[k]; // top
+      f.planes[4][k] = r2[k];         // near (z >= 0)
+      f.planes[5][k] = r3[k] - r2[k]; // far
+    }
+    // Unit normals, so the sphere test can compare against the radius
+    for (float *p : f.planes) {
+      float len = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+      if (len > 0) {
+        for (int k = 0; k < 4; k++)
+          p[k] /= len;
+      }
+    }
+    return f;
+  }
+
+  // proj * view, both column major
+  static Frustum fromViewProj(const float view[4][4], const float proj[4][4]) {
+    float m[4][4];
+    for (int c = 0; c < 4; c++) {
+      for (int r = 0; r < 4; r++) {
+        m[c][r] = 0.0f;
+        for (int k = 0; k < 4; k++)
+          m[c][r] += proj[k][r] * view[c][k];
+      }
+    }
+    return fromMatrix(m);
+  }
+};
+
+// Frustum culling for a list of bounds in object space: the planes are
+// pulled back through the view and projection matrices once, instead of
+// transforming every bound. Each bound gets the sphere test, then the box
+// test against the corner furthest along each plane's normal; both are
+// conservative, so a bound is dropped only when one of them proves it's
+// fully outside some plane. Four bounds at a time with SSE2/NEON, with
+// cullScalar() as the reference.
+class FrustumCuller {
+public:
+  // visible[i] = 1 if bounds i may be on screen, else 0. Returns the
+  // number visible.
+  static size_t cull(const BoundsSoA &bounds, const float view[4][4],
+                     const float proj[4][4], std::vector<uint8_t> &visible) {
+    return cull(bounds, Frustum::fromViewProj(view, proj), visible);
+  }
+
+  static size_t cull(const BoundsSoA &bounds, const Frustum &frustum,
+                     std::vector<uint8_t> &visible) {
+    visible.resize(bounds.size());
+    size_t i = 0, count = 0;
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+    for (; i + 4 <= bounds.size(); i += 4)
+      count += test4(bounds, frustum, i, &visible[i]);
+#endif
+    for (; i < bounds.size(); i++)
+      count += visible[i] = test1(bounds, frustum, i);
+    return count;
+  }
+
+  static size_t cullScalar(const BoundsSoA &bounds, const Frustum &frustum,
+                           std::vector<uint8_t> &visible) {
+    visible.resize(bounds.size());
+    size_t count = 0;
+    for (size_t i = 0; i < bounds.size(); i++)
+      count += visible[i] = test1(bounds, frustum, i);
+    return count;
+  }
+
+private:
+  static uint8_t test1(const BoundsSoA &b, const Frustum &f, size_t i) {
+    float hx = 0.5f * (b.maxX[i] - b.minX[i]);
+    float hy = 0.5f * (b.maxY[i] - b.minY[i]);
+    float hz = 0.5f * (b.maxZ[i] - b.minZ[i]);
+    float bx = b.minX[i] + hx, by = b.minY[i] + hy, bz = b.minZ[i] + hz;
+    bool inside = true;
+    for (const float *p : f.planes) {
+      float s = p[0] * b.centerX[i] + p[1] * b.centerY[i] +
+                p[2] * b.centerZ[i] + p[3];
+      // Grouped like test4(), so both give the same answer on the planes
+      float a = (p[0] * bx + p[1] * by + p[2] * bz + p[3]) +
+                (std::fabs(p[0]) * hx + std::fabs(p[1]) * hy +
+                 std::fabs(p[2]) * hz);
+      inside = inside && s + b.radius[i] >= 0.0f && a >= 0.0f;
+    }
+    return inside ? 1 : 0;
+  }
+
+#if defined(__SSE2__)
+  // test1() for bounds i..i+3.
+  static size_t test4(const BoundsSoA &b, const Frustum &f, size_t i,
+                      uint8_t *out) {
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 minX = _mm_loadu_ps(&b.minX[i]), minY = _mm_loadu_ps(&b.minY[i]),
+           minZ = _mm_loadu_ps(&b.minZ[i]);
+    __m128 hx = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(&b.maxX[i]), minX));
+    __m128 hy = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(&b.maxY[i]), minY));
+    __m128 hz = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(&b.maxZ[i]), minZ));
+    __m128 bx = _mm_add_ps(minX, hx), by = _mm_add_ps(minY, hy),
+           bz = _mm_add_ps(minZ, hz);
+    __m128 cx = _mm_loadu_ps(&b.centerX[i]), cy = _mm_loadu_ps(&b.centerY[i]),
+           cz = _mm_loadu_ps(&b.centerZ[i]), r = _mm_loadu_ps(&b.radius[i]);
+    __m128 zero = _mm_setzero_ps();
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+    for (const float *p : f.planes) {
+      __m128 px = _mm_set1_ps(p[0]), py = _mm_set1_ps(p[1]),
+             pz = _mm_set1_ps(p[2]), pw = _mm_set1_ps(p[3]);
+      __m128 s = _mm_add_ps(dot(px, py, pz, cx, cy, cz), pw);
+      __m128 a = _mm_add_ps(
+          _mm_add_ps(dot(px, py, pz, bx, by, bz), pw),
+          dot(_mm_set1_ps(std::fabs(p[0])), _mm_set1_ps(std::fabs(p[1])),
+              _mm_set1_ps(std::fabs(p[2])), hx, hy, hz));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(s, r), zero));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(a, zero));
+    }
+    int mask = _mm_movemask_ps(inside);
+    for (int k = 0; k < 4; k++)
+      out[k] = (mask >> k) & 1;
+    return size_t(__builtin_popcount(unsigned(mask)));
+  }
+
+  static __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by,
+                    __m128 bz) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                      _mm_mul_ps(az, bz));
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  // test1() for bounds i..i+3.
+  static size_t test4(const BoundsSoA &b, const Frustum &f, size_t i,
+                      uint8_t *out) {
+    float32x4_t half = vdupq_n_f32(0.5f);
+    float32x4_t minX = vld1q_f32(&b.minX[i]), minY = vld1q_f32(&b.minY[i]),
+                minZ = vld1q_f32(&b.minZ[i]);
+    float32x4_t hx = vmulq_f32(half, vsubq_f32(vld1q_f32(&b.maxX[i]), minX));
+    float32x4_t hy = vmulq_f32(half, vsubq_f32(vld1q_f32(&b.maxY[i]), minY));
+    float32x4_t hz = vmulq_f32(half, vsubq_f32(vld1q_f32(&b.maxZ[i]), minZ));
+    float32x4_t bx = vaddq_f32(minX, hx), by = vaddq_f32(minY, hy),
+                bz = vaddq_f32(minZ, hz);
+    float32x4_t cx = vld1q_f32(&b.centerX[i]), cy = vld1q_f32(&b.centerY[i]),
+                cz = vld1q_f32(&b.centerZ[i]), r = vld1q_f32(&b.radius[i]);
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    uint32x4_t inside = vdupq_n_u32(~0u);
+    for (const float *p : f.planes) {
+      float32x4_t px = vdupq_n_f32(p[0]), py = vdupq_n_f32(p[1]),
+                  pz = vdupq_n_f32(p[2]), pw = vdupq_n_f32(p[3]);
+      float32x4_t s = vaddq_f32(dot(px, py, pz, cx, cy, cz), pw);
+      float32x4_t a = vaddq_f32(
+          vaddq_f32(dot(px, py, pz, bx, by, bz), pw),
+          dot(vdupq_n_f32(std::fabs(p[0])), vdupq_n_f32(std::fabs(p[1])),
+              vdupq_n_f32(std::fabs(p[2])), hx, hy, hz));
+      inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(s, r), zero));
+      inside = vandq_u32(inside, vcgeq_f32(a, zero));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, inside);
+    size_t count = 0;
+    for (int k = 0; k < 4; k++)
+      count += out[k] = lanes[k] ? 1 : 0;
+    return count;
+  }
+
+  static float32x4_t dot(float32x4_t ax, float32x4_t ay, float32x4_t az,
+                         float32x4_t bx, float32x4_t by, float32x4_t bz) {
+    return vaddq_f32(vaddq_f32(vmulq_f32(ax, bx), vmulq_f32(ay, by)),
+                     vmulq_f32(az, bz));
+  }
+#endif
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "MeshCache.hpp"
+#include "MeshLoader.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+
+// The CPU half of getting a mesh on screen: the indexed, optimized mesh and
+// its LOD chain, ready to pack into GPU buffers. No Metal, so the renderer
+// can run it on an AssetLoader thread and the benches can time it headless.
+struct MeshAsset {
+  IndexedMesh mesh;
+  std::vector<MeshLod> lods; // lods[0] is the full mesh
+  bool fromCache = false;
+  // Vertex cache efficiency before/after MeshOptimizer (cold loads only)
+  VertexCacheStats cacheBefore, cacheAfter;
+
+  // Warm start: copy the mesh and its LODs out of `cacheFile`. Cold start:
+  // parse and index `objFile`, optimize and simplify it and leave a cache
+  // behind for next time.
+  static MeshAsset load(const std::string &objFile,
+                        const std::string &cacheFile) {
+    MeshAsset asset;
+    MeshCache cache;
+    if (cache.open(cacheFile, objFile) && cache.indexCount() > 0 &&
+        cache.lodCount() > 0) {
+      asset.mesh.vertices.assign(cache.vertices(),
+                                 cache.vertices() + cache.vertexCount());
+      asset.mesh.indices.assign(cache.indices(),
+                                cache.indices() + cache.indexCount());
+      asset.mesh.parts.shapes.assign(cache.shapes(),
+                                     cache.shapes() + cache.shapeCount());
+      asset.mesh.parts.ranges.assign(cache.ranges(),
+                                     cache.ranges() + cache.rangeCount());
+      asset.lods = cache.readLods();
+      asset.fromCache = true;
+    } else {
+      MeshLoadOptions loadOptions;
+      loadOptions.useMmap = true;
+      loadOptions.parseThreads = 0; // All cores (small files stay serial)
+      // The parser's per-face temporaries, freed in one go after the parse
+      tinyobj::arena_t arena;
+      loadOptions.arena = &arena;
+      asset.mesh = MeshLoader::loadObjIndexed(objFile, loadOptions);
+      // Reorder for the post-transform cache and vertex fetch. The cache
+      // keeps the result, so warm starts don't pay for it.
+      asset.cacheBefore = MeshOptimizer::analyzeVertexCache(asset.mesh);
+      MeshOptimizer::optimize(asset.mesh);
+      asset.cacheAfter = MeshOptimizer::analyzeVertexCache(asset.mesh);
+      if (!asset.mesh.indices.empty()) {
+        asset.lods = MeshSimplifier::buildLodChain(asset.mesh);
+        if (!MeshCache::write(cacheFile, objFile, asset.mesh, asset.lods))
+          std::cerr << "Could not write mesh cache " << cacheFile
+                    << std::endl;
+      }
+    }
+    return asset;
+  }
+};
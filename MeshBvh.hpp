@@ -0,0 +1,511 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MeshLoader.hpp"
+#include "Parallel.hpp"
+
+// 32 bytes, so two siblings share a 64-byte cache line. Children are
+// always allocated in pairs (the right one right after the left one), and
+// the pairs start at even indices, so a traversal step loads one line.
+struct BvhNode {
+  float min[3];
+  uint32_t leftFirst; // Interior: index of the left child. Leaf: first
+                      // triangle in MeshBvh::triangles.
+  float max[3];
+  uint32_t count; // Triangles in a leaf, 0 for an interior node
+
+  bool leaf() const { return count > 0; }
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode should stay 32 bytes");
+
+// A triangle as Moller-Trumbore wants it: one corner and the two edges
+// from it.
+struct BvhTriangle {
+  float v0[3];
+  float e1[3];
+  float e2[3];
+};
+
+struct BvhRay {
+  float origin[3];
+  float dir[3]; // Needn't be unit length; t is in units of dir
+  float tMin = 0.0f;
+  float tMax = INFINITY;
+};
+
+struct BvhHit {
+  float t = INFINITY;
+  float u = 0.0f, v = 0.0f; // Barycentrics of corners 1 and 2
+  uint32_t triangle = ~0u;  // Source triangle (index / 3), ~0u = miss
+
+  bool hit() const { return triangle != ~0u; }
+};
+
+// Bounding volume hierarchy over a triangle list, for CPU ray queries
+// (picking, baking, visibility). Built top-down with binned SAH (Wald
+// 2007): each split tries kBins planes per axis over the centroid bounds
+// and keeps the cheapest. Once a node is under kTaskTriangles the rest of
+// its subtree is a task, and the tasks are built in parallel into their
+// own node arrays and appended depth-first, so the layout (and so every
+// query result) is the same for any thread count. Triangles are copied
+// into leaf order, so a leaf's triangles are contiguous.
+class MeshBvh {
+public:
+  std::vector<BvhNode> nodes;         // nodes[0] is the root, [1] unused
+  std::vector<BvhTriangle> triangles; // In leaf order
+  std::vector<uint32_t> triangleIds;  // Leaf order -> source triangle
+
+  // Triangle t is vertices[indices[3t..3t+2]], or vertices[3t..3t+2] when
+  // indices is null (MeshLoader::loadObj output). threads: 0 = all cores.
+  static MeshBvh build(const Vertex *vertices, const uint32_t *indices,
+                       size_t triangleCount, unsigned threads = 0) {
+    MeshBvh bvh;
+    Builder b(vertices, indices, triangleCount);
+    bvh.nodes.resize(2);
+    if (triangleCount == 0) {
+      bvh.nodes[0] = BvhNode{{INFINITY, INFINITY, INFINITY}, 0,
+                             {-INFINITY, -INFINITY, -INFINITY}, 0};
+      return bvh;
+    }
+
+    threads = parallel::threadCount(threads);
+
+    // Top of the tree, one node at a time (each split over the threads),
+    // leaving the small subtrees as tasks
+    std::vector<Task> tasks;
+    std::vector<Task> stack{{0, 0, uint32_t(triangleCount), 0}};
+    while (!stack.empty()) {
+      Task t = stack.back();
+      stack.pop_back();
+      if (t.count <= kTaskTriangles) {
+        tasks.push_back(t);
+        continue;
+      }
+      uint32_t mid = b.split(t, bvh.nodes[t.node], threads);
+      if (mid == 0)
+        continue;
+      uint32_t left = uint32_t(bvh.nodes.size());
+      bvh.nodes[t.node].leftFirst = left;
+      bvh.nodes.resize(left + 2);
+      // Right first, so the left subtree comes out first
+      stack.push_back({left + 1, t.first + mid, t.count - mid, t.depth + 1});
+      stack.push_back({left, t.first, mid, t.depth + 1});
+    }
+
+    // Subtrees, each into its own array with its root in bvh.nodes
+    std::vector<std::vector<BvhNode>> subtrees(tasks.size());
+    threads = std::min<unsigned>(threads, unsigned(tasks.size()));
+    std::atomic<size_t> next(0);
+    parallel::onThreads(threads, [&](unsigned) {
+      for (size_t i; (i = next++) < tasks.size();)
+        b.buildSubtree(tasks[i], bvh.nodes[tasks[i].node], subtrees[i]);
+    });
+
+    // Append them, rebasing their child indices
+    for (size_t i = 0; i < tasks.size(); i++) {
+      uint32_t base = uint32_t(bvh.nodes.size());
+      BvhNode &root = bvh.nodes[tasks[i].node];
+      if (!root.leaf())
+        root.leftFirst += base;
+      for (BvhNode &n : subtrees[i]) {
+        if (!n.leaf())
+          n.leftFirst += base;
+      }
+      bvh.nodes.insert(bvh.nodes.end(), subtrees[i].begin(),
+                       subtrees[i].end());
+    }
+
+    bvh.triangleIds.resize(triangleCount);
+    bvh.triangles.resize(triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+      const float *p[3];
+      bvh.triangleIds[i] = b.refs[i].id;
+      b.corners(bvh.triangleIds[i], p);
+      BvhTriangle &tri = bvh.triangles[i];
+      for (int k = 0; k < 3; k++) {
+        tri.v0[k] = p[0][k];
+        tri.e1[k] = p[1][k] - p[0][k];
+        tri.e2[k] = p[2][k] - p[0][k];
+      }
+    }
+    return bvh;
+  }
+
+  static MeshBvh build(const IndexedMesh &mesh, unsigned threads = 0) {
+    return build(mesh.vertices.data(), mesh.indices.data(),
+                 mesh.indices.size() / 3, threads);
+  }
+
+  static MeshBvh build(const std::vector<Vertex> &vertices,
+                       unsigned threads = 0) {
+    return build(vertices.data(), nullptr, vertices.size() / 3, threads);
+  }
+
+  // Nearest triangle the ray hits within [tMin, tMax]. Both faces count.
+  BvhHit closestHit(const BvhRay &ray) const {
+    BvhHit hit;
+    traverse(ray, [&](uint32_t i, float t, float u, float v) {
+      if (t < hit.t) {
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        hit.triangle = triangleIds[i];
+      }
+      return false;
+    });
+    return hit;
+  }
+
+  // Whether the ray hits anything within [tMin, tMax], stopping at the
+  // first hit found. For shadow and visibility rays.
+  bool anyHit(const BvhRay &ray) const {
+    bool found = false;
+    traverse(ray, [&](uint32_t, float, float, float) { return found = true; });
+    return found;
+  }
+
+  // Same test the traversal uses, for checking against brute force.
+  static bool intersect(const BvhTriangle &tri, const BvhRay &ray, float tMax,
+                        float *t, float *u, float *v) {
+    const float *d = ray.dir;
+    float p[3] = {d[1] * tri.e2[2] - d[2] * tri.e2[1],
+                  d[2] * tri.e2[0] - d[0] * tri.e2[2],
+                  d[0] * tri.e2[1] - d[1] * tri.e2[0]};
+    float det = tri.e1[0] * p[0] + tri.e1[1] * p[1] + tri.e1[2] * p[2];
+    if (det == 0.0f)
+      return false; // Parallel (or degenerate triangle)
+    float inv = 1.0f / det;
+    float s[3] = {ray.origin[0] - tri.v0[0], ray.origin[1] - tri.v0[1],
+                  ray.origin[2] - tri.v0[2]};
+    float uu = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+    if (uu < 0.0f || uu > 1.0f)
+      return false;
+    float q[3] = {s[1] * tri.e1[2] - s[2] * tri.e1[1],
+                  s[2] * tri.e1[0] - s[0] * tri.e1[2],
+                  s[0] * tri.e1[1] - s[1] * tri.e1[0]};
+    float vv = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+    if (vv < 0.0f || uu + vv > 1.0f)
+      return false;
+    float tt = (tri.e2[0] * q[0] + tri.e2[1] * q[1] + tri.e2[2] * q[2]) * inv;
+    if (tt < ray.tMin || tt > tMax)
+      return false;
+    *t = tt;
+    *u = uu;
+    *v = vv;
+    return true;
+  }
+
+  static const int kBins = 16;
+  static const uint32_t kMaxLeaf = 8; // Split bigger leaves anyway
+  static const uint32_t kTaskTriangles = 16384; // Subtree size per task
+  // Past this depth splits go to the median, which bounds the depth (and
+  // so traverse()'s stack) even for meshes SAH keeps peeling one
+  // triangle off.
+  static const uint32_t kMedianDepth = 40;
+
+private:
+  struct Task {
+    uint32_t node, first, count, depth;
+  };
+
+  // Padded to 4 floats so grow() compiles to two vector min/max ops; the
+  // builder spends most of its time in it.
+  struct Box {
+    float min[4] = {INFINITY, INFINITY, INFINITY, INFINITY};
+    float max[4] = {-INFINITY, -INFINITY, -INFINITY, -INFINITY};
+
+    void grow(const Box &b) {
+      for (int k = 0; k < 4; k++) {
+        min[k] = std::min(min[k], b.min[k]);
+        max[k] = std::max(max[k], b.max[k]);
+      }
+    }
+    void grow(const float p[3]) {
+      for (int k = 0; k < 3; k++) {
+        min[k] = std::min(min[k], p[k]);
+        max[k] = std::max(max[k], p[k]);
+      }
+    }
+    // Half the surface area; only ratios matter
+    float area() const {
+      float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+      return dx < 0 ? 0.0f : dx * dy + dy * dz + dz * dx;
+    }
+  };
+
+  // A triangle's box and id. split() partitions refs[first, first + count)
+  // in place, so the passes over a node read memory in order, and tasks
+  // (which own disjoint ranges) can run side by side.
+  struct Ref {
+    Box box;
+    uint32_t id;
+    // Twice the centroid; the factor doesn't matter for binning
+    float centroid(int axis) const { return box.min[axis] + box.max[axis]; }
+  };
+
+  struct Builder {
+    const Vertex *vertices;
+    const uint32_t *indices;
+    std::vector<Ref> refs;
+
+    Builder(const Vertex *v, const uint32_t *idx, size_t triangleCount)
+        : vertices(v), indices(idx), refs(triangleCount) {
+      for (size_t t = 0; t < triangleCount; t++) {
+        const float *p[3];
+        corners(uint32_t(t), p);
+        for (int c = 0; c < 3; c++)
+          refs[t].box.grow(p[c]);
+        refs[t].id = uint32_t(t);
+      }
+    }
+
+    void corners(uint32_t t, const float *p[3]) const {
+      for (int c = 0; c < 3; c++)
+        p[c] = vertices[indices ? indices[3 * t + c] : 3 * t + c].position;
+    }
+
+    // Fill in node's bounds and decide: returns 0 to make it a leaf over
+    // refs[first, first + count), else partitions that range and returns
+    // the left child's triangle count. Big nodes spread the bounds and
+    // binning passes over `threads`; min/max and counts merge exactly, so
+    // the result doesn't depend on it.
+    uint32_t split(const Task &task, BvhNode &node, unsigned threads = 1) {
+      const uint32_t first = task.first, count = task.count;
+      Ref *begin = refs.data() + first, *end = begin + count;
+      const unsigned chunks =
+          count >= 4 * kTaskTriangles ? std::max(1u, threads) : 1;
+      Box box, centroids;
+      if (chunks == 1) {
+        bound(begin, end, box, centroids);
+      } else {
+        std::vector<Box> boxes(chunks), centres(chunks);
+        parallel::forSlices(count, chunks, [&](unsigned c, size_t a, size_t b) {
+          bound(begin + a, begin + b, boxes[c], centres[c]);
+        });
+        for (unsigned c = 0; c < chunks; c++) {
+          box.grow(boxes[c]);
+          centroids.grow(centres[c]);
+        }
+      }
+      for (int k = 0; k < 3; k++) {
+        node.min[k] = box.min[k];
+        node.max[k] = box.max[k];
+      }
+      node.leftFirst = first;
+      node.count = count;
+      if (count <= 2)
+        return 0;
+      if (task.depth >= kMedianDepth) {
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+          if (centroids.max[k] - centroids.min[k] >
+              centroids.max[axis] - centroids.min[axis])
+            axis = k;
+        }
+        std::nth_element(begin, begin + count / 2, end,
+                         [&](const Ref &a, const Ref &b) {
+                           return a.centroid(axis) < b.centroid(axis);
+                         });
+        node.count = 0;
+        return count / 2;
+      }
+
+      // Binned SAH over all three axes in one pass, in units of one
+      // triangle test; a split costs one more box test. Small nodes get
+      // fewer bins, since the sweep is a fixed cost per node.
+      const int binN = int(std::min<uint32_t>(kBins, count));
+      float scale[3];
+      for (int k = 0; k < 3; k++) {
+        float extent = centroids.max[k] - centroids.min[k];
+        scale[k] = extent > 0.0f ? binN / extent : 0.0f;
+      }
+      Bins bins;
+      if (chunks == 1) {
+        bin(begin, end, centroids.min, scale, binN, bins);
+      } else {
+        std::vector<Bins> parts(chunks);
+        parallel::forSlices(count, chunks, [&](unsigned c, size_t a, size_t b) {
+          bin(begin + a, begin + b, centroids.min, scale, binN, parts[c]);
+        });
+        for (const Bins &part : parts) {
+          for (int k = 0; k < 3; k++) {
+            for (int i = 0; i < binN; i++) {
+              bins.box[k][i].grow(part.box[k][i]);
+              bins.count[k][i] += part.count[k][i];
+            }
+          }
+        }
+      }
+      float bestCost = INFINITY;
+      int bestAxis = -1, bestBin = 0;
+      for (int axis = 0; axis < 3; axis++) {
+        if (scale[axis] == 0.0f)
+          continue;
+        // rightArea[i] / rightCount[i]: bins i..binN-1
+        float rightArea[kBins];
+        uint32_t rightCount[kBins];
+        Box right;
+        uint32_t n = 0;
+        for (int i = binN - 1; i > 0; i--) {
+          right.grow(bins.box[axis][i]);
+          n += bins.count[axis][i];
+          rightArea[i] = right.area();
+          rightCount[i] = n;
+        }
+        Box left;
+        n = 0;
+        for (int i = 1; i < binN; i++) {
+          left.grow(bins.box[axis][i - 1]);
+          n += bins.count[axis][i - 1];
+          float cost = left.area() * n + rightArea[i] * rightCount[i];
+          if (n > 0 && rightCount[i] > 0 && cost < bestCost) {
+            bestCost = cost;
+            bestAxis = axis;
+            bestBin = i;
+          }
+        }
+      }
+
+      float area = box.area();
+      float splitCost = area > 0 ? 1.0f + bestCost / area : INFINITY;
+      if (count <= kMaxLeaf && !(splitCost < float(count)))
+        return 0;
+      uint32_t mid = 0;
+      if (bestAxis >= 0) {
+        float lo = centroids.min[bestAxis], sc = scale[bestAxis];
+        mid = uint32_t(std::partition(begin, end,
+                                      [&](const Ref &r) {
+                                        return binOf(r, bestAxis, lo, sc,
+                                                     binN) < bestBin;
+                                      }) -
+                       begin);
+      }
+      if (mid == 0 || mid == count) {
+        // All centroids in one spot: any split is as good as another
+        mid = count / 2;
+      }
+      node.count = 0;
+      return mid;
+    }
+
+    struct Bins {
+      Box box[3][kBins];
+      uint32_t count[3][kBins] = {};
+    };
+
+    // Box around refs[a, b) and around their centroids.
+    static void bound(const Ref *a, const Ref *b, Box &box, Box &centroids) {
+      for (const Ref *r = a; r < b; r++) {
+        box.grow(r->box);
+        float c[3] = {r->centroid(0), r->centroid(1), r->centroid(2)};
+        centroids.grow(c);
+      }
+    }
+
+    static void bin(const Ref *a, const Ref *b, const float lo[3],
+                    const float scale[3], int binN, Bins &bins) {
+      for (const Ref *r = a; r < b; r++) {
+        for (int k = 0; k < 3; k++) {
+          int i = binOf(*r, k, lo[k], scale[k], binN);
+          bins.box[k][i].grow(r->box);
+          bins.count[k][i]++;
+        }
+      }
+    }
+
+    static int binOf(const Ref &r, int axis, float lo, float scale,
+                     int binN) {
+      int bin = int((r.centroid(axis) - lo) * scale);
+      return std::min(std::max(bin, 0), binN - 1);
+    }
+
+    // The whole subtree under task.node (whose node lives elsewhere) into
+    // out, depth first, with child indices relative to out.
+    void buildSubtree(const Task &task, BvhNode &root,
+                      std::vector<BvhNode> &out) {
+      // ~0u stands for root
+      std::vector<Task> stack{{~0u, task.first, task.count, task.depth}};
+      while (!stack.empty()) {
+        Task t = stack.back();
+        stack.pop_back();
+        uint32_t mid = split(t, t.node == ~0u ? root : out[t.node]);
+        if (mid == 0)
+          continue;
+        uint32_t left = uint32_t(out.size());
+        out.resize(left + 2);
+        (t.node == ~0u ? root : out[t.node]).leftFirst = left;
+        stack.push_back({left + 1, t.first + mid, t.count - mid, t.depth + 1});
+        stack.push_back({left, t.first, mid, t.depth + 1});
+      }
+    }
+  };
+
+  // Visit the triangles the ray may hit, nearest boxes first. onHit(i, t,
+  // u, v) gets leaf-order index i; returning true stops the traversal.
+  // Boxes further than the nearest hit so far are skipped.
+  template <typename OnHit> void traverse(const BvhRay &ray, OnHit &&onHit) const {
+    float inv[3] = {1.0f / ray.dir[0], 1.0f / ray.dir[1], 1.0f / ray.dir[2]};
+    float tMax = ray.tMax;
+    struct Entry {
+      uint32_t node;
+      float t;
+    };
+    Entry stack[64];
+    int top = 0;
+    float t0 = slab(nodes[0], ray, inv, tMax);
+    if (t0 == INFINITY)
+      return;
+    stack[top++] = {0, t0};
+    while (top > 0) {
+      Entry e = stack[--top];
+      if (e.t > tMax)
+        continue;
+      const BvhNode *node = &nodes[e.node];
+      while (!node->leaf()) {
+        uint32_t a = node->leftFirst, b = a + 1;
+        float ta = slab(nodes[a], ray, inv, tMax);
+        float tb = slab(nodes[b], ray, inv, tMax);
+        if (tb < ta) {
+          std::swap(a, b);
+          std::swap(ta, tb);
+        }
+        if (ta == INFINITY) {
+          node = nullptr;
+          break;
+        }
+        if (tb != INFINITY)
+          stack[top++] = {b, tb};
+        node = &nodes[a];
+      }
+      if (!node)
+        continue;
+      for (uint32_t i = node->leftFirst; i < node->leftFirst + node->count;
+           i++) {
+        float t, u, v;
+        if (intersect(triangles[i], ray, tMax, &t, &u, &v)) {
+          if (onHit(i, t, u, v))
+            return;
+          tMax = std::min(tMax, t);
+        }
+      }
+    }
+  }
+
+  // Entry distance into the node's box, or INFINITY when the ray misses it
+  // within [tMin, tMax].
+  static float slab(const BvhNode &n, const BvhRay &ray, const float inv[3],
+                    float tMax) {
+    float lo = ray.tMin, hi = tMax;
+    for (int k = 0; k < 3; k++) {
+      float t1 = (n.min[k] - ray.origin[k]) * inv[k];
+      float t2 = (n.max[k] - ray.origin[k]) * inv[k];
+      lo = std::max(lo, std::min(t1, t2));
+      hi = std::min(hi, std::max(t1, t2));
+    }
+    return lo <= hi ? lo : INFINITY;
+  }
+};
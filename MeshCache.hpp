@@ -0,0 +1,286 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "MeshLoader.hpp"
+#include "MeshSimplifier.hpp"
+
+// Binary cache of the MeshLoader output, so startup can skip OBJ parsing.
+// File layout: MeshCacheHeader, then vertexCount Vertex records, then
+// indexCount uint32 indices (none for a non-indexed mesh), then shapeCount
+// MeshShape and rangeCount MeshRange records (IndexedMesh::parts), as-is.
+// Then the LOD chain, so startup skips simplifying too: lodCount
+// MeshCacheLod records, then every level's indices one after the other
+// (lodIndexCount in all), then every level's ranges (lodRangeCount).
+// A cache is only used if it was built from a source file with the same size
+// and mtime, and with the same format version and Vertex layout.
+struct MeshCacheHeader {
+  char magic[4];     // "MSHC"
+  uint32_t version;  // MeshCache::kVersion
+  uint32_t vertexSize;
+  uint32_t indexSize; // sizeof(uint32_t)
+  uint64_t sourceSize;
+  int64_t sourceMtime; // seconds
+  uint64_t vertexCount;
+  uint64_t indexCount;
+  uint64_t shapeCount;
+  uint64_t rangeCount;
+  uint64_t lodCount;
+  uint64_t lodIndexCount;
+  uint64_t lodRangeCount;
+};
+
+// A MeshLod without its arrays: how many of the cache's LOD indices and
+// ranges are its own, after the levels before it
+struct MeshCacheLod {
+  float ratio;
+  float error;
+  uint64_t indexCount;
+  uint64_t rangeCount;
+};
+
+class MeshCache {
+public:
+  // Bump when the Vertex layout or what gets cached changes (currently the
+  // MeshOptimizer output, its MeshParts and its LOD chain).
+  static const uint32_t kVersion = 8;
+
+  MeshCache() = default;
+  ~MeshCache() { close(); }
+  MeshCache(const MeshCache &) = delete;
+  MeshCache &operator=(const MeshCache &) = delete;
+
+  // Map `cacheFile` if it is a valid cache of `sourceFile`.
+  bool open(const std::string &cacheFile, const std::string &sourceFile) {
+    close();
+    MeshCacheHeader expected;
+    if (!makeHeader(sourceFile, 0, 0, 0, 0, &expected))
+      return false;
+
+    int fd = ::open(cacheFile.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || size_t(sb.st_size) < sizeof(MeshCacheHeader)) {
+      ::close(fd);
+      return false;
+    }
+    void *p = mmap(nullptr, size_t(sb.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return false;
+    _data = p;
+    _size = size_t(sb.st_size);
+
+    const MeshCacheHeader *h = header();
+    // Everything but the counts has to match exactly
+    expected.vertexCount = h->vertexCount;
+    expected.indexCount = h->indexCount;
+    expected.shapeCount = h->shapeCount;
+    expected.rangeCount = h->rangeCount;
+    expected.lodCount = h->lodCount;
+    expected.lodIndexCount = h->lodIndexCount;
+    expected.lodRangeCount = h->lodRangeCount;
+    // The sections have to fill the file exactly. Each count is checked
+    // against what's left before it's multiplied, so no header can wrap
+    // the sum around to the right size.
+    size_t offset = sizeof(MeshCacheHeader);
+    if (memcmp(h, &expected, sizeof(expected)) != 0 ||
+        !skip(h->vertexCount, sizeof(Vertex), offset) ||
+        !skip(h->indexCount, sizeof(uint32_t), offset) ||
+        !skip(h->shapeCount, sizeof(MeshShape), offset) ||
+        !skip(h->rangeCount, sizeof(MeshRange), offset) ||
+        !skip(h->lodCount, sizeof(MeshCacheLod), offset) ||
+        !skip(h->lodIndexCount, sizeof(uint32_t), offset) ||
+        !skip(h->lodRangeCount, sizeof(MeshRange), offset) ||
+        offset != _size || !lodsAddUp()) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (_data)
+      munmap(_data, _size);
+    _data = nullptr;
+    _size = 0;
+  }
+
+  bool valid() const { return _data != nullptr; }
+  size_t vertexCount() const { return valid() ? header()->vertexCount : 0; }
+  // Points straight into the mapping, valid until close().
+  const Vertex *vertices() const {
+    return valid() ? reinterpret_cast<const Vertex *>(header() + 1) : nullptr;
+  }
+  // 0 for a non-indexed cache.
+  size_t indexCount() const { return valid() ? header()->indexCount : 0; }
+  const uint32_t *indices() const {
+    return valid() ? reinterpret_cast<const uint32_t *>(vertices() +
+                                                        vertexCount())
+                   : nullptr;
+  }
+  // The cached MeshParts (empty for a cache written without one).
+  size_t shapeCount() const { return valid() ? header()->shapeCount : 0; }
+  const MeshShape *shapes() const {
+    return valid() ? reinterpret_cast<const MeshShape *>(indices() +
+                                                         indexCount())
+                   : nullptr;
+  }
+  size_t rangeCount() const { return valid() ? header()->rangeCount : 0; }
+  const MeshRange *ranges() const {
+    return valid() ? reinterpret_cast<const MeshRange *>(shapes() +
+                                                         shapeCount())
+                   : nullptr;
+  }
+  // The cached LOD chain (empty for a cache written without one)
+  size_t lodCount() const { return valid() ? header()->lodCount : 0; }
+  const MeshCacheLod *lods() const {
+    return valid() ? reinterpret_cast<const MeshCacheLod *>(ranges() +
+                                                            rangeCount())
+                   : nullptr;
+  }
+  const uint32_t *lodIndices() const {
+    return valid() ? reinterpret_cast<const uint32_t *>(lods() + lodCount())
+                   : nullptr;
+  }
+  const MeshRange *lodRanges() const {
+    return valid() ? reinterpret_cast<const MeshRange *>(
+                         lodIndices() + header()->lodIndexCount)
+                   : nullptr;
+  }
+
+  // The chain as MeshSimplifier::buildLodChain() gave it to write()
+  std::vector<MeshLod> readLods() const {
+    std::vector<MeshLod> out(lodCount());
+    const uint32_t *indices = lodIndices();
+    const MeshRange *ranges = lodRanges();
+    for (size_t i = 0; i < out.size(); i++) {
+      const MeshCacheLod &lod = lods()[i];
+      out[i].ratio = lod.ratio;
+      out[i].error = lod.error;
+      out[i].indices.assign(indices, indices + lod.indexCount);
+      out[i].ranges.assign(ranges, ranges + lod.rangeCount);
+      indices += lod.indexCount;
+      ranges += lod.rangeCount;
+    }
+    return out;
+  }
+
+  // Write a cache for `sourceFile`. Goes through a temp file + rename so a
+  // crash mid-write never leaves a truncated cache behind.
+  static bool write(const std::string &cacheFile, const std::string &sourceFile,
+                    const std::vector<Vertex> &vertices,
+                    const std::vector<uint32_t> &indices = {},
+                    const MeshParts &parts = {},
+                    const std::vector<MeshLod> &lods = {}) {
+    MeshCacheHeader h;
+    if (!makeHeader(sourceFile, vertices.size(), indices.size(),
+                    parts.shapes.size(), parts.ranges.size(), &h))
+      return false;
+    std::vector<MeshCacheLod> records(lods.size());
+    for (size_t i = 0; i < lods.size(); i++) {
+      records[i].ratio = lods[i].ratio;
+      records[i].error = lods[i].error;
+      records[i].indexCount = lods[i].indices.size();
+      records[i].rangeCount = lods[i].ranges.size();
+      h.lodIndexCount += lods[i].indices.size();
+      h.lodRangeCount += lods[i].ranges.size();
+    }
+    h.lodCount = lods.size();
+    std::string tmp = cacheFile + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+      return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(vertices.data(), sizeof(Vertex), vertices.size(), f) ==
+                  vertices.size() &&
+              fwrite(indices.data(), sizeof(uint32_t), indices.size(), f) ==
+                  indices.size() &&
+              fwrite(parts.shapes.data(), sizeof(MeshShape),
+                     parts.shapes.size(), f) == parts.shapes.size() &&
+              fwrite(parts.ranges.data(), sizeof(MeshRange),
+                     parts.ranges.size(), f) == parts.ranges.size() &&
+              fwrite(records.data(), sizeof(MeshCacheLod), records.size(),
+                     f) == records.size();
+    for (const MeshLod &lod : lods)
+      ok = ok && fwrite(lod.indices.data(), sizeof(uint32_t),
+                        lod.indices.size(), f) == lod.indices.size();
+    for (const MeshLod &lod : lods)
+      ok = ok && fwrite(lod.ranges.data(), sizeof(MeshRange),
+                        lod.ranges.size(), f) == lod.ranges.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), cacheFile.c_str()) != 0) {
+      remove(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  static bool write(const std::string &cacheFile, const std::string &sourceFile,
+                    const IndexedMesh &mesh,
+                    const std::vector<MeshLod> &lods = {}) {
+    return write(cacheFile, sourceFile, mesh.vertices, mesh.indices,
+                 mesh.parts, lods);
+  }
+
+private:
+  void *_data = nullptr;
+  size_t _size = 0;
+
+  const MeshCacheHeader *header() const {
+    return static_cast<const MeshCacheHeader *>(_data);
+  }
+
+  // Moves `offset` past `count` records of `size` bytes, if they fit in
+  // the mapping
+  bool skip(uint64_t count, size_t size, size_t &offset) const {
+    if (count > (_size - offset) / size)
+      return false;
+    offset += size_t(count) * size;
+    return true;
+  }
+
+  // The LOD records' counts cover the LOD sections exactly. open() has
+  // already sized the sections, so each count is checked against what's
+  // left before it's taken off.
+  bool lodsAddUp() const {
+    uint64_t indices = header()->lodIndexCount;
+    uint64_t ranges = header()->lodRangeCount;
+    for (size_t i = 0; i < lodCount(); i++) {
+      const MeshCacheLod &lod = lods()[i];
+      if (lod.indexCount > indices || lod.rangeCount > ranges)
+        return false;
+      indices -= lod.indexCount;
+      ranges -= lod.rangeCount;
+    }
+    return indices == 0 && ranges == 0;
+  }
+
+  static bool makeHeader(const std::string &sourceFile, size_t vertexCount,
+                         size_t indexCount, size_t shapeCount,
+                         size_t rangeCount, MeshCacheHeader *h) {
+    struct stat sb;
+    if (stat(sourceFile.c_str(), &sb) != 0)
+      return false;
+    memset(h, 0, sizeof(*h)); // No uninitialized padding in the file
+    memcpy(h->magic, "MSHC", 4);
+    h->version = kVersion;
+    h->vertexSize = sizeof(Vertex);
+    h->indexSize = sizeof(uint32_t);
+    h->sourceSize = uint64_t(sb.st_size);
+    h->sourceMtime = int64_t(sb.st_mtime);
+    h->vertexCount = vertexCount;
+    h->indexCount = indexCount;
+    h->shapeCount = shapeCount;
+    h->rangeCount = rangeCount;
+    return true;
+  }
+};
@@ -1,5 +1,9 @@
 #pragma once
-#include <Metal/Metal.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -8,17 +12,271 @@
 // #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include "NormalGenerator.hpp"
+
 struct Vertex {
   float position[4];
   float normal[4];
   float color[4];
 };
 
+// Axis-aligned box and bounding sphere around some vertices (positions as
+// stored in Vertex, i.e. already scaled). The sphere is centred on the box,
+// which is never far from the smallest one and cheap to merge. An empty
+// Bounds has min > max and radius -1.
+struct Bounds {
+  float min[3] = {INFINITY, INFINITY, INFINITY};
+  float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+  float center[3] = {0, 0, 0};
+  float radius = -1.0f;
+
+  bool empty() const { return radius < 0; }
+
+  // Bounds of vertices[indices[0..count)], or of vertices[0..count) when
+  // indices is null.
+  static Bounds of(const Vertex *vertices, const uint32_t *indices,
+                   size_t count) {
+    Bounds b;
+    if (count == 0)
+      return b;
+    for (size_t i = 0; i < count; i++) {
+      const float *p = vertices[indices ? indices[i] : i].position;
+      for (int k = 0; k < 3; k++) {
+        b.min[k] = std::min(b.min[k], p[k]);
+        b.max[k] = std::max(b.max[k], p[k]);
+      }
+    }
+    for (int k = 0; k < 3; k++)
+      b.center[k] = 0.5f * (b.min[k] + b.max[k]);
+    float r2 = 0;
+    for (size_t i = 0; i < count; i++) {
+      const float *p = vertices[indices ? indices[i] : i].position;
+      float dx = p[0] - b.center[0], dy = p[1] - b.center[1],
+            dz = p[2] - b.center[2];
+      r2 = std::max(r2, dx * dx + dy * dy + dz * dz);
+    }
+    b.radius = std::sqrt(r2);
+    return b;
+  }
+
+  // Grow to hold o as well: the union of the boxes, and a sphere around
+  // both spheres centred on the new box.
+  void merge(const Bounds &o) {
+    if (o.empty())
+      return;
+    if (empty()) {
+      *this = o;
+      return;
+    }
+    float oldCenter[3] = {center[0], center[1], center[2]};
+    for (int k = 0; k < 3; k++) {
+      min[k] = std::min(min[k], o.min[k]);
+      max[k] = std::max(max[k], o.max[k]);
+      center[k] = 0.5f * (min[k] + max[k]);
+    }
+    radius = std::max(distance(center, oldCenter) + radius,
+                      distance(center, o.center) + o.radius);
+  }
+
+private:
+  static float distance(const float a[3], const float b[3]) {
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+  }
+};
+
+// A run of faces from one tinyobj shape_t with one material, as a range of
+// the mesh's corners (loadObj) or indices (IndexedMesh). What the renderer
+// culls and draws as a unit.
+struct MeshRange {
+  uint32_t shape;   // into MeshParts::shapes
+  int32_t material; // tinyobj material id, -1 = none
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  Bounds bounds;
+};
+
+// A tinyobj shape_t: its ranges (consecutive in MeshParts::ranges) and the
+// bounds around all of them.
+struct MeshShape {
+  uint32_t firstRange;
+  uint32_t rangeCount;
+  Bounds bounds;
+};
+
+struct MeshParts {
+  std::vector<MeshShape> shapes;
+  std::vector<MeshRange> ranges; // In index order, covering every index
+
+  // Recompute each range's bounds (and so each shape's) from `indices`
+  // (or the vertices themselves when null), after they've changed.
+  void computeBounds(const Vertex *vertices, const uint32_t *indices) {
+    for (MeshRange &r : ranges) {
+      r.bounds = indices ? Bounds::of(vertices, indices + r.firstIndex,
+                                      r.indexCount)
+                         : Bounds::of(vertices + r.firstIndex, nullptr,
+                                      r.indexCount);
+    }
+    for (MeshShape &s : shapes) {
+      s.bounds = Bounds();
+      for (uint32_t i = 0; i < s.rangeCount; i++)
+        s.bounds.merge(ranges[s.firstRange + i].bounds);
+    }
+  }
+
+  // One shape, one range, over `indexCount` indices.
+  static MeshParts whole(size_t indexCount) {
+    MeshParts parts;
+    parts.shapes.push_back({0, 1, Bounds()});
+    parts.ranges.push_back({0, -1, 0, uint32_t(indexCount), Bounds()});
+    return parts;
+  }
+};
+
+// Deduplicated mesh: each distinct Vertex once, plus a triangle list that
+// indexes into it. Indices are kept as uint32 while the mesh is worked on and
+// narrowed to indexSize() bytes when uploaded (see packIndices).
+struct IndexedMesh {
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  MeshParts parts; // Shapes and material ranges of `indices`
+
+  size_t indexSize() const;
+};
+
+// Narrowest index type (in bytes) that can address `vertexCount` vertices.
+// 0xFFFF is Metal's uint16 primitive-restart index, so a uint16 mesh can
+// only use 0 ... 0xFFFE.
+inline size_t indexSizeFor(size_t vertexCount) {
+  return vertexCount <= 0xFFFF ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+inline size_t IndexedMesh::indexSize() const {
+  return indexSizeFor(vertices.size());
+}
+
+// Copy `count` indices to `dst` as `indexSize`-byte integers.
+inline void packIndices(const uint32_t *src, size_t count, size_t indexSize,
+                        void *dst) {
+  if (indexSize == sizeof(uint32_t)) {
+    memcpy(dst, src, count * sizeof(uint32_t));
+    return;
+  }
+  uint16_t *out = static_cast<uint16_t *>(dst);
+  for (size_t i = 0; i < count; i++)
+    out[i] = uint16_t(src[i]);
+}
+
+// Builds an IndexedMesh one face corner at a time. Identical vertices
+// (bitwise) are stored once; lookups go through an open-addressing hash
+// table of vertex indices, kept at most half full.
+class VertexDeduper {
+public:
+  explicit VertexDeduper(IndexedMesh &mesh, size_t expectedCorners = 0)
+      : _mesh(mesh) {
+    _mesh.indices.reserve(expectedCorners); // One index per corner
+    // OBJ meshes usually end up with ~1/3-1/6 as many vertices as corners
+    rehash(expectedCorners / 2);
+  }
+
+  void add(const Vertex &v) {
+    if (2 * (_mesh.vertices.size() + 1) > _table.size())
+      rehash(_table.size());
+    size_t mask = _table.size() - 1;
+    size_t slot = hash(v) & mask;
+    while (_table[slot] != kEmpty) {
+      uint32_t i = _table[slot];
+      if (memcmp(&_mesh.vertices[i], &v, sizeof(Vertex)) == 0) {
+        _mesh.indices.push_back(i);
+        return;
+      }
+      slot = (slot + 1) & mask;
+    }
+    uint32_t i = uint32_t(_mesh.vertices.size());
+    _table[slot] = i;
+    _mesh.vertices.push_back(v);
+    _mesh.indices.push_back(i);
+  }
+
+private:
+  static constexpr uint32_t kEmpty = 0xFFFFFFFFu;
+  IndexedMesh &_mesh;
+  std::vector<uint32_t> _table;
+
+  static size_t hash(const Vertex &v) {
+    uint32_t words[sizeof(Vertex) / 4];
+    memcpy(words, &v, sizeof(Vertex));
+    uint32_t h = 0;
+    for (uint32_t w : words) {
+      h = (h ^ w) * 0x9E3779B1u;
+      h ^= h >> 15;
+    }
+    return h;
+  }
+
+  // Grow to at least 2 * minSize slots (power of two) and reinsert.
+  void rehash(size_t minSize) {
+    size_t size = 64;
+    while (size < 2 * minSize)
+      size *= 2;
+    _table.assign(size, kEmpty);
+    size_t mask = size - 1;
+    for (uint32_t i = 0; i < _mesh.vertices.size(); i++) {
+      size_t slot = hash(_mesh.vertices[i]) & mask;
+      while (_table[slot] != kEmpty)
+        slot = (slot + 1) & mask;
+      _table[slot] = i;
+    }
+  }
+};
+
+// Knobs for MeshLoader::loadObj. Defaults match the original behaviour
+// (prescan only changes how the parser allocates).
+struct MeshLoadOptions {
+  // mmap the file and parse it in place (tinyobj::LoadObjMapped) instead of
+  // copying it line by line through an ifstream. Same output, less I/O.
+  bool useMmap = false;
+  // Parser threads for the mmap path (tinyobj::LoadObjMappedParallel).
+  // 1 = serial, 0 = all cores. Output is identical either way.
+  unsigned int parseThreads = 1;
+  // Count the OBJ records before parsing (mmap path only), so the parser's
+  // arrays are each allocated once at their final size. Same output.
+  bool prescan = true;
+  // Take the parser's per-face temporaries from this arena instead of the
+  // heap (tinyobj::ObjReaderConfig::arena). loadObj() resets it once the
+  // Vertex array is built, so one arena can serve a whole batch of loads.
+  // Same output.
+  tinyobj::arena_t *arena = nullptr;
+  // Build the Vertex array straight from LoadObjWithCallback (streamObj)
+  // instead of going through attrib_t/shape_t. Roughly halves peak memory
+  // on big files. Ignores useMmap/parseThreads/arena/generateNormals.
+  bool streaming = false;
+  // Give corners without a normal a smooth one (NormalGenerator, honouring
+  // the file's smoothing groups) instead of a flat +z.
+  bool generateNormals = true;
+};
+
 class MeshLoader {
 public:
-  static std::vector<Vertex> loadObj(const std::string &filename) {
+  // With `parts`, also fills in the shapes and material ranges of the
+  // returned corners, with their bounds (streaming: one range for all).
+  static std::vector<Vertex> loadObj(const std::string &filename,
+                                     const MeshLoadOptions &options = {},
+                                     MeshParts *parts = nullptr) {
+    if (options.streaming) {
+      std::vector<Vertex> vertices = loadObjStreaming(filename);
+      if (parts) {
+        *parts = MeshParts::whole(vertices.size());
+        parts->computeBounds(vertices.data(), nullptr);
+      }
+      return vertices;
+    }
     tinyobj::ObjReaderConfig reader_config;
     reader_config.mtl_search_path = "./"; // Path to material files
+    reader_config.use_mmap = options.useMmap;
+    reader_config.num_threads = options.parseThreads;
+    reader_config.prescan = options.prescan;
+    reader_config.arena = options.arena;
 
     tinyobj::ObjReader reader;
 
@@ -26,6 +284,8 @@ public:
       if (!reader.Error().empty()) {
         std::cerr << "TinyObjReader: " << reader.Error();
       }
+      if (options.arena)
+        options.arena->reset();
       return {};
     }
 
@@ -34,10 +294,26 @@ public:
     }
     auto &attrib = reader.GetAttrib();
     auto &shapes = reader.GetShapes();
+    // One Vertex per face corner, so the final size is known up front
+    size_t cornerCount = 0;
+    for (const tinyobj::shape_t &shape : shapes)
+      cornerCount += shape.mesh.indices.size();
     std::vector<Vertex> vertices;
+    vertices.reserve(cornerCount);
+
+    if (parts)
+      *parts = MeshParts();
+    // Over the whole file: smoothing groups run across g/o boundaries
+    std::vector<float> generated;
+    if (options.generateNormals)
+      generated = generateNormals(attrib, shapes);
 
     // Loop over shapes
     for (size_t s = 0; s < shapes.size(); s++) {
+      if (parts)
+        addParts(shapes[s].mesh, uint32_t(vertices.size()), parts);
+      const float *shapeNormals =
+          generated.empty() ? nullptr : &generated[3 * vertices.size()];
       // Loop over faces(polygon)
       size_t index_offset = 0;
       for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
@@ -47,44 +323,290 @@ public:
         for (size_t v = 0; v < fv; v++) {
           // access to vertex
           tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-          Vertex vertex;
-
-          // Position
-          tinyobj::real_t vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-          tinyobj::real_t vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-          tinyobj::real_t vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-          // Scale (Should move to an external matrix at some point)
-          vertex.position[0] = vx * 0.5f;
-          vertex.position[1] = vy * 0.5f;
-          vertex.position[2] = vz * 0.5f;
-          vertex.position[3] = 1.0f;
-          // Normal (if they exist)
-          if (idx.normal_index >= 0) {
-            tinyobj::real_t nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
-            tinyobj::real_t ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
-            tinyobj::real_t nz = attrib.normals[3 * size_t(idx.normal_index) + 2];
-            vertex.normal[0] = nx;
-            vertex.normal[1] = ny;
-            vertex.normal[2] = nz;
-            vertex.normal[3] = 0.0f; // Vector not point, so w=0
-          } else {
-            //fallback if no normals
-            vertex.normal[2] = 1.0f;
-          }
-
-          // Color (Just our default for now)
-          vertex.color[0] = 1.0f;
-          vertex.color[1] = 1.0f;
-          vertex.color[2] = 1.0f;
-          vertex.color[3] = 1.0f;
-          
           // Save vert
-          vertices.push_back(vertex);
+          vertices.push_back(makeVertex(
+              attrib.vertices.data(), attrib.normals.data(), idx.vertex_index,
+              idx.normal_index,
+              shapeNormals ? shapeNormals + 3 * (index_offset + v)
+                           : nullptr));
         }
         index_offset += fv;
       }
     }
+    // Nothing the parse left behind points into the arena any more
+    if (options.arena)
+      options.arena->reset();
+    if (parts)
+      parts->computeBounds(vertices.data(), nullptr);
+    std::cout << "Loaded " << vertices.size() << " vertices." << std::endl;
+    return vertices;
+  }
+
+  // Streaming load: parses with tinyobj::LoadObjWithCallback and hands the
+  // final triangles to `sink(const Vertex *vertices, size_t count)` as each
+  // face is read (count is a multiple of 3). Only positions and normals are
+  // kept around, never the attrib_t/shape_t arrays, so peak memory is those
+  // plus whatever the sink keeps.
+  // Triangles and quads come out exactly as loadObj() gives them (quads are
+  // split along the shorter diagonal, like tinyobj). Bigger polygons are
+  // fanned rather than ear-clipped, so concave n-gons can differ.
+  // Returns false if the file can't be read.
+  template <typename Sink>
+  static bool streamObj(const std::string &filename, Sink &&sink) {
+    std::ifstream ifs(filename);
+    if (!ifs) {
+      std::cerr << "MeshLoader: Cannot open file [" << filename << "]\n";
+      return false;
+    }
+    StreamState<Sink> state(sink);
+    tinyobj::callback_t cb;
+    cb.vertex_cb = &StreamState<Sink>::onVertex;
+    cb.normal_cb = &StreamState<Sink>::onNormal;
+    cb.index_cb = &StreamState<Sink>::onFace;
+    tinyobj::MaterialFileReader matReader("./");
+    std::string warn, err;
+    bool ok = tinyobj::LoadObjWithCallback(ifs, cb, &state, &matReader, &warn,
+                                           &err);
+    if (!warn.empty()) {
+      std::cout << "TinyObjReader: " << warn;
+    }
+    if (!err.empty()) {
+      std::cerr << "TinyObjReader: " << err;
+    }
+    if (state.skippedFaces) {
+      std::cout << "MeshLoader: skipped " << state.skippedFaces
+                << " faces with invalid indices" << std::endl;
+    }
+    return ok;
+  }
+
+  // loadObj(), deduplicated into an IndexedMesh. With options.streaming the
+  // corners are deduplicated as they are parsed, so the full de-indexed
+  // array never exists (and the mesh is one range). One index per corner,
+  // so loadObj's corner ranges are index ranges as they are.
+  static IndexedMesh loadObjIndexed(const std::string &filename,
+                                    const MeshLoadOptions &options = {}) {
+    IndexedMesh mesh;
+    if (options.streaming) {
+      VertexDeduper dedup(mesh);
+      streamObj(filename, [&](const Vertex *v, size_t count) {
+        for (size_t i = 0; i < count; i++)
+          dedup.add(v[i]);
+      });
+      mesh.parts = MeshParts::whole(mesh.indices.size());
+      mesh.parts.computeBounds(mesh.vertices.data(), mesh.indices.data());
+    } else {
+      std::vector<Vertex> corners = loadObj(filename, options, &mesh.parts);
+      VertexDeduper dedup(mesh, corners.size());
+      for (const Vertex &v : corners)
+        dedup.add(v);
+    }
+    std::cout << "Indexed " << mesh.indices.size() << " corners into "
+              << mesh.vertices.size() << " vertices (uint"
+              << 8 * mesh.indexSize() << " indices)." << std::endl;
+    return mesh;
+  }
+
+  // loadObj() on top of streamObj(), for MeshLoadOptions::streaming.
+  static std::vector<Vertex> loadObjStreaming(const std::string &filename) {
+    std::vector<Vertex> vertices;
+    streamObj(filename, [&](const Vertex *v, size_t count) {
+      vertices.insert(vertices.end(), v, v + count);
+    });
     std::cout << "Loaded " << vertices.size() << " vertices." << std::endl;
     return vertices;
   }
+
+private:
+  // Append the shape starting at corner `first` to `parts`: one range per
+  // run of faces with the same material. Bounds come later.
+  static void addParts(const tinyobj::mesh_t &mesh, uint32_t first,
+                       MeshParts *parts) {
+    MeshShape shape = {uint32_t(parts->ranges.size()), 0, Bounds()};
+    uint32_t corner = first;
+    for (size_t f = 0; f < mesh.num_face_vertices.size(); f++) {
+      int material = f < mesh.material_ids.size() ? mesh.material_ids[f] : -1;
+      if (shape.rangeCount == 0 || parts->ranges.back().material != material) {
+        parts->ranges.push_back(
+            {uint32_t(parts->shapes.size()), material, corner, 0, Bounds()});
+        shape.rangeCount++;
+      }
+      parts->ranges.back().indexCount += mesh.num_face_vertices[f];
+      corner += mesh.num_face_vertices[f];
+    }
+    if (shape.rangeCount > 0)
+      parts->shapes.push_back(shape);
+  }
+
+  // Smooth normals for every corner of every shape, in shape order, or
+  // nothing if all the corners already have one. One pass over all the
+  // shapes' faces, keyed by position and smoothing group alone, so a
+  // group that spans shapes is smooth across them.
+  static std::vector<float>
+  generateNormals(const tinyobj::attrib_t &attrib,
+                  const std::vector<tinyobj::shape_t> &shapes) {
+    bool missing = false;
+    size_t cornerCount = 0, faceCount = 0;
+    for (const tinyobj::shape_t &shape : shapes) {
+      for (const tinyobj::index_t &idx : shape.mesh.indices)
+        missing = missing || idx.normal_index < 0;
+      cornerCount += shape.mesh.indices.size();
+      faceCount += shape.mesh.num_face_vertices.size();
+    }
+    if (!missing)
+      return {};
+    std::vector<uint32_t> corners, faceStart(1, 0);
+    std::vector<unsigned> groups;
+    corners.reserve(cornerCount);
+    faceStart.reserve(faceCount + 1);
+    groups.reserve(faceCount);
+    for (const tinyobj::shape_t &shape : shapes) {
+      const tinyobj::mesh_t &mesh = shape.mesh;
+      for (const tinyobj::index_t &idx : mesh.indices)
+        corners.push_back(uint32_t(idx.vertex_index));
+      for (size_t f = 0; f < mesh.num_face_vertices.size(); f++) {
+        faceStart.push_back(faceStart.back() + mesh.num_face_vertices[f]);
+        groups.push_back(mesh.smoothing_group_ids[f]);
+      }
+    }
+    return NormalGenerator::generate(
+        attrib.vertices.data(), attrib.vertices.size() / 3, corners.data(),
+        faceStart.data(), faceCount, groups.data());
+  }
+
+  // Build the Vertex for one face corner. Shared by every load path so they
+  // all produce the same output. `generated` (optional) is the normal to use
+  // when the file has none for this corner.
+  static Vertex makeVertex(const tinyobj::real_t *positions,
+                           const tinyobj::real_t *normals, int vertexIndex,
+                           int normalIndex,
+                           const float *generated = nullptr) {
+    Vertex vertex = {}; // Zeroed so equal vertices compare equal bitwise
+
+    // Position
+    tinyobj::real_t vx = positions[3 * size_t(vertexIndex) + 0];
+    tinyobj::real_t vy = positions[3 * size_t(vertexIndex) + 1];
+    tinyobj::real_t vz = positions[3 * size_t(vertexIndex) + 2];
+    // Scale (Should move to an external matrix at some point)
+    vertex.position[0] = vx * 0.5f;
+    vertex.position[1] = vy * 0.5f;
+    vertex.position[2] = vz * 0.5f;
+    vertex.position[3] = 1.0f;
+    // Normal (if they exist)
+    if (normalIndex >= 0) {
+      tinyobj::real_t nx = normals[3 * size_t(normalIndex) + 0];
+      tinyobj::real_t ny = normals[3 * size_t(normalIndex) + 1];
+      tinyobj::real_t nz = normals[3 * size_t(normalIndex) + 2];
+      vertex.normal[0] = nx;
+      vertex.normal[1] = ny;
+      vertex.normal[2] = nz;
+      vertex.normal[3] = 0.0f; // Vector not point, so w=0
+    } else if (generated) {
+      vertex.normal[0] = generated[0];
+      vertex.normal[1] = generated[1];
+      vertex.normal[2] = generated[2];
+      vertex.normal[3] = 0.0f;
+    } else {
+      // Fallback if no normals: +z, spelled out rather than left to the
+      // zero-init above
+      vertex.normal[0] = 0.0f;
+      vertex.normal[1] = 0.0f;
+      vertex.normal[2] = 1.0f;
+      vertex.normal[3] = 0.0f;
+    }
+
+    // Color (Just our default for now)
+    vertex.color[0] = 1.0f;
+    vertex.color[1] = 1.0f;
+    vertex.color[2] = 1.0f;
+    vertex.color[3] = 1.0f;
+    return vertex;
+  }
+
+  // Callback state for streamObj. LoadObjWithCallback passes raw OBJ indices
+  // (1-based, negative = relative, 0 = missing), so they're resolved here.
+  template <typename Sink> struct StreamState {
+    Sink &sink;
+    std::vector<tinyobj::real_t> positions;
+    std::vector<tinyobj::real_t> normals;
+    std::vector<Vertex> face; // scratch, reused for every face
+    size_t skippedFaces = 0;
+
+    explicit StreamState(Sink &s) : sink(s) {}
+
+    static void onVertex(void *user, tinyobj::real_t x, tinyobj::real_t y,
+                         tinyobj::real_t z, tinyobj::real_t) {
+      auto *st = static_cast<StreamState *>(user);
+      st->positions.insert(st->positions.end(), {x, y, z});
+    }
+
+    static void onNormal(void *user, tinyobj::real_t x, tinyobj::real_t y,
+                         tinyobj::real_t z) {
+      auto *st = static_cast<StreamState *>(user);
+      st->normals.insert(st->normals.end(), {x, y, z});
+    }
+
+    static int resolve(int idx, size_t count) {
+      if (idx > 0)
+        return idx <= int(count) ? idx - 1 : -2; // -2: not read (yet)
+      if (idx < 0)
+        return int(count) + idx >= 0 ? int(count) + idx : -2;
+      return -1;
+    }
+
+    static void onFace(void *user, tinyobj::index_t *indices, int num) {
+      auto *st = static_cast<StreamState *>(user);
+      const size_t nv = st->positions.size() / 3;
+      const size_t nn = st->normals.size() / 3;
+      if (num < 3) {
+        st->skippedFaces++;
+        return;
+      }
+      int v[3], n[3];
+      auto corner = [&](int k, int slot) {
+        v[slot] = resolve(indices[k].vertex_index, nv);
+        n[slot] = resolve(indices[k].normal_index, nn);
+        return v[slot] >= 0 && n[slot] != -2;
+      };
+      auto emit = [&](int a, int b, int c) {
+        if (!corner(a, 0) || !corner(b, 1) || !corner(c, 2))
+          return false;
+        for (int k = 0; k < 3; k++)
+          st->face.push_back(makeVertex(st->positions.data(),
+                                        st->normals.data(), v[k], n[k]));
+        return true;
+      };
+
+      st->face.clear();
+      bool ok = true;
+      if (num == 4) {
+        // Same split as tinyobj's triangulation: shorter diagonal.
+        int q[4];
+        for (int k = 0; k < 4; k++) {
+          q[k] = resolve(indices[k].vertex_index, nv);
+          ok &= q[k] >= 0;
+        }
+        if (ok) {
+          const tinyobj::real_t *p = st->positions.data();
+          tinyobj::real_t d02 = 0, d13 = 0;
+          for (int c = 0; c < 3; c++) {
+            tinyobj::real_t e02 = p[3 * q[2] + c] - p[3 * q[0] + c];
+            tinyobj::real_t e13 = p[3 * q[3] + c] - p[3 * q[1] + c];
+            d02 += e02 * e02;
+            d13 += e13 * e13;
+          }
+          ok = d02 < d13 ? emit(0, 1, 2) && emit(0, 2, 3)
+                         : emit(0, 1, 3) && emit(1, 2, 3);
+        }
+      } else {
+        for (int k = 1; ok && k + 1 < num; k++)
+          ok = emit(0, k, k + 1);
+      }
+      if (!ok) {
+        st->skippedFaces++;
+        return;
+      }
+      st->sink(static_cast<const Vertex *>(st->face.data()), st->face.size());
+    }
+  };
 };
\ No newline at end of file
@@ -0,0 +1,343 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MeshLoader.hpp"
+
+// Post-transform vertex cache behaviour of a triangle list, from a simulated
+// cache. ACMR = misses per triangle (3 is the worst, ~0.5 the best a big
+// regular mesh can do), ATVR = misses per vertex (1 is ideal).
+struct VertexCacheStats {
+  size_t misses = 0;
+  double acmr = 0;
+  double atvr = 0;
+};
+
+// Load-time reordering of an IndexedMesh for the GPU. Every pass is linear
+// in the triangle count (the cluster sort in optimizeOverdraw is over
+// clusters, not triangles), so it's fine on multi-million-triangle meshes.
+//
+// Typical use is optimize(), which runs, in order:
+//   optimizeVertexCache - Tipsify (Sander et al. 2007) triangle order
+//   optimizeOverdraw    - reorders Tipsify's clusters outside-in
+//   optimizeVertexFetch - renumbers vertices in first-use order
+// The first two only move triangles within each of mesh.parts' ranges, so
+// the ranges (and their bounds) stay valid.
+class MeshOptimizer {
+public:
+  enum class CacheModel { Fifo, Lru };
+
+  static void optimize(IndexedMesh &mesh, unsigned cacheSize = 16) {
+    forEachRange(mesh, [&](IndexedMesh &part) {
+      optimizeVertexCache(part, cacheSize);
+      optimizeOverdraw(part, 1.05f, cacheSize);
+    });
+    optimizeVertexFetch(mesh);
+  }
+
+  static VertexCacheStats analyzeVertexCache(const IndexedMesh &mesh,
+                                             unsigned cacheSize = 16,
+                                             CacheModel model = CacheModel::Fifo) {
+    VertexCacheStats stats;
+    const std::vector<uint32_t> &idx = mesh.indices;
+    if (idx.empty() || cacheSize == 0)
+      return stats;
+    if (model == CacheModel::Fifo) {
+      // A vertex is cached while fewer than cacheSize misses came after it.
+      std::vector<uint32_t> stamp(mesh.vertices.size(), 0);
+      uint32_t time = cacheSize + 1;
+      for (uint32_t v : idx) {
+        if (time - stamp[v] > cacheSize) {
+          stamp[v] = time++;
+          stats.misses++;
+        }
+      }
+    } else {
+      // Most recent first. cacheSize is small, so a linear scan is fine.
+      std::vector<uint32_t> cache;
+      cache.reserve(cacheSize + 1);
+      for (uint32_t v : idx) {
+        auto it = std::find(cache.begin(), cache.end(), v);
+        if (it == cache.end()) {
+          stats.misses++;
+          if (cache.size() == cacheSize)
+            cache.pop_back();
+          cache.insert(cache.begin(), v);
+        } else {
+          std::rotate(cache.begin(), it, it + 1);
+        }
+      }
+    }
+    stats.acmr = double(stats.misses) / double(idx.size() / 3);
+    stats.atvr = double(stats.misses) / double(usedVertexCount(mesh));
+    return stats;
+  }
+
+  // Tipsify: fan around one vertex at a time, picking the next fanning vertex
+  // among the ones just emitted that will still be in a cacheSize FIFO.
+  static void optimizeVertexCache(IndexedMesh &mesh, unsigned cacheSize = 16) {
+    const std::vector<uint32_t> &in = mesh.indices;
+    const size_t triCount = in.size() / 3;
+    const size_t vertexCount = mesh.vertices.size();
+    if (triCount == 0)
+      return;
+
+    // Triangles using each vertex (CSR), and how many are left to emit.
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (size_t i = 0; i < triCount * 3; i++)
+      live[in[i]]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] = offsets[v] + live[v];
+    std::vector<uint32_t> adjacency(triCount * 3);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triCount * 3; i++)
+      adjacency[fill[in[i]]++] = uint32_t(i / 3);
+
+    std::vector<uint32_t> stamp(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    std::vector<char> emitted(triCount, 0);
+    std::vector<uint32_t> deadEnd; // recently emitted vertices, for restarts
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> out;
+    out.reserve(triCount * 3);
+    size_t cursor = 0; // Last resort: next vertex in input order
+
+    int64_t fan = in[0];
+    while (fan >= 0) {
+      candidates.clear();
+      for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; a++) {
+        uint32_t t = adjacency[a];
+        if (emitted[t])
+          continue;
+        emitted[t] = 1;
+        for (int k = 0; k < 3; k++) {
+          uint32_t v = in[3 * size_t(t) + k];
+          out.push_back(v);
+          deadEnd.push_back(v);
+          candidates.push_back(v);
+          live[v]--;
+          if (time - stamp[v] > cacheSize)
+            stamp[v] = time++;
+        }
+      }
+
+      // Prefer the oldest candidate that will survive its remaining fan.
+      fan = -1;
+      int64_t bestPriority = -1;
+      for (uint32_t v : candidates) {
+        if (live[v] == 0)
+          continue;
+        int64_t priority = 0;
+        if (time - stamp[v] + 2 * live[v] <= cacheSize)
+          priority = time - stamp[v];
+        if (priority > bestPriority) {
+          bestPriority = priority;
+          fan = v;
+        }
+      }
+      if (fan >= 0)
+        continue;
+
+      // Dead end: back up through recent vertices, then scan forward.
+      while (fan < 0 && !deadEnd.empty()) {
+        uint32_t v = deadEnd.back();
+        deadEnd.pop_back();
+        if (live[v] > 0)
+          fan = v;
+      }
+      while (fan < 0 && cursor < vertexCount) {
+        if (live[cursor] > 0)
+          fan = int64_t(cursor);
+        cursor++;
+      }
+    }
+    mesh.indices.swap(out);
+  }
+
+  // Tipsify's overdraw pass. Splits the current triangle order into clusters
+  // (at cache restarts, and wherever the running ACMR is within `threshold`
+  // of the cluster's), then draws clusters facing away from the mesh centre
+  // first, since they're the most likely occluders. Run after
+  // optimizeVertexCache; `threshold` trades cache efficiency for overdraw.
+  static void optimizeOverdraw(IndexedMesh &mesh, float threshold = 1.05f,
+                               unsigned cacheSize = 16) {
+    std::vector<uint32_t> &idx = mesh.indices;
+    const size_t triCount = idx.size() / 3;
+    if (triCount < 2)
+      return;
+
+    // Hard boundaries: triangles where all three vertices miss.
+    std::vector<uint32_t> stamp(mesh.vertices.size(), 0);
+    uint32_t time = cacheSize + 1;
+    std::vector<uint32_t> hard;
+    for (uint32_t t = 0; t < triCount; t++) {
+      if (countMisses(idx, t, stamp, time, cacheSize) == 3 || t == 0)
+        hard.push_back(t);
+    }
+    hard.push_back(uint32_t(triCount));
+
+    // Soft boundaries inside each hard cluster. Each cluster is simulated
+    // with a cold cache, since it may end up drawn anywhere.
+    std::vector<uint32_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); h++) {
+      uint32_t begin = hard[h], end = hard[h + 1];
+      time += cacheSize + 1;
+      size_t total = 0;
+      for (uint32_t t = begin; t < end; t++)
+        total += countMisses(idx, t, stamp, time, cacheSize);
+      double clusterAcmr = double(total) / double(end - begin);
+
+      time += cacheSize + 1;
+      uint32_t start = begin;
+      size_t misses = 0;
+      clusters.push_back(start);
+      for (uint32_t t = begin; t + 1 < end; t++) {
+        misses += countMisses(idx, t, stamp, time, cacheSize);
+        // Don't cut tiny clusters, the cold start dominates their ACMR.
+        if (t + 1 - start >= 8 &&
+            double(misses) / double(t + 1 - start) <= threshold * clusterAcmr) {
+          start = t + 1;
+          misses = 0;
+          time += cacheSize + 1;
+          clusters.push_back(start);
+        }
+      }
+    }
+    clusters.push_back(uint32_t(triCount));
+    const size_t clusterCount = clusters.size() - 1;
+    if (clusterCount < 2)
+      return;
+
+    // Area-weighted centroid and normal sum of each cluster and the mesh.
+    std::vector<float> centroids(clusterCount * 3, 0.0f);
+    std::vector<float> normals(clusterCount * 3, 0.0f);
+    std::vector<float> areas(clusterCount, 0.0f);
+    float meshCentroid[3] = {0, 0, 0};
+    float meshArea = 0;
+    for (size_t c = 0; c < clusterCount; c++) {
+      for (uint32_t t = clusters[c]; t < clusters[c + 1]; t++) {
+        const float *p0 = mesh.vertices[idx[3 * size_t(t) + 0]].position;
+        const float *p1 = mesh.vertices[idx[3 * size_t(t) + 1]].position;
+        const float *p2 = mesh.vertices[idx[3 * size_t(t) + 2]].position;
+        float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+        float n[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                      e1[2] * e2[0] - e1[0] * e2[2],
+                      e1[0] * e2[1] - e1[1] * e2[0]};
+        float area = 0.5f * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int k = 0; k < 3; k++) {
+          float mid = (p0[k] + p1[k] + p2[k]) / 3.0f;
+          centroids[3 * c + k] += mid * area;
+          normals[3 * c + k] += n[k];
+          meshCentroid[k] += mid * area;
+        }
+        areas[c] += area;
+      }
+      meshArea += areas[c];
+    }
+    for (int k = 0; k < 3; k++)
+      meshCentroid[k] = meshArea > 0 ? meshCentroid[k] / meshArea : 0;
+
+    std::vector<float> keys(clusterCount);
+    std::vector<uint32_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+      float key = 0;
+      for (int k = 0; k < 3; k++) {
+        float centroid = areas[c] > 0 ? centroids[3 * c + k] / areas[c] : 0;
+        key += (centroid - meshCentroid[k]) * normals[3 * c + k];
+      }
+      keys[c] = key;
+      order[c] = uint32_t(c);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return keys[a] > keys[b];
+    });
+
+    std::vector<uint32_t> out;
+    out.reserve(idx.size());
+    for (uint32_t c : order)
+      out.insert(out.end(), idx.begin() + 3 * size_t(clusters[c]),
+                 idx.begin() + 3 * size_t(clusters[c + 1]));
+    idx.swap(out);
+  }
+
+  // Renumber vertices in the order the index buffer first uses them, so
+  // vertex fetches walk memory forwards. Drops unreferenced vertices.
+  static void optimizeVertexFetch(IndexedMesh &mesh) {
+    const uint32_t kUnused = 0xFFFFFFFFu;
+    std::vector<uint32_t> remap(mesh.vertices.size(), kUnused);
+    std::vector<Vertex> out;
+    out.reserve(mesh.vertices.size());
+    for (uint32_t &i : mesh.indices) {
+      if (remap[i] == kUnused) {
+        remap[i] = uint32_t(out.size());
+        out.push_back(mesh.vertices[i]);
+      }
+      i = remap[i];
+    }
+    mesh.vertices.swap(out);
+  }
+
+private:
+  // fn(part) on each range of mesh.parts as a mesh of its own, then copies
+  // part's triangles back over the range. part has just the range's
+  // vertices, so the passes' per-vertex arrays stay the range's size.
+  template <typename Fn> static void forEachRange(IndexedMesh &mesh, Fn &&fn) {
+    const std::vector<MeshRange> &ranges = mesh.parts.ranges;
+    if (ranges.size() <= 1) {
+      fn(mesh);
+      return;
+    }
+    const uint32_t kUnused = 0xFFFFFFFFu;
+    std::vector<uint32_t> local(mesh.vertices.size(), kUnused);
+    std::vector<uint32_t> global;
+    IndexedMesh part;
+    for (const MeshRange &r : ranges) {
+      uint32_t *idx = mesh.indices.data() + r.firstIndex;
+      part.vertices.clear();
+      part.indices.resize(r.indexCount);
+      global.clear();
+      for (uint32_t i = 0; i < r.indexCount; i++) {
+        if (local[idx[i]] == kUnused) {
+          local[idx[i]] = uint32_t(global.size());
+          global.push_back(idx[i]);
+          part.vertices.push_back(mesh.vertices[idx[i]]);
+        }
+        part.indices[i] = local[idx[i]];
+      }
+      fn(part);
+      for (uint32_t i = 0; i < r.indexCount; i++)
+        idx[i] = global[part.indices[i]];
+      for (uint32_t v : global)
+        local[v] = kUnused;
+    }
+  }
+
+  static size_t usedVertexCount(const IndexedMesh &mesh) {
+    std::vector<char> used(mesh.vertices.size(), 0);
+    size_t count = 0;
+    for (uint32_t v : mesh.indices) {
+      count += !used[v];
+      used[v] = 1;
+    }
+    return count;
+  }
+
+  // FIFO misses for triangle t, updating the simulated cache.
+  static int countMisses(const std::vector<uint32_t> &idx, uint32_t t,
+                         std::vector<uint32_t> &stamp, uint32_t &time,
+                         unsigned cacheSize) {
+    int misses = 0;
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = idx[3 * size_t(t) + k];
+      if (time - stamp[v] > cacheSize) {
+        stamp[v] = time++;
+        misses++;
+      }
+    }
+    return misses;
+  }
+};
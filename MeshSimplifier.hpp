@@ -0,0 +1,615 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MeshLoader.hpp"
+#include "Parallel.hpp"
+
+// One level of detail. Indices point into the vertex array of the mesh the
+// chain was built from, so every level shares one vertex buffer.
+struct MeshLod {
+  std::vector<uint32_t> indices;
+  float ratio; // Requested fraction of the source triangles
+  float error; // Max distance from the source surface, in mesh units
+  // mesh.parts.ranges re-cut for this level: indices are grouped by range,
+  // and each range's bounds are those of its remaining triangles. A range
+  // simplified away is kept with indexCount 0 (and empty bounds).
+  std::vector<MeshRange> ranges;
+};
+
+// Quadric error metric (Garland & Heckbert) simplification.
+//
+// Collapses are half-edge collapses onto an existing vertex, so no new
+// vertices are made. Seams are kept intact: vertices on a crease edge (the
+// faces either side disagree on the normal by more than 35 degrees) always
+// move together, and only onto a position where each of them has a matching
+// vertex across an edge. Other normal splits, including all of a
+// flat-shaded mesh like monke.obj where the normals are just the face
+// normals, move onto the closest-normal vertex instead. Open borders get
+// extra edge quadrics so they don't shrink.
+//
+// Each pass scores every edge, then applies the cheapest collapses that
+// don't touch each other, until the target triangle count is reached or
+// nothing more can collapse. Scoring and sorting are split over threads by
+// triangle; the collapses themselves go one at a time.
+class MeshSimplifier {
+public:
+  // Level 0 is the mesh itself (error 0), then one level per ratio. One
+  // simplification runs down through the levels, finest first, and each is
+  // what it had left on reaching that level's target: a level carries on
+  // from the one before, with the quadrics it built up, so its error is
+  // still against the full mesh. threads: 0 = all cores, for each pass.
+  static std::vector<MeshLod>
+  buildLodChain(const IndexedMesh &mesh,
+                const std::vector<float> &ratios = {0.5f, 0.25f, 0.1f, 0.02f},
+                unsigned threads = 0) {
+    std::vector<MeshLod> lods(ratios.size() + 1);
+    lods[0].indices = mesh.indices;
+    lods[0].ratio = 1.0f;
+    lods[0].error = 0.0f;
+    lods[0].ranges = mesh.parts.ranges;
+    if (lods[0].ranges.empty()) {
+      lods[0].ranges = MeshParts::whole(mesh.indices.size()).ranges;
+      lods[0].ranges[0].bounds = Bounds::of(
+          mesh.vertices.data(), mesh.indices.data(), mesh.indices.size());
+    }
+
+    std::vector<size_t> targets(ratios.size());
+    for (size_t i = 0; i < ratios.size(); i++)
+      targets[i] = size_t(double(mesh.indices.size() / 3) * ratios[i]);
+    simplifyChain(mesh, targets, threads,
+                  [&](size_t i, const std::vector<uint32_t> &idx, float error) {
+                    MeshLod &lod = lods[i + 1];
+                    lod.ratio = ratios[i];
+                    lod.indices = idx;
+                    lod.error = error;
+                    splitRanges(mesh, lods[0].ranges, lod);
+                  });
+    return lods;
+  }
+
+  // Group lod.indices by the range each triangle came from and fill
+  // lod.ranges. Collapses only move vertices onto existing ones, so a
+  // triangle's corners still belong to source ranges; it goes to the range
+  // two or more of them share, else to its first corner's. Stable, so the
+  // optimized triangle order survives within each range.
+  static void splitRanges(const IndexedMesh &mesh,
+                          const std::vector<MeshRange> &source, MeshLod &lod) {
+    lod.ranges = source;
+    if (source.size() == 1) {
+      lod.ranges[0].firstIndex = 0;
+      lod.ranges[0].indexCount = uint32_t(lod.indices.size());
+      lod.ranges[0].bounds = Bounds::of(
+          mesh.vertices.data(), lod.indices.data(), lod.indices.size());
+      return;
+    }
+    // Vertex -> range; a vertex shared by several ranges keeps the first
+    std::vector<uint32_t> rangeOf(mesh.vertices.size(), ~0u);
+    for (uint32_t r = 0; r < source.size(); r++) {
+      for (uint32_t i = source[r].firstIndex;
+           i < source[r].firstIndex + source[r].indexCount; i++) {
+        uint32_t &v = rangeOf[mesh.indices[i]];
+        if (v == ~0u)
+          v = r;
+      }
+    }
+    const size_t triangles = lod.indices.size() / 3;
+    std::vector<uint32_t> triRange(triangles), start(source.size() + 1, 0);
+    for (size_t t = 0; t < triangles; t++) {
+      const uint32_t *tri = &lod.indices[3 * t];
+      uint32_t a = rangeOf[tri[0]], b = rangeOf[tri[1]], c = rangeOf[tri[2]];
+      uint32_t r = (b == c) ? b : a;
+      triRange[t] = r < source.size() ? r : 0; // Not in any range
+      start[triRange[t] + 1] += 3;
+    }
+    for (size_t r = 0; r < source.size(); r++)
+      start[r + 1] += start[r];
+
+    std::vector<uint32_t> sorted(lod.indices.size());
+    std::vector<uint32_t> cursor(start.begin(), start.end() - 1);
+    for (size_t t = 0; t < triangles; t++) {
+      uint32_t &at = cursor[triRange[t]];
+      std::copy(&lod.indices[3 * t], &lod.indices[3 * t] + 3, &sorted[at]);
+      at += 3;
+    }
+    lod.indices.swap(sorted);
+    for (size_t r = 0; r < source.size(); r++) {
+      MeshRange &range = lod.ranges[r];
+      range.firstIndex = start[r];
+      range.indexCount = start[r + 1] - start[r];
+      range.bounds = Bounds::of(mesh.vertices.data(),
+                                lod.indices.data() + range.firstIndex,
+                                range.indexCount);
+    }
+  }
+
+  // Coarsest level whose error stays under maxPixelError when one mesh unit
+  // covers pixelsPerUnit pixels on screen. Works on anything with an
+  // `error` per level, e.g. MeshLod or the renderer's GPU-side ranges.
+  template <typename Lods>
+  static size_t selectLod(const Lods &lods, float pixelsPerUnit,
+                          float maxPixelError = 1.0f) {
+    size_t best = 0;
+    for (size_t i = 1; i < lods.size(); i++) {
+      if (lods[i].error * pixelsPerUnit <= maxPixelError)
+        best = i;
+    }
+    return best;
+  }
+
+  // Simplify to about targetTriangles. Returns the new index list; the max
+  // collapse error goes to *error. threads: 0 = all cores.
+  static std::vector<uint32_t> simplify(const IndexedMesh &mesh,
+                                        size_t targetTriangles, float *error,
+                                        unsigned threads = 0) {
+    std::vector<uint32_t> out;
+    simplifyChain(mesh, {targetTriangles}, threads,
+                  [&](size_t, const std::vector<uint32_t> &idx, float e) {
+                    out = idx;
+                    if (error)
+                      *error = e;
+                  });
+    return out;
+  }
+
+private:
+  // Passes with fewer triangles than this score on the calling thread
+  static const size_t kMinParallelTriangles = 4096;
+
+  // One simplification down through every target, largest first:
+  // emit(i, indices, error) for targets[i] once it's reached (or nothing
+  // more can collapse).
+  template <typename Emit>
+  static void simplifyChain(const IndexedMesh &mesh,
+                            const std::vector<size_t> &targets,
+                            unsigned threads, Emit &&emit) {
+    std::vector<uint32_t> idx = mesh.indices;
+    const size_t vertexCount = mesh.vertices.size();
+    float maxError = 0.0f;
+    std::vector<size_t> order(targets.size());
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return targets[a] > targets[b];
+    });
+    // Nothing to collapse: every level is the mesh itself
+    if (vertexCount == 0 || order.empty() ||
+        idx.size() / 3 <= targets[order.back()]) {
+      for (size_t i : order)
+        emit(i, idx, maxError);
+      return;
+    }
+    threads = parallel::threadCount(threads);
+
+    // Wedges: all vertices at one position share a representative (`pos`)
+    // and are linked in a ring through nextWedge.
+    std::vector<uint32_t> pos(vertexCount), nextWedge(vertexCount);
+    buildWedges(mesh, pos, nextWedge);
+
+    std::vector<Quadric> quadrics(vertexCount); // by representative
+    std::vector<char> crease(vertexCount), border(vertexCount); // likewise
+    buildQuadrics(mesh, idx, pos, quadrics, crease, border);
+
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint32_t> offsets, adjacency;
+    std::vector<Collapse> candidates;
+    std::vector<char> locked(vertexCount);
+    std::vector<uint32_t> wedgeFrom, wedgeTo; // scratch for one collapse
+    bool stuck = false;
+
+    for (size_t level : order) {
+      const size_t targetTriangles = targets[level];
+      while (!stuck && idx.size() / 3 > targetTriangles) {
+        const size_t triCount = idx.size() / 3;
+        buildAdjacency(idx, pos, vertexCount, offsets, adjacency);
+
+        // Score both directions of every edge, keep the cheaper. Each slice
+        // sorts its own, then they're merged; Collapse's order is total, so
+        // the list comes out the same on any number of threads.
+        unsigned slices = triCount < kMinParallelTriangles ? 1 : threads;
+        candidates.resize(3 * triCount);
+        parallel::forSlices(triCount, slices, [&](unsigned, size_t t0,
+                                                  size_t t1) {
+          for (size_t t = t0; t < t1; t++) {
+            for (int k = 0; k < 3; k++) {
+              uint32_t a = pos[idx[3 * t + k]];
+              uint32_t b = pos[idx[3 * t + (k + 1) % 3]];
+              float ab = quadrics[a].error(mesh.vertices[b].position);
+              float ba = quadrics[b].error(mesh.vertices[a].position);
+              candidates[3 * t + k] = ab <= ba ? Collapse{a, b, ab}
+                                               : Collapse{b, a, ba};
+            }
+          }
+          std::sort(candidates.begin() + 3 * t0, candidates.begin() + 3 * t1);
+        });
+        for (unsigned s = 1; s < slices; s++)
+          std::inplace_merge(candidates.begin(),
+                             candidates.begin() + 3 * (triCount * s / slices),
+                             candidates.begin() +
+                                 3 * (triCount * (s + 1) / slices));
+        // Don't go far past the cost of the collapses this pass needs; the
+        // next pass rescores with the merged quadrics. (Each edge is listed
+        // about twice, each collapse removes about two triangles.)
+        size_t goal =
+            std::min(triCount - targetTriangles, candidates.size() - 1);
+        float costLimit = candidates[goal].cost * 1.5f;
+
+        for (uint32_t v = 0; v < vertexCount; v++)
+          remap[v] = v;
+        std::fill(locked.begin(), locked.end(), 0);
+        size_t removed = 0, collapses = 0;
+        for (const Collapse &c : candidates) {
+          if (removed >= triCount - targetTriangles || c.cost > costLimit)
+            break;
+          if (locked[c.from] || locked[c.to])
+            continue;
+          // Where a seam meets an open border each side's wedges only have
+          // partners on their own side; moving it would tear the seam.
+          if (crease[c.from] && border[c.from])
+            continue;
+          if (!matchWedges(mesh, idx, pos, nextWedge, crease, offsets,
+                           adjacency, c, wedgeFrom, wedgeTo) ||
+              flips(mesh, idx, pos, offsets, adjacency, c))
+            continue;
+
+          for (size_t i = 0; i < wedgeFrom.size(); i++)
+            remap[wedgeFrom[i]] = wedgeTo[i];
+          quadrics[c.to].add(quadrics[c.from]);
+          // Lock the one-ring: those triangles change shape this pass
+          for (uint32_t a = offsets[c.from]; a < offsets[c.from + 1]; a++) {
+            const uint32_t *tri = &idx[3 * size_t(adjacency[a])];
+            bool shared = false;
+            for (int k = 0; k < 3; k++) {
+              locked[pos[tri[k]]] = 1;
+              shared |= pos[tri[k]] == c.to;
+            }
+            removed += shared;
+          }
+          maxError = std::max(maxError, c.cost);
+          collapses++;
+        }
+        if (collapses == 0) {
+          stuck = true; // Everything left is a seam, border or would flip
+          break;
+        }
+
+        // Apply the remap and drop the triangles that collapsed.
+        size_t out = 0;
+        for (size_t t = 0; t < triCount; t++) {
+          uint32_t a = remap[idx[3 * t]], b = remap[idx[3 * t + 1]],
+                   c = remap[idx[3 * t + 2]];
+          if (pos[a] == pos[b] || pos[b] == pos[c] || pos[a] == pos[c])
+            continue;
+          idx[out++] = a;
+          idx[out++] = b;
+          idx[out++] = c;
+        }
+        idx.resize(out);
+      }
+      emit(level, idx, maxError);
+    }
+  }
+
+  // Symmetric 4x4 quadric plus total weight, so error() is a distance.
+  struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0, c = 0, w = 0;
+
+    // Plane n.p + d = 0 (n unit length), with a weight.
+    void addPlane(const double n[3], double d, double weight) {
+      a00 += weight * n[0] * n[0];
+      a01 += weight * n[0] * n[1];
+      a02 += weight * n[0] * n[2];
+      a11 += weight * n[1] * n[1];
+      a12 += weight * n[1] * n[2];
+      a22 += weight * n[2] * n[2];
+      b0 += weight * n[0] * d;
+      b1 += weight * n[1] * d;
+      b2 += weight * n[2] * d;
+      c += weight * d * d;
+      w += weight;
+    }
+
+    void add(const Quadric &q) {
+      a00 += q.a00, a01 += q.a01, a02 += q.a02, a11 += q.a11;
+      a12 += q.a12, a22 += q.a22, b0 += q.b0, b1 += q.b1, b2 += q.b2;
+      c += q.c, w += q.w;
+    }
+
+    // RMS distance of p from the planes
+    float error(const float p[3]) const {
+      double x = p[0], y = p[1], z = p[2];
+      double e = a00 * x * x + a11 * y * y + a22 * z * z +
+                 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                 2 * (b0 * x + b1 * y + b2 * z) + c;
+      return w > 0 && e > 0 ? float(std::sqrt(e / w)) : 0.0f;
+    }
+  };
+
+  struct Collapse {
+    uint32_t from, to; // position representatives
+    float cost;
+    bool operator<(const Collapse &o) const {
+      if (cost != o.cost)
+        return cost < o.cost;
+      return from != o.from ? from < o.from : to < o.to;
+    }
+  };
+
+  // Border edges weigh this much more than an equal-area face, so borders
+  // only move when there is nothing else left.
+  static constexpr double kBorderWeight = 10.0;
+  // Normal splits wider than this are creases (cos 35 degrees)
+  static constexpr float kCreaseCos = 0.819f;
+
+  static void buildWedges(const IndexedMesh &mesh, std::vector<uint32_t> &pos,
+                          std::vector<uint32_t> &nextWedge) {
+    const size_t n = mesh.vertices.size();
+    std::vector<uint32_t> order(n);
+    for (uint32_t v = 0; v < n; v++)
+      order[v] = v;
+    auto less = [&](uint32_t a, uint32_t b) {
+      const float *pa = mesh.vertices[a].position;
+      const float *pb = mesh.vertices[b].position;
+      for (int k = 0; k < 3; k++)
+        if (pa[k] != pb[k])
+          return pa[k] < pb[k];
+      return a < b;
+    };
+    std::sort(order.begin(), order.end(), less);
+    for (size_t i = 0; i < n;) {
+      size_t j = i + 1;
+      while (j < n && memcmp(mesh.vertices[order[i]].position,
+                             mesh.vertices[order[j]].position,
+                             3 * sizeof(float)) == 0)
+        j++;
+      for (size_t k = i; k < j; k++) {
+        pos[order[k]] = order[i];
+        nextWedge[order[k]] = order[k + 1 < j ? k + 1 : i];
+      }
+      i = j;
+    }
+  }
+
+  static void buildQuadrics(const IndexedMesh &mesh,
+                            const std::vector<uint32_t> &idx,
+                            const std::vector<uint32_t> &pos,
+                            std::vector<Quadric> &quadrics,
+                            std::vector<char> &crease,
+                            std::vector<char> &border) {
+    const size_t triCount = idx.size() / 3;
+    // Edges keyed by (low, high) position, to find the ones used once.
+    struct Edge {
+      uint32_t lo, hi, tri;
+      int k;
+      bool operator<(const Edge &o) const {
+        return lo != o.lo ? lo < o.lo : (hi != o.hi ? hi < o.hi : tri < o.tri);
+      }
+    };
+    std::vector<Edge> edges;
+    edges.reserve(idx.size());
+
+    for (size_t t = 0; t < triCount; t++) {
+      double n[3], area;
+      if (!faceNormal(mesh, &idx[3 * t], n, &area))
+        continue;
+      const float *p0 = mesh.vertices[idx[3 * t]].position;
+      double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+      for (int k = 0; k < 3; k++) {
+        quadrics[pos[idx[3 * t + k]]].addPlane(n, d, area);
+        uint32_t a = pos[idx[3 * t + k]], b = pos[idx[3 * t + (k + 1) % 3]];
+        edges.push_back({std::min(a, b), std::max(a, b), uint32_t(t), k});
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < edges.size();) {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j].lo == edges[i].lo &&
+             edges[j].hi == edges[i].hi)
+        j++;
+      // Crease: the two sides of an edge disagree on a normal by more than
+      // kCreaseCos, and it isn't just flat shading. Both ends are seams.
+      bool marked = crease[edges[i].lo] && crease[edges[i].hi];
+      for (size_t a = i; a + 1 < j && !marked; a++) {
+        for (size_t b = a + 1; b < j; b++) {
+          uint32_t lo[2], hi[2];
+          bool flat = true;
+          const Edge *pair[2] = {&edges[a], &edges[b]};
+          for (int s = 0; s < 2; s++) {
+            const uint32_t *tri = &idx[3 * size_t(pair[s]->tri)];
+            uint32_t v0 = tri[pair[s]->k], v1 = tri[(pair[s]->k + 1) % 3];
+            lo[s] = pos[v0] == pair[s]->lo ? v0 : v1;
+            hi[s] = pos[v0] == pair[s]->lo ? v1 : v0;
+            flat &= isFlatShaded(mesh, tri, lo[s]) &&
+                    isFlatShaded(mesh, tri, hi[s]);
+          }
+          if (!flat && (normalCos(mesh, lo[0], lo[1]) < kCreaseCos ||
+                        normalCos(mesh, hi[0], hi[1]) < kCreaseCos)) {
+            crease[edges[i].lo] = crease[edges[i].hi] = 1;
+            marked = true;
+            break;
+          }
+        }
+      }
+      if (j - i == 1) {
+        // Border: plane through the edge, perpendicular to the face
+        const Edge &e = edges[i];
+        border[e.lo] = border[e.hi] = 1;
+        const uint32_t *tri = &idx[3 * size_t(e.tri)];
+        const float *pa = mesh.vertices[tri[e.k]].position;
+        const float *pb = mesh.vertices[tri[(e.k + 1) % 3]].position;
+        double n[3], area;
+        faceNormal(mesh, tri, n, &area);
+        double dir[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+        double len2 = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+        double m[3] = {dir[1] * n[2] - dir[2] * n[1],
+                       dir[2] * n[0] - dir[0] * n[2],
+                       dir[0] * n[1] - dir[1] * n[0]};
+        double ml = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+        if (ml > 0) {
+          for (int k = 0; k < 3; k++)
+            m[k] /= ml;
+          double d = -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]);
+          quadrics[e.lo].addPlane(m, d, kBorderWeight * len2);
+          quadrics[e.hi].addPlane(m, d, kBorderWeight * len2);
+        }
+      }
+      i = j;
+    }
+  }
+
+  static float normalCos(const IndexedMesh &mesh, uint32_t a, uint32_t b) {
+    const float *na = mesh.vertices[a].normal, *nb = mesh.vertices[b].normal;
+    float d = na[0] * nb[0] + na[1] * nb[1] + na[2] * nb[2];
+    float la = na[0] * na[0] + na[1] * na[1] + na[2] * na[2];
+    float lb = nb[0] * nb[0] + nb[1] * nb[1] + nb[2] * nb[2];
+    return la > 0 && lb > 0 ? d / std::sqrt(la * lb) : 1.0f;
+  }
+
+  // Is v's normal just the geometric normal of triangle tri?
+  static bool isFlatShaded(const IndexedMesh &mesh, const uint32_t *tri,
+                           uint32_t v) {
+    double n[3], area;
+    if (!faceNormal(mesh, tri, n, &area))
+      return true;
+    const float *vn = mesh.vertices[v].normal;
+    double len = std::sqrt(double(vn[0]) * vn[0] + double(vn[1]) * vn[1] +
+                           double(vn[2]) * vn[2]);
+    return len > 0 && (n[0] * vn[0] + n[1] * vn[1] + n[2] * vn[2]) > 0.999 * len;
+  }
+
+  // Unit normal and area; false for degenerate triangles.
+  static bool faceNormal(const IndexedMesh &mesh, const uint32_t *tri,
+                         double n[3], double *area) {
+    const float *p0 = mesh.vertices[tri[0]].position;
+    const float *p1 = mesh.vertices[tri[1]].position;
+    const float *p2 = mesh.vertices[tri[2]].position;
+    double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    *area = 0.5 * len;
+    if (len <= 0)
+      return false;
+    for (int k = 0; k < 3; k++)
+      n[k] /= len;
+    return true;
+  }
+
+  // Triangles around each position representative (CSR).
+  static void buildAdjacency(const std::vector<uint32_t> &idx,
+                             const std::vector<uint32_t> &pos,
+                             size_t vertexCount, std::vector<uint32_t> &offsets,
+                             std::vector<uint32_t> &adjacency) {
+    offsets.assign(vertexCount + 1, 0);
+    for (uint32_t v : idx)
+      offsets[pos[v] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] += offsets[v];
+    adjacency.resize(idx.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < idx.size(); i++)
+      adjacency[fill[pos[idx[i]]]++] = uint32_t(i / 3);
+  }
+
+  // For every vertex at c.from, find the vertex at c.to it shares an edge
+  // with. Fails if any has more than one, or none (collapsing would tear the
+  // seam) unless c.from isn't a crease, then the closest normal at c.to will
+  // do.
+  static bool matchWedges(const IndexedMesh &mesh,
+                          const std::vector<uint32_t> &idx,
+                          const std::vector<uint32_t> &pos,
+                          const std::vector<uint32_t> &nextWedge,
+                          const std::vector<char> &crease,
+                          const std::vector<uint32_t> &offsets,
+                          const std::vector<uint32_t> &adjacency,
+                          const Collapse &c, std::vector<uint32_t> &from,
+                          std::vector<uint32_t> &to) {
+    from.clear();
+    to.clear();
+    for (uint32_t a = offsets[c.from]; a < offsets[c.from + 1]; a++) {
+      const uint32_t *tri = &idx[3 * size_t(adjacency[a])];
+      uint32_t wFrom = 0, wTo = 0;
+      bool hasTo = false;
+      for (int k = 0; k < 3; k++) {
+        if (pos[tri[k]] == c.from)
+          wFrom = tri[k];
+        if (pos[tri[k]] == c.to) {
+          wTo = tri[k];
+          hasTo = true;
+        }
+      }
+      if (!hasTo)
+        continue;
+      auto it = std::find(from.begin(), from.end(), wFrom);
+      if (it == from.end()) {
+        from.push_back(wFrom);
+        to.push_back(wTo);
+      } else if (to[it - from.begin()] != wTo) {
+        return false;
+      }
+    }
+    if (from.empty())
+      return false;
+    for (uint32_t a = offsets[c.from]; a < offsets[c.from + 1]; a++) {
+      const uint32_t *tri = &idx[3 * size_t(adjacency[a])];
+      for (int k = 0; k < 3; k++) {
+        if (pos[tri[k]] != c.from ||
+            std::find(from.begin(), from.end(), tri[k]) != from.end())
+          continue;
+        if (crease[c.from])
+          return false;
+        uint32_t best = c.to;
+        float bestCos = -2.0f;
+        uint32_t w = c.to;
+        do {
+          float cos = normalCos(mesh, tri[k], w);
+          if (cos > bestCos) {
+            bestCos = cos;
+            best = w;
+          }
+          w = nextWedge[w];
+        } while (w != c.to);
+        from.push_back(tri[k]);
+        to.push_back(best);
+      }
+    }
+    return true;
+  }
+
+  // Would moving c.from onto c.to turn any surviving triangle around?
+  static bool flips(const IndexedMesh &mesh, const std::vector<uint32_t> &idx,
+                    const std::vector<uint32_t> &pos,
+                    const std::vector<uint32_t> &offsets,
+                    const std::vector<uint32_t> &adjacency, const Collapse &c) {
+    const float *target = mesh.vertices[c.to].position;
+    for (uint32_t a = offsets[c.from]; a < offsets[c.from + 1]; a++) {
+      const uint32_t *tri = &idx[3 * size_t(adjacency[a])];
+      if (pos[tri[0]] == c.to || pos[tri[1]] == c.to || pos[tri[2]] == c.to)
+        continue; // Collapses away
+      double before[3], after[3], area;
+      if (!faceNormal(mesh, tri, before, &area))
+        continue;
+      const float *p[3];
+      for (int k = 0; k < 3; k++)
+        p[k] = pos[tri[k]] == c.from ? target : mesh.vertices[tri[k]].position;
+      double e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+      double e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+      after[0] = e1[1] * e2[2] - e1[2] * e2[1];
+      after[1] = e1[2] * e2[0] - e1[0] * e2[2];
+      after[2] = e1[0] * e2[1] - e1[1] * e2[0];
+      double len = std::sqrt(after[0] * after[0] + after[1] * after[1] +
+                             after[2] * after[2]);
+      // Flipped, or close enough to edge-on that it might as well be
+      if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <=
+          0.1 * len)
+        return true;
+    }
+    return false;
+  }
+};
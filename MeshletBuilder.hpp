@@ -0,0 +1,335 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MeshLoader.hpp"
+
+// A cluster of up to MeshletBuilder::kMaxVertices vertices and
+// kMaxTriangles triangles, with enough bounds to cull it as a whole.
+struct Meshlet {
+  uint32_t vertexOffset;   // into MeshletMesh::vertices
+  uint32_t triangleOffset; // into MeshletMesh::triangles (3 bytes each)
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+
+  // Bounding sphere
+  float center[3];
+  float radius;
+
+  // Normal cone: every triangle normal is within acos(sqrt(1 -
+  // coneCutoff^2)) of coneAxis, and coneApex is a point every triangle
+  // faces away from whenever the whole cone does. coneCutoff = 1 means the
+  // triangles face too many ways to ever cull.
+  float coneAxis[3];
+  float coneCutoff;
+  float coneApex[3];
+};
+
+struct MeshletMesh {
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> vertices; // Meshlet-local -> IndexedMesh vertex
+  std::vector<uint8_t> triangles; // Meshlet-local vertex indices
+};
+
+// Splits an IndexedMesh into meshlets. Greedy: each meshlet grows from a
+// seed triangle by adding the neighbouring triangle (sharing a position, so
+// flat-shaded meshes grow too) that needs the fewest new vertices, until
+// either limit is hit. Ties (and near-ties, through kConeWeight) go to the
+// triangle facing most like the meshlet so far, which keeps the normal
+// cones narrow enough to cull. Seeds are taken in index order, so run
+// MeshOptimizer first for tighter meshlets. Deterministic: same input, same
+// meshlets.
+class MeshletBuilder {
+public:
+  static constexpr size_t kMaxVertices = 64;
+  static constexpr size_t kMaxTriangles = 124;
+  // How much a fully sideways triangle costs, in new vertices
+  static constexpr float kConeWeight = 1.0f;
+  static constexpr float kScoreSlack = 0.005f;
+
+  static MeshletMesh build(const IndexedMesh &mesh,
+                           size_t maxVertices = kMaxVertices,
+                           size_t maxTriangles = kMaxTriangles) {
+    MeshletMesh out;
+    const std::vector<uint32_t> &idx = mesh.indices;
+    const size_t triCount = idx.size() / 3;
+    const size_t vertexCount = mesh.vertices.size();
+    maxVertices = std::min<size_t>(std::max<size_t>(maxVertices, 3), 256);
+    maxTriangles = std::max<size_t>(maxTriangles, 1);
+
+    // Triangles around each position (CSR), positions numbered by their
+    // first vertex in sorted order
+    std::vector<uint32_t> pos = positionIds(mesh);
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (uint32_t v : idx)
+      offsets[pos[v] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] += offsets[v];
+    std::vector<uint32_t> adjacency(idx.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < idx.size(); i++)
+      adjacency[fill[pos[idx[i]]]++] = uint32_t(i / 3);
+
+    std::vector<float> normals(triCount * 3);
+    for (size_t t = 0; t < triCount; t++)
+      unitNormal(mesh.vertices[idx[3 * t]].position,
+                 mesh.vertices[idx[3 * t + 1]].position,
+                 mesh.vertices[idx[3 * t + 2]].position, &normals[3 * t]);
+    float axis[3] = {0, 0, 0}; // Normal sum of the current meshlet
+
+    std::vector<char> used(triCount, 0), queued(triCount, 0);
+    std::vector<int16_t> local(vertexCount, -1); // in the current meshlet
+    std::vector<uint32_t> candidates;
+    Meshlet m = {};
+    size_t seed = 0;
+
+    auto newVertices = [&](size_t t) {
+      int n = 0;
+      for (int k = 0; k < 3; k++)
+        n += local[idx[3 * t + k]] < 0;
+      return n;
+    };
+    auto finish = [&] {
+      if (m.triangleCount == 0)
+        return;
+      computeBounds(mesh, out, m);
+      out.meshlets.push_back(m);
+      for (uint32_t i = 0; i < m.vertexCount; i++)
+        local[out.vertices[m.vertexOffset + i]] = -1;
+      for (uint32_t t : candidates)
+        queued[t] = 0;
+      candidates.clear();
+      axis[0] = axis[1] = axis[2] = 0;
+      m = {};
+      m.vertexOffset = uint32_t(out.vertices.size());
+      m.triangleOffset = uint32_t(out.triangles.size() / 3);
+    };
+
+    for (;;) {
+      // Best neighbour that fits; drop the ones already taken.
+      int64_t best = -1;
+      float bestScore = INFINITY;
+      float alen = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] +
+                             axis[2] * axis[2]);
+      size_t kept = 0;
+      for (uint32_t t : candidates) {
+        if (used[t]) {
+          queued[t] = 0;
+          continue;
+        }
+        candidates[kept++] = t;
+        int n = newVertices(t);
+        if (m.vertexCount + n > maxVertices)
+          continue;
+        const float *tn = &normals[3 * t];
+        float facing =
+            alen > 0
+                ? (tn[0] * axis[0] + tn[1] * axis[1] + tn[2] * axis[2]) / alen
+                : 1.0f;
+        float score = float(n) + kConeWeight * (1.0f - facing);
+        // Near-ties keep queue order, which grows the meshlet compactly
+        if (score < bestScore - kScoreSlack) {
+          best = t;
+          bestScore = score;
+        }
+      }
+      candidates.resize(kept);
+
+      if (best < 0) {
+        if (m.triangleCount > 0) {
+          finish(); // Full, or nothing connected left
+          continue;
+        }
+        while (seed < triCount && used[seed])
+          seed++;
+        if (seed == triCount)
+          break;
+        best = int64_t(seed);
+      }
+
+      // Add it
+      size_t t = size_t(best);
+      used[t] = 1;
+      for (int k = 0; k < 3; k++)
+        axis[k] += normals[3 * t + k];
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = idx[3 * t + k];
+        if (local[v] < 0) {
+          local[v] = int16_t(m.vertexCount++);
+          out.vertices.push_back(v);
+        }
+        out.triangles.push_back(uint8_t(local[v]));
+      }
+      m.triangleCount++;
+      if (m.triangleCount == maxTriangles) {
+        finish();
+        continue;
+      }
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = pos[idx[3 * t + k]];
+        for (uint32_t a = offsets[v]; a < offsets[v + 1]; a++) {
+          uint32_t n = adjacency[a];
+          if (!used[n] && !queued[n]) {
+            queued[n] = 1;
+            candidates.push_back(n);
+          }
+        }
+      }
+    }
+    finish();
+    return out;
+  }
+
+  // Backface test for an orthographic view. viewDir points from the camera
+  // into the scene, in the mesh's model space (unit length).
+  static bool isBackfacing(const Meshlet &m, const float viewDir[3]) {
+    float d = m.coneAxis[0] * viewDir[0] + m.coneAxis[1] * viewDir[1] +
+              m.coneAxis[2] * viewDir[2];
+    return d > m.coneCutoff;
+  }
+
+  // Backface test for a perspective camera at cameraPos (model space).
+  static bool isBackfacingFrom(const Meshlet &m, const float cameraPos[3]) {
+    float d[3] = {m.coneApex[0] - cameraPos[0], m.coneApex[1] - cameraPos[1],
+                  m.coneApex[2] - cameraPos[2]};
+    float len = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    return d[0] * m.coneAxis[0] + d[1] * m.coneAxis[1] + d[2] * m.coneAxis[2] >
+           m.coneCutoff * len;
+  }
+
+  // Orthographic cull of every meshlet. Fills `visible` with the indices of
+  // the meshlets to draw and returns how many triangles were rejected.
+  static size_t cull(const MeshletMesh &mesh, const float viewDir[3],
+                     std::vector<uint32_t> &visible) {
+    visible.clear();
+    size_t culled = 0;
+    for (uint32_t i = 0; i < mesh.meshlets.size(); i++) {
+      if (isBackfacing(mesh.meshlets[i], viewDir))
+        culled += mesh.meshlets[i].triangleCount;
+      else
+        visible.push_back(i);
+    }
+    return culled;
+  }
+
+private:
+  // Unit normal of a CCW triangle (zero if degenerate)
+  static void unitNormal(const float *p0, const float *p1, const float *p2,
+                         float n[3]) {
+    float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (int k = 0; k < 3; k++)
+      n[k] = len > 0 ? n[k] / len : 0.0f;
+  }
+
+  // Same id for every vertex at the same position.
+  static std::vector<uint32_t> positionIds(const IndexedMesh &mesh) {
+    const size_t n = mesh.vertices.size();
+    std::vector<uint32_t> order(n), pos(n);
+    for (uint32_t v = 0; v < n; v++)
+      order[v] = v;
+    auto cmp = [&](uint32_t a, uint32_t b) {
+      int c = memcmp(mesh.vertices[a].position, mesh.vertices[b].position,
+                     3 * sizeof(float));
+      return c != 0 ? c < 0 : a < b;
+    };
+    std::sort(order.begin(), order.end(), cmp);
+    for (size_t i = 0; i < n; i++) {
+      bool same = i > 0 && memcmp(mesh.vertices[order[i]].position,
+                                  mesh.vertices[order[i - 1]].position,
+                                  3 * sizeof(float)) == 0;
+      pos[order[i]] = same ? pos[order[i - 1]] : order[i];
+    }
+    return pos;
+  }
+
+  static void computeBounds(const IndexedMesh &mesh, const MeshletMesh &out,
+                            Meshlet &m) {
+    // Sphere around the box centre
+    float lo[3] = {INFINITY, INFINITY, INFINITY};
+    float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint32_t i = 0; i < m.vertexCount; i++) {
+      const float *p = mesh.vertices[out.vertices[m.vertexOffset + i]].position;
+      for (int k = 0; k < 3; k++) {
+        lo[k] = std::min(lo[k], p[k]);
+        hi[k] = std::max(hi[k], p[k]);
+      }
+    }
+    for (int k = 0; k < 3; k++)
+      m.center[k] = 0.5f * (lo[k] + hi[k]);
+    float r2 = 0;
+    for (uint32_t i = 0; i < m.vertexCount; i++) {
+      const float *p = mesh.vertices[out.vertices[m.vertexOffset + i]].position;
+      float dx = p[0] - m.center[0], dy = p[1] - m.center[1],
+            dz = p[2] - m.center[2];
+      r2 = std::max(r2, dx * dx + dy * dy + dz * dz);
+    }
+    m.radius = std::sqrt(r2);
+
+    // Cone around the mean of the (unit) triangle normals
+    std::vector<float> normals;
+    normals.reserve(3 * m.triangleCount);
+    float axis[3] = {0, 0, 0};
+    for (uint32_t t = 0; t < m.triangleCount; t++) {
+      const float *p[3];
+      trianglePositions(mesh, out, m, t, p);
+      float n[3];
+      unitNormal(p[0], p[1], p[2], n);
+      for (int k = 0; k < 3; k++) {
+        axis[k] += n[k];
+        normals.push_back(n[k]);
+      }
+    }
+    float alen = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] +
+                           axis[2] * axis[2]);
+    float minDot = alen > 0 ? 1.0f : -1.0f;
+    for (int k = 0; k < 3; k++)
+      m.coneAxis[k] = alen > 0 ? axis[k] / alen : 0.0f;
+    for (uint32_t t = 0; t < m.triangleCount && minDot > 0; t++) {
+      const float *n = &normals[3 * t];
+      minDot = std::min(minDot, n[0] * m.coneAxis[0] + n[1] * m.coneAxis[1] +
+                                    n[2] * m.coneAxis[2]);
+    }
+    for (int k = 0; k < 3; k++)
+      m.coneApex[k] = m.center[k];
+    // Cones wider than ~84 degrees cull almost nothing; don't bother.
+    if (minDot <= 0.1f) {
+      m.coneCutoff = 1.0f;
+      return;
+    }
+    m.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+
+    // Apex: slide back from the centre along the axis until behind every
+    // triangle's plane.
+    float maxT = 0;
+    for (uint32_t t = 0; t < m.triangleCount; t++) {
+      const float *p[3];
+      trianglePositions(mesh, out, m, t, p);
+      const float *n = &normals[3 * t];
+      float dc = (m.center[0] - p[0][0]) * n[0] +
+                 (m.center[1] - p[0][1]) * n[1] +
+                 (m.center[2] - p[0][2]) * n[2];
+      float da = m.coneAxis[0] * n[0] + m.coneAxis[1] * n[1] +
+                 m.coneAxis[2] * n[2];
+      if (da > 0)
+        maxT = std::max(maxT, dc / da);
+    }
+    for (int k = 0; k < 3; k++)
+      m.coneApex[k] = m.center[k] - m.coneAxis[k] * maxT;
+  }
+
+  static void trianglePositions(const IndexedMesh &mesh, const MeshletMesh &out,
+                                const Meshlet &m, uint32_t t,
+                                const float *p[3]) {
+    for (int k = 0; k < 3; k++) {
+      uint8_t l = out.triangles[3 * (size_t(m.triangleOffset) + t) + k];
+      p[k] = mesh.vertices[out.vertices[m.vertexOffset + l]].position;
+    }
+  }
+};
@@ -0,0 +1,273 @@
+// We need to define these implementations in EXACTLY one .cpp file
+#define NS_PRIVATE_IMPLEMENTATION
+#define CA_PRIVATE_IMPLEMENTATION
+#define MTL_PRIVATE_IMPLEMENTATION
+
+#include "MetalBackend.hpp"
+#include <cassert>
+#include <iostream>
+
+static MTL::PixelFormat toMetal(PixelFormat format) {
+  switch (format) {
+  case PixelFormat::BGRA8Unorm:
+    return MTL::PixelFormatBGRA8Unorm;
+  case PixelFormat::Depth32Float:
+    return MTL::PixelFormatDepth32Float;
+  default:
+    return MTL::PixelFormatInvalid;
+  }
+}
+
+static MTL::LoadAction toMetal(LoadAction action) {
+  switch (action) {
+  case LoadAction::Load:
+    return MTL::LoadActionLoad;
+  case LoadAction::Clear:
+    return MTL::LoadActionClear;
+  default:
+    return MTL::LoadActionDontCare;
+  }
+}
+
+static MTL::StoreAction toMetal(StoreAction action) {
+  return action == StoreAction::Store ? MTL::StoreActionStore
+                                      : MTL::StoreActionDontCare;
+}
+
+template <typename T> static T *object(uintptr_t id) {
+  return reinterpret_cast<T *>(id);
+}
+
+MetalBackend::MetalBackend(MTL::Device *device, CA::MetalLayer *layer)
+    : _device(device), _layer(layer) {
+  // In C++, we need to retain objects we keep around
+  _device->retain();
+  _layer->retain();
+  _commandQueue = _device->newCommandQueue();
+
+  // Update path to match the Makefile's build directory
+  NS::Error *pError = nullptr;
+  _library = _device->newLibrary(
+      NS::String::string("./build/default.metallib", NS::UTF8StringEncoding),
+      &pError);
+  if (!_library) {
+    __builtin_printf("%s", pError->localizedDescription()->utf8String());
+    assert(false);
+  }
+}
+
+MetalBackend::~MetalBackend() {
+  _library->release();
+  _commandQueue->release();
+  _layer->release();
+  _device->release();
+}
+
+// MTLResourceStorageModeShared = CPU writes, GPU reads
+BufferHandle MetalBackend::newBuffer(const void *data, size_t bytes) {
+  MTL::Buffer *buffer =
+      data ? _device->newBuffer(data, bytes, MTL::ResourceStorageModeShared)
+           : _device->newBuffer(bytes, MTL::ResourceStorageModeShared);
+  BufferHandle handle;
+  handle.id = reinterpret_cast<uintptr_t>(buffer);
+  return handle;
+}
+
+void *MetalBackend::bufferContents(BufferHandle buffer) {
+  return object<MTL::Buffer>(buffer.id)->contents();
+}
+
+// Command buffers still in flight retain the buffers they use, so this
+// can come right after the last draw that used it.
+void MetalBackend::releaseBuffer(BufferHandle buffer) {
+  if (buffer)
+    object<MTL::Buffer>(buffer.id)->release();
+}
+
+TextureHandle MetalBackend::newTexture(const TextureDesc &desc) {
+  MTL::TextureDescriptor *texDesc = MTL::TextureDescriptor::texture2DDescriptor(
+      toMetal(desc.format), desc.width, desc.height, false);
+  MTL::TextureUsage usage = MTL::TextureUsage(0);
+  if (desc.renderTarget)
+    usage = usage | MTL::TextureUsageRenderTarget;
+  if (desc.shaderRead)
+    usage = usage | MTL::TextureUsageShaderRead;
+  texDesc->setUsage(usage);
+  texDesc->setStorageMode(MTL::StorageModePrivate); // GPU only
+  TextureHandle handle;
+  // texDesc is autoreleased (texture2DDescriptor isn't a new/alloc call);
+  // main.mm's per-frame pool drains it
+  handle.id = reinterpret_cast<uintptr_t>(_device->newTexture(texDesc));
+  return handle;
+}
+
+void MetalBackend::releaseTexture(TextureHandle texture) {
+  if (texture)
+    object<MTL::Texture>(texture.id)->release();
+}
+
+PipelineHandle MetalBackend::newPipeline(const PipelineDesc &desc) {
+  NS::String *vertexName =
+      NS::String::string(desc.vertexFunction, NS::UTF8StringEncoding);
+  NS::String *fragName =
+      NS::String::string(desc.fragmentFunction, NS::UTF8StringEncoding);
+  PipelineHandle handle;
+  // Generated shaders are compiled here, into a library of their own
+  MTL::Library *library = _library;
+  if (desc.source) {
+    NS::Error *error = nullptr;
+    library = _device->newLibrary(
+        NS::String::string(desc.source, NS::UTF8StringEncoding), nullptr,
+        &error);
+    if (!library) {
+      std::cerr << "Failed to compile generated shaders: "
+                << error->localizedDescription()->utf8String() << std::endl;
+      return handle;
+    }
+  }
+  MTL::Function *vertexFn = library->newFunction(vertexName);
+  MTL::Function *fragFn = library->newFunction(fragName);
+  if (library != _library)
+    library->release(); // The functions keep what they need
+  if (!vertexFn || !fragFn) {
+    std::cerr << "No shader function " << (vertexFn ? "" : desc.vertexFunction)
+              << (vertexFn || fragFn ? "" : ", ")
+              << (fragFn ? "" : desc.fragmentFunction) << std::endl;
+    if (vertexFn)
+      vertexFn->release();
+    if (fragFn)
+      fragFn->release();
+    return handle;
+  }
+
+  MTL::RenderPipelineDescriptor *pipeDesc =
+      MTL::RenderPipelineDescriptor::alloc()->init();
+  pipeDesc->setVertexFunction(vertexFn);
+  pipeDesc->setFragmentFunction(fragFn);
+  pipeDesc->colorAttachments()->object(0)->setPixelFormat(
+      toMetal(desc.colorFormat));
+  pipeDesc->setDepthAttachmentPixelFormat(toMetal(desc.depthFormat));
+
+  NS::Error *error = nullptr;
+  Pipeline *pipeline = new Pipeline;
+  pipeline->state = _device->newRenderPipelineState(pipeDesc, &error);
+  if (!pipeline->state) {
+    std::cerr << "Failed to create pipeline state: "
+              << error->localizedDescription()->utf8String() << std::endl;
+    delete pipeline;
+    pipeline = nullptr;
+  } else if (desc.depthTest) {
+    MTL::DepthStencilDescriptor *depthDesc =
+        MTL::DepthStencilDescriptor::alloc()->init();
+    depthDesc->setDepthCompareFunction(
+        MTL::CompareFunctionLess);         // "Only draw if closer"
+    depthDesc->setDepthWriteEnabled(true); // "Update the depth buffer"
+    pipeline->depthStencil = _device->newDepthStencilState(depthDesc);
+    depthDesc->release();
+  }
+  handle.id = reinterpret_cast<uintptr_t>(pipeline);
+
+  pipeDesc->release();
+  vertexFn->release();
+  fragFn->release();
+  return handle;
+}
+
+void MetalBackend::releasePipeline(PipelineHandle pipeline) {
+  if (!pipeline)
+    return;
+  Pipeline *p = object<Pipeline>(pipeline.id);
+  p->state->release();
+  if (p->depthStencil)
+    p->depthStencil->release();
+  delete p;
+}
+
+bool MetalBackend::beginFrame() {
+  _drawable = _layer->nextDrawable();
+  if (!_drawable)
+    return false;
+  _cmdBuf = _commandQueue->commandBuffer();
+  return true;
+}
+
+TextureHandle MetalBackend::frameTarget() {
+  TextureHandle handle;
+  handle.id = reinterpret_cast<uintptr_t>(_drawable->texture());
+  return handle;
+}
+
+int MetalBackend::frameWidth() const {
+  return int(_layer->drawableSize().width);
+}
+
+int MetalBackend::frameHeight() const {
+  return int(_layer->drawableSize().height);
+}
+
+void MetalBackend::endFrame() {
+  _cmdBuf->presentDrawable(_drawable);
+  _cmdBuf->commit();
+  _cmdBuf = nullptr;
+  _drawable = nullptr;
+}
+
+void MetalBackend::beginPass(const PassDesc &desc) {
+  MTL::RenderPassDescriptor *pass =
+      MTL::RenderPassDescriptor::renderPassDescriptor();
+  MTL::RenderPassColorAttachmentDescriptor *color =
+      pass->colorAttachments()->object(0);
+  color->setTexture(object<MTL::Texture>(desc.color.texture.id));
+  color->setLoadAction(toMetal(desc.color.load));
+  color->setClearColor(MTL::ClearColor::Make(
+      desc.color.clearColor[0], desc.color.clearColor[1],
+      desc.color.clearColor[2], desc.color.clearColor[3]));
+  color->setStoreAction(toMetal(desc.color.store));
+  if (desc.depth.texture) {
+    MTL::RenderPassDepthAttachmentDescriptor *depth = pass->depthAttachment();
+    depth->setTexture(object<MTL::Texture>(desc.depth.texture.id));
+    depth->setLoadAction(toMetal(desc.depth.load));
+    depth->setStoreAction(toMetal(desc.depth.store));
+    depth->setClearDepth(desc.depth.clearDepth);
+  }
+  _encoder = _cmdBuf->renderCommandEncoder(pass);
+}
+
+void MetalBackend::endPass() {
+  _encoder->endEncoding();
+  _encoder = nullptr;
+}
+
+void MetalBackend::setPipeline(PipelineHandle pipeline) {
+  Pipeline *p = object<Pipeline>(pipeline.id);
+  _encoder->setRenderPipelineState(p->state);
+  if (p->depthStencil)
+    _encoder->setDepthStencilState(p->depthStencil);
+}
+
+void MetalBackend::setVertexBuffer(BufferHandle buffer, size_t offset,
+                                   int index) {
+  _encoder->setVertexBuffer(object<MTL::Buffer>(buffer.id), offset, index);
+}
+
+void MetalBackend::setVertexBytes(const void *data, size_t bytes, int index) {
+  _encoder->setVertexBytes(data, bytes, index);
+}
+
+void MetalBackend::setFragmentTexture(TextureHandle texture, int index) {
+  _encoder->setFragmentTexture(object<MTL::Texture>(texture.id), index);
+}
+
+void MetalBackend::drawIndexed(size_t indexCount, IndexType indexType,
+                               BufferHandle indexBuffer, size_t offset) {
+  _encoder->drawIndexedPrimitives(
+      MTL::PrimitiveTypeTriangle, (NS::UInteger)indexCount,
+      indexType == IndexType::UInt16 ? MTL::IndexTypeUInt16
+                                     : MTL::IndexTypeUInt32,
+      object<MTL::Buffer>(indexBuffer.id), (NS::UInteger)offset);
+}
+
+void MetalBackend::draw(size_t vertexCount) {
+  _encoder->drawPrimitives(MTL::PrimitiveTypeTriangle, (NS::UInteger)0,
+                           (NS::UInteger)vertexCount);
+}
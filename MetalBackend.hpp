@@ -0,0 +1,60 @@
+#pragma once
+#include <Foundation/Foundation.hpp>
+#include <Metal/Metal.hpp>
+#include <QuartzCore/QuartzCore.hpp> // For CA::MetalLayer
+
+#include "RenderBackend.hpp"
+
+// RenderBackend on metal-cpp: one command buffer per frame, one render
+// command encoder per pass, presenting into `layer`'s drawables. Handles
+// are the Metal objects' pointers (pipelines pair a RenderPipelineState
+// with its DepthStencilState).
+class MetalBackend : public RenderBackend {
+public:
+  MetalBackend(MTL::Device *device, CA::MetalLayer *layer);
+  ~MetalBackend() override;
+
+  BufferHandle newBuffer(const void *data, size_t bytes) override;
+  void *bufferContents(BufferHandle buffer) override;
+  void releaseBuffer(BufferHandle buffer) override;
+
+  TextureHandle newTexture(const TextureDesc &desc) override;
+  void releaseTexture(TextureHandle texture) override;
+
+  PipelineHandle newPipeline(const PipelineDesc &desc) override;
+  void releasePipeline(PipelineHandle pipeline) override;
+
+  bool beginFrame() override;
+  TextureHandle frameTarget() override;
+  int frameWidth() const override;
+  int frameHeight() const override;
+  void endFrame() override;
+
+  void beginPass(const PassDesc &desc) override;
+  void endPass() override;
+
+  void setPipeline(PipelineHandle pipeline) override;
+  void setVertexBuffer(BufferHandle buffer, size_t offset, int index) override;
+  void setVertexBytes(const void *data, size_t bytes, int index) override;
+  void setFragmentTexture(TextureHandle texture, int index) override;
+
+  void drawIndexed(size_t indexCount, IndexType indexType,
+                   BufferHandle indexBuffer, size_t offset) override;
+  void draw(size_t vertexCount) override;
+
+private:
+  struct Pipeline {
+    MTL::RenderPipelineState *state = nullptr;
+    MTL::DepthStencilState *depthStencil = nullptr;
+  };
+
+  MTL::Device *_device;
+  CA::MetalLayer *_layer;
+  MTL::CommandQueue *_commandQueue;
+  MTL::Library *_library;
+
+  // The frame and pass in flight
+  CA::MetalDrawable *_drawable = nullptr;
+  MTL::CommandBuffer *_cmdBuf = nullptr;
+  MTL::RenderCommandEncoder *_encoder = nullptr;
+};
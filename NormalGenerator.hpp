@@ -0,0 +1,297 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Parallel.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Smooth vertex normals for meshes that come without any (OBJ files with no
+// vn records). Each face corner gets the normalized sum of the corner
+// normals of every face that shares its position and smoothing group, each
+// weighted by the face's area and the corner's angle, so thin slivers and
+// fan centres don't drag the result around. Smoothing group 0 ("s off") is
+// flat shaded: those corners get their own face normal.
+//
+// Faces come in CSR form (corners faceStart[f]..faceStart[f + 1] belong to
+// face f, counter-clockwise), so triangle lists and raw polygons both work.
+// Three passes, each split over threads and each writing only its own
+// slice: corner weights (gathered into SoA blocks and weighed 4 at a time
+// with SSE2/NEON), position -> corner lists, then the per-position sums.
+// The weights live in the output array until their position overwrites
+// them with the result. Sums are taken in corner order, so the result
+// doesn't depend on the thread count.
+class NormalGenerator {
+public:
+  // Unit normal (3 floats) per corner. smoothingGroups has one id per face,
+  // or is null for "everything in one group". threads: 0 = all cores
+  // (small meshes stay serial).
+  template <typename Real>
+  static std::vector<float>
+  generate(const Real *positions, size_t positionCount,
+           const uint32_t *corners, const uint32_t *faceStart,
+           size_t faceCount, const unsigned *smoothingGroups,
+           unsigned threads = 0) {
+    const size_t cornerCount = faceStart[faceCount];
+    std::vector<float> normals(3 * cornerCount);
+    if (cornerCount == 0)
+      return normals;
+    threads = unsigned(std::max<size_t>(
+        1, std::min<size_t>(parallel::threadCount(threads),
+                            cornerCount / kMinCornersPerThread)));
+
+    // Corner weights: cross(next - p, prev - p) * corner angle
+    float *w = normals.data();
+    std::vector<unsigned> groups(smoothingGroups ? cornerCount : 0);
+    parallel::forSlices(faceCount, threads, [&](unsigned, size_t f0,
+                                                size_t f1) {
+      Block block;
+      size_t blockStart = faceStart[f0];
+      for (size_t f = f0; f < f1; f++) {
+        const uint32_t s = faceStart[f], e = faceStart[f + 1];
+        for (uint32_t c = s; c < e; c++) {
+          if (smoothingGroups)
+            groups[c] = smoothingGroups[f];
+          block.push(&positions[3 * size_t(corners[c])],
+                     &positions[3 * size_t(corners[c + 1 < e ? c + 1 : s])],
+                     &positions[3 * size_t(corners[c > s ? c - 1 : e - 1])]);
+          if (block.size == kBlock) {
+            block.weigh(w + 3 * blockStart);
+            blockStart += kBlock;
+          }
+        }
+      }
+      block.weigh(w + 3 * blockStart);
+    });
+
+    // Position -> its corners. Counted and placed with atomics when
+    // threaded, so each position's list is sorted afterwards.
+    std::vector<std::atomic<uint32_t>> cursor(positionCount);
+    auto bump = [&](uint32_t p) {
+      if (threads == 1) { // No lock prefix needed
+        uint32_t v = cursor[p].load(std::memory_order_relaxed);
+        cursor[p].store(v + 1, std::memory_order_relaxed);
+        return v;
+      }
+      return cursor[p].fetch_add(1, std::memory_order_relaxed);
+    };
+    parallel::forSlices(cornerCount, threads, [&](unsigned, size_t c0,
+                                                  size_t c1) {
+      for (size_t c = c0; c < c1; c++)
+        bump(corners[c]);
+    });
+    std::vector<uint32_t> listStart(positionCount + 1);
+    uint32_t total = 0;
+    for (size_t p = 0; p < positionCount; p++) {
+      listStart[p] = total;
+      total += cursor[p].load(std::memory_order_relaxed);
+      cursor[p].store(listStart[p], std::memory_order_relaxed);
+    }
+    listStart[positionCount] = total;
+    std::vector<uint32_t> list(cornerCount);
+    parallel::forSlices(cornerCount, threads, [&](unsigned, size_t c0,
+                                                  size_t c1) {
+      for (size_t c = c0; c < c1; c++)
+        list[bump(corners[c])] = uint32_t(c);
+    });
+
+    // Sum each (position, smoothing group). A position's corners are only
+    // read and written here, and every weight in a group is read before
+    // the group's result is written over them.
+    auto groupOf = [&](uint32_t c) { return smoothingGroups ? groups[c] : 1u; };
+    parallel::forSlices(positionCount, threads, [&](unsigned, size_t p0,
+                                                    size_t p1) {
+      for (size_t p = p0; p < p1; p++) {
+        uint32_t *b = &list[listStart[p]], *e = &list[listStart[p + 1]];
+        if (threads > 1)
+          std::sort(b, e);
+        for (uint32_t *i = b; i < e; i++) {
+          const unsigned g = groupOf(*i);
+          if (g == 0) {
+            float *n = &w[3 * size_t(*i)];
+            writeNormal(n[0], n[1], n[2], n);
+            continue;
+          }
+          bool done = false; // An earlier corner in this group wrote it
+          for (uint32_t *j = b; j < i && !done; j++)
+            done = groupOf(*j) == g;
+          if (done)
+            continue;
+          float n[3] = {0, 0, 0};
+          for (uint32_t *j = i; j < e; j++) {
+            if (groupOf(*j) != g)
+              continue;
+            for (int k = 0; k < 3; k++)
+              n[k] += w[3 * size_t(*j) + k];
+          }
+          for (uint32_t *j = i; j < e; j++) {
+            if (groupOf(*j) == g)
+              writeNormal(n[0], n[1], n[2], &w[3 * size_t(*j)]);
+          }
+        }
+      }
+    });
+    return normals;
+  }
+
+private:
+  static constexpr size_t kBlock = 256; // Corners per SoA block
+  static constexpr size_t kMinCornersPerThread = 1 << 16;
+  static constexpr float kTiny = 1e-30f;
+  static constexpr float kHalfPi = 1.57079633f;
+  // atan(x) ~= x * poly(x^2) on [0, 1], within 1e-5 radians. Bigger t use
+  // atan(t) = pi/2 - atan(1/t).
+  static constexpr float kAtan[6] = {0.99997726f,  -0.33262347f, 0.19354346f,
+                                     -0.11643287f, 0.05265332f,  -0.01172120f};
+
+  // Edge vectors (a = next - p, b = prev - p) of a run of corners, SoA.
+  struct Block {
+    float a[3][kBlock], b[3][kBlock], out[3][kBlock];
+    size_t size = 0;
+
+    template <typename Real>
+    void push(const Real *p, const Real *next, const Real *prev) {
+      for (int k = 0; k < 3; k++) {
+        a[k][size] = float(next[k] - p[k]);
+        b[k][size] = float(prev[k] - p[k]);
+      }
+      size++;
+    }
+
+    // Write the block's corner weights to w (3 floats per corner) and
+    // empty it.
+    void weigh(float *w) {
+      size_t i = 0;
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+      for (; i + 4 <= size; i += 4)
+        weigh4(i);
+#endif
+      for (; i < size; i++)
+        weigh1(i);
+      for (i = 0; i < size; i++) {
+        w[3 * i + 0] = out[0][i];
+        w[3 * i + 1] = out[1][i];
+        w[3 * i + 2] = out[2][i];
+      }
+      size = 0;
+    }
+
+    // out = cross(a, b) * angle(a, b). |cross| is twice the face's area
+    // (for a triangle), so this is the area and angle weighted corner
+    // normal. The angle uses the half-angle form, tan(angle / 2) =
+    // |a x b| / (|a||b| + a.b), which stays accurate near 0 and 180
+    // degrees.
+    void weigh1(size_t i) {
+      float cx = a[1][i] * b[2][i] - a[2][i] * b[1][i];
+      float cy = a[2][i] * b[0][i] - a[0][i] * b[2][i];
+      float cz = a[0][i] * b[1][i] - a[1][i] * b[0][i];
+      float d = a[0][i] * b[0][i] + a[1][i] * b[1][i] + a[2][i] * b[2][i];
+      float la2 = a[0][i] * a[0][i] + a[1][i] * a[1][i] + a[2][i] * a[2][i];
+      float lb2 = b[0][i] * b[0][i] + b[1][i] * b[1][i] + b[2][i] * b[2][i];
+      float c = std::sqrt(cx * cx + cy * cy + cz * cz);
+      float t = c / std::max(std::sqrt(la2 * lb2) + d, kTiny);
+      float x = std::min(t, 1.0f) / std::max(t, 1.0f);
+      float x2 = x * x, p = kAtan[5];
+      for (int k = 4; k >= 0; k--)
+        p = p * x2 + kAtan[k];
+      float r = x * p;
+      float angle = 2.0f * (t > 1.0f ? kHalfPi - r : r);
+      out[0][i] = cx * angle;
+      out[1][i] = cy * angle;
+      out[2][i] = cz * angle;
+    }
+
+#if defined(__SSE2__)
+    // weigh1() for corners i..i+3.
+    void weigh4(size_t i) {
+      __m128 ax = _mm_loadu_ps(&a[0][i]), ay = _mm_loadu_ps(&a[1][i]),
+             az = _mm_loadu_ps(&a[2][i]), bx = _mm_loadu_ps(&b[0][i]),
+             by = _mm_loadu_ps(&b[1][i]), bz = _mm_loadu_ps(&b[2][i]);
+      __m128 cx = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+      __m128 cy = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz));
+      __m128 cz = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+      __m128 d = dot(ax, ay, az, bx, by, bz);
+      __m128 la2 = dot(ax, ay, az, ax, ay, az);
+      __m128 lb2 = dot(bx, by, bz, bx, by, bz);
+      __m128 c = _mm_sqrt_ps(dot(cx, cy, cz, cx, cy, cz));
+      __m128 den = _mm_add_ps(_mm_sqrt_ps(_mm_mul_ps(la2, lb2)), d);
+      __m128 t = _mm_div_ps(c, _mm_max_ps(den, _mm_set1_ps(kTiny)));
+      __m128 one = _mm_set1_ps(1.0f);
+      __m128 x = _mm_div_ps(_mm_min_ps(t, one), _mm_max_ps(t, one));
+      __m128 x2 = _mm_mul_ps(x, x);
+      __m128 p = _mm_set1_ps(kAtan[5]);
+      for (int k = 4; k >= 0; k--)
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(kAtan[k]));
+      __m128 r = _mm_mul_ps(x, p);
+      __m128 big = _mm_cmpgt_ps(t, one);
+      r = _mm_or_ps(_mm_and_ps(big, _mm_sub_ps(_mm_set1_ps(kHalfPi), r)),
+                    _mm_andnot_ps(big, r));
+      __m128 angle = _mm_add_ps(r, r);
+      _mm_storeu_ps(&out[0][i], _mm_mul_ps(cx, angle));
+      _mm_storeu_ps(&out[1][i], _mm_mul_ps(cy, angle));
+      _mm_storeu_ps(&out[2][i], _mm_mul_ps(cz, angle));
+    }
+
+    static __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by,
+                      __m128 bz) {
+      return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                        _mm_mul_ps(az, bz));
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    // weigh1() for corners i..i+3.
+    void weigh4(size_t i) {
+      float32x4_t ax = vld1q_f32(&a[0][i]), ay = vld1q_f32(&a[1][i]),
+                  az = vld1q_f32(&a[2][i]), bx = vld1q_f32(&b[0][i]),
+                  by = vld1q_f32(&b[1][i]), bz = vld1q_f32(&b[2][i]);
+      float32x4_t cx = vsubq_f32(vmulq_f32(ay, bz), vmulq_f32(az, by));
+      float32x4_t cy = vsubq_f32(vmulq_f32(az, bx), vmulq_f32(ax, bz));
+      float32x4_t cz = vsubq_f32(vmulq_f32(ax, by), vmulq_f32(ay, bx));
+      float32x4_t d = dot(ax, ay, az, bx, by, bz);
+      float32x4_t la2 = dot(ax, ay, az, ax, ay, az);
+      float32x4_t lb2 = dot(bx, by, bz, bx, by, bz);
+      float32x4_t c = vsqrtq_f32(dot(cx, cy, cz, cx, cy, cz));
+      float32x4_t den = vaddq_f32(vsqrtq_f32(vmulq_f32(la2, lb2)), d);
+      float32x4_t t = vdivq_f32(c, vmaxq_f32(den, vdupq_n_f32(kTiny)));
+      float32x4_t one = vdupq_n_f32(1.0f);
+      float32x4_t x = vdivq_f32(vminq_f32(t, one), vmaxq_f32(t, one));
+      float32x4_t x2 = vmulq_f32(x, x);
+      float32x4_t p = vdupq_n_f32(kAtan[5]);
+      for (int k = 4; k >= 0; k--)
+        p = vaddq_f32(vmulq_f32(p, x2), vdupq_n_f32(kAtan[k]));
+      float32x4_t r = vmulq_f32(x, p);
+      r = vbslq_f32(vcgtq_f32(t, one), vsubq_f32(vdupq_n_f32(kHalfPi), r),
+                    r);
+      float32x4_t angle = vaddq_f32(r, r);
+      vst1q_f32(&out[0][i], vmulq_f32(cx, angle));
+      vst1q_f32(&out[1][i], vmulq_f32(cy, angle));
+      vst1q_f32(&out[2][i], vmulq_f32(cz, angle));
+    }
+
+    static float32x4_t dot(float32x4_t ax, float32x4_t ay, float32x4_t az,
+                           float32x4_t bx, float32x4_t by, float32x4_t bz) {
+      return vaddq_f32(vaddq_f32(vmulq_f32(ax, bx), vmulq_f32(ay, by)),
+                       vmulq_f32(az, bz));
+    }
+#endif
+  };
+
+  static void writeNormal(float x, float y, float z, float *out) {
+    float len = std::sqrt(x * x + y * y + z * z);
+    if (len > 0) {
+      out[0] = x / len;
+      out[1] = y / len;
+      out[2] = z / len;
+    } else { // Degenerate: same as having no normal at all
+      out[0] = 0.0f;
+      out[1] = 0.0f;
+      out[2] = 1.0f;
+    }
+  }
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MeshLoader.hpp"
+
+// 16-byte alternative to the 48-byte Vertex, for when vertex fetch bandwidth
+// matters more than precision. Decoded by vertex_main_packed in
+// Shaders.metal, so keep the two in sync.
+//   position: unorm16 x3 within the mesh bounds (+1 pad)
+//   normal:   octahedral, snorm16 x2 (x in the low half)
+//   color:    unorm8 x4, RGBA from the low byte up
+// Position w (always 1) and normal w (always 0) are rebuilt by the decoder.
+struct PackedVertex {
+  uint16_t position[4];
+  uint32_t normal;
+  uint32_t color;
+};
+
+// Dequantization constants for a packed mesh: p = boundsMin + q/65535 *
+// boundsExtent. float4s so it matches the Metal struct (buffer 2).
+struct PackedMeshInfo {
+  float boundsMin[4];
+  float boundsExtent[4];
+};
+
+struct PackedMesh {
+  std::vector<PackedVertex> vertices;
+  PackedMeshInfo info;
+};
+
+class VertexPacker {
+public:
+  static PackedMesh pack(const Vertex *vertices, size_t count) {
+    PackedMesh mesh = {};
+    if (count == 0)
+      return mesh;
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; k++)
+      lo[k] = hi[k] = vertices[0].position[k];
+    for (size_t i = 1; i < count; i++) {
+      for (int k = 0; k < 3; k++) {
+        lo[k] = std::fmin(lo[k], vertices[i].position[k]);
+        hi[k] = std::fmax(hi[k], vertices[i].position[k]);
+      }
+    }
+    for (int k = 0; k < 3; k++) {
+      mesh.info.boundsMin[k] = lo[k];
+      // Flat axes still need a non-zero extent to divide by
+      mesh.info.boundsExtent[k] = hi[k] > lo[k] ? hi[k] - lo[k] : 1.0f;
+    }
+
+    mesh.vertices.resize(count);
+    for (size_t i = 0; i < count; i++)
+      mesh.vertices[i] = packVertex(vertices[i], mesh.info);
+    return mesh;
+  }
+
+  static PackedVertex packVertex(const Vertex &v, const PackedMeshInfo &info) {
+    PackedVertex p;
+    for (int k = 0; k < 3; k++) {
+      float t = (v.position[k] - info.boundsMin[k]) / info.boundsExtent[k];
+      p.position[k] = uint16_t(quantize(t, 65535.0f));
+    }
+    p.position[3] = 0;
+    p.normal = encodeOctahedral(v.normal);
+    p.color = 0;
+    for (int k = 0; k < 4; k++)
+      p.color |= uint32_t(quantize(v.color[k], 255.0f)) << (8 * k);
+    return p;
+  }
+
+  // CPU mirror of vertex_main_packed's decode.
+  static Vertex unpackVertex(const PackedVertex &p, const PackedMeshInfo &info) {
+    Vertex v;
+    for (int k = 0; k < 3; k++)
+      v.position[k] = info.boundsMin[k] +
+                      float(p.position[k]) / 65535.0f * info.boundsExtent[k];
+    v.position[3] = 1.0f;
+    decodeOctahedral(p.normal, v.normal);
+    v.normal[3] = 0.0f;
+    for (int k = 0; k < 4; k++)
+      v.color[k] = float((p.color >> (8 * k)) & 0xFF) / 255.0f;
+    return v;
+  }
+
+  // Unit vector -> octahedron -> two snorm16s. A zero vector encodes as +z.
+  static uint32_t encodeOctahedral(const float n[3]) {
+    float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+    float x = l1 > 0 ? n[0] / l1 : 0.0f;
+    float y = l1 > 0 ? n[1] / l1 : 0.0f;
+    if (n[2] < 0) {
+      float fx = (1.0f - std::fabs(y)) * signNotZero(x);
+      float fy = (1.0f - std::fabs(x)) * signNotZero(y);
+      x = fx;
+      y = fy;
+    }
+    uint32_t qx = uint16_t(int16_t(std::lround(clampUnit(x) * 32767.0f)));
+    uint32_t qy = uint16_t(int16_t(std::lround(clampUnit(y) * 32767.0f)));
+    return qx | (qy << 16);
+  }
+
+  // Same math as Metal's unpack_snorm2x16_to_float + the octahedral unfold.
+  static void decodeOctahedral(uint32_t e, float n[3]) {
+    float x = std::fmax(float(int16_t(e & 0xFFFF)) / 32767.0f, -1.0f);
+    float y = std::fmax(float(int16_t(e >> 16)) / 32767.0f, -1.0f);
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+    if (z < 0) {
+      float fx = (1.0f - std::fabs(y)) * signNotZero(x);
+      float fy = (1.0f - std::fabs(x)) * signNotZero(y);
+      x = fx;
+      y = fy;
+    }
+    float len = std::sqrt(x * x + y * y + z * z);
+    n[0] = x / len;
+    n[1] = y / len;
+    n[2] = z / len;
+  }
+
+private:
+  static float signNotZero(float v) { return v >= 0 ? 1.0f : -1.0f; }
+  static float clampUnit(float v) { return std::fmax(-1.0f, std::fmin(1.0f, v)); }
+  static long quantize(float t, float scale) {
+    return std::lround(std::fmax(0.0f, std::fmin(1.0f, t)) * scale);
+  }
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fork-join helpers shared by the loaders, the BVH builder and the
+// renderers. Every call runs on the calling thread plus threads - 1 others
+// and returns once all of them are done. The free functions start those
+// threads per call, which is fine at load time; WorkerPool keeps them for
+// work that comes every frame.
+namespace parallel {
+
+// threads, or all cores for 0
+inline unsigned threadCount(unsigned threads) {
+  return threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// fn(t) for t in [0, threads), for callers that share out work themselves
+// (e.g. off an atomic counter).
+template <typename Fn> void onThreads(unsigned threads, Fn &&fn) {
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; t++)
+    pool.emplace_back([&fn, t] { fn(t); });
+  fn(0u);
+  for (std::thread &t : pool)
+    t.join();
+}
+
+// fn(slice, begin, end) over `threads` even slices of [0, n).
+template <typename Fn> void forSlices(size_t n, unsigned threads, Fn &&fn) {
+  onThreads(threads, [&fn, n, threads](unsigned t) {
+    fn(t, n * t / threads, n * (t + 1) / threads);
+  });
+}
+
+// Threads - 1 workers started once and parked on a condition variable
+// between calls. One caller at a time, and fn mustn't call back into the
+// pool.
+class WorkerPool {
+public:
+  // threads: 0 = all cores
+  explicit WorkerPool(unsigned threads = 0)
+      : _threads(threadCount(threads)) {
+    for (unsigned t = 1; t < _threads; t++)
+      _workers.emplace_back([this, t] { work(t); });
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _wake.notify_all();
+    for (std::thread &t : _workers)
+      t.join();
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  unsigned threads() const { return _threads; }
+
+  // fn(slice, begin, end) over threads() even slices of [0, n).
+  template <typename Fn> void forSlices(size_t n, Fn &&fn) {
+    using F = typename std::remove_reference<Fn>::type;
+    run(n, [](void *fn, unsigned t, size_t b, size_t e) {
+      (*static_cast<F *>(fn))(t, b, e);
+    }, const_cast<void *>(static_cast<const void *>(&fn)));
+  }
+
+private:
+  typedef void (*Call)(void *fn, unsigned slice, size_t begin, size_t end);
+
+  const unsigned _threads;
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _wake, _done;
+  uint64_t _generation = 0; // Bumped once per call
+  unsigned _pending = 0;    // Workers still busy with this call
+  bool _stopping = false;
+  Call _call = nullptr;
+  void *_fn = nullptr;
+  size_t _n = 0;
+
+  void run(size_t n, Call call, void *fn) {
+    if (_workers.empty()) {
+      call(fn, 0, 0, n);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _call = call;
+      _fn = fn;
+      _n = n;
+      _pending = unsigned(_workers.size());
+      _generation++;
+    }
+    _wake.notify_all();
+    call(fn, 0, 0, n / _threads);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _pending == 0; });
+  }
+
+  void work(unsigned t) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+      _wake.wait(lock, [&] { return _stopping || _generation != seen; });
+      if (_stopping)
+        return;
+      seen = _generation;
+      Call call = _call;
+      void *fn = _fn;
+      size_t n = _n;
+      lock.unlock();
+      call(fn, t, n * t / _threads, n * (t + 1) / _threads);
+      lock.lock();
+      if (--_pending == 0)
+        _done.notify_one();
+    }
+  }
+};
+
+} // namespace parallel
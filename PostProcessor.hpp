@@ -0,0 +1,678 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RenderBackend.hpp"
+#include "RenderGraph.hpp"
+#include "SoftwareRenderer.hpp"
+
+// A chain of post-process effects on the scene pass's colour, with its
+// depth alongside. Run one pass per effect, and every effect is a
+// full-screen read and write of an offscreen texture; instead, effects
+// that only look at the pixel they write, or at a small neighbourhood of
+// it, are fused into one pass, so a chain of N such effects costs one
+// round trip through memory instead of N.
+//
+// Each effect is written twice: as a Metal function body, which the
+// PostProcessor strings together into one generated shader per fused
+// pass, and as a row function for the CPU, which CpuBackend (and
+// PostProcessor::run() without a backend) runs in the same fused order.
+// A generated pipeline carries its pass as the desc's CpuProgram, which is
+// what CpuBackend runs. A pass of one effect that Shaders.metal already
+// has (the default chain, post_fragment_main's edges) uses that instead.
+//
+// In an effect's Metal body:
+//   IN(dx, dy)     the chain's colour so far at p + (dx, dy), float4 RGBA
+//   DEPTH(dx, dy)  the scene's depth there
+//   p, size        the pixel (int2, from the top left) and the target size
+// and it returns the pixel's new float4. Coordinates are clamped to the
+// edge. Between fused effects colour stays float; it's quantized to BGRA8
+// only at pass boundaries.
+
+// What an effect's CPU side sees: row y of the chain's colour so far and
+// the rows around it, out to its radius(), as RGBA floats
+struct PostRow {
+  int y = 0, width = 0, height = 0;
+  int radius = 0;
+  const float *const *rows = nullptr; // 2 * radius + 1 of them
+  const float *depth = nullptr;       // The whole depth target
+
+  // Rows are clamped to the edge already; columns are the effect's to clamp
+  const float *in(int dy) const { return rows[dy + radius]; }
+  const float *depthRow(int dy) const {
+    int row = std::min(std::max(y + dy, 0), height - 1);
+    return depth + size_t(row) * width;
+  }
+  int clampX(int x) const { return std::min(std::max(x, 0), width - 1); }
+};
+
+class PostEffect {
+public:
+  virtual ~PostEffect() {}
+  virtual const char *name() const = 0;
+  // How far IN() reaches (0: only the pixel itself). DEPTH() reads don't
+  // count: depth comes from the scene, not from earlier effects.
+  virtual int radius() const { return 0; }
+  // The Metal body, with the effect's parameters baked in
+  virtual std::string msl() const = 0;
+  // One row, RGBA floats, `width` pixels. With radius() 0, `out` may be
+  // row.in(0): read each pixel before writing it.
+  virtual void run(const PostRow &row, float *out) const = 0;
+  // The Shaders.metal fragment function (with post_vertex_main) that is
+  // this effect on its own, if there's one; used for a pass of just it
+  virtual const char *builtinFunction() const { return nullptr; }
+
+protected:
+  // A float as Metal source, exactly
+  static std::string num(float x) {
+    char s[32];
+    snprintf(s, sizeof(s), "%.9g", x);
+    std::string n = s;
+    if (n.find_first_of(".en") == std::string::npos)
+      n += ".0";
+    return n;
+  }
+};
+
+// Renderer's original post pass: a Laplacian of the scene's depth, squared
+// through a smoothstep and added to the colour, so silhouettes and creases
+// glow. Pixel for pixel what SoftwareRenderer::postProcess() draws.
+class DepthEdgeEffect : public PostEffect {
+public:
+  explicit DepthEdgeEffect(float sensitivity = 0.05f)
+      : _sensitivity(sensitivity) {}
+  const char *name() const override { return "edges"; }
+  // post_fragment_main's EDGE_SENSITIVITY
+  const char *builtinFunction() const override {
+    return _sensitivity == 0.05f ? "post_fragment_main" : nullptr;
+  }
+  std::string msl() const override {
+    return "  float d = DEPTH(0, 0);\n"
+           "  float diff = fabs(d - DEPTH(-1, 0)) + fabs(d - DEPTH(1, 0)) +\n"
+           "               fabs(d - DEPTH(0, -1)) + fabs(d - DEPTH(0, 1));\n"
+           "  float edge = smoothstep(0.0, " +
+           num(_sensitivity) +
+           ", diff);\n"
+           "  edge = edge * edge;\n"
+           "  return IN(0, 0) + float4(edge, edge, edge, 1.0);\n";
+  }
+  void run(const PostRow &row, float *out) const override {
+    const float *in = row.in(0), *depth = row.depthRow(0);
+    const float *up = row.depthRow(-1), *down = row.depthRow(1);
+    int x = 0;
+    if (x < row.width) // Clamps on the left
+      add(in, out, 0, edge(depth, up, down, row, 0));
+    x = 1;
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+    // Four edges at a time, away from the clamped last column
+    for (; x + 4 < row.width; x += 4) {
+      float e[4];
+#if defined(__SSE2__)
+      __m128 d = _mm_loadu_ps(depth + x), sign = _mm_set1_ps(-0.0f);
+      const float *taps[4] = {depth + x - 1, depth + x + 1, up + x, down + x};
+      __m128 diff = _mm_setzero_ps();
+      for (const float *tap : taps) // fabs() is clearing the sign bit
+        diff = _mm_add_ps(
+            diff, _mm_andnot_ps(sign, _mm_sub_ps(d, _mm_loadu_ps(tap))));
+      __m128 t = _mm_div_ps(diff, _mm_set1_ps(_sensitivity));
+      t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+      __m128 v = _mm_mul_ps(_mm_mul_ps(t, t),
+                            _mm_sub_ps(_mm_set1_ps(3.0f),
+                                       _mm_mul_ps(_mm_set1_ps(2.0f), t)));
+      _mm_storeu_ps(e, _mm_mul_ps(v, v));
+#else
+      float32x4_t d = vld1q_f32(depth + x);
+      const float *taps[4] = {depth + x - 1, depth + x + 1, up + x, down + x};
+      float32x4_t diff = vdupq_n_f32(0.0f);
+      for (const float *tap : taps)
+        diff = vaddq_f32(diff, vabdq_f32(d, vld1q_f32(tap)));
+      float32x4_t t = vdivq_f32(diff, vdupq_n_f32(_sensitivity));
+      t = vminq_f32(vmaxq_f32(t, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+      float32x4_t v = vmulq_f32(vmulq_f32(t, t),
+                                vsubq_f32(vdupq_n_f32(3.0f),
+                                          vmulq_n_f32(t, 2.0f)));
+      vst1q_f32(e, vmulq_f32(v, v));
+#endif
+      for (int j = 0; j < 4; j++)
+        add(in, out, x + j, e[j]);
+    }
+#endif
+    for (; x < row.width; x++)
+      add(in, out, x, edge(depth, up, down, row, x));
+  }
+
+private:
+  float _sensitivity;
+
+  float edge(const float *depth, const float *up, const float *down,
+             const PostRow &row, int x) const {
+    float d = depth[x];
+    float depthDiff = std::fabs(d - depth[row.clampX(x - 1)]) +
+                      std::fabs(d - depth[row.clampX(x + 1)]) +
+                      std::fabs(d - up[x]) + std::fabs(d - down[x]);
+    float t = std::min(std::max(depthDiff / _sensitivity, 0.0f), 1.0f);
+    float e = t * t * (3.0f - 2.0f * t);
+    return e * e;
+  }
+
+  static void add(const float *in, float *out, int x, float edge) {
+    for (int k = 0; k < 3; k++)
+      out[4 * x + k] = in[4 * x + k] + edge;
+    out[4 * x + 3] = in[4 * x + 3] + 1.0f;
+  }
+};
+
+// Darkens towards the corners
+class VignetteEffect : public PostEffect {
+public:
+  explicit VignetteEffect(float strength = 0.35f) : _strength(strength) {}
+  const char *name() const override { return "vignette"; }
+  std::string msl() const override {
+    return "  float2 uv = (float2(p) + 0.5) / float2(size) - 0.5;\n"
+           "  float f = 1.0 - " +
+           num(_strength) +
+           " * dot(uv, uv) * 2.0;\n"
+           "  float4 c = IN(0, 0);\n"
+           "  return float4(c.rgb * f, c.a);\n";
+  }
+  void run(const PostRow &row, float *out) const override {
+    const float *in = row.in(0);
+    float v = (float(row.y) + 0.5f) / float(row.height) - 0.5f;
+    for (int x = 0; x < row.width; x++) {
+      float u = (float(x) + 0.5f) / float(row.width) - 0.5f;
+      float f = 1.0f - _strength * (u * u + v * v) * 2.0f;
+      for (int k = 0; k < 3; k++)
+        out[4 * x + k] = in[4 * x + k] * f;
+      out[4 * x + 3] = in[4 * x + 3];
+    }
+  }
+
+private:
+  float _strength;
+};
+
+// Pushes colours away from (amount > 1) or towards (< 1) their luma
+class SaturationEffect : public PostEffect {
+public:
+  explicit SaturationEffect(float amount = 1.25f) : _amount(amount) {}
+  const char *name() const override { return "saturation"; }
+  std::string msl() const override {
+    return "  float4 c = IN(0, 0);\n"
+           "  float l = dot(c.rgb, float3(0.2126, 0.7152, 0.0722));\n"
+           "  return float4(l + (c.rgb - l) * " +
+           num(_amount) + ", c.a);\n";
+  }
+  void run(const PostRow &row, float *out) const override {
+    const float *in = row.in(0);
+    for (int x = 0; x < row.width; x++) {
+      const float *c = in + 4 * x;
+      float l = c[0] * 0.2126f + c[1] * 0.7152f + c[2] * 0.0722f;
+      float a = c[3];
+      for (int k = 0; k < 3; k++)
+        out[4 * x + k] = l + (c[k] - l) * _amount;
+      out[4 * x + 3] = a;
+    }
+  }
+
+private:
+  float _amount;
+};
+
+// Unsharp mask over the four neighbours
+class SharpenEffect : public PostEffect {
+public:
+  explicit SharpenEffect(float amount = 0.5f) : _amount(amount) {}
+  const char *name() const override { return "sharpen"; }
+  int radius() const override { return 1; }
+  std::string msl() const override {
+    return "  float4 c = IN(0, 0);\n"
+           "  float4 b = (IN(-1, 0) + IN(1, 0) + IN(0, -1) + IN(0, 1)) * "
+           "0.25;\n"
+           "  return float4(c.rgb + (c.rgb - b.rgb) * " +
+           num(_amount) + ", c.a);\n";
+  }
+  void run(const PostRow &row, float *out) const override {
+    const float *in = row.in(0), *up = row.in(-1), *down = row.in(1);
+    for (int x = 0; x < row.width; x++) {
+      const float *left = in + 4 * row.clampX(x - 1);
+      const float *right = in + 4 * row.clampX(x + 1);
+      for (int k = 0; k < 3; k++) {
+        float c = in[4 * x + k];
+        float b = (left[k] + right[k] + up[4 * x + k] + down[4 * x + k]) *
+                  0.25f;
+        out[4 * x + k] = c + (c - b) * _amount;
+      }
+      out[4 * x + 3] = in[4 * x + 3];
+    }
+  }
+
+private:
+  float _amount;
+};
+
+// Mean of the (2 radius + 1)^2 pixels around
+class BoxBlurEffect : public PostEffect {
+public:
+  explicit BoxBlurEffect(int radius = 1) : _radius(std::max(radius, 1)) {}
+  const char *name() const override { return "blur"; }
+  int radius() const override { return _radius; }
+  std::string msl() const override {
+    std::string r = std::to_string(_radius);
+    int taps = (2 * _radius + 1) * (2 * _radius + 1);
+    return "  float4 sum = 0.0;\n"
+           "  for (int dy = -" +
+           r + "; dy <= " + r +
+           "; dy++)\n"
+           "    for (int dx = -" +
+           r + "; dx <= " + r +
+           "; dx++)\n"
+           "      sum += IN(dx, dy);\n"
+           "  return sum * " +
+           num(1.0f / float(taps)) + ";\n";
+  }
+  void run(const PostRow &row, float *out) const override {
+    int taps = (2 * _radius + 1) * (2 * _radius + 1);
+    float scale = 1.0f / float(taps);
+    for (int x = 0; x < row.width; x++) {
+      float sum[4] = {0, 0, 0, 0};
+      for (int dy = -_radius; dy <= _radius; dy++) {
+        const float *in = row.in(dy);
+        for (int dx = -_radius; dx <= _radius; dx++) {
+          const float *c = in + 4 * row.clampX(x + dx);
+          for (int k = 0; k < 4; k++)
+            sum[k] += c[k];
+        }
+      }
+      for (int k = 0; k < 4; k++)
+        out[4 * x + k] = sum[k] * scale;
+    }
+  }
+
+private:
+  int _radius;
+};
+
+// One fused pass: BGRA8 colour and the scene's depth in, BGRA8 out. Its
+// effects are per-pixel ones, then at most one that reads a
+// neighbourhood (the gather), then per-pixel ones again. The generated
+// shader recomputes what comes before the gather at each of its taps,
+// which is why PostProcessor only fuses small ones; the CPU keeps those
+// rows in a ring instead.
+class PostPass : public CpuProgram {
+public:
+  const std::vector<const PostEffect *> &effects() const { return _effects; }
+  // The gather's radius, 0 without one
+  int radius() const { return _radius; }
+  // "edges+vignette"; "copy" for an empty chain's pass
+  std::string name() const {
+    std::string n;
+    for (const PostEffect *e : _effects)
+      n += (n.empty() ? "" : "+") + std::string(e->name());
+    return n.empty() ? "copy" : n;
+  }
+  // The generated Metal: post_chain_vertex and post_chain_fragment, colour
+  // at [[texture(0)]] and depth at [[texture(1)]]
+  const std::string &source() const { return _source; }
+  // The Shaders.metal function the pass's pipeline uses instead of the
+  // generated source, or null
+  const char *builtinFunction() const {
+    return _effects.size() == 1 ? _effects[0]->builtinFunction() : nullptr;
+  }
+  PipelineHandle pipeline() const { return _pipeline; }
+
+  // threads: 0 = all cores. `out` can't be `color`.
+  void run(const uint32_t *color, const float *depth, uint32_t *out,
+           int width, int height, unsigned threads = 0) const {
+    threads = std::max(
+        1u, std::min(parallel::threadCount(threads), unsigned(height)));
+    parallel::forSlices(size_t(height), threads, [&](unsigned, size_t y0,
+                                                     size_t y1) {
+      runRows(color, depth, out, width, height, int(y0), int(y1));
+    });
+  }
+  // Same, on a pool's threads
+  void run(const uint32_t *color, const float *depth, uint32_t *out,
+           int width, int height,
+           parallel::WorkerPool &pool) const override {
+    pool.forSlices(size_t(height), [&](unsigned, size_t y0, size_t y1) {
+      runRows(color, depth, out, width, height, int(y0), int(y1));
+    });
+  }
+
+private:
+  friend class PostProcessor;
+  static const size_t kNoGather = size_t(-1);
+
+  std::vector<const PostEffect *> _effects;
+  size_t _gather = kNoGather; // Index in _effects
+  int _radius = 0;
+  std::string _source;
+  PipelineHandle _pipeline;
+
+  // Rows [y0, y1). The effects before the gather fill a ring of the
+  // 2 radius + 1 rows it reads, each row computed once (bar the band's
+  // edges); the gather and the rest run on one row in flight.
+  void runRows(const uint32_t *color, const float *depth, uint32_t *out,
+               int width, int height, int y0, int y1) const {
+    size_t before = _gather == kNoGather ? _effects.size() : _gather;
+    int ringSize = 2 * _radius + 1;
+    size_t rowFloats = size_t(width) * 4;
+    std::vector<float> ring(rowFloats * ringSize), scratch(rowFloats);
+    std::vector<int> ringRow(ringSize, -1);
+    std::vector<const float *> rows(ringSize);
+    PostRow row;
+    row.width = width;
+    row.height = height;
+    row.depth = depth;
+    for (int y = y0; y < y1; y++) {
+      for (int dy = -_radius; dy <= _radius; dy++) {
+        int ry = std::min(std::max(y + dy, 0), height - 1);
+        int slot = ry % ringSize;
+        float *dst = &ring[rowFloats * slot];
+        if (ringRow[slot] != ry) {
+          ringRow[slot] = ry;
+          unpack(color + size_t(ry) * width, width, dst);
+          for (size_t i = 0; i < before; i++)
+            runInPlace(*_effects[i], row, ry, dst);
+        }
+        rows[dy + _radius] = dst;
+      }
+      const float *result = rows[_radius];
+      if (_gather != kNoGather) {
+        row.y = y;
+        row.radius = _radius;
+        row.rows = rows.data();
+        _effects[_gather]->run(row, scratch.data());
+        for (size_t i = _gather + 1; i < _effects.size(); i++)
+          runInPlace(*_effects[i], row, y, scratch.data());
+        result = scratch.data();
+      }
+      pack(result, width, out + size_t(y) * width);
+    }
+  }
+
+  static void runInPlace(const PostEffect &effect, PostRow &row, int y,
+                         float *pixels) {
+    const float *rows[1] = {pixels};
+    row.y = y;
+    row.radius = 0;
+    row.rows = rows;
+    effect.run(row, pixels);
+  }
+
+  // BGRA8 to RGBA floats, and back as SoftwareRenderer::packColor()
+  // does. A pixel is one four-lane vector, so these are SIMD where the
+  // effects can't easily be.
+  static void unpack(const uint32_t *src, int width, float *dst) {
+    const float scale = 1.0f / 255.0f;
+    for (int x = 0; x < width; x++, dst += 4) {
+      uint32_t c = src[x];
+#if defined(__SSE2__)
+      __m128i v = _mm_cvtsi32_si128(int(c)), zero = _mm_setzero_si128();
+      v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero); // b g r a
+      __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(scale));
+      _mm_storeu_ps(dst, _mm_shuffle_ps(f, f, _MM_SHUFFLE(3, 0, 1, 2)));
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+      uint8x8_t bytes = vreinterpret_u8_u32(vdup_n_u32(swapRB(c)));
+      uint32x4_t v = vmovl_u16(vget_low_u16(vmovl_u8(bytes))); // r g b a
+      vst1q_f32(dst, vmulq_n_f32(vcvtq_f32_u32(v), scale));
+#else
+      dst[0] = float((c >> 16) & 0xff) * scale;
+      dst[1] = float((c >> 8) & 0xff) * scale;
+      dst[2] = float(c & 0xff) * scale;
+      dst[3] = float(c >> 24) * scale;
+#endif
+    }
+  }
+
+  static void pack(const float *src, int width, uint32_t *dst) {
+    int x = 0;
+#if defined(__SSE2__)
+    // Rounds to nearest even, as lrint()
+    for (; x + 4 <= width; x += 4, src += 16) {
+      __m128i q[4];
+      for (int j = 0; j < 4; j++) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 4 * j),
+                                         _mm_setzero_ps()),
+                              _mm_set1_ps(1.0f));
+        q[j] = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(255.0f)));
+      }
+      __m128i rgba = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]),
+                                      _mm_packs_epi32(q[2], q[3]));
+      __m128i rb = _mm_and_si128(rgba, _mm_set1_epi32(0x00ff00ff));
+      __m128i bgra = _mm_or_si128(
+          _mm_and_si128(rgba, _mm_set1_epi32(int32_t(0xff00ff00))),
+          _mm_or_si128(_mm_srli_epi32(rb, 16), _mm_slli_epi32(rb, 16)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), bgra);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    for (; x < width; x++, src += 4) {
+      float32x4_t v = vminq_f32(vmaxq_f32(vld1q_f32(src), vdupq_n_f32(0.0f)),
+                                vdupq_n_f32(1.0f));
+      uint16x4_t h = vqmovun_s32(vcvtnq_s32_f32(vmulq_n_f32(v, 255.0f)));
+      uint8x8_t bytes = vqmovn_u16(vcombine_u16(h, h)); // r g b a
+      dst[x] = swapRB(vget_lane_u32(vreinterpret_u32_u8(bytes), 0));
+    }
+#endif
+    for (; x < width; x++, src += 4)
+      dst[x] = SoftwareRenderer::packColor(src[0], src[1], src[2], src[3]);
+  }
+
+  // RGBA8 <-> BGRA8
+  static uint32_t swapRB(uint32_t c) {
+    return (c & 0xff00ff00u) | ((c >> 16) & 0xff) | ((c & 0xff) << 16);
+  }
+
+  void buildSource() {
+    std::string s =
+        "// Generated by PostProcessor: " + name() +
+        "\n"
+        "#include <metal_stdlib>\n"
+        "using namespace metal;\n"
+        "\n"
+        "struct PostChainOut {\n"
+        "  float4 position [[position]];\n"
+        "};\n"
+        "\n"
+        "vertex PostChainOut post_chain_vertex(uint vertexID "
+        "[[vertex_id]]) {\n"
+        "  float2 pos = float2((vertexID << 1) & 2, vertexID & 2);\n"
+        "  PostChainOut out;\n"
+        "  out.position = float4(pos * 2.0f - 1.0f, 0.0f, 1.0f);\n"
+        "  return out;\n"
+        "}\n"
+        "\n"
+        "#define POST_ARGS texture2d<float> color, texture2d<float> depth, "
+        "int2 p\n"
+        "#define POST_PROLOGUE \\\n"
+        "  int2 size = int2(color.get_width(), color.get_height()); \\\n"
+        "  p = clamp(p, int2(0), size - 1)\n"
+        "#define DEPTH(dx, dy) \\\n"
+        "  depth.read(uint2(clamp(p + int2(dx, dy), int2(0), size - 1))).r\n"
+        "\n"
+        "static float4 stage0(POST_ARGS) {\n"
+        "  POST_PROLOGUE;\n"
+        "  return color.read(uint2(p));\n"
+        "}\n";
+    for (size_t i = 0; i < _effects.size(); i++) {
+      std::string prev = "stage" + std::to_string(i);
+      s += "\n// " + std::string(_effects[i]->name()) +
+           "\n#define IN(dx, dy) " + prev +
+           "(color, depth, p + int2(dx, dy))\n"
+           "static float4 stage" +
+           std::to_string(i + 1) +
+           "(POST_ARGS) {\n"
+           "  POST_PROLOGUE;\n" +
+           _effects[i]->msl() + "}\n#undef IN\n";
+    }
+    s += "\n"
+         "fragment float4 post_chain_fragment(\n"
+         "    PostChainOut in [[stage_in]],\n"
+         "    texture2d<float> color [[texture(0)]],\n"
+         "    texture2d<float> depth [[texture(1)]]) {\n"
+         "  return stage" +
+         std::to_string(_effects.size()) +
+         "(color, depth, int2(in.position.xy));\n"
+         "}\n";
+    _source = s;
+  }
+};
+
+// The chain, and its fused passes. Effects run in the order added; with
+// fusion on (the default) each joins the pass before unless that would
+// put two gathers in one pass, or a gather wider than kMaxFusedRadius
+// behind other effects. Off, every effect gets a pass (for comparison).
+// An empty chain is one pass that copies. The backend, if any, has to
+// outlive the PostProcessor.
+class PostProcessor {
+public:
+  static const int kMaxFusedRadius = 2;
+
+  explicit PostProcessor(RenderBackend *backend = nullptr)
+      : _backend(backend) {}
+  ~PostProcessor() { releasePasses(); }
+  PostProcessor(const PostProcessor &) = delete;
+  PostProcessor &operator=(const PostProcessor &) = delete;
+
+  PostEffect &add(std::unique_ptr<PostEffect> effect) {
+    _effects.push_back(std::move(effect));
+    _planned = false;
+    return *_effects.back();
+  }
+  void clear() {
+    _effects.clear();
+    _planned = false;
+  }
+  size_t size() const { return _effects.size(); }
+
+  void setFusion(bool fusion) {
+    _planned = _planned && fusion == _fusion;
+    _fusion = fusion;
+  }
+  bool fusion() const { return _fusion; }
+
+  // Planned (and their pipelines made) on first use after a change
+  const std::vector<std::unique_ptr<PostPass>> &passes() {
+    plan();
+    return _passes;
+  }
+
+  // "[edges+vignette] [blur]"
+  std::string describe() {
+    std::string s;
+    for (const std::unique_ptr<PostPass> &p : passes())
+      s += (s.empty() ? "[" : " [") + p->name() + "]";
+    return s;
+  }
+
+  // The chain's passes into a frame's graph: `color` and `depth` (the
+  // scene's) in, `output` written. Each pass samples the one before
+  // through a transient BGRA8 texture of output's size, and the scene's
+  // depth directly.
+  void addPasses(RenderGraph &graph, GraphTexture color, GraphTexture depth,
+                 GraphTexture output) {
+    const std::vector<std::unique_ptr<PostPass>> &chain = passes();
+    TextureDesc linkDesc = graph.desc(output);
+    linkDesc.format = PixelFormat::BGRA8Unorm;
+    GraphTexture in = color;
+    for (size_t i = 0; i < chain.size(); i++) {
+      GraphTexture out = i + 1 < chain.size()
+                             ? graph.createTexture("post link", linkDesc)
+                             : output;
+      PipelineHandle pipeline = chain[i]->pipeline();
+      graph
+          .addPass("post " + chain[i]->name(),
+                   [=](RenderBackend &backend, const RenderGraph &g) {
+                     backend.setPipeline(pipeline);
+                     backend.setFragmentTexture(g.texture(in), 0);
+                     backend.setFragmentTexture(g.texture(depth), 1);
+                     backend.draw(3); // The fullscreen triangle
+                   })
+          .read(in)
+          .read(depth)
+          .writeColor(out); // Every pixel, so nothing to load
+      in = out;
+    }
+  }
+
+  // The chain on the CPU, no backend needed: what CpuBackend runs, pass by
+  // pass through scratch BGRA8 textures. `out` can't be `color`.
+  void run(const uint32_t *color, const float *depth, uint32_t *out,
+           int width, int height, unsigned threads = 0) {
+    const std::vector<std::unique_ptr<PostPass>> &chain = passes();
+    size_t pixels = size_t(width) * height;
+    if (chain.size() > 1 && _scratch[0].size() != pixels) {
+      _scratch[0].resize(pixels);
+      _scratch[1].resize(pixels);
+    }
+    const uint32_t *in = color;
+    for (size_t i = 0; i < chain.size(); i++) {
+      uint32_t *dst = i + 1 < chain.size() ? _scratch[i % 2].data() : out;
+      chain[i]->run(in, depth, dst, width, height, threads);
+      in = dst;
+    }
+  }
+
+private:
+  RenderBackend *_backend;
+  std::vector<std::unique_ptr<PostEffect>> _effects;
+  std::vector<std::unique_ptr<PostPass>> _passes;
+  bool _fusion = true;
+  bool _planned = false;
+  std::vector<uint32_t> _scratch[2]; // run()'s links
+
+  void plan() {
+    if (_planned)
+      return;
+    _planned = true;
+    releasePasses();
+    _passes.emplace_back(new PostPass);
+    for (const std::unique_ptr<PostEffect> &e : _effects) {
+      PostPass *pass = _passes.back().get();
+      int radius = e->radius();
+      bool fits = pass->_effects.empty() ||
+                  (_fusion && (radius == 0 ||
+                               (pass->_gather == PostPass::kNoGather &&
+                                radius <= kMaxFusedRadius)));
+      if (!fits) {
+        _passes.emplace_back(new PostPass);
+        pass = _passes.back().get();
+      }
+      if (radius > 0) {
+        pass->_gather = pass->_effects.size();
+        pass->_radius = radius;
+      }
+      pass->_effects.push_back(e.get());
+    }
+    for (std::unique_ptr<PostPass> &pass : _passes) {
+      pass->buildSource();
+      if (!_backend)
+        continue;
+      PipelineDesc desc;
+      desc.colorFormat = PixelFormat::BGRA8Unorm;
+      if (const char *builtin = pass->builtinFunction()) {
+        desc.vertexFunction = "post_vertex_main";
+        desc.fragmentFunction = builtin;
+        pass->_pipeline = _backend->newPipeline(desc);
+        continue;
+      }
+      desc.vertexFunction = "post_chain_vertex";
+      desc.fragmentFunction = "post_chain_fragment";
+      desc.source = pass->_source.c_str();
+      desc.cpuProgram = pass.get();
+      pass->_pipeline = _backend->newPipeline(desc);
+    }
+  }
+
+  void releasePasses() {
+    for (std::unique_ptr<PostPass> &pass : _passes) {
+      if (_backend && pass->_pipeline)
+        _backend->releasePipeline(pass->_pipeline);
+    }
+    _passes.clear();
+  }
+};
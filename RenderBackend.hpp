@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "Parallel.hpp"
+
+// What Renderer needs from a graphics API: buffers, textures, pipelines,
+// passes and draws, in Metal's shape. MetalBackend is the real one;
+// CpuBackend runs the same frames on SoftwareRenderer, so Renderer's frame
+// logic builds and runs headless on Linux too.
+//
+// Resources are opaque handles (0 is none), owned by the backend until
+// released. newBuffer() and bufferContents() may be called from any
+// thread (Renderer uploads on its AssetLoader thread); everything else is
+// for the render thread. A frame goes
+//   beginFrame, { beginPass, set..., draw..., endPass }..., endFrame
+// and frameTarget() is the texture it presents.
+
+struct BufferHandle {
+  uintptr_t id = 0;
+  explicit operator bool() const { return id != 0; }
+};
+struct TextureHandle {
+  uintptr_t id = 0;
+  explicit operator bool() const { return id != 0; }
+};
+struct PipelineHandle {
+  uintptr_t id = 0;
+  explicit operator bool() const { return id != 0; }
+};
+
+enum class PixelFormat { Invalid, BGRA8Unorm, Depth32Float };
+enum class IndexType { UInt16, UInt32 };
+enum class LoadAction { DontCare, Load, Clear };
+enum class StoreAction { DontCare, Store };
+
+struct TextureDesc {
+  int width = 0, height = 0;
+  PixelFormat format = PixelFormat::BGRA8Unorm;
+  bool renderTarget = true;
+  bool shaderRead = false; // Sampled by a later pass
+};
+
+// What a pipeline made from generated source does, for backends that
+// can't compile Metal: CpuBackend runs it for the pipeline's full-screen
+// draws, with [[texture(0)]] as BGRA8 colour and [[texture(1)]] as depth,
+// writing every pixel of the pass's colour target. MetalBackend ignores it.
+class CpuProgram {
+public:
+  virtual void run(const uint32_t *color, const float *depth, uint32_t *out,
+                   int width, int height,
+                   parallel::WorkerPool &pool) const = 0;
+
+protected:
+  ~CpuProgram() {}
+};
+
+// Shaders by their Shaders.metal function names, with the fixed state
+// that goes with them. Generated shaders bring their own source, and the
+// CPU version of it.
+struct PipelineDesc {
+  const char *vertexFunction = nullptr;
+  const char *fragmentFunction = nullptr;
+  const char *source = nullptr; // Metal source holding the two functions
+  // Has to outlive the pipeline
+  const CpuProgram *cpuProgram = nullptr;
+  PixelFormat colorFormat = PixelFormat::BGRA8Unorm;
+  PixelFormat depthFormat = PixelFormat::Invalid;
+  bool depthTest = false; // Less, with depth writes
+};
+
+struct PassDesc {
+  struct Color {
+    TextureHandle texture;
+    LoadAction load = LoadAction::DontCare;
+    StoreAction store = StoreAction::Store;
+    float clearColor[4] = {0, 0, 0, 1};
+  } color;
+  struct Depth {
+    TextureHandle texture; // None: no depth attachment
+    LoadAction load = LoadAction::DontCare;
+    StoreAction store = StoreAction::DontCare;
+    float clearDepth = 1.0f;
+  } depth;
+};
+
+class RenderBackend {
+public:
+  virtual ~RenderBackend() {}
+
+  // CPU-visible (shared) memory. `data` may be null for an uninitialized
+  // buffer, filled through bufferContents(). No empty buffers.
+  virtual BufferHandle newBuffer(const void *data, size_t bytes) = 0;
+  virtual void *bufferContents(BufferHandle buffer) = 0;
+  // Fine right after the last draw that used it: frames still in flight
+  // keep what they use
+  virtual void releaseBuffer(BufferHandle buffer) = 0;
+
+  virtual TextureHandle newTexture(const TextureDesc &desc) = 0;
+  virtual void releaseTexture(TextureHandle texture) = 0;
+
+  // Invalid if the backend doesn't have the functions
+  virtual PipelineHandle newPipeline(const PipelineDesc &desc) = 0;
+  virtual void releasePipeline(PipelineHandle pipeline) = 0;
+
+  // False when there's nothing to draw into this time (no drawable);
+  // skip the frame.
+  virtual bool beginFrame() = 0;
+  // The texture endFrame() presents, and its size; valid in a frame
+  virtual TextureHandle frameTarget() = 0;
+  virtual int frameWidth() const = 0;
+  virtual int frameHeight() const = 0;
+  virtual void endFrame() = 0;
+
+  virtual void beginPass(const PassDesc &desc) = 0;
+  virtual void endPass() = 0;
+
+  // State for the draws that follow, in the current pass. Buffer and
+  // texture indices are the shaders' [[buffer(n)]] and [[texture(n)]].
+  virtual void setPipeline(PipelineHandle pipeline) = 0;
+  virtual void setVertexBuffer(BufferHandle buffer, size_t offset,
+                               int index) = 0;
+  // Small constants (Uniforms and the like), copied at the call
+  virtual void setVertexBytes(const void *data, size_t bytes, int index) = 0;
+  virtual void setFragmentTexture(TextureHandle texture, int index) = 0;
+
+  // Triangles. `offset` is in bytes into `indexBuffer`.
+  virtual void drawIndexed(size_t indexCount, IndexType indexType,
+                           BufferHandle indexBuffer, size_t offset) = 0;
+  virtual void draw(size_t vertexCount) = 0;
+};
@@ -0,0 +1,483 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "RenderBackend.hpp"
+
+// One frame's passes and the targets between them. Passes say what they
+// write (one colour and one depth attachment) and what they sample, and
+// compile() works out the rest:
+//   - the order: every pass after the writers of what it reads or keeps,
+//     declaration order otherwise
+//   - culling: passes nothing imported depends on are dropped
+//   - load and store actions: clear, or load only if something earlier
+//     wrote the target and this pass keeps it; store only if a later pass
+//     reads or keeps it, or it's imported
+//   - aliasing: graph-created (transient) textures live from their first
+//     to their last use, and ones with the same description whose
+//     lifetimes don't overlap share a texture
+// execute() then takes the shared textures from a pool kept across
+// frames, so a graph rebuilt every frame allocates nothing once warm, and
+// runs the passes. A texture left unused for a frame goes back to the
+// backend.
+//
+// Rebuild each frame: reset(), createTexture()/importTexture(), addPass(),
+// compile(), execute().
+struct GraphTexture {
+  int index = -1;
+  explicit operator bool() const { return index >= 0; }
+};
+
+class RenderGraph {
+  struct Pass;
+
+public:
+  using Execute = std::function<void(RenderBackend &, const RenderGraph &)>;
+
+  struct Stats {
+    size_t passes = 0;       // Declared
+    size_t culledPasses = 0; // Of those, dropped
+    size_t transients = 0;   // Textures the graph creates ...
+    size_t textures = 0;     // ... and the ones they share after aliasing
+    size_t transientBytes = 0; // Without aliasing ...
+    size_t allocatedBytes = 0; // ... and with it
+    size_t savedBytes() const { return transientBytes - allocatedBytes; }
+  };
+
+  // A compiled pass's attachment
+  struct Attachment {
+    GraphTexture texture;
+    LoadAction load = LoadAction::DontCare;
+    StoreAction store = StoreAction::DontCare;
+  };
+
+  // Declares what a pass touches; from addPass()
+  class PassBuilder {
+  public:
+    // The whole target is cleared ...
+    PassBuilder &clearColor(GraphTexture t, float r, float g, float b,
+                            float a) {
+      Pass &p = pass();
+      p.color = {t.index, Write::Clear};
+      p.clearColor[0] = r;
+      p.clearColor[1] = g;
+      p.clearColor[2] = b;
+      p.clearColor[3] = a;
+      return *this;
+    }
+    // ... or written, over what was there if `keep`, else every pixel of
+    // it (a fullscreen pass), so what was there doesn't matter
+    PassBuilder &writeColor(GraphTexture t, bool keep = false) {
+      pass().color = {t.index, keep ? Write::Keep : Write::Overwrite};
+      return *this;
+    }
+    PassBuilder &clearDepth(GraphTexture t, float depth) {
+      pass().depth = {t.index, Write::Clear};
+      pass().clearDepth = depth;
+      return *this;
+    }
+    PassBuilder &writeDepth(GraphTexture t, bool keep = false) {
+      pass().depth = {t.index, keep ? Write::Keep : Write::Overwrite};
+      return *this;
+    }
+    // Sampled by the pass's shaders
+    PassBuilder &read(GraphTexture t) {
+      pass().reads.push_back(t.index);
+      return *this;
+    }
+
+  private:
+    friend class RenderGraph;
+    PassBuilder(RenderGraph *graph, size_t index)
+        : _graph(graph), _index(index) {}
+    Pass &pass() { return _graph->_passes[_index]; }
+    RenderGraph *_graph;
+    size_t _index;
+  };
+
+  // backend: where execute() gets and returns textures; may be null for a
+  // graph that's only compiled
+  explicit RenderGraph(RenderBackend *backend = nullptr) : _backend(backend) {}
+  ~RenderGraph() {
+    for (PoolEntry &e : _pool)
+      _backend->releaseTexture(e.handle);
+  }
+  RenderGraph(const RenderGraph &) = delete;
+  RenderGraph &operator=(const RenderGraph &) = delete;
+
+  // Aliasing on (the default) or every transient in a texture of its own,
+  // to check what aliasing changes (nothing, in a correct graph)
+  void setAliasing(bool aliasing) { _aliasing = aliasing; }
+  bool aliasing() const { return _aliasing; }
+
+  // Forget the last frame's passes and textures; the pool stays
+  void reset() {
+    _resources.clear();
+    _passes.clear();
+    _order.clear();
+    _stats = Stats();
+    _compiled = false;
+  }
+
+  GraphTexture createTexture(const std::string &name, const TextureDesc &desc) {
+    Resource r;
+    r.name = name;
+    r.desc = desc;
+    _resources.push_back(r);
+    GraphTexture t;
+    t.index = int(_resources.size() - 1);
+    return t;
+  }
+
+  // From outside the graph (the frame's drawable): never aliased, always
+  // stored, and it's what keeps passes from being culled
+  GraphTexture importTexture(const std::string &name, TextureHandle texture,
+                             const TextureDesc &desc) {
+    GraphTexture t = createTexture(name, desc);
+    _resources[t.index].imported = true;
+    _resources[t.index].handle = texture;
+    return t;
+  }
+
+  PassBuilder addPass(const std::string &name, Execute execute) {
+    Pass p;
+    p.name = name;
+    p.execute = std::move(execute);
+    _passes.push_back(std::move(p));
+    return PassBuilder(this, _passes.size() - 1);
+  }
+
+  // False (and nothing to execute) on a cycle or a bad texture
+  bool compile() {
+    _compiled = false;
+    _stats = Stats();
+    _stats.passes = _passes.size();
+    if (!checkTextures() || !sortPasses())
+      return false;
+    cullPasses();
+    assignActions();
+    aliasTextures();
+    _compiled = true;
+    return true;
+  }
+
+  // Runs the compiled passes in order, each between beginPass() and
+  // endPass(), inside the caller's frame.
+  void execute() {
+    if (!_compiled)
+      return;
+    acquireTextures();
+    for (size_t p : _order) {
+      const Pass &pass = _passes[p];
+      PassDesc desc;
+      if (pass.color.texture >= 0) {
+        desc.color.texture = texture(_color[p].texture);
+        desc.color.load = _color[p].load;
+        desc.color.store = _color[p].store;
+        std::copy(pass.clearColor, pass.clearColor + 4, desc.color.clearColor);
+      }
+      if (pass.depth.texture >= 0) {
+        desc.depth.texture = texture(_depth[p].texture);
+        desc.depth.load = _depth[p].load;
+        desc.depth.store = _depth[p].store;
+        desc.depth.clearDepth = pass.clearDepth;
+      }
+      _backend->beginPass(desc);
+      if (pass.execute)
+        pass.execute(*_backend, *this);
+      _backend->endPass();
+    }
+    releaseUnused();
+  }
+
+  // The backend texture behind `t`, while executing
+  TextureHandle texture(GraphTexture t) const {
+    const Resource &r = _resources[t.index];
+    return r.imported ? r.handle : _pool[_slots[r.slot].pool].handle;
+  }
+
+  const TextureDesc &desc(GraphTexture t) const {
+    return _resources[t.index].desc;
+  }
+
+  // After compile(): the passes that run, in order, and their attachments
+  const std::vector<size_t> &order() const { return _order; }
+  const std::string &passName(size_t pass) const { return _passes[pass].name; }
+  const Attachment &colorAttachment(size_t pass) const { return _color[pass]; }
+  const Attachment &depthAttachment(size_t pass) const { return _depth[pass]; }
+  // Transients with the same slot share a texture
+  int slot(GraphTexture t) const { return _resources[t.index].slot; }
+  const Stats &stats() const { return _stats; }
+
+  static size_t bytesPerPixel(PixelFormat format) {
+    switch (format) {
+    case PixelFormat::BGRA8Unorm:
+    case PixelFormat::Depth32Float:
+      return 4;
+    default:
+      return 0;
+    }
+  }
+
+private:
+  enum class Write { None, Clear, Overwrite, Keep };
+  struct Use {
+    int texture = -1;
+    Write write = Write::None;
+  };
+  struct Pass {
+    std::string name;
+    Execute execute;
+    Use color, depth;
+    float clearColor[4] = {0, 0, 0, 1};
+    float clearDepth = 1.0f;
+    std::vector<int> reads;
+    bool culled = false;
+  };
+  struct Resource {
+    std::string name;
+    TextureDesc desc;
+    bool imported = false;
+    TextureHandle handle;          // Imported only
+    int first = -1, last = -1;     // Lifetime, in positions in _order
+    int slot = -1;                 // Transients: the shared texture
+  };
+  // A texture shared by transients
+  struct Slot {
+    TextureDesc desc;
+    int last; // Position of its latest user's last use
+    size_t pool = 0;
+  };
+  struct PoolEntry {
+    TextureDesc desc;
+    TextureHandle handle;
+    bool used = false;
+  };
+
+  RenderBackend *_backend;
+  std::vector<Resource> _resources;
+  std::vector<Pass> _passes;
+  std::vector<size_t> _order;
+  std::vector<Attachment> _color, _depth; // By pass
+  std::vector<Slot> _slots;
+  std::vector<PoolEntry> _pool;
+  Stats _stats;
+  bool _compiled = false;
+  bool _aliasing = true;
+
+  bool valid(int t) const { return t >= 0 && t < int(_resources.size()); }
+
+  static bool sameDesc(const TextureDesc &a, const TextureDesc &b) {
+    return a.width == b.width && a.height == b.height &&
+           a.format == b.format && a.renderTarget == b.renderTarget &&
+           a.shaderRead == b.shaderRead;
+  }
+
+  static bool writes(const Pass &p, int t) {
+    return p.color.texture == t || p.depth.texture == t;
+  }
+
+  // Every pass's write of `t` that keeps what was there
+  static bool keeps(const Pass &p, int t) {
+    return (p.color.texture == t && p.color.write == Write::Keep) ||
+           (p.depth.texture == t && p.depth.write == Write::Keep);
+  }
+
+  static bool reads(const Pass &p, int t) {
+    return std::find(p.reads.begin(), p.reads.end(), t) != p.reads.end();
+  }
+
+  // Indices in range, and usage flags for what the passes do with them
+  bool checkTextures() {
+    for (Pass &p : _passes) {
+      if ((p.color.texture >= 0 && !valid(p.color.texture)) ||
+          (p.depth.texture >= 0 && !valid(p.depth.texture)))
+        return false;
+      for (int t : p.reads) {
+        if (!valid(t))
+          return false;
+        if (!_resources[t].imported)
+          _resources[t].desc.shaderRead = true;
+      }
+    }
+    return true;
+  }
+
+  // Kahn's algorithm, taking the earliest declared pass that's ready. A
+  // texture's writers run in declaration order, and its readers after all
+  // of them.
+  bool sortPasses() {
+    size_t n = _passes.size();
+    std::vector<std::vector<size_t>> after(n);
+    std::vector<size_t> waitingOn(n, 0);
+    auto edge = [&](size_t from, size_t to) {
+      after[from].push_back(to);
+      waitingOn[to]++;
+    };
+    for (size_t t = 0; t < _resources.size(); t++) {
+      std::vector<size_t> writers;
+      for (size_t p = 0; p < n; p++)
+        if (writes(_passes[p], int(t)))
+          writers.push_back(p);
+      for (size_t i = 1; i < writers.size(); i++)
+        edge(writers[i - 1], writers[i]);
+      for (size_t p = 0; p < n && !writers.empty(); p++)
+        if (reads(_passes[p], int(t)) && !writes(_passes[p], int(t)))
+          edge(writers.back(), p);
+    }
+    std::vector<size_t> ready;
+    for (size_t p = 0; p < n; p++)
+      if (waitingOn[p] == 0)
+        ready.push_back(p);
+    _order.clear();
+    while (!ready.empty()) {
+      auto next = std::min_element(ready.begin(), ready.end());
+      size_t p = *next;
+      ready.erase(next);
+      _order.push_back(p);
+      for (size_t q : after[p])
+        if (--waitingOn[q] == 0)
+          ready.push_back(q);
+    }
+    return _order.size() == n;
+  }
+
+  // Backwards from the imported textures: a pass stays if it writes one,
+  // or something a later pass that stays reads or keeps. A clear or a full
+  // overwrite ends the need for earlier writers.
+  void cullPasses() {
+    std::vector<bool> needed(_resources.size(), false);
+    for (size_t i = 0; i < _resources.size(); i++)
+      needed[i] = _resources[i].imported;
+    std::vector<size_t> kept;
+    for (size_t i = _order.size(); i-- > 0;) {
+      Pass &p = _passes[_order[i]];
+      bool live = (p.color.texture >= 0 && needed[p.color.texture]) ||
+                  (p.depth.texture >= 0 && needed[p.depth.texture]);
+      p.culled = !live;
+      if (!live) {
+        _stats.culledPasses++;
+        continue;
+      }
+      for (const Use *u : {&p.color, &p.depth})
+        if (u->texture >= 0 && !_resources[u->texture].imported)
+          needed[u->texture] = u->write == Write::Keep;
+      for (int t : p.reads)
+        needed[t] = true;
+      kept.push_back(_order[i]);
+    }
+    _order.assign(kept.rbegin(), kept.rend());
+  }
+
+  Attachment attachment(const Use &use, size_t position) const {
+    Attachment a;
+    a.texture.index = use.texture;
+    if (use.texture < 0)
+      return a;
+    const Resource &r = _resources[use.texture];
+    bool writtenBefore = r.imported;
+    for (size_t i = 0; i < position; i++)
+      writtenBefore = writtenBefore || writes(_passes[_order[i]], use.texture);
+    if (use.write == Write::Clear)
+      a.load = LoadAction::Clear;
+    else if (use.write == Write::Keep && writtenBefore)
+      a.load = LoadAction::Load;
+    bool usedAfter = r.imported;
+    for (size_t i = position + 1; i < _order.size(); i++) {
+      const Pass &later = _passes[_order[i]];
+      usedAfter = usedAfter || reads(later, use.texture) ||
+                  keeps(later, use.texture);
+    }
+    a.store = usedAfter ? StoreAction::Store : StoreAction::DontCare;
+    return a;
+  }
+
+  // Load and store actions, and every texture's lifetime
+  void assignActions() {
+    _color.assign(_passes.size(), Attachment());
+    _depth.assign(_passes.size(), Attachment());
+    for (size_t i = 0; i < _order.size(); i++) {
+      const Pass &p = _passes[_order[i]];
+      _color[_order[i]] = attachment(p.color, i);
+      _depth[_order[i]] = attachment(p.depth, i);
+      auto use = [&](int t) {
+        Resource &r = _resources[t];
+        if (r.first < 0)
+          r.first = int(i);
+        r.last = int(i);
+      };
+      if (p.color.texture >= 0)
+        use(p.color.texture);
+      if (p.depth.texture >= 0)
+        use(p.depth.texture);
+      for (int t : p.reads)
+        use(t);
+    }
+  }
+
+  // Greedy interval packing, in order of first use: each transient takes
+  // the first slot of its description that's free by then.
+  void aliasTextures() {
+    _slots.clear();
+    std::vector<int> transients;
+    for (size_t t = 0; t < _resources.size(); t++)
+      if (!_resources[t].imported && _resources[t].first >= 0)
+        transients.push_back(int(t));
+    std::stable_sort(transients.begin(), transients.end(), [&](int a, int b) {
+      return _resources[a].first < _resources[b].first;
+    });
+    for (int t : transients) {
+      Resource &r = _resources[t];
+      size_t bytes = size_t(r.desc.width) * r.desc.height *
+                     bytesPerPixel(r.desc.format);
+      _stats.transients++;
+      _stats.transientBytes += bytes;
+      for (size_t s = 0; s < _slots.size() && r.slot < 0 && _aliasing; s++) {
+        if (_slots[s].last < r.first && sameDesc(_slots[s].desc, r.desc)) {
+          r.slot = int(s);
+          _slots[s].last = r.last;
+        }
+      }
+      if (r.slot < 0) {
+        _slots.push_back({r.desc, r.last});
+        r.slot = int(_slots.size() - 1);
+        _stats.allocatedBytes += bytes;
+      }
+    }
+    _stats.textures = _slots.size();
+  }
+
+  void acquireTextures() {
+    for (PoolEntry &e : _pool)
+      e.used = false;
+    for (Slot &s : _slots) {
+      size_t e = 0;
+      while (e < _pool.size() &&
+             (_pool[e].used || !sameDesc(_pool[e].desc, s.desc)))
+        e++;
+      if (e == _pool.size())
+        _pool.push_back({s.desc, _backend->newTexture(s.desc)});
+      _pool[e].used = true;
+      s.pool = e;
+    }
+  }
+
+  // After the frame: what it didn't use goes back (say, last size's)
+  void releaseUnused() {
+    size_t kept = 0;
+    for (size_t e = 0; e < _pool.size(); e++) {
+      if (_pool[e].used) {
+        for (Slot &s : _slots)
+          if (s.pool == e)
+            s.pool = kept;
+        _pool[kept++] = _pool[e];
+      } else {
+        _backend->releaseTexture(_pool[e].handle);
+      }
+    }
+    _pool.resize(kept);
+  }
+};
@@ -1,243 +1,241 @@
 // We need to define these implementations in EXACTLY one .cpp file
-#define NS_PRIVATE_IMPLEMENTATION
-#define CA_PRIVATE_IMPLEMENTATION
-#define MTL_PRIVATE_IMPLEMENTATION
 #define TINYOBJLOADER_IMPLEMENTATION
 
 #include "Renderer.hpp"
-#include "MeshLoader.hpp"
+#include "MeshAsset.hpp"
+#include "MeshSimplifier.hpp"
+#include "PackedVertex.hpp"
+#include "Uniforms.hpp"
+#include <chrono>
 #include <cmath>
 #include <iostream>
+#include <memory>
 
 // /10 to slow it way down while I'm fiddling.
 const float angleChange = 0.05f / 10.0f;
 
-struct Uniforms {
-  float rotationMatrix[4][4];
-};
+// Upload 16-byte PackedVertex records (vertex_main_packed) instead of the
+// 48-byte Vertex (vertex_main). See PackedVertex.hpp.
+const bool usePackedVertices = true;
 
-Renderer::Renderer(MTL::Device *device)
-    : _device(device), _angle(0.0f), _angleDelta(angleChange) {
-  // In C++, we need to retain objects we keep around
-  _device->retain();
-  _commandQueue = _device->newCommandQueue();
+static double nowMs() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Renderer::Renderer(RenderBackend *backend)
+    : _backend(backend), _graph(backend), _post(backend), _angle(0.0f),
+      _angleDelta(angleChange), _startMs(nowMs()) {
+  buildBuffers(); // First, so the load overlaps the rest of the setup
   buildShaders();
-  buildBuffers();
-  buildFirstPassTex();
 }
 
 Renderer::~Renderer() {
-  _vertexBuffer->release();
-  _commandQueue->release();
-  _pipelineState->release();
-  _device->release();
-  _depthStencilState->release();
-  _offscreenColorTexture->release();
-  _depthTexture->release();
+  _loader.wait(); // The load job uses _backend
+  releaseMesh(_mesh);
+  if (std::unique_ptr<GpuMesh> loaded = _loadedMesh.take())
+    releaseMesh(*loaded);
+  _backend->releasePipeline(_pipelineState);
 }
 
 void Renderer::buildShaders() {
-  // Load the library
-  NS::Error *pError = nullptr;
-  // Update path to match the Makefile's build directory
-  MTL::Library *pLibrary = _device->newLibrary(
-      NS::String::string("./build/default.metallib", NS::UTF8StringEncoding),
-      &pError);
-  if (!pLibrary) {
-    __builtin_printf("%s", pError->localizedDescription()->utf8String());
-    assert(false);
-  }
-
-  // Build functions
-  NS::String *vertexName =
-      NS::String::string("vertex_main", NS::UTF8StringEncoding);
-  NS::String *fragName =
-      NS::String::string("fragment_main", NS::UTF8StringEncoding);
-  MTL::Function *vertexFn = pLibrary->newFunction(vertexName);
-  MTL::Function *fragFn = pLibrary->newFunction(fragName);
-
-  MTL::RenderPipelineDescriptor *desc =
-      MTL::RenderPipelineDescriptor::alloc()->init();
-  desc->setVertexFunction(vertexFn);
-  desc->setFragmentFunction(fragFn);
-  desc->colorAttachments()->object(0)->setPixelFormat(
-      MTL::PixelFormat::PixelFormatBGRA8Unorm);
-  desc->setDepthAttachmentPixelFormat(
-      MTL::PixelFormat::PixelFormatDepth32Float);
-
-  NS::Error *error = nullptr;
-  _pipelineState = _device->newRenderPipelineState(desc, &error);
-  if (!_pipelineState) {
-    std::cerr << "Failed to create pipeline state: "
-              << error->localizedDescription()->utf8String() << std::endl;
-  }
-
-  // Create Depth/Stencil State
-  MTL::DepthStencilDescriptor *depthDesc =
-      MTL::DepthStencilDescriptor::alloc()->init();
-  depthDesc->setDepthCompareFunction(
-      MTL::CompareFunctionLess); // "Only draw if closer"
-  depthDesc->setDepthWriteEnabled(
-      true); // "Update the depth buffer when drawing"
-  _depthStencilState = _device->newDepthStencilState(depthDesc);
-
-  // Post-Process Pipeline
-  // Fns
-  NS::String *postVertName =
-      NS::String::string("post_vertex_main", NS::UTF8StringEncoding);
-  NS::String *postFragName =
-      NS::String::string("post_fragment_main", NS::UTF8StringEncoding);
-  MTL::Function *postVertFn = pLibrary->newFunction(postVertName);
-  MTL::Function *postFragFn = pLibrary->newFunction(postFragName);
-
-  // Descriptor
-  MTL::RenderPipelineDescriptor *postDesc =
-      MTL::RenderPipelineDescriptor::alloc()->init();
-  postDesc->setVertexFunction(postVertFn);
-  postDesc->setFragmentFunction(postFragFn);
-  postDesc->colorAttachments()->object(0)->setPixelFormat(
-      MTL::PixelFormatBGRA8Unorm);
-  postDesc->setDepthAttachmentPixelFormat(
-      MTL::PixelFormatInvalid); // Post-process does not use depth testing, b/c
-                                // flat image
-
-  _postPipelineState = _device->newRenderPipelineState(postDesc, &error);
-  // Cleanup
-  depthDesc->release();
-  vertexFn->release();
-  fragFn->release();
-  desc->release();
-  pLibrary->release();
-  vertexName->release();
-  fragName->release();
-  postVertName->release();
-  postFragName->release();
-  postVertFn->release();
-  postFragFn->release();
-  postDesc->release();
+  PipelineDesc desc;
+  desc.vertexFunction =
+      usePackedVertices ? "vertex_main_packed" : "vertex_main";
+  desc.fragmentFunction = "fragment_main";
+  desc.colorFormat = PixelFormat::BGRA8Unorm;
+  desc.depthFormat = PixelFormat::Depth32Float;
+  desc.depthTest = true; // "Only draw if closer", and update the depth
+  _pipelineState = _backend->newPipeline(desc);
+
+  // Post-process chain: post_fragment_main's depth edges for now, which
+  // is Shaders.metal's pipeline as it stands. Add effects here; per-pixel
+  // and small-neighbourhood ones fuse into one generated pass (see
+  // PostProcessor.hpp).
+  _post.add(std::unique_ptr<PostEffect>(new DepthEdgeEffect()));
+  _post.passes(); // Makes the pipelines now rather than in the first frame
 }
 
 void Renderer::buildBuffers() {
-  // monke.obj should be in the same folder as the executable
-  std::vector<Vertex> mesh = MeshLoader::loadObj("monke.obj");
-  _vertexCount = mesh.size();
-  size_t dataSize = mesh.size() * sizeof(Vertex);
-  // Create GPU buffer
-  // MTLResourceStorageModeShared = CPU writes, GPU reads
-  _vertexBuffer = _device->newBuffer(dataSize, MTL::ResourceStorageModeShared);
-  // Copy data from C++ Vector to Metal Buffer
-  memcpy(_vertexBuffer->contents(), mesh.data(), dataSize);
+  // Everything from parsing to the GPU buffers runs on the loader thread.
+  // draw() keeps presenting the empty placeholder meanwhile, and swaps the
+  // mesh in once it's published.
+  _loader.submit([this] {
+    // monke.obj should be in the same folder as the executable
+    const char *objFile = "monke.obj";
+    // Next to default.metallib, so `make clean` drops it too
+    const char *cacheFile = "./build/monke.meshcache";
+
+    double t0 = nowMs();
+    MeshAsset asset = MeshAsset::load(objFile, cacheFile);
+    if (asset.fromCache) {
+      std::cout << "Loaded " << asset.mesh.vertices.size()
+                << " vertices from " << cacheFile << std::endl;
+    } else {
+      std::cout << "Vertex cache ACMR " << asset.cacheBefore.acmr << " -> "
+                << asset.cacheAfter.acmr << ", ATVR " << asset.cacheBefore.atvr
+                << " -> " << asset.cacheAfter.atvr << std::endl;
+    }
+    std::unique_ptr<GpuMesh> mesh(new GpuMesh(uploadMesh(asset)));
+    std::cout << "Mesh loaded in " << nowMs() - t0 << " ms" << std::endl;
+    _loadedMesh.publish(std::move(mesh));
+  });
 }
 
-// Helper for math
-Uniforms makeRotation(float angleRadians) {
-  float c = cos(angleRadians);
-  float s = sin(angleRadians);
-  Uniforms u;
-
-  // Initialize identity matrix
-  // For loop will output:
-  // [[1, 0, 0, 0],
-  //  [0, 1, 0, 0],
-  //  [0, 0, 1, 0],
-  //  [0, 0, 0, 1]]
-  for (int i = 0; i < 4; i++)
-    for (int j = 0; j < 4; j++)
-      u.rotationMatrix[i][j] = (i == j ? 1.0f : 0.0f);
-  // Then make it into a rotation matrix:
-  u.rotationMatrix[0][0] = c;
-  u.rotationMatrix[0][1] = s;
-  u.rotationMatrix[1][0] = -s;
-  u.rotationMatrix[1][1] = c;
-  // This leaves it as:
-  // [[c, -s, 0, 0],
-  //  [s, c, 0, 0],
-  //  [0, 0, 1, 0],
-  //  [0, 0, 0, 1]]
-  return u;
+// Runs on the loader thread: only makes and fills buffers, which every
+// backend allows from any thread.
+Renderer::GpuMesh Renderer::uploadMesh(const MeshAsset &asset) {
+  GpuMesh gpu;
+  const Vertex *vertices = asset.mesh.vertices.data();
+  size_t vertexCount = asset.mesh.vertices.size();
+  gpu.vertexCount = vertexCount;
+  if (asset.mesh.indices.empty())
+    return gpu; // No empty buffers; draw() skips the mesh
+
+  if (usePackedVertices) {
+    PackedMesh packed = VertexPacker::pack(vertices, vertexCount);
+    gpu.packedMeshInfo = packed.info;
+    gpu.vertexBuffer = _backend->newBuffer(packed.vertices.data(),
+                                           vertexCount * sizeof(PackedVertex));
+  } else {
+    gpu.vertexBuffer =
+        _backend->newBuffer(vertices, vertexCount * sizeof(Vertex));
+  }
+  // uint16 indices whenever the vertex count allows, half the bytes
+  size_t indexSize = indexSizeFor(vertexCount);
+  gpu.indexType =
+      indexSize == sizeof(uint16_t) ? IndexType::UInt16 : IndexType::UInt32;
+
+  // LOD chain, all levels back to back in one index buffer over the shared
+  // vertex buffer. draw() picks one by projected size.
+  const std::vector<MeshLod> &lods = asset.lods;
+  size_t indexCount = 0;
+  for (const MeshLod &lod : lods) {
+    LodRange range;
+    range.indexOffset = indexCount * indexSize;
+    range.indexCount = lod.indices.size();
+    range.error = lod.error;
+    for (const MeshRange &r : lod.ranges) {
+      range.ranges.push_back(
+          {(indexCount + r.firstIndex) * indexSize, r.indexCount});
+      range.bounds.push(r.bounds);
+    }
+    gpu.lods.push_back(std::move(range));
+    indexCount += lod.indices.size();
+  }
+  gpu.indexBuffer = _backend->newBuffer(nullptr, indexCount * indexSize);
+  char *dst = static_cast<char *>(_backend->bufferContents(gpu.indexBuffer));
+  for (size_t i = 0; i < lods.size(); i++)
+    packIndices(lods[i].indices.data(), lods[i].indices.size(), indexSize,
+                dst + gpu.lods[i].indexOffset);
+  for (const LodRange &lod : gpu.lods)
+    std::cout << "LOD " << &lod - gpu.lods.data() << ": "
+              << lod.indexCount / 3 << " triangles in " << lod.ranges.size()
+              << " ranges, error " << lod.error << std::endl;
+  return gpu;
 }
 
-void Renderer::draw(CA::MetalLayer *layer) {
-  CA::MetalDrawable *drawable = layer->nextDrawable();
-  if (!drawable)
-    return;
+void Renderer::releaseMesh(GpuMesh &mesh) {
+  _backend->releaseBuffer(mesh.vertexBuffer);
+  _backend->releaseBuffer(mesh.indexBuffer);
+  mesh = GpuMesh();
+}
+
+void Renderer::draw() {
+  // Swap in a newly loaded mesh between frames. Backends keep buffers alive
+  // for frames still in flight, so the old mesh can go right away.
+  if (std::unique_ptr<GpuMesh> loaded = _loadedMesh.take()) {
+    releaseMesh(_mesh);
+    _mesh = std::move(*loaded);
+    std::cout << "Mesh swapped in " << nowMs() - _startMs
+              << " ms after startup" << std::endl;
+  }
 
-  MTL::CommandBuffer *cmdBuf = _commandQueue->commandBuffer();
-
-  // Pass 1: Render object and depth to offscreen tex
-  MTL::RenderPassDescriptor *pass1 =
-      MTL::RenderPassDescriptor::renderPassDescriptor();
-  // Set color
-  pass1->colorAttachments()->object(0)->setTexture(_offscreenColorTexture);
-  pass1->colorAttachments()->object(0)->setLoadAction(MTL::LoadActionClear);
-  pass1->colorAttachments()->object(0)->setClearColor(
-      MTL::ClearColor::Make(0.1, 0.1, 0.1, 1));
-  pass1->colorAttachments()->object(0)->setStoreAction(
-      MTL::StoreActionStore); // Save for Pass 2!
-  // Set depth
-  pass1->depthAttachment()->setTexture(_depthTexture);
-  pass1->depthAttachment()->setLoadAction(MTL::LoadActionClear);
-  pass1->depthAttachment()->setStoreAction(
-      MTL::StoreActionStore); // Save for Pass 2!
-  pass1->depthAttachment()->setClearDepth(1.0);
-  // Set uniforms and encode first pass
-  MTL::RenderCommandEncoder *enc1 = cmdBuf->renderCommandEncoder(pass1);
-  enc1->setRenderPipelineState(_pipelineState);
-  enc1->setDepthStencilState(_depthStencilState);
+  if (!_backend->beginFrame())
+    return;
   _angle += _angleDelta;
   Uniforms u = makeRotation(_angle);
 
-  enc1->setVertexBuffer(_vertexBuffer, 0, 0);
-  enc1->setVertexBytes(&u, sizeof(u), 1);
-  enc1->drawPrimitives(MTL::PrimitiveTypeTriangle, (NS::UInteger)0,
-                       (NS::UInteger)_vertexCount);
-  enc1->endEncoding();
-
-  // Pass 2 (post-processor): Render fullscreen quad using results from Pass 1
-  MTL::RenderPassDescriptor *pass2 =
-      MTL::RenderPassDescriptor::renderPassDescriptor();
-
-  // Output tex to the real screen (drawable)
-  pass2->colorAttachments()->object(0)->setTexture(drawable->texture());
-  pass2->colorAttachments()->object(0)->setLoadAction(
-      MTL::LoadActionDontCare); // Overwriting anyway
-  pass2->colorAttachments()->object(0)->setStoreAction(MTL::StoreActionStore);
-
-  // Encode pass 2
-  MTL::RenderCommandEncoder *enc2 = cmdBuf->renderCommandEncoder(pass2);
-  enc2->setRenderPipelineState(_postPipelineState);
-  // Inputs (the textures from pass 1)
-  enc2->setFragmentTexture(_offscreenColorTexture, 0);
-  enc2->setFragmentTexture(_depthTexture, 1);
-  // Draw 3 vertices (The shader generates the fullscreen triangle coordinates
-  // automatically)
-  enc2->drawPrimitives(MTL::PrimitiveTypeTriangle, (NS::UInteger)0,
-                       (NS::UInteger)3);
-  enc2->endEncoding();
+  // Pass 1 renders the object and its depth offscreen, at the drawable's
+  // size; the post-processor's passes sample both onto the drawable. The
+  // graph orders them, picks the load and store actions (both of pass 1's
+  // targets stored for the post passes) and hands out the offscreen
+  // textures.
+  TextureDesc colorDesc;
+  colorDesc.width = _backend->frameWidth();
+  colorDesc.height = _backend->frameHeight();
+  colorDesc.format = PixelFormat::BGRA8Unorm;
+  TextureDesc depthDesc = colorDesc;
+  depthDesc.format = PixelFormat::Depth32Float;
+  _graph.reset();
+  GraphTexture color = _graph.createTexture("color", colorDesc);
+  GraphTexture depth = _graph.createTexture("depth", depthDesc);
+  GraphTexture frame =
+      _graph.importTexture("frame", _backend->frameTarget(), colorDesc);
+
+  _graph
+      .addPass("scene",
+               [&](RenderBackend &, const RenderGraph &) { drawScene(u); })
+      .clearColor(color, 0.1f, 0.1f, 0.1f, 1.0f)
+      .clearDepth(depth, 1.0f);
+  // Fullscreen triangles using results from Pass 1
+  _post.addPasses(_graph, color, depth, frame);
+  _graph.compile();
+  _graph.execute();
   // --- Commit ---
-  cmdBuf->presentDrawable(drawable);
-  cmdBuf->commit();
+  _backend->endFrame();
+
+  if (!_firstFrameLogged) {
+    _firstFrameLogged = true;
+    std::cout << "First frame " << nowMs() - _startMs << " ms after startup"
+              << (_mesh.indexBuffer ? "" : " (placeholder)") << std::endl;
+    const RenderGraph::Stats &graph = _graph.stats();
+    std::cout << "Render graph: " << graph.passes - graph.culledPasses
+              << " passes, " << graph.textures << " offscreen textures ("
+              << graph.allocatedBytes / 1e6 << " MB, "
+              << graph.savedBytes() / 1e6 << " MB saved by aliasing)"
+              << std::endl;
+    std::cout << "Post chain: " << _post.describe() << std::endl;
+  }
 }
 
-void Renderer::buildFirstPassTex() {
-  // Depth texture
-  // Match window size -- make configurable or read window size dynamically
-  int l = 1000, w = 1000;
-  MTL::TextureDescriptor *depthDesc =
-      MTL::TextureDescriptor::texture2DDescriptor(MTL::PixelFormatDepth32Float,
-                                                  l, w, false);
-  depthDesc->setUsage(MTL::TextureUsageRenderTarget);
-  depthDesc->setStorageMode(MTL::StorageModePrivate); // GPU only
-  _depthTexture = _device->newTexture(depthDesc);
-  depthDesc->release();
-
-  // First pass texture
-  MTL::TextureDescriptor *colorDesc =
-      MTL::TextureDescriptor::texture2DDescriptor(MTL::PixelFormatBGRA8Unorm, l,
-                                                  w, false);
-  colorDesc->setUsage(MTL::TextureUsageRenderTarget |
-                      MTL::TextureUsageShaderRead); // Allow Reading!
-  colorDesc->setStorageMode(MTL::StorageModePrivate);
-  _offscreenColorTexture = _device->newTexture(colorDesc);
-  colorDesc->release();
-}
\ No newline at end of file
+// Pass 1's draws: the mesh's selected LOD, culled by range
+void Renderer::drawScene(const Uniforms &u) {
+  _backend->setPipeline(_pipelineState);
+  _frameStats = FrameStats();
+  if (!_mesh.indexBuffer)
+    return;
+  // Positions are already in clip space, which spans 2 units across the
+  // drawable. Coarsest LOD that stays within a pixel of the full mesh.
+  float pixelsPerUnit = _backend->frameWidth() / 2.0f;
+  const LodRange &lod =
+      _mesh.lods[MeshSimplifier::selectLod(_mesh.lods, pixelsPerUnit)];
+  _backend->setVertexBuffer(_mesh.vertexBuffer, 0, 0);
+  _backend->setVertexBytes(&u, sizeof(u), 1);
+  if (usePackedVertices)
+    _backend->setVertexBytes(&_mesh.packedMeshInfo,
+                             sizeof(_mesh.packedMeshInfo), 2);
+
+  // Cull the LOD's ranges against the view. The rotation is the whole
+  // transform (no projection yet), so it stands in for view * proj.
+  static const float identity[4][4] = {
+      {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+  size_t visible =
+      FrustumCuller::cull(lod.bounds, u.rotationMatrix, identity, _visible);
+  _frameStats.visibleRanges = visible;
+  _frameStats.culledRanges = lod.ranges.size() - visible;
+  // One draw per run of visible ranges; they're adjacent in the buffer
+  for (size_t i = 0; i < lod.ranges.size();) {
+    if (!_visible[i] || lod.ranges[i].indexCount == 0) {
+      i++;
+      continue;
+    }
+    size_t offset = lod.ranges[i].indexOffset, count = 0;
+    for (; i < lod.ranges.size() && _visible[i]; i++)
+      count += lod.ranges[i].indexCount;
+    _backend->drawIndexed(count, _mesh.indexType, _mesh.indexBuffer, offset);
+    _frameStats.visibleTriangles += count / 3;
+    _frameStats.drawCalls++;
+  }
+}
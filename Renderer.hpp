@@ -1,32 +1,94 @@
 #pragma once
-#include <Foundation/Foundation.hpp>
-#include <Metal/Metal.hpp>
-#include <QuartzCore/QuartzCore.hpp> // For CA::MetalLayer
+#include <cstdint>
 #include <vector>
 
+#include "AssetLoader.hpp"
+#include "FrustumCuller.hpp"
+#include "PackedVertex.hpp"
+#include "PostProcessor.hpp"
+#include "RenderBackend.hpp"
+#include "RenderGraph.hpp"
+
+struct MeshAsset;
+struct Uniforms;
+
+// The scene and the frame: what to draw and in which passes, written
+// against RenderBackend (MetalBackend in the app, CpuBackend headless).
+// The backend has to outlive the Renderer.
 class Renderer {
 public:
-  Renderer(MTL::Device *device);
+  Renderer(RenderBackend *backend);
   ~Renderer();
 
-  void draw(CA::MetalLayer *layer);
+  void draw();
+
+  // What the last draw() sent to the GPU, after frustum culling of the
+  // selected LOD's MeshRanges.
+  struct FrameStats {
+    size_t visibleRanges = 0;
+    size_t culledRanges = 0;
+    size_t visibleTriangles = 0;
+    size_t drawCalls = 0;
+  };
+  const FrameStats &frameStats() const { return _frameStats; }
+  // The loaded mesh has replaced the placeholder
+  bool meshLoaded() const { return bool(_mesh.indexBuffer); }
 
 private:
-  MTL::Device *_device;
-  MTL::CommandQueue *_commandQueue;
-  MTL::RenderPipelineState *_pipelineState;
-  MTL::RenderPipelineState *_postPipelineState; // Pipeline for pass 2
-  MTL::DepthStencilState *_depthStencilState;
+  RenderBackend *_backend;
+  PipelineHandle _pipelineState; // Pass 1's
+
+  // The frame's passes, rebuilt every draw(); it also owns pass 1's
+  // offscreen colour and depth textures, sized to the drawable
+  RenderGraph _graph;
+  PostProcessor _post; // Pass 2 onwards, with its own pipelines
+
+  // One MeshRange of a LOD in GpuMesh::indexBuffer
+  struct DrawRange {
+    size_t indexOffset = 0; // bytes
+    size_t indexCount = 0;
+  };
 
-  MTL::Texture *_offscreenColorTexture; // Hold output of pass 1.
-  MTL::Texture *_depthTexture;          // Cheat temp depth tex.
-  MTL::Buffer *_vertexBuffer;
-  int _vertexCount;
+  // One level of detail in GpuMesh::indexBuffer (see MeshSimplifier). Its
+  // ranges are back to back in index order, with their bounds alongside
+  // for the culler.
+  struct LodRange {
+    size_t indexOffset = 0; // bytes
+    size_t indexCount = 0;
+    float error = 0;
+    std::vector<DrawRange> ranges;
+    BoundsSoA bounds;
+  };
+
+  struct GpuMesh {
+    BufferHandle vertexBuffer;
+    size_t vertexCount = 0;
+    BufferHandle indexBuffer; // Every LOD, back to back
+    IndexType indexType = IndexType::UInt32;
+    PackedMeshInfo packedMeshInfo = {}; // Only used with packed vertices
+    std::vector<LodRange> lods;
+  };
+  // What draw() renders. Starts empty (the placeholder: just the clear
+  // colour) and is swapped for the loaded mesh between two frames.
+  GpuMesh _mesh;
+  AssetSlot<GpuMesh> _loadedMesh; // Filled by the _loader thread
 
   float _angleDelta;
   float _angle;
 
+  FrameStats _frameStats;
+  std::vector<uint8_t> _visible; // FrustumCuller output, reused per frame
+
+  // Time to first frame / to the real mesh, from the constructor
+  double _startMs;
+  bool _firstFrameLogged = false;
+
+  // Last, so it's destroyed (and its thread joined) first
+  AssetLoader _loader;
+
   void buildShaders();
   void buildBuffers();
-  void buildFirstPassTex();
+  GpuMesh uploadMesh(const MeshAsset &asset);
+  void releaseMesh(GpuMesh &mesh);
+  void drawScene(const Uniforms &u);
 };
\ No newline at end of file
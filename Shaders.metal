@@ -31,6 +31,45 @@ vertex VertexOut vertex_main(device const VertexIn* vertices [[buffer(0)]], // R
     return out;
 }
 
+// Packed alternative to VertexIn, matches "PackedVertex" in PackedVertex.hpp.
+// 16 bytes instead of 48; vertex_main_packed decodes it.
+struct PackedVertexIn {
+    ushort4 position; // unorm16 within the mesh bounds, w unused
+    uint normal;      // octahedral, snorm16 x2
+    uint color;       // unorm8 x4
+};
+
+// Matches "PackedMeshInfo": position = boundsMin + unorm * boundsExtent
+struct PackedMeshInfo {
+    float4 boundsMin;
+    float4 boundsExtent;
+};
+
+// Octahedral unfold, same math as VertexPacker::decodeOctahedral
+static float3 decode_octahedral(float2 e) {
+    float3 n = float3(e, 1.0 - fabs(e.x) - fabs(e.y));
+    if (n.z < 0) {
+        float2 s = select(float2(-1.0), float2(1.0), n.xy >= 0);
+        n.xy = (1.0 - fabs(n.yx)) * s;
+    }
+    return normalize(n);
+}
+
+vertex VertexOut vertex_main_packed(device const PackedVertexIn* vertices [[buffer(0)]],
+                                    constant Uniforms &uniforms        [[buffer(1)]],
+                                    constant PackedMeshInfo &mesh      [[buffer(2)]],
+                                    uint vertexId                      [[vertex_id]])
+{
+    PackedVertexIn v = vertices[vertexId];
+    VertexOut out;
+    float3 pos = mesh.boundsMin.xyz + float3(v.position.xyz) / 65535.0 * mesh.boundsExtent.xyz;
+    out.position = uniforms.rotationMatrix * float4(pos, 1.0);
+    float3 normal = decode_octahedral(unpack_snorm2x16_to_float(v.normal));
+    out.normal = (uniforms.rotationMatrix * float4(normal, 0.0)).xyz;
+    out.color = unpack_unorm4x8_to_float(v.color);
+    return out;
+}
+
 fragment float4 fragment_main(VertexOut in [[stage_in]]) {
     float3 normal = normalize(in.normal);
     float3 lightDir = normalize(float3(1.0, 1.0, 1.0));
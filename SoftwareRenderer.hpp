@@ -0,0 +1,1289 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MeshLoader.hpp"
+#include "PackedVertex.hpp"
+#include "Parallel.hpp"
+#include "Uniforms.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Headless CPU version of Renderer's two passes, so frames can be rendered,
+// compared and timed on machines without Metal. Follows Shaders.metal:
+//   pass 1: vertex_main / vertex_main_packed, then fragment_main's diffuse
+//           lighting into a BGRA8 colour target and a Depth32F target
+//           (cleared to (0.1, 0.1, 0.1, 1) and 1.0, depth test Less)
+//   pass 2: post_fragment_main's depth Laplacian edge composite, sampling
+//           both targets bilinearly with clamp to edge, into frame()
+// Rasterization follows the usual GPU rules: pixel centres at +0.5,
+// 4 bits of subpixel precision, top-left fill rule, no face culling
+// (Renderer doesn't set a cull mode). Triangles are clipped against the
+// view volume (Metal's clip z is 0..w), and varyings are interpolated
+// perspective-correct.
+//
+// Draws are sort-middle, with no locks anywhere:
+//   1. vertices are transformed in even slices, one per thread
+//   2. triangles are split into one contiguous chunk per thread; each
+//      thread clips and sets up its own and bins them into kTileSize
+//      square screen tiles, in lists of its own
+//   3. threads take whole tiles off a shared counter, copy the tile's
+//      colour and depth into a small buffer of their own, rasterize,
+//      depth-test and shade every binned triangle into it, and copy it
+//      back
+// A tile walks the chunks' bins in chunk order, so every pixel sees its
+// triangles in submission order and the image is the same at any thread
+// count.
+class SoftwareRenderer {
+public:
+  // Since the last beginFrame()
+  struct Stats {
+    size_t triangles = 0; // Submitted
+    size_t clipped = 0;   // That needed clipping (or were clipped away)
+    size_t fragments = 0; // Covered pixels that reached the depth test
+    size_t shaded = 0;    // That passed it
+    size_t blocks = 0;      // kBlockSize blocks visited by the SIMD kernel
+    size_t emptyBlocks = 0; // Skipped without touching a pixel
+    // Hierarchical Z (SIMD kernel only)
+    size_t tileTriangles = 0;  // Triangle-tile pairs the SIMD kernel saw
+    size_t hiZTriangles = 0;   // Of those, dropped as behind the whole tile
+    size_t hiZBlocks = 0;      // Blocks dropped as behind everything in them
+    size_t hiZFrontBlocks = 0; // Blocks in front of everything in them
+
+    void add(const Stats &o) {
+      triangles += o.triangles;
+      clipped += o.clipped;
+      fragments += o.fragments;
+      shaded += o.shaded;
+      blocks += o.blocks;
+      emptyBlocks += o.emptyBlocks;
+      tileTriangles += o.tileTriangles;
+      hiZTriangles += o.hiZTriangles;
+      hiZBlocks += o.hiZBlocks;
+      hiZFrontBlocks += o.hiZFrontBlocks;
+    }
+  };
+
+  // threads: 0 = all cores
+  explicit SoftwareRenderer(int width = 1000, int height = 1000,
+                            unsigned threads = 0)
+      : _width(width), _height(height), _color(size_t(width) * height),
+        _depth(size_t(width) * height), _frame(size_t(width) * height),
+        _tilesX((width + kTileSize - 1) / kTileSize),
+        _tilesY((height + kTileSize - 1) / kTileSize),
+        _blocksX((width + kBlockSize - 1) / kBlockSize),
+        _blocksY((height + kBlockSize - 1) / kBlockSize),
+        _blockMin(size_t(_blocksX) * _blocksY),
+        _blockMax(size_t(_blocksX) * _blocksY) {
+    setThreads(threads);
+  }
+
+  int width() const { return _width; }
+  int height() const { return _height; }
+  unsigned threads() const { return _threads; }
+  // The renderer's threads, for other per-frame work on its targets (see
+  // CpuBackend's generated post passes)
+  parallel::WorkerPool &pool() { return *_pool; }
+
+  void setThreads(unsigned threads) {
+    threads = parallel::threadCount(threads);
+    if (!_pool || _pool->threads() != threads)
+      _pool.reset(new parallel::WorkerPool(threads));
+    _threads = threads;
+    _workers.resize(threads);
+    for (Worker &w : _workers)
+      w.bins.resize(size_t(_tilesX) * _tilesY);
+  }
+
+  // SIMD kernels (the default where there are any) or the scalar
+  // per-pixel references, for the scene pass and for postProcess().
+  // Both give identical pixels.
+  void setSimd(bool simd) { _simd = simd; }
+  bool simd() const { return _simd; }
+
+  // Hierarchical Z: bounds on the nearest and furthest depth in every
+  // kBlockSize block, kept up to date as triangles land. The SIMD kernel
+  // skips a triangle that's behind a whole tile, or the part of it behind
+  // a whole block, and skips the depth test where it's in front of one.
+  // On by default; it never changes the image.
+  void setHiZ(bool hiZ) { _hiZ = hiZ; }
+  bool hiZ() const { return _hiZ; }
+
+  // Pass 1's clear.
+  void beginFrame() {
+    clearColor(packColor(0.1f, 0.1f, 0.1f, 1.0f));
+    clearDepth(1.0f);
+    _stats = Stats();
+  }
+
+  // The two halves of beginFrame()'s clear, with any value, for backends
+  // that take clears from a pass description.
+  void clearColor(uint32_t bgra) {
+    std::fill(_color.begin(), _color.end(), bgra);
+  }
+  void clearDepth(float depth) {
+    std::fill(_depth.begin(), _depth.end(), depth);
+    std::fill(_blockMin.begin(), _blockMin.end(), depth);
+    std::fill(_blockMax.begin(), _blockMax.end(), depth);
+  }
+  void resetStats() { _stats = Stats(); }
+
+  // Trade a target for the caller's, which must be width() * height(), so
+  // a backend can keep its own textures and lend them to the renderer for
+  // a pass (see CpuBackend). Depth that comes in without a clearDepth()
+  // needs a rebuildHiZ() before anything is drawn against it.
+  void swapColor(std::vector<uint32_t> &color) { _color.swap(color); }
+  void swapDepth(std::vector<float> &depth) { _depth.swap(depth); }
+  void swapFrame(std::vector<uint32_t> &frame) { _frame.swap(frame); }
+
+  // Recompute every block's nearest and furthest depth from depth().
+  void rebuildHiZ() {
+    forSlices(size_t(_blocksY), [&](unsigned, size_t b0, size_t b1) {
+      for (size_t by = b0; by < b1; by++) {
+        for (int bx = 0; bx < _blocksX; bx++) {
+          int x0 = bx * kBlockSize, y0 = int(by) * kBlockSize;
+          int x1 = std::min(x0 + kBlockSize, _width);
+          int y1 = std::min(y0 + kBlockSize, _height);
+          float lo = 1.0f, hi = 0.0f;
+          for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+              lo = std::min(lo, _depth[size_t(y) * _width + x]);
+              hi = std::max(hi, _depth[size_t(y) * _width + x]);
+            }
+          }
+          _blockMin[by * _blocksX + bx] = lo;
+          _blockMax[by * _blocksX + bx] = hi;
+        }
+      }
+    });
+  }
+
+  // Pass 1 draws, as vertex_main (48-byte Vertex) ...
+  void drawIndexed(const Vertex *vertices, size_t vertexCount,
+                   const uint32_t *indices, size_t indexCount,
+                   const Uniforms &u) {
+    _transformed.resize(vertexCount);
+    forSlices(vertexCount, [&](unsigned, size_t i0, size_t i1) {
+      for (size_t i = i0; i < i1; i++)
+        vertexMain(vertices[i], u, _transformed[i]);
+    });
+    drawTransformed(indices, indexCount);
+  }
+
+  // ... or as vertex_main_packed (PackedVertex + PackedMeshInfo).
+  void drawIndexed(const PackedVertex *vertices, size_t vertexCount,
+                   const PackedMeshInfo &info, const uint32_t *indices,
+                   size_t indexCount, const Uniforms &u) {
+    _transformed.resize(vertexCount);
+    forSlices(vertexCount, [&](unsigned, size_t i0, size_t i1) {
+      for (size_t i = i0; i < i1; i++)
+        vertexMain(VertexPacker::unpackVertex(vertices[i], info), u,
+                   _transformed[i]);
+    });
+    drawTransformed(indices, indexCount);
+  }
+
+  // Pass 2 into frame(): post_fragment_main's edge term and composite,
+  // fused into one pass over the targets. The neighbours are one texel
+  // away at any size, where the shader's fixed 0.001 uv step is only one
+  // texel at 1000 wide; at the same size the two agree to within rounding
+  // (see postProcessReference()). Bands of rows go to the threads, and
+  // each walks its band in kPostColumns wide strips so the three depth
+  // rows it reads stay in L1.
+  void postProcess() {
+    forSlices(size_t(_height), [&](unsigned, size_t y0, size_t y1) {
+      for (int x0 = 0; x0 < _width; x0 += kPostColumns) {
+        int x1 = std::min(x0 + kPostColumns, _width);
+        for (size_t y = y0; y < y1; y++)
+          edgeRow(int(y), x0, x1);
+      }
+    });
+  }
+
+  // post_fragment_main as the shader has it: bilinear samples at the
+  // fixed 0.001 uv offset, one pixel at a time. What postProcess() is
+  // checked against.
+  void postProcessReference() {
+    // The shader's fixed 1/1000 uv step (see post_fragment_main)
+    const float offset = 0.001f;
+    for (int y = 0; y < _height; y++) {
+      for (int x = 0; x < _width; x++) {
+        float u = (x + 0.5f) / _width, v = (y + 0.5f) / _height;
+        float c[4];
+        sampleColor(u, v, c);
+        float depth = sampleDepth(u, v);
+        float depthDiff = std::fabs(depth - sampleDepth(u - offset, v)) +
+                          std::fabs(depth - sampleDepth(u + offset, v)) +
+                          std::fabs(depth - sampleDepth(u, v - offset)) +
+                          std::fabs(depth - sampleDepth(u, v + offset));
+        float edge = smoothstep(0.0f, kEdgeSensitivity, depthDiff);
+        edge = edge * edge;
+        _frame[size_t(y) * _width + x] =
+            packColor(c[0] + edge, c[1] + edge, c[2] + edge, c[3] + 1.0f);
+      }
+    }
+  }
+
+  // BGRA8, pass 1's colour target
+  const std::vector<uint32_t> &color() const { return _color; }
+  const std::vector<float> &depth() const { return _depth; }
+  // BGRA8, pass 2's output (what Renderer presents)
+  const std::vector<uint32_t> &frame() const { return _frame; }
+  const Stats &stats() const { return _stats; }
+
+  // Binary PPM (P6), alpha dropped. Any image viewer opens it and it needs
+  // no library.
+  static bool writePpm(const std::string &path, const uint32_t *bgra,
+                       int width, int height) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+      return false;
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(size_t(width) * 3);
+    bool ok = true;
+    for (int y = 0; y < height && ok; y++) {
+      for (int x = 0; x < width; x++) {
+        uint32_t p = bgra[size_t(y) * width + x];
+        row[3 * x + 0] = uint8_t(p >> 16);
+        row[3 * x + 1] = uint8_t(p >> 8);
+        row[3 * x + 2] = uint8_t(p);
+      }
+      ok = fwrite(row.data(), 1, row.size(), f) == row.size();
+    }
+    return fclose(f) == 0 && ok;
+  }
+
+  // Reads back what writePpm wrote (P6, maxval 255, no comments), with
+  // alpha set to 255. Returns false on anything else.
+  static bool readPpm(const std::string &path, std::vector<uint32_t> &bgra,
+                      int &width, int &height) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+    int maxval = 0;
+    bool ok = fscanf(f, "P6 %d %d %d", &width, &height, &maxval) == 3 &&
+              maxval == 255 && width > 0 && height > 0 && fgetc(f) != EOF;
+    std::vector<uint8_t> row(ok ? size_t(width) * 3 : 0);
+    if (ok)
+      bgra.resize(size_t(width) * height);
+    for (int y = 0; y < height && ok; y++) {
+      ok = fread(row.data(), 1, row.size(), f) == row.size();
+      for (int x = 0; x < width && ok; x++)
+        bgra[size_t(y) * width + x] = uint32_t(row[3 * x + 2]) |
+                                      uint32_t(row[3 * x + 1]) << 8 |
+                                      uint32_t(row[3 * x]) << 16 | 0xff000000u;
+    }
+    fclose(f);
+    return ok;
+  }
+
+  static uint32_t packColor(float r, float g, float b, float a) {
+    return uint32_t(toUnorm8(b)) | uint32_t(toUnorm8(g)) << 8 |
+           uint32_t(toUnorm8(r)) << 16 | uint32_t(toUnorm8(a)) << 24;
+  }
+
+  static const int kSubpixelBits = 4;
+  // 64x64 colour + depth is 32 KB, which stays in L1/L2 while it's shaded
+  static const int kTileSize = 64;
+  static const int kBlockSize = 8;
+  // postProcess() column strip: 3 rows of depth at 1024 wide is 12 KB
+  static const int kPostColumns = 1024;
+  // post_fragment_main's edgeSensitivity
+  static constexpr float kEdgeSensitivity = 0.05f;
+
+private:
+#if defined(__AVX2__)
+  // The handful of vector operations shadeBlock() needs, 8 lanes of AVX2,
+  // 4 of SSE2 or 4 of NEON. M is a per-lane mask. AVX2 needs -mavx2 (make
+  // bench-avx2 / cpu-avx2); leave out FMA, whose contractions would change
+  // the scalar kernel's bits.
+  struct Lanes {
+    static const int kWidth = 8;
+    typedef __m256 F;
+    typedef __m256i I;
+    typedef __m256 M;
+    static F set(float x) { return _mm256_set1_ps(x); }
+    static I seti(int32_t x) { return _mm256_set1_epi32(x); }
+    static F load(const float *p) { return _mm256_loadu_ps(p); }
+    static I loadi(const void *p) {
+      return _mm256_loadu_si256(static_cast<const __m256i *>(p));
+    }
+    static void store(float *p, F x) { _mm256_storeu_ps(p, x); }
+    static void storei(void *p, I x) {
+      _mm256_storeu_si256(static_cast<__m256i *>(p), x);
+    }
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F min(F a, F b) { return _mm256_min_ps(a, b); }
+    static F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I subi(I a, I b) { return _mm256_sub_epi32(a, b); }
+    static I ori(I a, I b) { return _mm256_or_si256(a, b); }
+    static I andi(I a, I b) { return _mm256_and_si256(a, b); }
+    template <int n> static I shl(I a) { return _mm256_slli_epi32(a, n); }
+    template <int n> static I shr(I a) { return _mm256_srli_epi32(a, n); }
+    static F abs(F a) { return _mm256_andnot_ps(set(-0.0f), a); }
+    static F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+    static I round(F a) { return _mm256_cvtps_epi32(a); } // Nearest even
+    static M lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static M nonNegative(I a) {
+      return _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, seti(-1)));
+    }
+    static M mand(M a, M b) { return _mm256_and_ps(a, b); }
+    static F select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+    static I selecti(M m, I a, I b) {
+      return _mm256_castps_si256(_mm256_blendv_ps(
+          _mm256_castsi256_ps(b), _mm256_castsi256_ps(a), m));
+    }
+    static unsigned bits(M m) { return unsigned(_mm256_movemask_ps(m)); }
+  };
+#elif defined(__SSE2__)
+  struct Lanes {
+    static const int kWidth = 4;
+    typedef __m128 F;
+    typedef __m128i I;
+    typedef __m128 M;
+    static F set(float x) { return _mm_set1_ps(x); }
+    static I seti(int32_t x) { return _mm_set1_epi32(x); }
+    static F load(const float *p) { return _mm_loadu_ps(p); }
+    static I loadi(const void *p) {
+      return _mm_loadu_si128(static_cast<const __m128i *>(p));
+    }
+    static void store(float *p, F x) { _mm_storeu_ps(p, x); }
+    static void storei(void *p, I x) {
+      _mm_storeu_si128(static_cast<__m128i *>(p), x);
+    }
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm_div_ps(a, b); }
+    static F min(F a, F b) { return _mm_min_ps(a, b); }
+    static F max(F a, F b) { return _mm_max_ps(a, b); }
+    static F sqrt(F a) { return _mm_sqrt_ps(a); }
+    static I addi(I a, I b) { return _mm_add_epi32(a, b); }
+    static I subi(I a, I b) { return _mm_sub_epi32(a, b); }
+    static I ori(I a, I b) { return _mm_or_si128(a, b); }
+    static I andi(I a, I b) { return _mm_and_si128(a, b); }
+    template <int n> static I shl(I a) { return _mm_slli_epi32(a, n); }
+    template <int n> static I shr(I a) { return _mm_srli_epi32(a, n); }
+    static F abs(F a) { return _mm_andnot_ps(set(-0.0f), a); }
+    static F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+    static I round(F a) { return _mm_cvtps_epi32(a); } // Nearest even
+    static M lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static M nonNegative(I a) {
+      return _mm_castsi128_ps(_mm_cmpgt_epi32(a, seti(-1)));
+    }
+    static M mand(M a, M b) { return _mm_and_ps(a, b); }
+    static F select(M m, F a, F b) {
+      return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+    }
+    static I selecti(M m, I a, I b) {
+      return _mm_castps_si128(
+          select(m, _mm_castsi128_ps(a), _mm_castsi128_ps(b)));
+    }
+    static unsigned bits(M m) { return unsigned(_mm_movemask_ps(m)); }
+  };
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  struct Lanes {
+    static const int kWidth = 4;
+    typedef float32x4_t F;
+    typedef int32x4_t I;
+    typedef uint32x4_t M;
+    static F set(float x) { return vdupq_n_f32(x); }
+    static I seti(int32_t x) { return vdupq_n_s32(x); }
+    static F load(const float *p) { return vld1q_f32(p); }
+    static I loadi(const void *p) {
+      return vld1q_s32(static_cast<const int32_t *>(p));
+    }
+    static void store(float *p, F x) { vst1q_f32(p, x); }
+    static void storei(void *p, I x) { vst1q_s32(static_cast<int32_t *>(p), x); }
+    static F add(F a, F b) { return vaddq_f32(a, b); }
+    static F sub(F a, F b) { return vsubq_f32(a, b); }
+    static F mul(F a, F b) { return vmulq_f32(a, b); }
+    static F div(F a, F b) { return vdivq_f32(a, b); }
+    static F min(F a, F b) { return vminq_f32(a, b); }
+    static F max(F a, F b) { return vmaxq_f32(a, b); }
+    static F sqrt(F a) { return vsqrtq_f32(a); }
+    static I addi(I a, I b) { return vaddq_s32(a, b); }
+    static I subi(I a, I b) { return vsubq_s32(a, b); }
+    static I ori(I a, I b) { return vorrq_s32(a, b); }
+    static I andi(I a, I b) { return vandq_s32(a, b); }
+    template <int n> static I shl(I a) { return vshlq_n_s32(a, n); }
+    template <int n> static I shr(I a) {
+      return vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), n));
+    }
+    static F abs(F a) { return vabsq_f32(a); }
+    static F toFloat(I a) { return vcvtq_f32_s32(a); }
+    static I round(F a) { return vcvtnq_s32_f32(a); } // Nearest even
+    static M lt(F a, F b) { return vcltq_f32(a, b); }
+    static M nonNegative(I a) { return vcgezq_s32(a); }
+    static M mand(M a, M b) { return vandq_u32(a, b); }
+    static F select(M m, F a, F b) { return vbslq_f32(m, a, b); }
+    static I selecti(M m, I a, I b) { return vbslq_s32(m, a, b); }
+    static unsigned bits(M m) {
+      const uint32_t weights[4] = {1, 2, 4, 8};
+      return vaddvq_u32(vandq_u32(m, vld1q_u32(weights)));
+    }
+  };
+#endif
+
+  // VertexOut: clip position and the two varyings
+  struct ClipVertex {
+    float position[4];
+    float normal[3];
+    float color[4];
+  };
+
+  // A vertex after the viewport transform, ready for edge setup
+  struct ScreenVertex {
+    int64_t x, y;   // Fixed point, kSubpixelBits
+    float z;        // NDC depth, 0..1
+    float invW;     // For perspective-correct varyings
+    float normal[3]; // Pre-divided by w
+    float color[4];  // Pre-divided by w
+  };
+
+  // A triangle ready to rasterize: wound so its area is positive, with its
+  // covered pixel range (inclusive, inside the target).
+  struct TriangleSetup {
+    ScreenVertex v[3];
+    float invArea;
+    float zMin, zMax; // Over the vertices
+    int x0, y0, x1, y1;
+  };
+
+  // One per thread. Binning writes triangles/bins; rastering reads every
+  // worker's bins and writes only its own tile buffers and stats.
+  struct Worker {
+    std::vector<TriangleSetup> triangles;
+    std::vector<std::vector<uint32_t>> bins; // Per tile, into triangles
+    std::vector<uint32_t> tileColor;
+    std::vector<float> tileDepth;
+    size_t smallTriangles = 0; // Binned ones with kSmallTriangle boxes
+    Stats stats;
+  };
+
+  int _width, _height;
+  std::vector<uint32_t> _color;
+  std::vector<float> _depth;
+  std::vector<uint32_t> _frame;
+  std::vector<ClipVertex> _transformed;
+  Stats _stats;
+  int _tilesX, _tilesY;
+  unsigned _threads = 1;
+  std::vector<Worker> _workers;
+  // Kept across frames: binning, raster and post each fork every frame
+  std::unique_ptr<parallel::WorkerPool> _pool;
+  bool _simd = true;
+  // Hierarchical Z, per kBlockSize block. Only the worker holding a tile
+  // touches its blocks.
+  int _blocksX, _blocksY;
+  std::vector<float> _blockMin, _blockMax;
+  bool _hiZ = true;
+
+  static void vertexMain(const Vertex &v, const Uniforms &u, ClipVertex &out) {
+    const float(*m)[4] = u.rotationMatrix; // m[column][row]
+    for (int r = 0; r < 4; r++) {
+      out.position[r] = m[0][r] * v.position[0] + m[1][r] * v.position[1] +
+                        m[2][r] * v.position[2] + m[3][r] * v.position[3];
+    }
+    for (int r = 0; r < 3; r++) {
+      out.normal[r] = m[0][r] * v.normal[0] + m[1][r] * v.normal[1] +
+                      m[2][r] * v.normal[2] + m[3][r] * v.normal[3];
+    }
+    for (int k = 0; k < 4; k++)
+      out.color[k] = v.color[k];
+  }
+
+  // fragment_main
+  static uint32_t fragmentMain(const float n[3], const float color[4]) {
+    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    const float l = 0.57735026f; // normalize(float3(1, 1, 1))
+    float lightIntensity = saturate((n[0] + n[1] + n[2]) * l / len);
+    lightIntensity = smoothstep(0.0f, 1.0f, lightIntensity);
+    return packColor(color[0] * (lightIntensity + 0.1f),
+                     color[1] * (lightIntensity + 0.1f),
+                     color[2] * (lightIntensity + 0.1f), 1.0f);
+  }
+
+  // fn(worker, begin, end) over _threads even slices of [0, n)
+  template <typename Fn> void forSlices(size_t n, Fn &&fn) {
+    _pool->forSlices(n, fn);
+  }
+
+  void drawTransformed(const uint32_t *indices, size_t indexCount) {
+    size_t triangleCount = indexCount / 3;
+    forSlices(triangleCount, [&](unsigned w, size_t t0, size_t t1) {
+      binTriangles(_workers[w], indices, t0, t1);
+    });
+
+    size_t binned = 0, small = 0;
+    for (const Worker &w : _workers) {
+      binned += w.triangles.size();
+      small += w.smallTriangles;
+    }
+    bool blocks = _simd && small * 10 < binned * kSmallDrawTenths;
+
+    std::atomic<size_t> nextTile(0);
+    size_t tileCount = size_t(_tilesX) * _tilesY;
+    forSlices(_threads, [&](unsigned w, size_t, size_t) {
+      for (size_t tile = nextTile++; tile < tileCount; tile = nextTile++)
+        rasterTile(_workers[w], tile, blocks);
+    });
+
+    for (Worker &w : _workers) {
+      _stats.add(w.stats);
+      w.stats = Stats();
+      w.smallTriangles = 0;
+      w.triangles.clear();
+      for (std::vector<uint32_t> &bin : w.bins)
+        bin.clear();
+    }
+  }
+
+  // Clip and set up triangles [t0, t1) and bin them.
+  void binTriangles(Worker &w, const uint32_t *indices, size_t t0,
+                    size_t t1) {
+    for (size_t t = t0; t < t1; t++) {
+      const ClipVertex *tri[3] = {&_transformed[indices[3 * t]],
+                                  &_transformed[indices[3 * t + 1]],
+                                  &_transformed[indices[3 * t + 2]]};
+      w.stats.triangles++;
+      unsigned outside = ~0u, any = 0;
+      for (const ClipVertex *v : tri) {
+        unsigned o = outcode(v->position);
+        any |= o;
+        outside &= o;
+      }
+      if (outside) { // All three beyond one plane
+        w.stats.clipped++;
+        continue;
+      }
+      if (!any) {
+        setupTriangle(w, *tri[0], *tri[1], *tri[2]);
+        continue;
+      }
+      w.stats.clipped++;
+      ClipVertex poly[9];
+      int n = clipTriangle(*tri[0], *tri[1], *tri[2], poly);
+      for (int k = 1; k + 1 < n; k++)
+        setupTriangle(w, poly[0], poly[k], poly[k + 1]);
+    }
+  }
+
+  // The view volume's planes as dot products with (x, y, z, w)
+  static float planeDistance(const float p[4], int plane) {
+    switch (plane) {
+    case 0: return p[3] + p[0];
+    case 1: return p[3] - p[0];
+    case 2: return p[3] + p[1];
+    case 3: return p[3] - p[1];
+    case 4: return p[2];
+    default: return p[3] - p[2];
+    }
+  }
+
+  static unsigned outcode(const float p[4]) {
+    unsigned code = 0;
+    for (int plane = 0; plane < 6; plane++)
+      code |= unsigned(planeDistance(p, plane) < 0.0f) << plane;
+    return code;
+  }
+
+  // Sutherland-Hodgman against each plane in turn; returns the vertex
+  // count of the convex polygon left in out (at most 9).
+  static int clipTriangle(const ClipVertex &a, const ClipVertex &b,
+                          const ClipVertex &c, ClipVertex out[9]) {
+    ClipVertex buf[9];
+    ClipVertex *src = out, *dst = buf;
+    src[0] = a;
+    src[1] = b;
+    src[2] = c;
+    int n = 3;
+    for (int plane = 0; plane < 6 && n > 0; plane++) {
+      int m = 0;
+      for (int i = 0; i < n; i++) {
+        const ClipVertex &p = src[i], &q = src[(i + 1) % n];
+        float dp = planeDistance(p.position, plane);
+        float dq = planeDistance(q.position, plane);
+        if (dp >= 0)
+          dst[m++] = p;
+        if ((dp >= 0) != (dq >= 0))
+          lerp(p, q, dp / (dp - dq), dst[m++]);
+      }
+      std::swap(src, dst);
+      n = m;
+    }
+    if (src != out)
+      std::copy(src, src + n, out);
+    return n;
+  }
+
+  static void lerp(const ClipVertex &p, const ClipVertex &q, float t,
+                   ClipVertex &out) {
+    for (int k = 0; k < 4; k++) {
+      out.position[k] = p.position[k] + t * (q.position[k] - p.position[k]);
+      out.color[k] = p.color[k] + t * (q.color[k] - p.color[k]);
+    }
+    for (int k = 0; k < 3; k++)
+      out.normal[k] = p.normal[k] + t * (q.normal[k] - p.normal[k]);
+  }
+
+  // Metal's viewport transform (y down, depth range 0..1), snapped to the
+  // subpixel grid.
+  ScreenVertex toScreen(const ClipVertex &v) const {
+    ScreenVertex s;
+    float invW = 1.0f / v.position[3];
+    float x = (v.position[0] * invW * 0.5f + 0.5f) * _width;
+    float y = (0.5f - v.position[1] * invW * 0.5f) * _height;
+    s.x = int64_t(std::lrint(x * (1 << kSubpixelBits)));
+    s.y = int64_t(std::lrint(y * (1 << kSubpixelBits)));
+    s.z = v.position[2] * invW;
+    s.invW = invW;
+    for (int k = 0; k < 3; k++)
+      s.normal[k] = v.normal[k] * invW;
+    for (int k = 0; k < 4; k++)
+      s.color[k] = v.color[k] * invW;
+    return s;
+  }
+
+  void setupTriangle(Worker &w, const ClipVertex &c0, const ClipVertex &c1,
+                     const ClipVertex &c2) {
+    TriangleSetup s;
+    s.v[0] = toScreen(c0);
+    s.v[1] = toScreen(c1);
+    s.v[2] = toScreen(c2);
+    int64_t area = orient(s.v[0], s.v[1], s.v[2]);
+    if (area == 0)
+      return;
+    if (area < 0) { // Either winding is drawn; make it positive
+      std::swap(s.v[1], s.v[2]);
+      area = -area;
+    }
+    s.invArea = 1.0f / float(area);
+    s.zMin = std::min({s.v[0].z, s.v[1].z, s.v[2].z});
+    s.zMax = std::max({s.v[0].z, s.v[1].z, s.v[2].z});
+
+    // Pixel range whose centres fall in the bounding box
+    const int64_t half = 1 << (kSubpixelBits - 1), one = 1 << kSubpixelBits;
+    const ScreenVertex *v = s.v;
+    int64_t minX = std::min({v[0].x, v[1].x, v[2].x});
+    int64_t maxX = std::max({v[0].x, v[1].x, v[2].x});
+    int64_t minY = std::min({v[0].y, v[1].y, v[2].y});
+    int64_t maxY = std::max({v[0].y, v[1].y, v[2].y});
+    s.x0 = int(std::max<int64_t>(0, ceilDiv(minX - half, one)));
+    s.x1 = int(std::min<int64_t>(_width - 1, floorDiv(maxX - half, one)));
+    s.y0 = int(std::max<int64_t>(0, ceilDiv(minY - half, one)));
+    s.y1 = int(std::min<int64_t>(_height - 1, floorDiv(maxY - half, one)));
+    if (s.x0 > s.x1 || s.y0 > s.y1)
+      return;
+
+    uint32_t id = uint32_t(w.triangles.size());
+    w.triangles.push_back(s);
+    w.smallTriangles +=
+        (s.x1 - s.x0 + 1) * (s.y1 - s.y0 + 1) <= kSmallTriangle;
+    int tx0 = s.x0 / kTileSize, tx1 = s.x1 / kTileSize;
+    int ty0 = s.y0 / kTileSize, ty1 = s.y1 / kTileSize;
+    bool single = tx0 == tx1 && ty0 == ty1;
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = tx0; tx <= tx1; tx++) {
+        if (single || touchesTile(s, tx, ty))
+          w.bins[size_t(ty) * _tilesX + tx].push_back(id);
+      }
+    }
+  }
+
+  // False when one edge leaves every pixel centre of the tile outside, so
+  // long thin triangles don't land in every tile their box crosses.
+  bool touchesTile(const TriangleSetup &s, int tx, int ty) const {
+    int px0 = tx * kTileSize, py0 = ty * kTileSize;
+    int px1 = std::min(px0 + kTileSize, _width) - 1;
+    int py1 = std::min(py0 + kTileSize, _height) - 1;
+    for (int k = 0; k < 3; k++) {
+      Edge e = edge(s, k);
+      // The corner furthest along the edge's inside direction
+      int px = e.stepX > 0 ? px1 : px0, py = e.stepY > 0 ? py1 : py0;
+      if (e.at(px, py) + e.bias < 0)
+        return false;
+    }
+    return true;
+  }
+
+  // Edge k is the one opposite vertex k; inside when at(px, py) >= 0, with
+  // at() stepping -dy per pixel in x and +dx per pixel in y. The bias
+  // makes pixels exactly on a right or bottom edge fall outside.
+  struct Edge {
+    int64_t ax, ay, dx, dy, stepX, stepY, bias;
+
+    int64_t at(int px, int py) const {
+      const int64_t one = 1 << kSubpixelBits, half = one / 2;
+      return dx * (int64_t(py) * one + half - ay) -
+             dy * (int64_t(px) * one + half - ax);
+    }
+  };
+
+  static Edge edge(const TriangleSetup &s, int k) {
+    const ScreenVertex &a = s.v[(k + 1) % 3], &b = s.v[(k + 2) % 3];
+    Edge e;
+    e.ax = a.x;
+    e.ay = a.y;
+    e.dx = b.x - a.x;
+    e.dy = b.y - a.y;
+    e.stepX = -e.dy * (1 << kSubpixelBits);
+    e.stepY = e.dx * (1 << kSubpixelBits);
+    bool topLeft = e.dy < 0 || (e.dy == 0 && e.dx > 0);
+    e.bias = topLeft ? 0 : -1;
+    return e;
+  }
+
+  void rasterTile(Worker &w, size_t tile, bool blocks) {
+    int px0 = int(tile % _tilesX) * kTileSize;
+    int py0 = int(tile / _tilesX) * kTileSize;
+    int px1 = std::min(px0 + kTileSize, _width) - 1;
+    int py1 = std::min(py0 + kTileSize, _height) - 1;
+    bool empty = true;
+    for (const Worker &from : _workers)
+      empty = empty && from.bins[tile].empty();
+    if (empty)
+      return;
+
+    int tileW = px1 - px0 + 1, tileH = py1 - py0 + 1;
+    w.tileColor.resize(size_t(kTileSize) * kTileSize);
+    w.tileDepth.resize(size_t(kTileSize) * kTileSize);
+    for (int y = 0; y < tileH; y++) {
+      size_t src = size_t(py0 + y) * _width + px0;
+      std::copy(&_color[src], &_color[src] + tileW,
+                &w.tileColor[size_t(y) * kTileSize]);
+      std::copy(&_depth[src], &_depth[src] + tileW,
+                &w.tileDepth[size_t(y) * kTileSize]);
+    }
+
+    float tileMax = _hiZ && blocks ? blockMax(px0, py0, px1, py1) : 1.0f;
+    float scalarNear = 1.0f; // Nearest vertex rasterScalar() drew
+    bool scalarShaded = false;
+    for (const Worker &from : _workers) {
+      for (uint32_t id : from.bins[tile]) {
+        const TriangleSetup &s = from.triangles[id];
+        if (!blocks) {
+          size_t before = w.stats.shaded;
+          rasterScalar(w, s, px0, py0, px1, py1);
+          if (w.stats.shaded != before) {
+            scalarNear = std::min(scalarNear, s.zMin);
+            scalarShaded = true;
+          }
+          continue;
+        }
+        w.stats.tileTriangles++;
+        if (_hiZ && s.zMin - kHiZEpsilon >= tileMax) {
+          w.stats.hiZTriangles++;
+          continue;
+        }
+        // Depth only ever gets nearer, so tileMax can't grow
+        if (rasterBlocks(w, s, px0, py0, px1, py1) && _hiZ)
+          tileMax = blockMax(px0, py0, px1, py1, tileMax);
+      }
+    }
+
+    // The furthest bounds are still behind everything; the nearest ones
+    // come forward to cover what the scalar kernel drew, once per tile
+    if (_hiZ && scalarShaded) {
+      for (int by = py0 / kBlockSize; by <= py1 / kBlockSize; by++) {
+        for (int bx = px0 / kBlockSize; bx <= px1 / kBlockSize; bx++) {
+          float &lo = _blockMin[size_t(by) * _blocksX + bx];
+          lo = std::min(lo, scalarNear - kHiZEpsilon);
+        }
+      }
+    }
+
+    for (int y = 0; y < tileH; y++) {
+      size_t dst = size_t(py0 + y) * _width + px0;
+      std::copy(&w.tileColor[size_t(y) * kTileSize],
+                &w.tileColor[size_t(y) * kTileSize] + tileW, &_color[dst]);
+      std::copy(&w.tileDepth[size_t(y) * kTileSize],
+                &w.tileDepth[size_t(y) * kTileSize] + tileW, &_depth[dst]);
+    }
+  }
+
+  // Furthest depth over the blocks holding pixels [x0, x1] x [y0, y1].
+  // Stops early on reaching `bound`, when nothing can be further.
+  float blockMax(int x0, int y0, int x1, int y1, float bound = 1.0f) const {
+    float m = 0.0f;
+    for (int by = y0 / kBlockSize; by <= y1 / kBlockSize && m < bound; by++)
+      for (int bx = x0 / kBlockSize; bx <= x1 / kBlockSize; bx++)
+        m = std::max(m, _blockMax[size_t(by) * _blocksX + bx]);
+    return m;
+  }
+
+  // Recompute block (bx, by)'s nearest and furthest depth from w's tile.
+  void updateBlock(const Worker &w, int bx, int by) {
+    int originX = bx / kTileSize * kTileSize;
+    int originY = by / kTileSize * kTileSize;
+    int x1 = std::min(bx + kBlockSize, _width) - 1;
+    int y1 = std::min(by + kBlockSize, _height) - 1;
+    float lo = 1.0f, hi = 0.0f;
+    int x = bx;
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+    if (x1 == bx + kBlockSize - 1) { // Whole rows of lanes
+      Lanes::F vlo = Lanes::set(1.0f), vhi = Lanes::set(0.0f);
+      for (int y = by; y <= y1; y++) {
+        const float *row =
+            &w.tileDepth[size_t(y - originY) * kTileSize + (bx - originX)];
+        for (int i = 0; i < kBlockSize; i += Lanes::kWidth) {
+          vlo = Lanes::min(vlo, Lanes::load(row + i));
+          vhi = Lanes::max(vhi, Lanes::load(row + i));
+        }
+      }
+      float los[Lanes::kWidth], his[Lanes::kWidth];
+      Lanes::store(los, vlo);
+      Lanes::store(his, vhi);
+      for (int i = 0; i < Lanes::kWidth; i++) {
+        lo = std::min(lo, los[i]);
+        hi = std::max(hi, his[i]);
+      }
+      x = x1 + 1;
+    }
+#endif
+    for (int y = by; y <= y1 && x <= x1; y++) {
+      const float *row = &w.tileDepth[size_t(y - originY) * kTileSize];
+      for (int px = x; px <= x1; px++) {
+        lo = std::min(lo, row[px - originX]);
+        hi = std::max(hi, row[px - originX]);
+      }
+    }
+    size_t b = size_t(by / kBlockSize) * _blocksX + bx / kBlockSize;
+    _blockMin[b] = lo;
+    _blockMax[b] = hi;
+  }
+
+  // Interpolated depth can stray this far past the vertices' range from
+  // float rounding; hierarchical Z allows for it, so it stays exact.
+  static constexpr float kHiZEpsilon = 1e-5f;
+  // Bounding boxes up to this many pixels skip the block kernel. Below
+  // about 32 a triangle covers too few lanes of its blocks to pay for
+  // setting them up: a dense grid's 20-30 pixel triangles ran slower
+  // through the kernel than through rasterScalar().
+  static const int kSmallTriangle = 32;
+  // A draw this much made of them (in tenths) goes to rasterScalar()
+  // whole: rasterBlocks() would pass nearly every triangle on to it
+  // anyway, after the hierarchical Z checks and upkeep that cost a dense
+  // grid's LOD 0 a few percent over the scalar kernel and never drop one.
+  static const int kSmallDrawTenths = 9;
+
+  // rasterScalar() over kBlockSize square blocks of the tile. A block
+  // that one edge leaves entirely outside is skipped from its corners
+  // alone, as is one whose nearest depth is behind the triangle; the rest
+  // go through shadeBlock() a row of Lanes at a time. Both give the same
+  // pixels: the edge values are the same integers, just stepped from the
+  // block's corner in 32 bits instead of 64. Returns whether any block's
+  // furthest depth was recomputed.
+  bool rasterBlocks(Worker &w, const TriangleSetup &s, int px0, int py0,
+                    int px1, int py1) {
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+    int x0 = std::max(s.x0, px0), x1 = std::min(s.x1, px1);
+    int y0 = std::max(s.y0, py0), y1 = std::min(s.y1, py1);
+    if (x0 > x1 || y0 > y1)
+      return false;
+    // A few pixels: setting up lanes would cost more than it saves, and
+    // so would rescanning the blocks' depths after every one of a dense
+    // mesh's triangles. The nearest bound just takes the triangle's; the
+    // furthest stays where it was, still behind everything in the block,
+    // until a bigger triangle's updateBlock() tightens it again.
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) <= kSmallTriangle) {
+      size_t before = w.stats.shaded;
+      rasterScalar(w, s, x0, y0, x1, y1);
+      if (w.stats.shaded == before || !_hiZ)
+        return false;
+      for (int by = y0 / kBlockSize; by <= y1 / kBlockSize; by++) {
+        for (int bx = x0 / kBlockSize; bx <= x1 / kBlockSize; bx++) {
+          float &lo = _blockMin[size_t(by) * _blocksX + bx];
+          lo = std::min(lo, s.zMin - kHiZEpsilon);
+        }
+      }
+      return false; // No furthest depth moved
+    }
+    bool wrote = false;
+    Edge edges[3] = {edge(s, 0), edge(s, 1), edge(s, 2)};
+    BlockSetup t(s, edges);
+    const int last = kBlockSize - 1;
+    const int64_t limit = INT32_MAX - 1;
+    for (int by = y0 & ~last; by <= y1; by += kBlockSize) {
+      for (int bx = x0 & ~last; bx <= x1; bx += kBlockSize) {
+        w.stats.blocks++;
+        bool empty = false, full = true, fits = true;
+        for (const Edge &e : edges) {
+          // Biased edge value over the block's pixel centres
+          int64_t corner = e.at(bx, by) + e.bias;
+          int64_t lo = corner + std::min<int64_t>(0, e.stepX) * last +
+                       std::min<int64_t>(0, e.stepY) * last;
+          int64_t hi = corner + std::max<int64_t>(0, e.stepX) * last +
+                       std::max<int64_t>(0, e.stepY) * last;
+          empty = empty || hi < 0;
+          full = full && lo >= 0;
+          fits = fits && lo > -limit && hi < limit;
+        }
+        if (empty) {
+          w.stats.emptyBlocks++;
+          continue;
+        }
+        size_t b = size_t(by / kBlockSize) * _blocksX + bx / kBlockSize;
+        bool front = false;
+        if (_hiZ) {
+          if (s.zMin - kHiZEpsilon >= _blockMax[b]) {
+            w.stats.hiZBlocks++;
+            continue;
+          }
+          front = s.zMax + kHiZEpsilon < _blockMin[b];
+          w.stats.hiZFrontBlocks += front;
+        }
+        // Only far outside 1000x1000 can a block's values need 64 bits
+        bool shaded;
+        if (!fits) {
+          size_t before = w.stats.shaded;
+          rasterScalar(w, s, bx, by, bx + last, by + last);
+          shaded = w.stats.shaded != before;
+        } else {
+          shaded = shadeBlock(w, t, edges, bx, by, std::max(x0, bx),
+                              std::max(y0, by), std::min(x1, bx + last),
+                              std::min(y1, by + last), full, front);
+        }
+        if (shaded && _hiZ)
+          updateBlock(w, bx, by);
+        wrote = wrote || shaded;
+      }
+    }
+    return wrote;
+#else
+    size_t before = w.stats.shaded;
+    rasterScalar(w, s, px0, py0, px1, py1);
+    return w.stats.shaded != before;
+#endif
+  }
+
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+  // A triangle's per-lane constants, broadcast once for all its blocks
+  struct BlockSetup {
+    Lanes::I laneX, steps[3], bias[3]; // x offset, stepX * lane, fill bias
+    Lanes::F invArea, z[3], invW[3], n[3][3], c[3][3];
+
+    BlockSetup(const TriangleSetup &s, const Edge edges[3]) {
+      int32_t lanes[Lanes::kWidth], lanesStep[3][Lanes::kWidth];
+      for (int i = 0; i < Lanes::kWidth; i++) {
+        lanes[i] = i;
+        for (int k = 0; k < 3; k++)
+          lanesStep[k][i] = int32_t(edges[k].stepX * i);
+      }
+      laneX = Lanes::loadi(lanes);
+      for (int k = 0; k < 3; k++) {
+        steps[k] = Lanes::loadi(lanesStep[k]);
+        bias[k] = Lanes::seti(int32_t(edges[k].bias));
+      }
+      invArea = Lanes::set(s.invArea);
+      for (int i = 0; i < 3; i++) {
+        z[i] = Lanes::set(s.v[i].z);
+        invW[i] = Lanes::set(s.v[i].invW);
+        for (int k = 0; k < 3; k++) {
+          n[i][k] = Lanes::set(s.v[i].normal[k]);
+          c[i][k] = Lanes::set(s.v[i].color[k]);
+        }
+      }
+    }
+  };
+
+  // shade() for the pixels of block (bx, by) inside [x0, x1] x [y0, y1]
+  // that s covers, Lanes::kWidth at a time. Same operations in the same
+  // order as rasterScalar() and shade(), so the same bits come out.
+  // front: the whole triangle is nearer than the block's nearest depth,
+  // so every covered pixel passes. Returns whether any depth was written.
+  bool shadeBlock(Worker &w, const BlockSetup &t, const Edge edges[3],
+                  int bx, int by, int x0, int y0, int x1, int y1, bool full,
+                  bool front) {
+    typedef Lanes L;
+    const int width = L::kWidth;
+    int originX = bx / kTileSize * kTileSize;
+    int originY = by / kTileSize * kTileSize;
+    // Lane 0's edge values on the first row; they fit 32 bits anywhere in
+    // the block (rasterBlocks() checked)
+    int32_t row[3], stepY[3], stepGroup[3];
+    for (int k = 0; k < 3; k++) {
+      row[k] = int32_t(edges[k].at(bx, y0));
+      stepY[k] = int32_t(edges[k].stepY);
+      stepGroup[k] = int32_t(edges[k].stepX * width);
+    }
+
+    bool wrote = false;
+    for (int y = y0; y <= y1; y++) {
+      float *depthRow = &w.tileDepth[size_t(y - originY) * kTileSize];
+      uint32_t *colorRow = &w.tileColor[size_t(y - originY) * kTileSize];
+      for (int g = 0; g < kBlockSize / width; g++) {
+        int gx = bx + g * width;
+        if (gx > x1 || gx + width - 1 < x0)
+          continue;
+        L::I x = L::addi(L::seti(gx), t.laneX);
+        L::M covered = L::mand(L::nonNegative(L::subi(x, L::seti(x0))),
+                               L::nonNegative(L::subi(L::seti(x1), x)));
+        L::I e[3];
+        for (int k = 0; k < 3; k++) {
+          e[k] = L::addi(L::seti(row[k] + stepGroup[k] * g), t.steps[k]);
+          if (!full)
+            covered = L::mand(covered, L::nonNegative(L::addi(e[k], t.bias[k])));
+        }
+        unsigned mask = L::bits(covered);
+        if (!mask)
+          continue;
+        w.stats.fragments += size_t(__builtin_popcount(mask));
+
+        L::F l0 = L::mul(L::toFloat(e[0]), t.invArea);
+        L::F l1 = L::mul(L::toFloat(e[1]), t.invArea);
+        L::F l2 = L::mul(L::toFloat(e[2]), t.invArea);
+        L::F depth = L::load(depthRow + (gx - originX));
+        L::F zz = L::add(L::add(L::mul(l0, t.z[0]), L::mul(l1, t.z[1])),
+                         L::mul(l2, t.z[2]));
+        L::M pass = front ? covered : L::mand(covered, L::lt(zz, depth));
+        mask = L::bits(pass);
+        if (!mask)
+          continue;
+        wrote = true;
+        w.stats.shaded += size_t(__builtin_popcount(mask));
+        L::store(depthRow + (gx - originX), L::select(pass, zz, depth));
+
+        L::F ww = L::div(L::set(1.0f),
+                         L::add(L::add(L::mul(l0, t.invW[0]), L::mul(l1, t.invW[1])),
+                                L::mul(l2, t.invW[2])));
+        L::F nn[3], cc[3];
+        for (int k = 0; k < 3; k++) {
+          nn[k] = L::mul(L::add(L::add(L::mul(l0, t.n[0][k]), L::mul(l1, t.n[1][k])),
+                                L::mul(l2, t.n[2][k])),
+                         ww);
+          cc[k] = L::mul(L::add(L::add(L::mul(l0, t.c[0][k]), L::mul(l1, t.c[1][k])),
+                                L::mul(l2, t.c[2][k])),
+                         ww);
+        }
+        uint32_t *dst = colorRow + (gx - originX);
+        L::storei(dst, L::selecti(pass, fragmentMain(nn, cc), L::loadi(dst)));
+      }
+      for (int k = 0; k < 3; k++)
+        row[k] += stepY[k];
+    }
+    return wrote;
+  }
+
+  // fragment_main() on Lanes::kWidth fragments, packed to BGRA8
+  static Lanes::I fragmentMain(const Lanes::F n[3], const Lanes::F color[3]) {
+    typedef Lanes L;
+    L::F len = L::sqrt(L::add(L::add(L::mul(n[0], n[0]), L::mul(n[1], n[1])),
+                              L::mul(n[2], n[2])));
+    L::F lightIntensity = saturate(L::div(
+        L::mul(L::add(L::add(n[0], n[1]), n[2]), L::set(0.57735026f)), len));
+    // smoothstep(0, 1, x) on an x already in 0..1
+    lightIntensity = L::mul(
+        L::mul(lightIntensity, lightIntensity),
+        L::sub(L::set(3.0f), L::mul(L::set(2.0f), lightIntensity)));
+    L::F k = L::add(lightIntensity, L::set(0.1f));
+    L::I unorm[3];
+    for (int i = 0; i < 3; i++)
+      unorm[i] = L::round(L::mul(saturate(L::mul(color[i], k)), L::set(255.0f)));
+    return L::ori(L::ori(unorm[2], L::shl<8>(unorm[1])),
+                  L::ori(L::shl<16>(unorm[0]), L::seti(int32_t(0xff000000))));
+  }
+
+  // Same argument order as saturate(), so NaNs come out the same way on x86
+  static Lanes::F saturate(Lanes::F x) {
+    return Lanes::min(Lanes::set(1.0f), Lanes::max(Lanes::set(0.0f), x));
+  }
+#endif
+
+  // The part of s inside pixels [px0, px1] x [py0, py1] (within one tile)
+  // into w's tile buffers, one pixel at a time. The reference for
+  // rasterBlocks(), and its fallback.
+  void rasterScalar(Worker &w, const TriangleSetup &s, int px0, int py0,
+                    int px1, int py1) {
+    int x0 = std::max(s.x0, px0), x1 = std::min(s.x1, px1);
+    int y0 = std::max(s.y0, py0), y1 = std::min(s.y1, py1);
+    if (x0 > x1 || y0 > y1)
+      return;
+    int originX = x0 / kTileSize * kTileSize;
+    int originY = y0 / kTileSize * kTileSize;
+    Edge edges[3] = {edge(s, 0), edge(s, 1), edge(s, 2)};
+    int64_t row[3];
+    for (int k = 0; k < 3; k++)
+      row[k] = edges[k].at(x0, y0);
+
+    for (int y = y0; y <= y1; y++) {
+      int64_t e[3] = {row[0], row[1], row[2]};
+      size_t line = size_t(y - originY) * kTileSize - originX;
+      for (int x = x0; x <= x1; x++) {
+        if ((e[0] + edges[0].bias) >= 0 && (e[1] + edges[1].bias) >= 0 &&
+            (e[2] + edges[2].bias) >= 0) {
+          float l0 = float(e[0]) * s.invArea, l1 = float(e[1]) * s.invArea;
+          float l2 = float(e[2]) * s.invArea;
+          shade(w, s.v, l0, l1, l2, line + x);
+        }
+        for (int k = 0; k < 3; k++)
+          e[k] += edges[k].stepX;
+      }
+      for (int k = 0; k < 3; k++)
+        row[k] += edges[k].stepY;
+    }
+  }
+
+  // Depth test and fragment_main for one covered pixel, given its
+  // screen-space barycentrics; pixel indexes w's tile buffers.
+  static void shade(Worker &w, const ScreenVertex v[3], float l0, float l1,
+                    float l2, size_t pixel) {
+    w.stats.fragments++;
+    float z = l0 * v[0].z + l1 * v[1].z + l2 * v[2].z;
+    if (!(z < w.tileDepth[pixel]))
+      return;
+    w.stats.shaded++;
+    w.tileDepth[pixel] = z;
+    float invW = 1.0f / (l0 * v[0].invW + l1 * v[1].invW + l2 * v[2].invW);
+    float n[3], c[4];
+    for (int k = 0; k < 3; k++)
+      n[k] = (l0 * v[0].normal[k] + l1 * v[1].normal[k] +
+              l2 * v[2].normal[k]) * invW;
+    for (int k = 0; k < 4; k++)
+      c[k] = (l0 * v[0].color[k] + l1 * v[1].color[k] + l2 * v[2].color[k]) *
+             invW;
+    w.tileColor[pixel] = fragmentMain(n, c);
+  }
+
+  static int64_t orient(const ScreenVertex &a, const ScreenVertex &b,
+                        const ScreenVertex &c) {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  }
+
+  static int64_t floorDiv(int64_t a, int64_t b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+  }
+  static int64_t ceilDiv(int64_t a, int64_t b) { return -floorDiv(-a, b); }
+
+  // postProcess() for pixels [x0, x1) of row y. Lanes in the middle, one
+  // at a time at the clamped first and last columns.
+  void edgeRow(int y, int x0, int x1) {
+    const float *row = &_depth[size_t(y) * _width];
+    const float *up = &_depth[size_t(std::max(y - 1, 0)) * _width];
+    const float *down = &_depth[size_t(std::min(y + 1, _height - 1)) * _width];
+    const uint32_t *color = &_color[size_t(y) * _width];
+    uint32_t *out = &_frame[size_t(y) * _width];
+    int x = x0;
+    if (x == 0 && x < x1) {
+      out[0] = edgePixel(row, up, down, color[0], 0);
+      x = 1;
+    }
+#if defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))
+    typedef Lanes L;
+    int end = std::min(x1, _width - 1); // The last column clamps
+    for (; _simd && x + L::kWidth <= end; x += L::kWidth) {
+      L::F d = L::load(row + x);
+      L::F depthDiff = L::add(
+          L::add(L::add(L::abs(L::sub(d, L::load(row + x - 1))),
+                        L::abs(L::sub(d, L::load(row + x + 1)))),
+                 L::abs(L::sub(d, L::load(up + x)))),
+          L::abs(L::sub(d, L::load(down + x))));
+      L::F t = saturate(L::div(depthDiff, L::set(kEdgeSensitivity)));
+      L::F edge = L::mul(L::mul(t, t),
+                         L::sub(L::set(3.0f), L::mul(L::set(2.0f), t)));
+      edge = L::mul(edge, edge);
+      L::I p = L::loadi(color + x), byte = L::seti(0xff);
+      L::I unorm[3];
+      L::I channel[3] = {L::andi(p, byte), L::andi(L::shr<8>(p), byte),
+                         L::andi(L::shr<16>(p), byte)}; // b, g, r
+      for (int k = 0; k < 3; k++) {
+        L::F c = L::mul(L::toFloat(channel[k]), L::set(1.0f / 255.0f));
+        unorm[k] = L::round(L::mul(saturate(L::add(c, edge)), L::set(255.0f)));
+      }
+      L::storei(out + x,
+                L::ori(L::ori(unorm[0], L::shl<8>(unorm[1])),
+                       L::ori(L::shl<16>(unorm[2]),
+                              L::seti(int32_t(0xff000000)))));
+    }
+#endif
+    for (; x < x1; x++)
+      out[x] = edgePixel(row, up, down, color[x], x);
+  }
+
+  // One pixel of postProcess(), given its row and the rows above and below
+  uint32_t edgePixel(const float *row, const float *up, const float *down,
+                     uint32_t color, int x) const {
+    float d = row[x];
+    float depthDiff = std::fabs(d - row[std::max(x - 1, 0)]) +
+                      std::fabs(d - row[std::min(x + 1, _width - 1)]) +
+                      std::fabs(d - up[x]) + std::fabs(d - down[x]);
+    float edge = smoothstep(0.0f, kEdgeSensitivity, depthDiff);
+    edge = edge * edge;
+    float c[3];
+    for (int k = 0; k < 3; k++) // r, g, b
+      c[k] = float((color >> (16 - 8 * k)) & 0xff) * (1.0f / 255.0f);
+    // Alpha is the target's plus 1, so always saturates
+    return packColor(c[0] + edge, c[1] + edge, c[2] + edge, 1.0f);
+  }
+
+  // texture2d::sample with filter::linear, address::clamp_to_edge
+  void sampleColor(float u, float v, float out[4]) const {
+    int x0, y0, x1, y1;
+    float fx, fy;
+    bilinear(u, v, x0, y0, x1, y1, fx, fy);
+    uint32_t p[4] = {_color[size_t(y0) * _width + x0],
+                     _color[size_t(y0) * _width + x1],
+                     _color[size_t(y1) * _width + x0],
+                     _color[size_t(y1) * _width + x1]};
+    const int shift[4] = {16, 8, 0, 24}; // r, g, b, a in BGRA8
+    for (int k = 0; k < 4; k++) {
+      float t[4];
+      for (int i = 0; i < 4; i++)
+        t[i] = float((p[i] >> shift[k]) & 0xff) / 255.0f;
+      out[k] = (t[0] * (1 - fx) + t[1] * fx) * (1 - fy) +
+               (t[2] * (1 - fx) + t[3] * fx) * fy;
+    }
+  }
+
+  float sampleDepth(float u, float v) const {
+    int x0, y0, x1, y1;
+    float fx, fy;
+    bilinear(u, v, x0, y0, x1, y1, fx, fy);
+    float d00 = _depth[size_t(y0) * _width + x0];
+    float d10 = _depth[size_t(y0) * _width + x1];
+    float d01 = _depth[size_t(y1) * _width + x0];
+    float d11 = _depth[size_t(y1) * _width + x1];
+    return (d00 * (1 - fx) + d10 * fx) * (1 - fy) +
+           (d01 * (1 - fx) + d11 * fx) * fy;
+  }
+
+  void bilinear(float u, float v, int &x0, int &y0, int &x1, int &y1,
+                float &fx, float &fy) const {
+    float tx = u * _width - 0.5f, ty = v * _height - 0.5f;
+    float bx = std::floor(tx), by = std::floor(ty);
+    fx = tx - bx;
+    fy = ty - by;
+    x0 = std::min(std::max(int(bx), 0), _width - 1);
+    x1 = std::min(std::max(int(bx) + 1, 0), _width - 1);
+    y0 = std::min(std::max(int(by), 0), _height - 1);
+    y1 = std::min(std::max(int(by) + 1, 0), _height - 1);
+  }
+
+  static float saturate(float x) { return std::min(std::max(x, 0.0f), 1.0f); }
+
+  static float smoothstep(float e0, float e1, float x) {
+    float t = saturate((x - e0) / (e1 - e0));
+    return t * t * (3.0f - 2.0f * t);
+  }
+
+  static uint8_t toUnorm8(float x) {
+    return uint8_t(std::lrint(saturate(x) * 255.0f));
+  }
+};
@@ -0,0 +1,110 @@
+#pragma once
+// Global operator new/delete that count, so a bench's allocation stats see
+// every std::vector/std::string the code under test touches. Defines the
+// replacement operators, so include it from one .cpp only (the bench).
+// malloc() isn't counted (tinyobj::arena_t's blocks, for one).
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace {
+std::atomic<size_t> gAllocs{0}, gAllocBytes{0}, gLiveBytes{0}, gPeakBytes{0};
+const size_t kHeader = 16; // Keeps malloc's 16-byte alignment
+
+struct AllocStats {
+  size_t allocs, bytes, peak;
+};
+
+template <typename Fn> AllocStats measureAllocs(Fn &&fn) {
+  size_t allocs = gAllocs, bytes = gAllocBytes, live = gLiveBytes;
+  gPeakBytes = live;
+  fn();
+  return {gAllocs - allocs, gAllocBytes - bytes, gPeakBytes - live};
+}
+} // namespace
+
+// Every replaced new and delete goes through this pair. Each block is
+// malloc()'d (aligned_alloc() for over-aligned types) with a header in
+// front holding its size and the header's own size. The pair stays out of
+// line so the compiler never sees free() applied to what operator new
+// returned (-Wmismatched-new-delete).
+#if defined(__GNUC__)
+#define ALLOC_COUNTER_NOINLINE __attribute__((noinline))
+#else
+#define ALLOC_COUNTER_NOINLINE
+#endif
+
+namespace {
+ALLOC_COUNTER_NOINLINE void *countedAlloc(size_t n, size_t align) noexcept {
+  size_t header = align > kHeader ? align : kHeader;
+  char *base = static_cast<char *>(
+      align > kHeader ? aligned_alloc(align, (n + header + align - 1) /
+                                                 align * align)
+                      : malloc(n + header));
+  if (!base)
+    return nullptr;
+  char *p = base + header;
+  memcpy(p - kHeader, &n, sizeof(n));
+  memcpy(p - kHeader + sizeof(n), &header, sizeof(header));
+  gAllocs++;
+  gAllocBytes += n;
+  size_t live = gLiveBytes += n;
+  size_t peak = gPeakBytes;
+  while (live > peak && !gPeakBytes.compare_exchange_weak(peak, live)) {
+  }
+  return p;
+}
+
+ALLOC_COUNTER_NOINLINE void countedFree(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  char *p = static_cast<char *>(ptr);
+  size_t n, header;
+  memcpy(&n, p - kHeader, sizeof(n));
+  memcpy(&header, p - kHeader + sizeof(n), sizeof(header));
+  gLiveBytes -= n;
+  free(p - header);
+}
+
+inline void *countedNew(size_t n, size_t align) {
+  void *p = countedAlloc(n, align);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+} // namespace
+
+void *operator new(size_t n) { return countedNew(n, 0); }
+void *operator new[](size_t n) { return countedNew(n, 0); }
+void *operator new(size_t n, std::align_val_t a) {
+  return countedNew(n, size_t(a));
+}
+void *operator new[](size_t n, std::align_val_t a) {
+  return countedNew(n, size_t(a));
+}
+void *operator new(size_t n, const std::nothrow_t &) noexcept {
+  return countedAlloc(n, 0);
+}
+void *operator new[](size_t n, const std::nothrow_t &) noexcept {
+  return countedAlloc(n, 0);
+}
+
+void operator delete(void *p) noexcept { countedFree(p); }
+void operator delete[](void *p) noexcept { countedFree(p); }
+void operator delete(void *p, size_t) noexcept { countedFree(p); }
+void operator delete[](void *p, size_t) noexcept { countedFree(p); }
+void operator delete(void *p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  countedFree(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  countedFree(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  countedFree(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  countedFree(p);
+}
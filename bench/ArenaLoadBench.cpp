@@ -0,0 +1,73 @@
+// Batch loading with and without a tinyobj::arena_t (MeshLoadOptions::arena).
+// Loads monke.obj a few hundred times in a row, the way a level load pulls in
+// hundreds of small assets, then the generated grid a few times, through
+// MeshLoader::loadObj on the serial mmap path. One arena serves the whole
+// batch and is reset after every load. Reports heap allocations per load,
+// time per load and the arena's size, and checks the Vertex arrays match.
+//
+// Usage: ArenaLoadBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshLoader.hpp"
+#include "AllocCounter.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+
+struct BatchResult {
+  double msPerLoad = 0;
+  double allocsPerLoad = 0;
+  double peakMB = 0;
+  std::vector<Vertex> last;
+};
+
+static BatchResult loadBatch(const std::string &file, int count,
+                             tinyobj::arena_t *arena) {
+  MeshLoadOptions options;
+  options.useMmap = true;
+  options.arena = arena;
+  BatchResult r;
+  double t0 = bench::nowMs();
+  AllocStats st = measureAllocs([&] {
+    for (int i = 0; i < count; i++)
+      r.last = MeshLoader::loadObj(file, options);
+  });
+  r.msPerLoad = (bench::nowMs() - t0) / count;
+  r.allocsPerLoad = double(st.allocs) / count;
+  r.peakMB = st.peak / 1e6;
+  return r;
+}
+
+static bool run(const std::string &file, int count) {
+  // Warm up the page cache and the arena, so neither row pays for first use
+  tinyobj::arena_t arena;
+  loadBatch(file, 1, nullptr);
+  loadBatch(file, 1, &arena);
+
+  BatchResult heap = loadBatch(file, count, nullptr);
+  BatchResult pooled = loadBatch(file, count, &arena);
+  bool same = heap.last.size() == pooled.last.size() &&
+              memcmp(heap.last.data(), pooled.last.data(),
+                     heap.last.size() * sizeof(Vertex)) == 0;
+  printf("%-28s x%-4d heap : %9.3f ms/load | %9.0f allocs/load | peak %7.1f "
+         "MB\n",
+         file.c_str(), count, heap.msPerLoad, heap.allocsPerLoad, heap.peakMB);
+  printf("%-28s x%-4d arena: %9.3f ms/load | %9.0f allocs/load | peak %7.1f "
+         "MB + arena %.1f MB | %.2fx | %s\n",
+         file.c_str(), count, pooled.msPerLoad, pooled.allocsPerLoad,
+         pooled.peakMB, arena.bytes_reserved() / 1e6,
+         heap.msPerLoad / pooled.msPerLoad, same ? "identical" : "MISMATCH");
+  return same;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = run("monke.obj", 300);
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  ok = run(big, 3) && ok;
+  return ok ? 0 : 1;
+}
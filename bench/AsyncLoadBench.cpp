@@ -0,0 +1,127 @@
+// Time to first frame, blocking vs background mesh load. A headless stand-in
+// for Renderer: the same MeshAsset load + VertexPacker pack the Renderer's
+// loader job runs, handed over through an AssetSlot, and a 60 Hz "frame"
+// loop that takes it at the start of a frame the way Renderer::draw does.
+//   blocking   = everything loads before the first frame (the old startup)
+//   background = first frame right away with the placeholder, mesh later
+// Both run cold (no MeshCache) and warm.
+//
+// Usage: AsyncLoadBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../AssetLoader.hpp"
+#include "../MeshAsset.hpp"
+#include "../PackedVertex.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+
+// What the Renderer's GpuMesh holds, minus the MTL::Buffers.
+struct LoadedMesh {
+  PackedMesh packed;
+  size_t indexCount = 0; // Over every LOD
+};
+
+static LoadedMesh prepare(const std::string &objFile,
+                          const std::string &cacheFile) {
+  MeshAsset asset = MeshAsset::load(objFile, cacheFile);
+  LoadedMesh mesh;
+  mesh.packed =
+      VertexPacker::pack(asset.mesh.vertices.data(), asset.mesh.vertices.size());
+  for (const MeshLod &lod : asset.lods)
+    mesh.indexCount += lod.indices.size();
+  return mesh;
+}
+
+struct Startup {
+  double firstFrame = 0; // ms from startup
+  double meshReady = 0;  // ms from startup to the first frame with the mesh
+  int placeholderFrames = 0;
+  LoadedMesh mesh;
+};
+
+static const double kFrameMs = 1000.0 / 60.0;
+
+// Wait for the next vsync tick after `start`.
+static void waitForVsync(double start) {
+  double next = start + kFrameMs * (std::floor((bench::nowMs() - start) /
+                                               kFrameMs) +
+                                    1);
+  while (bench::nowMs() < next)
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+static Startup blocking(const std::string &objFile,
+                        const std::string &cacheFile) {
+  Startup s;
+  double start = bench::nowMs();
+  s.mesh = prepare(objFile, cacheFile);
+  s.firstFrame = s.meshReady = bench::nowMs() - start;
+  return s;
+}
+
+static Startup background(const std::string &objFile,
+                          const std::string &cacheFile) {
+  Startup s;
+  double start = bench::nowMs();
+  AssetLoader loader;
+  AssetSlot<LoadedMesh> slot;
+  loader.submit([&] {
+    slot.publish(std::unique_ptr<LoadedMesh>(
+        new LoadedMesh(prepare(objFile, cacheFile))));
+  });
+  for (;;) {
+    // One frame: swap in whatever finished, then "draw" it
+    if (std::unique_ptr<LoadedMesh> loaded = slot.take()) {
+      s.mesh = std::move(*loaded);
+      s.meshReady = bench::nowMs() - start;
+      if (s.firstFrame == 0)
+        s.firstFrame = s.meshReady;
+      break;
+    }
+    if (s.firstFrame == 0)
+      s.firstFrame = bench::nowMs() - start;
+    s.placeholderFrames++;
+    waitForVsync(start);
+  }
+  return s;
+}
+
+static bool run(const std::string &objFile) {
+  std::string cacheFile = objFile + ".meshcache";
+  bool ok = true;
+  for (int warm = 0; warm < 2; warm++) {
+    if (!warm)
+      remove(cacheFile.c_str());
+    Startup b = blocking(objFile, cacheFile);
+    if (!warm)
+      remove(cacheFile.c_str());
+    Startup a = background(objFile, cacheFile);
+    bool same = a.mesh.packed.vertices.size() ==
+                    b.mesh.packed.vertices.size() &&
+                a.mesh.indexCount == b.mesh.indexCount &&
+                memcmp(a.mesh.packed.vertices.data(),
+                       b.mesh.packed.vertices.data(),
+                       a.mesh.packed.vertices.size() * sizeof(PackedVertex)) ==
+                    0;
+    ok = ok && same;
+    printf("%-28s %s | blocking: first frame %8.2f ms | background: first "
+           "frame %6.3f ms, mesh after %8.2f ms (%d placeholder frames) | %s\n",
+           objFile.c_str(), warm ? "warm" : "cold", b.firstFrame, a.firstFrame,
+           a.meshReady, a.placeholderFrames, same ? "OK" : "MISMATCH");
+  }
+  remove(cacheFile.c_str());
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = run("monke.obj");
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  ok = run(big) && ok;
+  return ok ? 0 : 1;
+}
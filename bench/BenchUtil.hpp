@@ -0,0 +1,74 @@
+#pragma once
+// Small helpers shared by the benchmarks in bench/.
+// These only use the portable parts of the tree (no Metal), so they build on
+// Linux too: `make bench CXX=g++`, then run from the repo root so monke.obj
+// is found.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+
+namespace bench {
+
+inline double nowMs() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(
+             steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Run fn `reps` times and return the best time in ms.
+template <typename Fn> double bestOf(int reps, Fn &&fn) {
+  double best = 1e30;
+  for (int i = 0; i < reps; i++) {
+    double t0 = nowMs();
+    fn();
+    double t = nowMs() - t0;
+    if (t < best)
+      best = t;
+  }
+  return best;
+}
+
+inline bool fileExists(const std::string &path) {
+  struct stat sb;
+  return stat(path.c_str(), &sb) == 0;
+}
+
+// Write a wavy grid as an OBJ with roughly `triangles` triangles, with
+// normals, in the same "v/vn/f a//n" shape Blender exports. Skips the write
+// if the file is already there, since the big ones take a while.
+inline bool writeGridObj(const std::string &path, size_t triangles) {
+  if (fileExists(path))
+    return true;
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f)
+    return false;
+  size_t quads = triangles / 2;
+  size_t n = size_t(std::sqrt(double(quads))); // quads per side
+  if (n < 1)
+    n = 1;
+  fprintf(f, "# generated grid, %zu triangles\no Grid\n", n * n * 2);
+  for (size_t y = 0; y <= n; y++) {
+    for (size_t x = 0; x <= n; x++) {
+      float fx = float(x) / float(n) * 2.0f - 1.0f;
+      float fy = float(y) / float(n) * 2.0f - 1.0f;
+      float fz = 0.1f * std::sin(fx * 10.0f) * std::cos(fy * 10.0f);
+      fprintf(f, "v %.6f %.6f %.6f\n", fx, fy, fz);
+    }
+  }
+  fprintf(f, "vn 0.000000 0.000000 1.000000\ns 0\n");
+  for (size_t y = 0; y < n; y++) {
+    for (size_t x = 0; x < n; x++) {
+      size_t a = y * (n + 1) + x + 1; // OBJ indices are 1-based
+      size_t b = a + 1, c = a + n + 1, d = c + 1;
+      fprintf(f, "f %zu//1 %zu//1 %zu//1\n", a, b, d);
+      fprintf(f, "f %zu//1 %zu//1 %zu//1\n", a, d, c);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+} // namespace bench
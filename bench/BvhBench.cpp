@@ -0,0 +1,165 @@
+// MeshBvh build time and ray throughput, on monke.obj and the generated
+// grid (indexed, as MeshAsset has it). Builds at 1, 2, 4 ... threads must
+// give the same nodes. Rays start on a sphere around the mesh and aim at
+// random points in its box, so most of them hit; the any-hit rays stop
+// at that point. Both kinds are checked against a brute-force loop over
+// every triangle for the first [check] rays.
+//
+// Usage: BvhBench [triangles] [check]   (default 1M, 200)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshBvh.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <random>
+
+static std::vector<BvhRay> makeRays(const IndexedMesh &mesh, size_t count) {
+  Bounds b = Bounds::of(mesh.vertices.data(), nullptr, mesh.vertices.size());
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f), box(0.0f, 1.0f);
+  std::vector<BvhRay> rays(count);
+  for (BvhRay &ray : rays) {
+    float d[3], len2;
+    do {
+      for (float &x : d)
+        x = unit(rng);
+      len2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    } while (len2 > 1.0f || len2 < 1e-4f);
+    float scale = 2.0f * b.radius / std::sqrt(len2);
+    for (int k = 0; k < 3; k++) {
+      ray.origin[k] = b.center[k] + d[k] * scale;
+      float target = b.min[k] + box(rng) * (b.max[k] - b.min[k]);
+      ray.dir[k] = target - ray.origin[k];
+    }
+  }
+  return rays;
+}
+
+static BvhHit bruteForce(const IndexedMesh &mesh, const BvhRay &ray) {
+  BvhHit hit;
+  for (size_t t = 0; t < mesh.indices.size() / 3; t++) {
+    const float *p[3];
+    for (int c = 0; c < 3; c++)
+      p[c] = mesh.vertices[mesh.indices[3 * t + c]].position;
+    BvhTriangle tri;
+    for (int k = 0; k < 3; k++) {
+      tri.v0[k] = p[0][k];
+      tri.e1[k] = p[1][k] - p[0][k];
+      tri.e2[k] = p[2][k] - p[0][k];
+    }
+    float tt, u, v;
+    if (MeshBvh::intersect(tri, ray, hit.t < ray.tMax ? hit.t : ray.tMax, &tt,
+                           &u, &v) &&
+        tt < hit.t) {
+      hit.t = tt;
+      hit.triangle = uint32_t(t);
+    }
+  }
+  return hit;
+}
+
+static bool sameNodes(const MeshBvh &a, const MeshBvh &b) {
+  return a.nodes.size() == b.nodes.size() &&
+         memcmp(a.nodes.data(), b.nodes.data(),
+                a.nodes.size() * sizeof(BvhNode)) == 0 &&
+         a.triangleIds == b.triangleIds;
+}
+
+// Rays per second over `threads` threads, each taking an equal slice.
+template <typename Fn>
+static double raysPerSecond(size_t count, unsigned threads, Fn &&fn) {
+  double ms = bench::bestOf(3, [&] {
+    parallel::forSlices(count, threads, [&](unsigned, size_t i0, size_t i1) {
+      for (size_t i = i0; i < i1; i++)
+        fn(i);
+    });
+  });
+  return count / ms * 1e3;
+}
+
+static bool run(const std::string &file, size_t rayCount, size_t check) {
+  MeshLoadOptions options;
+  options.useMmap = true;
+  IndexedMesh mesh = MeshLoader::loadObjIndexed(file, options);
+  size_t tris = mesh.indices.size() / 3;
+  bool ok = tris > 0;
+
+  MeshBvh bvh;
+  double baseMs = 0;
+  unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+  for (unsigned t = 1; t <= maxThreads; t *= 2) {
+    MeshBvh built;
+    double ms = bench::bestOf(3, [&] { built = MeshBvh::build(mesh, t); });
+    bool same = true;
+    if (t == 1) {
+      bvh = std::move(built);
+      baseMs = ms;
+    } else {
+      same = sameNodes(bvh, built);
+    }
+    ok = ok && same;
+    printf("%-28s %9zu tris  build x%-2u %9.2f ms | %.2fx | %s\n",
+           file.c_str(), tris, t, ms, baseMs / ms,
+           same ? "identical" : "MISMATCH");
+  }
+  size_t leaves = 0, leafTris = 0;
+  for (size_t i = 0; i < bvh.nodes.size(); i++) {
+    if (i != 1 && bvh.nodes[i].leaf()) {
+      leaves++;
+      leafTris += bvh.nodes[i].count;
+    }
+  }
+  printf("%-28s %zu nodes (%.1f MB), %zu leaves, %.2f tris/leaf\n",
+         file.c_str(), bvh.nodes.size(), bvh.nodes.size() * 32 / 1e6, leaves,
+         double(leafTris) / leaves);
+
+  // Any-hit rays stop at their target, like a shadow or visibility ray
+  std::vector<BvhRay> rays = makeRays(mesh, rayCount), shadow = rays;
+  for (BvhRay &ray : shadow)
+    ray.tMax = 1.0f;
+  std::vector<BvhHit> hits(rays.size());
+  std::vector<uint8_t> occluded(rays.size());
+
+  size_t wrong = 0;
+  for (size_t i = 0; i < std::min(check, rays.size()); i++) {
+    BvhHit got = bvh.closestHit(rays[i]), want = bruteForce(mesh, rays[i]);
+    wrong += got.hit() != want.hit() || (want.hit() && got.t != want.t);
+    wrong += bvh.anyHit(shadow[i]) != bruteForce(mesh, shadow[i]).hit();
+  }
+  ok = ok && wrong == 0;
+  printf("%-28s brute force on %zu rays: %s\n", file.c_str(),
+         std::min(check, rays.size()), wrong ? "MISMATCH" : "OK");
+
+  for (unsigned t = 1; t <= maxThreads; t *= 2) {
+    double closest = raysPerSecond(rays.size(), t, [&](size_t i) {
+      hits[i] = bvh.closestHit(rays[i]);
+    });
+    double any = raysPerSecond(shadow.size(), t, [&](size_t i) {
+      occluded[i] = bvh.anyHit(shadow[i]);
+    });
+    size_t hitCount = 0, occludedCount = 0;
+    for (size_t i = 0; i < rays.size(); i++) {
+      hitCount += hits[i].hit();
+      occludedCount += occluded[i];
+    }
+    printf("%-28s x%-2u closest-hit %7.2f Mrays/s (%4.1f%% hit) | any-hit "
+           "%7.2f Mrays/s (%4.1f%% occluded)\n",
+           file.c_str(), t, closest / 1e6, 100.0 * hitCount / rays.size(),
+           any / 1e6, 100.0 * occludedCount / rays.size());
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  size_t check = argc > 2 ? strtoull(argv[2], nullptr, 10) : 200;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = run("monke.obj", 1000000, std::max<size_t>(check, 1000));
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  ok = run(big, 1000000, check) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+// Floats per second for tinyobj's number parsing: the old tryParseDouble
+// (+ cast to real_t, what parseReal used to do) against tryParseReal.
+// Also counts how often each disagrees with the correctly rounded strtof
+// (strtod with TINYOBJLOADER_USE_DOUBLE), and fails if tryParseReal ever
+// does.
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../tiny_obj_loader.h"
+#include "BenchUtil.hpp"
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct Input {
+  std::vector<char> text; // '\0' separated
+  std::vector<size_t> offsets;
+  std::vector<size_t> lengths;
+};
+
+static Input makeInput(size_t n, const char *fmt, double scale) {
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  Input in;
+  char buf[64];
+  for (size_t i = 0; i < n; i++) {
+    int len = snprintf(buf, sizeof(buf), fmt, dist(rng) * scale);
+    in.offsets.push_back(in.text.size());
+    in.lengths.push_back(size_t(len));
+    in.text.insert(in.text.end(), buf, buf + len + 1);
+  }
+  return in;
+}
+
+// The midpoint between two neighbouring real_t values, or the wider type's
+// value just below or above it, printed to 60 digits: the rounding depends
+// on digits well past the 19 that fit in 64 bits.
+#ifdef TINYOBJLOADER_USE_DOUBLE
+typedef long double Wide; // x87 or quad: holds a double midpoint exactly
+#define HAVE_WIDE (LDBL_MANT_DIG >= 64)
+static const char *kWideFmt = "%.60Le";
+#else
+typedef double Wide;
+#define HAVE_WIDE 1
+static const char *kWideFmt = "%.60e";
+#endif
+
+static Input makeHalfway(size_t n) {
+  std::mt19937_64 rng(1234);
+  Input in;
+  char buf[128];
+  while (in.offsets.size() < n) {
+    tinyobj::real_t f;
+    uint64_t bits = rng();
+    memcpy(&f, &bits, sizeof(f));
+    f = std::fabs(f);
+    tinyobj::real_t next = std::nextafter(f, tinyobj::real_t(INFINITY));
+    if (!std::isfinite(next))
+      continue;
+    Wide mid = Wide(f) + (Wide(next) - Wide(f)) / 2;
+    size_t i = in.offsets.size();
+    if (i % 3 == 1)
+      mid = std::nextafter(mid, Wide(0));
+    else if (i % 3 == 2)
+      mid = std::nextafter(mid, Wide(INFINITY));
+    int len = snprintf(buf, sizeof(buf), kWideFmt, (bits >> 63) ? -mid : mid);
+    in.offsets.push_back(in.text.size());
+    in.lengths.push_back(size_t(len));
+    in.text.insert(in.text.end(), buf, buf + len + 1);
+  }
+  return in;
+}
+
+static tinyobj::real_t reference(const char *s) {
+#ifdef TINYOBJLOADER_USE_DOUBLE
+  return strtod(s, nullptr);
+#else
+  return strtof(s, nullptr);
+#endif
+}
+
+// Returns how many results were not correctly rounded.
+template <typename Parse>
+static size_t run(const char *name, const Input &in, Parse parse) {
+  const size_t n = in.offsets.size();
+  std::vector<tinyobj::real_t> out(n);
+  double ms = bench::bestOf(5, [&] {
+    for (size_t i = 0; i < n; i++) {
+      const char *s = &in.text[in.offsets[i]];
+      parse(s, s + in.lengths[i], &out[i]);
+    }
+  });
+  size_t wrong = 0;
+  for (size_t i = 0; i < n; i++) {
+    tinyobj::real_t ref = reference(&in.text[in.offsets[i]]);
+    wrong += memcmp(&ref, &out[i], sizeof(ref)) != 0;
+  }
+  printf("  %-14s %8.1f Mfloats/s | %zu / %zu not correctly rounded\n", name,
+         n / ms / 1e3, wrong, n);
+  return wrong;
+}
+
+// Returns whether tryParseReal rounded everything correctly.
+static bool compare(const char *label, const Input &in) {
+  printf("%s\n", label);
+  run("tryParseDouble", in,
+      [](const char *s, const char *e, tinyobj::real_t *r) {
+        double d = 0;
+        tinyobj::tryParseDouble(s, e, &d);
+        *r = static_cast<tinyobj::real_t>(d);
+      });
+  return run("tryParseReal", in,
+             [](const char *s, const char *e, tinyobj::real_t *r) {
+               tinyobj::tryParseReal(s, e, r);
+             }) == 0;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 4000000;
+  bool ok = true;
+  ok &= compare("Exporter style (%.6f, |x| < 1)", makeInput(n, "%.6f", 1.0));
+  ok &= compare("Exporter style (%.6f, |x| < 1000)",
+                makeInput(n, "%.6f", 1000.0));
+  ok &= compare("Scientific (%.8e)", makeInput(n, "%.8e", 1e-3));
+  ok &= compare("Long (%.17g)", makeInput(n, "%.17g", 50.0));
+  if (HAVE_WIDE)
+    ok &= compare("Near halfway (61 digits, any exponent)",
+                  makeHalfway(n / 10));
+  return ok ? 0 : 1;
+}
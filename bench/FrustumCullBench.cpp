@@ -0,0 +1,270 @@
+// MeshParts bounds and FrustumCuller.
+//   1. A tiled OBJ (tiles x tiles objects, each split over two materials)
+//      goes through MeshAsset::load cold and warm. Every LOD's ranges must
+//      cover its indices back to back, every bound must hold its range's
+//      vertices, and the warm (MeshCache) parts and LODs must match the
+//      cold ones.
+//   2. A camera zoomed onto a corner of that mesh: any range with a vertex
+//      on screen must be kept, and most of the others should go.
+//   3. [bounds] random bounds under a spinning perspective camera, SIMD
+//      against cullScalar: same answers, and ns per bound for each.
+//
+// Usage: FrustumCullBench [bounds]   (default 100k)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../FrustumCuller.hpp"
+#include "../MeshAsset.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <random>
+
+// tiles x tiles wavy patches of cells x cells quads, one "o" each, left
+// half in material "a" and right half in "b".
+static bool writeTiledObj(const std::string &path, int tiles, int cells) {
+  std::string mtl = path.substr(0, path.size() - 4) + ".mtl";
+  FILE *m = fopen(mtl.c_str(), "w");
+  if (!m)
+    return false;
+  fprintf(m, "newmtl a\nKd 0.8 0.2 0.2\nnewmtl b\nKd 0.2 0.2 0.8\n");
+  fclose(m);
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f)
+    return false;
+  // MeshLoader looks for materials from the working directory
+  fprintf(f, "mtllib %s\n", mtl.c_str());
+  size_t base = 1;
+  for (int ty = 0; ty < tiles; ty++) {
+    for (int tx = 0; tx < tiles; tx++) {
+      fprintf(f, "o Tile_%d_%d\n", tx, ty);
+      for (int y = 0; y <= cells; y++) {
+        for (int x = 0; x <= cells; x++) {
+          float fx = (tx + float(x) / cells) / tiles * 2.0f - 1.0f;
+          float fy = (ty + float(y) / cells) / tiles * 2.0f - 1.0f;
+          float fz = 0.1f * std::sin(fx * 10.0f) * std::cos(fy * 10.0f);
+          fprintf(f, "v %.6f %.6f %.6f\n", fx, fy, fz);
+        }
+      }
+      for (int half = 0; half < 2; half++) {
+        fprintf(f, "usemtl %s\n", half ? "b" : "a");
+        for (int y = 0; y < cells; y++) {
+          for (int x = half * cells / 2; x < (half + 1) * cells / 2; x++) {
+            size_t a = base + size_t(y) * (cells + 1) + x, b = a + 1;
+            size_t c = a + cells + 1, d = c + 1;
+            fprintf(f, "f %zu %zu %zu\nf %zu %zu %zu\n", a, b, d, a, d, c);
+          }
+        }
+      }
+      base += size_t(cells + 1) * (cells + 1);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static bool contains(const Bounds &b, const float *p) {
+  const float eps = 1e-5f;
+  float dx = p[0] - b.center[0], dy = p[1] - b.center[1],
+        dz = p[2] - b.center[2];
+  bool inSphere = std::sqrt(dx * dx + dy * dy + dz * dz) <= b.radius + eps;
+  bool inBox = true;
+  for (int k = 0; k < 3; k++)
+    inBox = inBox && p[k] >= b.min[k] - eps && p[k] <= b.max[k] + eps;
+  return inSphere && inBox;
+}
+
+static bool checkLods(const MeshAsset &asset) {
+  const std::vector<Vertex> &v = asset.mesh.vertices;
+  bool ok = true;
+  for (const MeshLod &lod : asset.lods) {
+    uint32_t next = 0;
+    for (const MeshRange &r : lod.ranges) {
+      ok = ok && r.firstIndex == next && r.indexCount % 3 == 0;
+      next = r.firstIndex + r.indexCount;
+      ok = ok && (r.indexCount > 0 || r.bounds.empty());
+      for (uint32_t i = r.firstIndex; i < next && ok; i++)
+        ok = contains(r.bounds, v[lod.indices[i]].position);
+    }
+    ok = ok && next == lod.indices.size();
+  }
+  for (const MeshShape &s : asset.mesh.parts.shapes) {
+    for (uint32_t r = s.firstRange; r < s.firstRange + s.rangeCount; r++) {
+      const Bounds &b = asset.mesh.parts.ranges[r].bounds, &o = s.bounds;
+      float dx = b.center[0] - o.center[0], dy = b.center[1] - o.center[1],
+            dz = b.center[2] - o.center[2];
+      ok = ok && std::sqrt(dx * dx + dy * dy + dz * dz) + b.radius <=
+                     o.radius + 1e-5f;
+      for (int k = 0; k < 3; k++)
+        ok = ok && b.min[k] >= o.min[k] && b.max[k] <= o.max[k];
+    }
+  }
+  return ok;
+}
+
+static bool samePart(const MeshParts &a, const MeshParts &b) {
+  return a.shapes.size() == b.shapes.size() &&
+         a.ranges.size() == b.ranges.size() &&
+         memcmp(a.shapes.data(), b.shapes.data(),
+                a.shapes.size() * sizeof(MeshShape)) == 0 &&
+         memcmp(a.ranges.data(), b.ranges.data(),
+                a.ranges.size() * sizeof(MeshRange)) == 0;
+}
+
+static bool sameLods(const std::vector<MeshLod> &a,
+                     const std::vector<MeshLod> &b) {
+  bool same = a.size() == b.size();
+  for (size_t i = 0; same && i < a.size(); i++)
+    same = a[i].ratio == b[i].ratio && a[i].error == b[i].error &&
+           a[i].indices == b[i].indices &&
+           a[i].ranges.size() == b[i].ranges.size() &&
+           memcmp(a[i].ranges.data(), b[i].ranges.data(),
+                  a[i].ranges.size() * sizeof(MeshRange)) == 0;
+  return same;
+}
+
+// Column-major perspective, Metal clip z in [0, w]
+static void perspective(float fovY, float aspect, float zn, float zf,
+                        float m[4][4]) {
+  float f = 1.0f / std::tan(fovY / 2);
+  for (int c = 0; c < 4; c++)
+    for (int r = 0; r < 4; r++)
+      m[c][r] = 0.0f;
+  m[0][0] = f / aspect;
+  m[1][1] = f;
+  m[2][2] = zf / (zn - zf);
+  m[2][3] = -1.0f;
+  m[3][2] = zn * zf / (zn - zf);
+}
+
+// Camera at distance `dist` on the +z side, spun by `angle` about y,
+// looking at (tx, ty, 0).
+static void lookAt(float angle, float dist, float tx, float ty,
+                   float m[4][4]) {
+  float c = std::cos(angle), s = std::sin(angle);
+  // Rotation about y (its transpose is the inverse), then the offset
+  float rot[3][3] = {{c, 0, -s}, {0, 1, 0}, {s, 0, c}}; // rot[col][row]
+  for (int col = 0; col < 3; col++) {
+    for (int row = 0; row < 3; row++)
+      m[col][row] = rot[row][col];
+    m[col][3] = 0.0f;
+  }
+  float t[3] = {-tx, -ty, 0.0f};
+  for (int row = 0; row < 3; row++)
+    m[3][row] = m[0][row] * t[0] + m[1][row] * t[1] + m[2][row] * t[2];
+  m[3][2] -= dist;
+  m[3][3] = 1.0f;
+}
+
+static bool onScreen(const float m[4][4], const float *p) {
+  float clip[4];
+  for (int r = 0; r < 4; r++)
+    clip[r] = m[0][r] * p[0] + m[1][r] * p[1] + m[2][r] * p[2] + m[3][r];
+  return std::fabs(clip[0]) <= clip[3] && std::fabs(clip[1]) <= clip[3] &&
+         clip[2] >= 0 && clip[2] <= clip[3];
+}
+
+static bool checkMesh() {
+  std::string obj = "build/bench/tiles.obj";
+  std::string cacheFile = obj + ".meshcache";
+  if (!writeTiledObj(obj, 8, 64)) {
+    fprintf(stderr, "Could not write %s\n", obj.c_str());
+    return false;
+  }
+  remove(cacheFile.c_str());
+  MeshAsset cold = MeshAsset::load(obj, cacheFile);
+  MeshAsset warm = MeshAsset::load(obj, cacheFile);
+  bool coldOk = checkLods(cold), warmOk = checkLods(warm) && warm.fromCache &&
+                                          samePart(cold.mesh.parts,
+                                                   warm.mesh.parts) &&
+                                          sameLods(cold.lods, warm.lods);
+  printf("%-22s %zu shapes, %zu ranges, %zu LODs | cold %s | warm %s\n",
+         obj.c_str(), cold.mesh.parts.shapes.size(),
+         cold.mesh.parts.ranges.size(), cold.lods.size(),
+         coldOk ? "OK" : "MISMATCH", warmOk ? "OK" : "MISMATCH");
+
+  // Zoomed onto the (-1, -1) corner
+  float view[4][4], proj[4][4], viewProj[4][4];
+  lookAt(0.3f, 1.0f, -0.8f, -0.8f, view);
+  perspective(0.8f, 1.0f, 0.1f, 10.0f, proj);
+  for (int c = 0; c < 4; c++)
+    for (int r = 0; r < 4; r++) {
+      viewProj[c][r] = 0.0f;
+      for (int k = 0; k < 4; k++)
+        viewProj[c][r] += proj[k][r] * view[c][k];
+    }
+  bool cullOk = true;
+  for (const MeshLod &lod : cold.lods) {
+    BoundsSoA soa;
+    for (const MeshRange &r : lod.ranges)
+      soa.push(r.bounds);
+    std::vector<uint8_t> visible;
+    size_t kept = FrustumCuller::cull(soa, view, proj, visible);
+    size_t needed = 0;
+    for (size_t r = 0; r < lod.ranges.size(); r++) {
+      const MeshRange &range = lod.ranges[r];
+      bool seen = false;
+      for (uint32_t i = range.firstIndex;
+           i < range.firstIndex + range.indexCount && !seen; i++)
+        seen = onScreen(viewProj, cold.mesh.vertices[lod.indices[i]].position);
+      needed += seen;
+      cullOk = cullOk && (!seen || visible[r]);
+    }
+    printf("  LOD %zu  %3zu ranges: %3zu kept, %3zu with a vertex on screen\n",
+           size_t(&lod - cold.lods.data()), lod.ranges.size(), kept, needed);
+    cullOk = cullOk && kept < lod.ranges.size();
+  }
+  printf("%-22s zoomed camera culling | %s\n", obj.c_str(),
+         cullOk ? "OK" : "MISMATCH");
+  remove(cacheFile.c_str());
+  return coldOk && warmOk && cullOk;
+}
+
+static bool checkCuller(size_t count) {
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> pos(-20.0f, 20.0f), size(0.05f, 1.0f);
+  BoundsSoA soa;
+  for (size_t i = 0; i < count; i++) {
+    Bounds b;
+    if (i % 97 != 0) { // Some empty ones too
+      float c[3] = {pos(rng), pos(rng), pos(rng)};
+      Vertex corners[2] = {};
+      for (int k = 0; k < 3; k++) {
+        corners[0].position[k] = c[k] - size(rng);
+        corners[1].position[k] = c[k] + size(rng);
+      }
+      b = Bounds::of(corners, nullptr, 2);
+    }
+    soa.push(b);
+  }
+
+  float proj[4][4];
+  perspective(1.0f, 16.0f / 9.0f, 0.1f, 30.0f, proj);
+  const int frames = 64;
+  std::vector<uint8_t> simd, scalar;
+  double simdMs = 0, scalarMs = 0;
+  size_t visible = 0;
+  bool same = true;
+  for (int frame = 0; frame < frames; frame++) {
+    float view[4][4];
+    lookAt(float(frame) * 0.1f, 5.0f, 0.0f, 0.0f, view);
+    Frustum f = Frustum::fromViewProj(view, proj);
+    size_t a = 0, b = 0;
+    simdMs += bench::bestOf(3, [&] { a = FrustumCuller::cull(soa, f, simd); });
+    scalarMs +=
+        bench::bestOf(3, [&] { b = FrustumCuller::cullScalar(soa, f, scalar); });
+    same = same && a == b && simd == scalar;
+    visible += a;
+  }
+  double n = double(count) * frames;
+  printf("%zu bounds x%d frames: %.1f%% visible | scalar %.2f ns/bound | "
+         "SIMD %.2f ns/bound | %.2fx | %s\n",
+         count, frames, 100.0 * visible / n, scalarMs * 1e6 / n,
+         simdMs * 1e6 / n, scalarMs / simdMs, same ? "identical" : "MISMATCH");
+  return same;
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = checkMesh();
+  ok = checkCuller(count) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+// Golden-image check for the two passes. Renders monke with SoftwareRenderer
+// at a few rotation angles and compares both the scene (pass 1's colour
+// target) and the post-processed frame (pass 2) with the references in
+// bench/golden/. An image passes when at most kMaxOverFraction of its
+// pixels have a channel more than kTolerance away, and its SSIM (on luma,
+// 8x8 windows) is at least kMinSsim. Per-stage times go to
+// build/bench/golden_timings.json; with --baseline, a stage that got more
+// than [threshold] times slower than in that file fails the run too. Only a
+// baseline taken at the same size on as many threads is compared with;
+// another one is reported and skipped. The load is timed with the mesh
+// cache already written, so a clean checkout times a warm load as well.
+// bench/golden/timings.json is the committed baseline `make check` uses.
+// Exits non-zero on any failure, so `make check` can gate on it.
+//
+// Usage: GoldenBench [--update] [--baseline file] [--threshold x]
+//   --update     rewrite the references (and the committed baseline's
+//                timings) instead of checking them
+//   --threshold  allowed slowdown against the baseline (default 1.5)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshAsset.hpp"
+#include "../SoftwareRenderer.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+static const int kSize = 256;
+static const float kAngles[] = {0.0f, 0.8f, 1.6f, 3.0f};
+static const int kTolerance = 2;
+static const double kMaxOverFraction = 0.001;
+static const double kMinSsim = 0.99;
+// Stages faster than this are all noise; they can't fail the timing check
+static const double kTimingFloorMs = 0.25;
+
+static const char *kGoldenDir = "bench/golden";
+static const char *kTimingsFile = "build/bench/golden_timings.json";
+static const char *kBaselineFile = "bench/golden/timings.json";
+
+static double luma(uint32_t p) {
+  return 0.299 * ((p >> 16) & 0xff) + 0.587 * ((p >> 8) & 0xff) +
+         0.114 * (p & 0xff);
+}
+
+// Mean SSIM over 8x8 windows at a stride of 4, with the usual constants for
+// an 8-bit range.
+static double ssim(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b,
+                   int width, int height) {
+  const double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+  const int window = 8, stride = 4;
+  double sum = 0;
+  int count = 0;
+  for (int y0 = 0; y0 + window <= height; y0 += stride) {
+    for (int x0 = 0; x0 + window <= width; x0 += stride) {
+      double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+      for (int y = y0; y < y0 + window; y++) {
+        for (int x = x0; x < x0 + window; x++) {
+          double la = luma(a[size_t(y) * width + x]);
+          double lb = luma(b[size_t(y) * width + x]);
+          sa += la;
+          sb += lb;
+          saa += la * la;
+          sbb += lb * lb;
+          sab += la * lb;
+        }
+      }
+      double n = window * window, ma = sa / n, mb = sb / n;
+      double va = saa / n - ma * ma, vb = sbb / n - mb * mb;
+      double cov = sab / n - ma * mb;
+      sum += (2 * ma * mb + c1) * (2 * cov + c2) /
+             ((ma * ma + mb * mb + c1) * (va + vb + c2));
+      count++;
+    }
+  }
+  return count ? sum / count : 1.0;
+}
+
+// Pixels where a colour channel is more than `tolerance` away (alpha is
+// ignored: the PPMs don't keep it), and the largest difference seen.
+static size_t overTolerance(const std::vector<uint32_t> &a,
+                            const std::vector<uint32_t> &b, int tolerance,
+                            int *worst) {
+  size_t count = 0;
+  *worst = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    int diff = 0;
+    for (int shift = 0; shift < 24; shift += 8)
+      diff = std::max(diff, std::abs(int((a[i] >> shift) & 0xff) -
+                                     int((b[i] >> shift) & 0xff)));
+    *worst = std::max(*worst, diff);
+    count += diff > tolerance;
+  }
+  return count;
+}
+
+static bool checkImage(const std::string &name,
+                       const std::vector<uint32_t> &image, bool update) {
+  std::string path = std::string(kGoldenDir) + "/" + name + ".ppm";
+  if (update) {
+    bool ok = SoftwareRenderer::writePpm(path, image.data(), kSize, kSize);
+    printf("%-22s %s\n", name.c_str(), ok ? "updated" : "WRITE FAILED");
+    return ok;
+  }
+  std::vector<uint32_t> golden;
+  int width, height;
+  if (!SoftwareRenderer::readPpm(path, golden, width, height) ||
+      width != kSize || height != kSize) {
+    printf("%-22s missing or unreadable %s (run with --update)\n",
+           name.c_str(), path.c_str());
+    return false;
+  }
+  int worst;
+  size_t over = overTolerance(image, golden, kTolerance, &worst);
+  double score = ssim(image, golden, kSize, kSize);
+  bool ok = over <= kMaxOverFraction * image.size() && score >= kMinSsim;
+  printf("%-22s max diff %3d, %5zu pixels over %d | SSIM %.5f | %s\n",
+         name.c_str(), worst, over, kTolerance, score, ok ? "OK" : "MISMATCH");
+  if (!ok) {
+    std::string got = std::string("build/bench/") + name + ".ppm";
+    SoftwareRenderer::writePpm(got, image.data(), kSize, kSize);
+    printf("%-22s wrote %s to compare\n", name.c_str(), got.c_str());
+  }
+  return ok;
+}
+
+struct Timings {
+  int size = 0;
+  unsigned threads = 0;
+  std::map<std::string, double> stages;
+};
+
+// What writeTimings leaves behind: "size" and "threads", then one
+// "stage": ms line each inside "stages_ms"
+static Timings readTimings(const std::string &path) {
+  Timings timings;
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f)
+    return timings;
+  char line[256], key[128];
+  double value;
+  bool inStages = false;
+  while (fgets(line, sizeof(line), f)) {
+    if (inStages) {
+      if (strchr(line, '}'))
+        inStages = false;
+      else if (sscanf(line, " \"%127[^\"]\": %lf", key, &value) == 2)
+        timings.stages[key] = value;
+    } else if (sscanf(line, " \"%127[^\"]\":", key) == 1) {
+      if (!strcmp(key, "stages_ms"))
+        inStages = true;
+      else if (!strcmp(key, "size") && sscanf(line, " %*s %lf", &value) == 1)
+        timings.size = int(value);
+      else if (!strcmp(key, "threads") &&
+               sscanf(line, " %*s %lf", &value) == 1)
+        timings.threads = unsigned(value);
+    }
+  }
+  fclose(f);
+  return timings;
+}
+
+static bool writeTimings(const std::string &path,
+                         const std::vector<std::pair<std::string, double>> &stages,
+                         unsigned threads) {
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f)
+    return false;
+  fprintf(f, "{\n  \"size\": %d,\n  \"threads\": %u,\n  \"stages_ms\": {\n",
+          kSize, threads);
+  for (size_t i = 0; i < stages.size(); i++)
+    fprintf(f, "    \"%s\": %.4f%s\n", stages[i].first.c_str(),
+            stages[i].second, i + 1 < stages.size() ? "," : "");
+  fprintf(f, "  }\n}\n");
+  return fclose(f) == 0;
+}
+
+int main(int argc, char **argv) {
+  bool update = false;
+  std::string baseline;
+  double threshold = 1.5;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--update")) {
+      update = true;
+    } else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) {
+      baseline = argv[++i];
+    } else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--update] [--baseline file] [--threshold x]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+
+  // Read before this run's timings are written, which may go to the same
+  // file
+  Timings base;
+  if (!baseline.empty() && !update) {
+    base = readTimings(baseline);
+    if (base.stages.empty()) {
+      fprintf(stderr, "No timings in %s\n", baseline.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<std::pair<std::string, double>> stages;
+  const char *objPath = "monke.obj";
+  const char *cachePath = "build/bench/monke.obj.meshcache";
+  // Writes the cache if there's none yet (or it's stale), untimed
+  MeshAsset asset = MeshAsset::load(objPath, cachePath);
+  double loadMs =
+      bench::bestOf(5, [&] { asset = MeshAsset::load(objPath, cachePath); });
+  // Cold and warm loads are an order of magnitude apart; keep them apart
+  // (cold again only if the cache couldn't be written)
+  stages.emplace_back(asset.fromCache ? "load_warm" : "load_cold", loadMs);
+  if (asset.lods.empty() || asset.lods[0].indices.empty()) {
+    fprintf(stderr, "Could not load monke.obj\n");
+    return 1;
+  }
+
+  SoftwareRenderer r(kSize, kSize);
+  const MeshLod &lod = asset.lods[0];
+  bool ok = true;
+  for (float angle : kAngles) {
+    char name[32];
+    snprintf(name, sizeof(name), "monke_a%.2f", angle);
+    double sceneMs = bench::bestOf(5, [&] {
+      r.beginFrame();
+      r.drawIndexed(asset.mesh.vertices.data(), asset.mesh.vertices.size(),
+                    lod.indices.data(), lod.indices.size(),
+                    makeRotation(angle));
+    });
+    double postMs = bench::bestOf(5, [&] { r.postProcess(); });
+    stages.emplace_back(std::string(name) + "/scene", sceneMs);
+    stages.emplace_back(std::string(name) + "/post", postMs);
+    ok = checkImage(std::string(name) + "_scene", r.color(), update) && ok;
+    ok = checkImage(std::string(name) + "_post", r.frame(), update) && ok;
+  }
+
+  const char *timingsFile = update ? kBaselineFile : kTimingsFile;
+  if (!writeTimings(timingsFile, stages, r.threads())) {
+    fprintf(stderr, "Could not write %s\n", timingsFile);
+    return 1;
+  }
+  // Times from another thread count or size say nothing about this run
+  if (!base.stages.empty() &&
+      (base.threads != r.threads() || base.size != kSize)) {
+    printf("%s was taken at %d px on %u thread(s), this run is %d px on %u; "
+           "timings not compared\n",
+           baseline.c_str(), base.size, base.threads, kSize, r.threads());
+    base.stages.clear();
+  }
+  for (const auto &stage : stages) {
+    auto it = base.stages.find(stage.first);
+    if (it == base.stages.end()) {
+      printf("%-22s %9.3f ms\n", stage.first.c_str(), stage.second);
+      continue;
+    }
+    bool slow = stage.second > it->second * threshold &&
+                stage.second - it->second > kTimingFloorMs;
+    ok = ok && !slow;
+    printf("%-22s %9.3f ms | baseline %9.3f ms | %.2fx | %s\n",
+           stage.first.c_str(), stage.second, it->second,
+           stage.second / it->second, slow ? "SLOWER" : "OK");
+  }
+  printf("timings written to %s\n", timingsFile);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Vertex deduplication in MeshLoader::loadObjIndexed: how much smaller the
+// vertex + index buffers get than the de-indexed Vertex array, and what the
+// dedup pass costs on top of the parse.
+//
+// Also checks that expanding the indices gives back loadObj's array exactly,
+// and that uint16 meshes never need the restart index 0xFFFF.
+//
+// Usage: IndexedMeshBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshLoader.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+
+static void run(const std::string &objFile, int reps) {
+  MeshLoadOptions options;
+  options.useMmap = true;
+  options.parseThreads = 0;
+
+  std::vector<Vertex> flat;
+  double flatMs =
+      bench::bestOf(reps, [&] { flat = MeshLoader::loadObj(objFile, options); });
+  IndexedMesh mesh;
+  double indexedMs = bench::bestOf(
+      reps, [&] { mesh = MeshLoader::loadObjIndexed(objFile, options); });
+  MeshLoadOptions streamOptions;
+  streamOptions.streaming = true;
+  IndexedMesh streamed;
+  double streamedMs = bench::bestOf(reps, [&] {
+    streamed = MeshLoader::loadObjIndexed(objFile, streamOptions);
+  });
+
+  bool same = mesh.indices.size() == flat.size() &&
+              streamed.indices == mesh.indices &&
+              streamed.vertices.size() == mesh.vertices.size();
+  for (size_t i = 0; same && i < flat.size(); i++)
+    same = memcmp(&flat[i], &mesh.vertices[mesh.indices[i]], sizeof(Vertex)) ==
+           0;
+
+  double flatKB = flat.size() * sizeof(Vertex) / 1024.0;
+  double indexedKB = (mesh.vertices.size() * sizeof(Vertex) +
+                      mesh.indices.size() * mesh.indexSize()) /
+                     1024.0;
+  printf("%s\n", objFile.c_str());
+  printf("  corners %zu -> vertices %zu (%.2fx fewer vertex shader runs), "
+         "uint%zu indices\n",
+         flat.size(), mesh.vertices.size(),
+         double(flat.size()) / double(mesh.vertices.size()),
+         8 * mesh.indexSize());
+  printf("  buffers %.1f KB -> %.1f KB (%.2fx)\n", flatKB, indexedKB,
+         flatKB / indexedKB);
+  printf("  loadObj %.2f ms | loadObjIndexed %.2f ms | streaming %.2f ms%s\n",
+         flatMs, indexedMs, streamedMs, same ? "" : " | MISMATCH");
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  // 0xFFFF is uint16's primitive restart, so 65536 vertices need uint32
+  bool narrow = indexSizeFor(0xFFFF) == 2 && indexSizeFor(0x10000) == 4;
+  printf("uint16 indices up to 65535 vertices%s\n",
+         narrow ? "" : " | MISMATCH");
+  run("monke.obj", 10);
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  run(big, 3);
+  return narrow ? 0 : 1;
+}
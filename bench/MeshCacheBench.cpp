@@ -0,0 +1,85 @@
+// Cold vs warm startup for the mesh load in Renderer::buildBuffers:
+//   cold = parse the OBJ + write the MeshCache
+//   warm = mmap the MeshCache + one copy into a "vertex buffer"
+// and checks that a header whose counts overflow the size check is refused.
+//
+// Usage: MeshCacheBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshCache.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+
+// A copy of `cacheFile` whose vertex count is off by 2^60: 2^60 * 48 bytes
+// wraps to 0, so a size check that multiplies first would take it
+static bool rejectsWrappedCount(const std::string &cacheFile,
+                                const std::string &objFile) {
+  std::string bad = cacheFile + ".bad";
+  FILE *in = fopen(cacheFile.c_str(), "rb");
+  if (!in)
+    return false;
+  std::vector<char> bytes;
+  char buf[1 << 16];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    bytes.insert(bytes.end(), buf, buf + n);
+  fclose(in);
+  MeshCacheHeader h;
+  memcpy(&h, bytes.data(), sizeof(h));
+  h.vertexCount += uint64_t(1) << 60;
+  memcpy(bytes.data(), &h, sizeof(h));
+  FILE *out = fopen(bad.c_str(), "wb");
+  if (!out)
+    return false;
+  fwrite(bytes.data(), 1, bytes.size(), out);
+  fclose(out);
+  MeshCache cache;
+  bool rejected = !cache.open(bad, objFile);
+  remove(bad.c_str());
+  return rejected;
+}
+
+static bool run(const std::string &objFile, int reps) {
+  std::string cacheFile = objFile + ".meshcache";
+  MeshLoadOptions options;
+  options.useMmap = true;
+  options.parseThreads = 0;
+
+  size_t count = 0;
+  double cold = bench::bestOf(reps, [&] {
+    remove(cacheFile.c_str());
+    std::vector<Vertex> mesh = MeshLoader::loadObj(objFile, options);
+    MeshCache::write(cacheFile, objFile, mesh);
+    count = mesh.size();
+  });
+
+  std::vector<Vertex> gpuBuffer; // stand-in for the MTL::Buffer
+  bool ok = true;
+  double warm = bench::bestOf(reps, [&] {
+    MeshCache cache;
+    ok = cache.open(cacheFile, objFile) && cache.vertexCount() == count;
+    if (ok)
+      gpuBuffer.assign(cache.vertices(), cache.vertices() + count);
+  });
+
+  bool rejected = rejectsWrappedCount(cacheFile, objFile);
+  printf("%-28s %9zu verts | cold %9.2f ms | warm %8.2f ms | %6.1fx%s%s\n",
+         objFile.c_str(), count, cold, warm, cold / warm,
+         ok ? "" : " | CACHE MISS",
+         rejected ? "" : " | CORRUPT HEADER ACCEPTED");
+  remove(cacheFile.c_str());
+  return ok && rejected;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = run("monke.obj", 10);
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  ok = run(big, 3) && ok;
+  return ok ? 0 : 1;
+}
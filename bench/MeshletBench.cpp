@@ -0,0 +1,119 @@
+// MeshletBuilder on the spinning monke (and a big grid for build speed):
+// meshlet stats, then how many triangles cone culling rejects at various
+// angles, next to the per-triangle backface count (the most it could
+// reject). Culling is checked to be conservative: a culled meshlet with a
+// front-facing triangle counts as an error.
+//
+// The renderer spins monke about the view axis, which never changes what
+// faces away, so the sweep also turns it about the vertical axis like a
+// turntable. Views are orthographic down +z, as in Renderer (clip space,
+// smaller z is nearer).
+//
+// Usage: MeshletBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshOptimizer.hpp"
+#include "../MeshletBuilder.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+
+// View direction in model space for a model rotated by `angle` about `axis`
+// (0 = x, 1 = y, 2 = z): the inverse rotation applied to +z.
+static void viewDirFor(int axis, float angle, float dir[3]) {
+  float c = std::cos(angle), s = std::sin(angle);
+  float v[3] = {0, 0, 1};
+  int a = (axis + 1) % 3, b = (axis + 2) % 3;
+  dir[axis] = v[axis];
+  dir[a] = c * v[a] + s * v[b];
+  dir[b] = -s * v[a] + c * v[b];
+}
+
+static bool frontFacing(const float *p0, const float *p1, const float *p2,
+                        const float dir[3]) {
+  float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+  float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+  float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0]};
+  return n[0] * dir[0] + n[1] * dir[1] + n[2] * dir[2] <= 0;
+}
+
+static void stats(const std::string &name, const IndexedMesh &mesh,
+                  const MeshletMesh &ml, double ms) {
+  size_t v = 0, t = 0, cullable = 0;
+  for (const Meshlet &m : ml.meshlets) {
+    v += m.vertexCount;
+    t += m.triangleCount;
+    cullable += m.coneCutoff < 1.0f;
+  }
+  size_t n = ml.meshlets.size();
+  printf("%s: %zu tris -> %zu meshlets in %.2f ms | avg %.1f verts %.1f tris "
+         "| %zu with a usable cone | %.2f vertex refs per vertex\n",
+         name.c_str(), mesh.indices.size() / 3, n, ms, double(v) / n,
+         double(t) / n, cullable, double(v) / mesh.vertices.size());
+}
+
+static void sweep(const IndexedMesh &mesh, const MeshletMesh &ml, int axis) {
+  const char *names[] = {"x", "y", "z"};
+  std::vector<uint32_t> visible;
+  size_t total = mesh.indices.size() / 3;
+  for (int deg = 0; deg < 360; deg += 45) {
+    float dir[3];
+    viewDirFor(axis, deg * float(M_PI) / 180.0f, dir);
+    size_t culled = MeshletBuilder::cull(ml, dir, visible);
+
+    size_t backfacing = 0, wrong = 0;
+    for (size_t i = 0; i < mesh.indices.size(); i += 3)
+      backfacing += !frontFacing(mesh.vertices[mesh.indices[i]].position,
+                                 mesh.vertices[mesh.indices[i + 1]].position,
+                                 mesh.vertices[mesh.indices[i + 2]].position,
+                                 dir);
+    size_t next = 0;
+    for (uint32_t i = 0; i < ml.meshlets.size(); i++) {
+      if (next < visible.size() && visible[next] == i) {
+        next++;
+        continue;
+      }
+      const Meshlet &m = ml.meshlets[i];
+      for (uint32_t t = 0; t < m.triangleCount; t++) {
+        const float *p[3];
+        for (int k = 0; k < 3; k++) {
+          uint8_t l = ml.triangles[3 * (size_t(m.triangleOffset) + t) + k];
+          p[k] = mesh.vertices[ml.vertices[m.vertexOffset + l]].position;
+        }
+        wrong += frontFacing(p[0], p[1], p[2], dir);
+      }
+    }
+    printf("  about %s %3d deg: culled %4zu/%zu meshlets, %5.1f%% of tris "
+           "(backfacing %5.1f%%)%s\n",
+           names[axis], deg, ml.meshlets.size() - visible.size(),
+           ml.meshlets.size(), 100.0 * culled / total,
+           100.0 * backfacing / total,
+           wrong ? " | CULLED FRONT FACES" : "");
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  MeshLoadOptions options;
+  options.useMmap = true;
+  options.parseThreads = 0;
+
+  IndexedMesh monke = MeshLoader::loadObjIndexed("monke.obj", options);
+  MeshOptimizer::optimize(monke);
+  MeshletMesh ml;
+  double ms = bench::bestOf(10, [&] { ml = MeshletBuilder::build(monke); });
+  stats("monke.obj", monke, ml, ms);
+  sweep(monke, ml, 2);
+  sweep(monke, ml, 1);
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  IndexedMesh grid = MeshLoader::loadObjIndexed(big, options);
+  MeshOptimizer::optimize(grid);
+  ms = bench::bestOf(3, [&] { ml = MeshletBuilder::build(grid); });
+  stats(big, grid, ml, ms);
+  return 0;
+}
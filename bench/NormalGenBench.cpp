@@ -0,0 +1,255 @@
+// NormalGenerator: correctness, then throughput against the thread count.
+//   monke.obj is flat shaded ("s 0", one vn per face), so generating with
+//   the file's smoothing groups must give back the file's normals, and
+//   MeshLoader::loadObj on a copy with the vn records stripped must too.
+//   Stripped and smoothed, the copy must load to the same normals with a
+//   "g" line splitting its faces into two shapes: groups span shapes.
+//   Smoothed (every face in group 1), it's checked against a plain double
+//   precision reference (exact angles, one map entry per position/group).
+//   Then a wavy grid of [triangles] triangles built in memory, split into
+//   two smoothing groups down the middle, is timed at 1, 2, 4 ... threads,
+//   and each result must match the 1-thread one bit for bit.
+//
+// Usage: NormalGenBench [triangles]   (default 10M for the grid)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshLoader.hpp"
+#include "BenchUtil.hpp"
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <thread>
+
+struct Faces {
+  std::vector<float> positions;
+  std::vector<uint32_t> corners;
+  std::vector<uint32_t> faceStart{0};
+  std::vector<unsigned> groups;
+  size_t faceCount() const { return faceStart.size() - 1; }
+};
+
+static Faces fromShape(const tinyobj::attrib_t &attrib,
+                       const tinyobj::mesh_t &mesh) {
+  Faces f;
+  f.positions = attrib.vertices;
+  for (const tinyobj::index_t &idx : mesh.indices)
+    f.corners.push_back(uint32_t(idx.vertex_index));
+  for (unsigned n : mesh.num_face_vertices)
+    f.faceStart.push_back(f.faceStart.back() + n);
+  f.groups = mesh.smoothing_group_ids;
+  return f;
+}
+
+static std::vector<float> generate(const Faces &f, unsigned threads = 0) {
+  return NormalGenerator::generate(
+      f.positions.data(), f.positions.size() / 3, f.corners.data(),
+      f.faceStart.data(), f.faceCount(), f.groups.data(), threads);
+}
+
+// Straightforward version of the same weighting, for comparison.
+static std::vector<float> reference(const Faces &f) {
+  std::map<std::pair<uint32_t, unsigned>, std::array<double, 3>> sums;
+  std::vector<std::array<double, 3>> own(f.corners.size());
+  for (size_t face = 0; face < f.faceCount(); face++) {
+    uint32_t s = f.faceStart[face], n = f.faceStart[face + 1] - s;
+    for (uint32_t k = 0; k < n; k++) {
+      const float *p = &f.positions[3 * f.corners[s + k]];
+      const float *a = &f.positions[3 * f.corners[s + (k + 1) % n]];
+      const float *b = &f.positions[3 * f.corners[s + (k + n - 1) % n]];
+      double e1[3], e2[3];
+      for (int c = 0; c < 3; c++) {
+        e1[c] = double(a[c]) - p[c];
+        e2[c] = double(b[c]) - p[c];
+      }
+      double cr[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                      e1[2] * e2[0] - e1[0] * e2[2],
+                      e1[0] * e2[1] - e1[1] * e2[0]};
+      double angle =
+          std::atan2(std::sqrt(cr[0] * cr[0] + cr[1] * cr[1] + cr[2] * cr[2]),
+                     e1[0] * e2[0] + e1[1] * e2[1] + e1[2] * e2[2]);
+      std::array<double, 3> &sum = sums[{f.corners[s + k], f.groups[face]}];
+      for (int c = 0; c < 3; c++) {
+        own[s + k][c] = cr[c] * angle;
+        sum[c] += cr[c] * angle;
+      }
+    }
+  }
+  std::vector<float> out(3 * f.corners.size());
+  for (size_t face = 0; face < f.faceCount(); face++) {
+    for (uint32_t c = f.faceStart[face]; c < f.faceStart[face + 1]; c++) {
+      std::array<double, 3> n =
+          f.groups[face] ? sums[{f.corners[c], f.groups[face]}] : own[c];
+      double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (int k = 0; k < 3; k++)
+        out[3 * c + k] = len > 0 ? float(n[k] / len) : (k == 2 ? 1.0f : 0.0f);
+    }
+  }
+  return out;
+}
+
+// Largest angle (degrees) between matching normals of a and b. Not
+// assuming unit length: the file's vn are rounded to 4 decimals.
+static double maxAngle(const float *a, const float *b, size_t count,
+                       size_t strideA = 3, size_t strideB = 3) {
+  double worst = 0;
+  for (size_t i = 0; i < count; i++) {
+    const float *x = a + strideA * i, *y = b + strideB * i;
+    double d = double(x[0]) * y[0] + double(x[1]) * y[1] + double(x[2]) * y[2];
+    double lx = std::sqrt(double(x[0]) * x[0] + double(x[1]) * x[1] +
+                          double(x[2]) * x[2]);
+    double ly = std::sqrt(double(y[0]) * y[0] + double(y[1]) * y[1] +
+                          double(y[2]) * y[2]);
+    d /= std::max(lx * ly, 1e-30);
+    worst = std::max(worst, std::acos(std::min(1.0, std::max(-1.0, d))));
+  }
+  return worst * 180.0 / M_PI;
+}
+
+// monke.obj without its vn records, as `path`. smooth: "s 1" for "s 0".
+// With `group`, a "g" line goes before face `splitAt`.
+static void writeStripped(const std::string &path, bool smooth,
+                          const char *group = nullptr, int splitAt = 0) {
+  std::ifstream in("monke.obj");
+  std::ofstream out(path);
+  int face = 0;
+  for (std::string line; std::getline(in, line);) {
+    if (line.compare(0, 3, "vn ") == 0)
+      continue;
+    if (smooth && line == "s 0")
+      line = "s 1";
+    if (line.compare(0, 2, "f ") == 0) {
+      if (group && face++ == splitAt)
+        out << "g " << group << "\n";
+      // "a/b/c" -> "a/b"
+      std::string f;
+      for (size_t i = 0, slashes = 0; i < line.size(); i++) {
+        slashes = line[i] == ' ' ? 0 : slashes + (line[i] == '/');
+        if (slashes < 2)
+          f += line[i];
+      }
+      line = f;
+    }
+    out << line << "\n";
+  }
+}
+
+static bool checkMonke() {
+  tinyobj::ObjReader reader;
+  tinyobj::ObjReaderConfig config;
+  config.mtl_search_path = "./";
+  if (!reader.ParseFromFile("monke.obj", config) ||
+      reader.GetShapes().empty()) {
+    fprintf(stderr, "Could not load monke.obj\n");
+    return false;
+  }
+  const tinyobj::attrib_t &attrib = reader.GetAttrib();
+  const tinyobj::mesh_t &mesh = reader.GetShapes()[0].mesh;
+  Faces faces = fromShape(attrib, mesh);
+  bool ok = true;
+
+  // Flat: the file's own normals
+  std::vector<float> flat = generate(faces), fileNormals;
+  for (const tinyobj::index_t &idx : mesh.indices)
+    for (int k = 0; k < 3; k++)
+      fileNormals.push_back(attrib.normals[3 * idx.normal_index + k]);
+  double err = maxAngle(flat.data(), fileNormals.data(), mesh.indices.size());
+  ok = ok && err < 0.01;
+  printf("monke.obj  s 0    vs file normals     max %.4f deg | %s\n", err,
+         err < 0.01 ? "OK" : "MISMATCH");
+
+  // Smooth: against the reference
+  std::fill(faces.groups.begin(), faces.groups.end(), 1u);
+  std::vector<float> smooth = generate(faces), ref = reference(faces);
+  err = maxAngle(smooth.data(), ref.data(), mesh.indices.size());
+  ok = ok && err < 0.01;
+  printf("monke.obj  s 1    vs reference        max %.4f deg | %s\n", err,
+         err < 0.01 ? "OK" : "MISMATCH");
+
+  // End to end: loadObj on monke.obj without its vn records
+  std::string stripped = "build/bench/monke_nonormals.obj";
+  writeStripped(stripped, false);
+  std::vector<Vertex> with = MeshLoader::loadObj("monke.obj");
+  std::vector<Vertex> without = MeshLoader::loadObj(stripped);
+  err = with.size() == without.size() && !with.empty()
+            ? maxAngle(with[0].normal, without[0].normal, with.size(), 12, 12)
+            : 180.0;
+  ok = ok && err < 0.01;
+  printf("monke.obj  loadObj without vn        max %.4f deg | %s\n", err,
+         err < 0.01 ? "OK" : "MISMATCH");
+
+  // Smoothed, whole and cut into two shapes mid-mesh
+  writeStripped(stripped, true);
+  std::vector<Vertex> whole = MeshLoader::loadObj(stripped);
+  writeStripped(stripped, true, "back", int(mesh.num_face_vertices.size()) / 2);
+  MeshParts parts;
+  std::vector<Vertex> split = MeshLoader::loadObj(stripped, {}, &parts);
+  bool same = parts.shapes.size() == 2 && whole.size() == split.size() &&
+              !whole.empty();
+  for (size_t i = 0; same && i < whole.size(); i++)
+    same = memcmp(whole[i].normal, split[i].normal, sizeof(float) * 3) == 0;
+  ok = ok && same;
+  printf("monke.obj  s 1 split by g, loadObj   %s\n",
+         same ? "same normals | OK" : "CREASED | MISMATCH");
+  remove(stripped.c_str());
+  return ok;
+}
+
+// (n + 1)^2 positions, 2n^2 triangles, left and right halves in smoothing
+// groups 1 and 2.
+static Faces makeGrid(size_t triangles) {
+  size_t n = std::max<size_t>(1, size_t(std::sqrt(double(triangles / 2))));
+  Faces f;
+  f.positions.reserve(3 * (n + 1) * (n + 1));
+  for (size_t y = 0; y <= n; y++) {
+    for (size_t x = 0; x <= n; x++) {
+      float fx = float(x) / float(n) * 2.0f - 1.0f;
+      float fy = float(y) / float(n) * 2.0f - 1.0f;
+      f.positions.insert(f.positions.end(),
+                         {fx, fy, 0.1f * std::sin(fx * 10.0f) *
+                                      std::cos(fy * 10.0f)});
+    }
+  }
+  f.corners.reserve(6 * n * n);
+  f.faceStart.reserve(2 * n * n + 1);
+  f.groups.reserve(2 * n * n);
+  for (size_t y = 0; y < n; y++) {
+    for (size_t x = 0; x < n; x++) {
+      uint32_t a = uint32_t(y * (n + 1) + x), b = a + 1;
+      uint32_t c = a + uint32_t(n) + 1, d = c + 1;
+      f.corners.insert(f.corners.end(), {a, b, d, a, d, c});
+      for (int t = 0; t < 2; t++) {
+        f.faceStart.push_back(f.faceStart.back() + 3);
+        f.groups.push_back(x < n / 2 ? 1 : 2);
+      }
+    }
+  }
+  return f;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = checkMonke();
+
+  Faces grid = makeGrid(tris);
+  std::vector<float> base;
+  double baseMs = 0;
+  unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+  for (unsigned t = 1; t <= maxThreads; t *= 2) {
+    std::vector<float> normals;
+    double ms = bench::bestOf(3, [&] { normals = generate(grid, t); });
+    bool same = true;
+    if (t == 1) {
+      base = std::move(normals);
+      baseMs = ms;
+    } else {
+      same = normals == base;
+    }
+    ok = ok && same;
+    printf("grid %9zu tris  x%-2u threads %9.2f ms | %7.1f Mtri/s | %.2fx | "
+           "%s\n",
+           grid.faceCount(), t, ms, grid.faceCount() / ms / 1e3, baseMs / ms,
+           same ? "identical" : "MISMATCH");
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+// Compares tinyobj::ObjReader::ParseFromFile (ifstream + safeGetline) against
+// the mmap path (ObjReaderConfig::use_mmap -> LoadObjMapped), then sweeps the
+// thread count of the parallel mmap parser (LoadObjMappedParallel).
+// Then counts heap allocations and peak heap use of the mmap parse and of
+// MeshLoader::loadObj with and without the counting pre-scan
+// (ObjReaderConfig::prescan), and checks the pre-scan reserved every array
+// at exactly its final size. First, a file whose last group is a polygon
+// that triangulates to nothing must come out with the same shapes from the
+// serial and the parallel parser.
+//
+// Usage: ObjLoadBench [triangles]   (default 10M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshLoader.hpp"
+#include "AllocCounter.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+static bool parse(const std::string &file, bool useMmap, unsigned threads,
+                  tinyobj::ObjReader &reader, bool prescan = true) {
+  tinyobj::ObjReaderConfig config;
+  config.mtl_search_path = "./";
+  config.use_mmap = useMmap;
+  config.num_threads = threads;
+  config.prescan = prescan;
+  return reader.ParseFromFile(file, config);
+}
+
+template <typename T> static bool exact(const std::vector<T> &v) {
+  return v.capacity() == v.size();
+}
+
+// Did the parse allocate every array it fills at exactly its final size?
+static bool exactlyReserved(const tinyobj::ObjReader &r) {
+  const tinyobj::attrib_t &a = r.GetAttrib();
+  bool ok = exact(a.vertices) && exact(a.normals) && exact(a.texcoords) &&
+            exact(a.colors) && exact(r.GetShapes());
+  for (const tinyobj::shape_t &shape : r.GetShapes())
+    ok = ok && exact(shape.mesh.indices) &&
+         exact(shape.mesh.num_face_vertices) && exact(shape.mesh.material_ids) &&
+         exact(shape.mesh.smoothing_group_ids);
+  return ok;
+}
+
+static bool sameResult(const tinyobj::ObjReader &x,
+                       const tinyobj::ObjReader &y) {
+  bool same = x.Valid() && y.Valid() &&
+              x.GetAttrib().vertices == y.GetAttrib().vertices &&
+              x.GetAttrib().normals == y.GetAttrib().normals &&
+              x.GetAttrib().texcoords == y.GetAttrib().texcoords &&
+              x.GetShapes().size() == y.GetShapes().size();
+  for (size_t s = 0; same && s < x.GetShapes().size(); s++) {
+    same = x.GetShapes()[s].name == y.GetShapes()[s].name;
+    const auto &a = x.GetShapes()[s].mesh;
+    const auto &b = y.GetShapes()[s].mesh;
+    same = same && a.num_face_vertices == b.num_face_vertices &&
+           a.material_ids == b.material_ids &&
+           a.smoothing_group_ids == b.smoothing_group_ids &&
+           a.indices.size() == b.indices.size();
+    for (size_t i = 0; same && i < a.indices.size(); i++)
+      same = a.indices[i].vertex_index == b.indices[i].vertex_index &&
+             a.indices[i].normal_index == b.indices[i].normal_index &&
+             a.indices[i].texcoord_index == b.indices[i].texcoord_index;
+  }
+  return same;
+}
+
+// Six groups of triangles, big enough to split into chunks, then a group
+// holding only a self-intersecting pentagon that ear clipping gives no
+// triangles for. The serial parser still keeps that last, empty shape.
+static bool checkEmptyLastShape() {
+  std::string file = "build/bench/empty_last_shape.obj";
+  {
+    std::ofstream out(file);
+    const int rows = 300, cols = 300;
+    for (int y = 0; y <= rows; y++)
+      for (int x = 0; x <= cols; x++)
+        out << "v " << x << " " << y << " 0\n";
+    for (int g = 0; g < 6; g++) {
+      out << "g part" << g << "\n";
+      for (int y = g * rows / 6; y < (g + 1) * rows / 6; y++) {
+        for (int x = 0; x < cols; x++) {
+          int a = y * (cols + 1) + x + 1, b = a + cols + 1;
+          out << "f " << a << " " << a + 1 << " " << b + 1 << "\n";
+          out << "f " << a << " " << b + 1 << " " << b << "\n";
+        }
+      }
+    }
+    out << "v 2 -2 0\nv -2 3 0\nv 1 1 0\nv 0 2 0\nv 3 1 0\n"
+        << "g tail\nf -5 -4 -3 -2 -1\n";
+  }
+  tinyobj::ObjReader serial;
+  bool ok = parse(file, true, 1, serial) && serial.GetShapes().size() == 7 &&
+            serial.GetShapes()[6].mesh.indices.empty();
+  for (unsigned t : {2u, 4u}) {
+    tinyobj::ObjReader parallel;
+    ok = parse(file, true, t, parallel) && sameResult(serial, parallel) && ok;
+  }
+  printf("%-28s serial vs parallel, empty last shape | %s\n",
+         "empty_last_shape.obj", ok ? "identical" : "MISMATCH");
+  remove(file.c_str());
+  return ok;
+}
+
+static bool run(const std::string &file, int reps) {
+  bool ok = true;
+  tinyobj::ObjReader stream, mapped;
+  double tStream = bench::bestOf(reps, [&] { parse(file, false, 1, stream); });
+  double tMapped = bench::bestOf(reps, [&] { parse(file, true, 1, mapped); });
+
+  bool same = sameResult(stream, mapped);
+  ok = ok && same;
+  printf("%-28s ParseFromFile %9.2f ms | mmap %9.2f ms | %.2fx | %s\n",
+         file.c_str(), tStream, tMapped, tStream / tMapped,
+         same ? "identical" : "MISMATCH");
+
+  unsigned maxThreads = std::thread::hardware_concurrency();
+  for (unsigned t = 2; t <= maxThreads * 2 && t <= 64; t *= 2) {
+    tinyobj::ObjReader parallel;
+    double tPar = bench::bestOf(reps, [&] { parse(file, true, t, parallel); });
+    same = sameResult(mapped, parallel);
+    ok = ok && same;
+    printf("%-28s mmap x%-2u threads %9.2f ms | %.2fx vs 1 thread | %s\n",
+           file.c_str(), t, tPar, tMapped / tPar,
+           same ? "identical" : "MISMATCH");
+  }
+
+  // Allocations, with and without the pre-scan
+  for (unsigned threads : {1u, 4u}) {
+    for (bool prescan : {false, true}) {
+      tinyobj::ObjReader reader;
+      double ms = bench::bestOf(
+          reps, [&] { parse(file, true, threads, reader, prescan); });
+      tinyobj::ObjReader counted;
+      AllocStats st = measureAllocs(
+          [&] { parse(file, true, threads, counted, prescan); });
+      same = sameResult(mapped, counted);
+      ok = ok && same;
+      printf("%-28s mmap %-7s prescan %-3s %9.2f ms | %8zu allocs | %8.1f "
+             "MB allocated | peak %7.1f MB | %s%s\n",
+             file.c_str(), threads == 1 ? "serial" : "x4",
+             prescan ? "on" : "off", ms, st.allocs, st.bytes / 1e6,
+             st.peak / 1e6, same ? "identical" : "MISMATCH",
+             prescan ? (exactlyReserved(counted) ? ", exact reserve"
+                                                 : ", NOT EXACT")
+                     : "");
+    }
+  }
+  for (bool prescan : {false, true}) {
+    MeshLoadOptions options;
+    options.useMmap = true;
+    options.prescan = prescan;
+    std::vector<Vertex> vertices;
+    AllocStats st =
+        measureAllocs([&] { vertices = MeshLoader::loadObj(file, options); });
+    printf("%-28s MeshLoader::loadObj prescan %-3s | %8zu allocs | %8.1f MB "
+           "allocated | peak %7.1f MB\n",
+           file.c_str(), prescan ? "on" : "off", st.allocs, st.bytes / 1e6,
+           st.peak / 1e6);
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = checkEmptyLastShape();
+  ok = run("monke.obj", 20) && ok;
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  ok = run(big, 3) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// PackedVertex round trip (VertexPacker::pack -> unpackVertex, the same math
+// as vertex_main_packed) against its error bounds, plus encode speed and the
+// vertex bandwidth saved. Exits non-zero if any bound is broken.
+//
+// Bounds: position within half a quantization step of the mesh extent
+// (+ float rounding), normals within kMaxNormalError radians, colors within
+// half a unorm8 step.
+//
+// Usage: PackedVertexBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../PackedVertex.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <random>
+
+static const double kMaxNormalError = 1e-4; // radians; measured max ~6.5e-5
+
+static double angleBetween(const float a[3], const float b[3]) {
+  double la = std::sqrt(double(a[0]) * a[0] + double(a[1]) * a[1] + double(a[2]) * a[2]);
+  double lb = std::sqrt(double(b[0]) * b[0] + double(b[1]) * b[1] + double(b[2]) * b[2]);
+  double d = (double(a[0]) * b[0] + double(a[1]) * b[1] + double(a[2]) * b[2]) /
+             (la * lb);
+  return std::acos(d > 1 ? 1 : (d < -1 ? -1 : d));
+}
+
+static bool check(const std::string &name, const std::vector<Vertex> &in) {
+  PackedMesh packed;
+  double ms = bench::bestOf(3, [&] {
+    packed = VertexPacker::pack(in.data(), in.size());
+  });
+
+  double posErr = 0, normErr = 0, colorErr = 0;
+  bool ok = true;
+  for (size_t i = 0; i < in.size(); i++) {
+    Vertex out = VertexPacker::unpackVertex(packed.vertices[i], packed.info);
+    for (int k = 0; k < 3; k++) {
+      double step = packed.info.boundsExtent[k] / 65535.0;
+      double e = std::fabs(double(out.position[k]) - in[i].position[k]);
+      // Half a step, plus a few ulps of the dequantize arithmetic
+      ok &= e <= 0.5 * step + 4e-7 * (std::fabs(in[i].position[k]) +
+                                      packed.info.boundsExtent[k]);
+      posErr = std::fmax(posErr, e / step);
+    }
+    ok &= out.position[3] == 1.0f && out.normal[3] == 0.0f;
+    double a = angleBetween(in[i].normal, out.normal);
+    normErr = std::fmax(normErr, a);
+    for (int k = 0; k < 4; k++)
+      colorErr = std::fmax(colorErr,
+                           std::fabs(double(out.color[k]) - in[i].color[k]));
+  }
+  ok &= normErr <= kMaxNormalError && colorErr <= 0.5 / 255.0 + 1e-6;
+
+  printf("%-32s %9zu verts | pack %7.2f ms | %5.1f MB -> %5.1f MB | max err: "
+         "pos %.3f steps, normal %.2e rad, color %.4f | %s\n",
+         name.c_str(), in.size(), ms, in.size() * sizeof(Vertex) / 1e6,
+         in.size() * sizeof(PackedVertex) / 1e6, posErr, normErr, colorErr,
+         ok ? "OK" : "OUT OF BOUNDS");
+  return ok;
+}
+
+// Random directions (incl. axis-aligned and -z hemisphere edge cases),
+// positions and colors, to cover what the meshes don't.
+static std::vector<Vertex> randomVertices(size_t count) {
+  std::mt19937 rng(42);
+  std::normal_distribution<float> gauss;
+  std::uniform_real_distribution<float> uni(-100.0f, 100.0f);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<Vertex> v(count);
+  const float axes[6][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0},
+                            {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+  for (size_t i = 0; i < count; i++) {
+    float n[3] = {gauss(rng), gauss(rng), gauss(rng)};
+    if (i < 6)
+      memcpy(n, axes[i], sizeof(n));
+    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (int k = 0; k < 3; k++) {
+      v[i].position[k] = uni(rng);
+      v[i].normal[k] = n[k] / len;
+    }
+    v[i].position[3] = 1.0f;
+    v[i].normal[3] = 0.0f;
+    for (int k = 0; k < 4; k++)
+      v[i].color[k] = unit(rng);
+  }
+  return v;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  MeshLoadOptions options;
+  options.useMmap = true;
+  options.parseThreads = 0;
+
+  bool ok = check("monke.obj",
+                  MeshLoader::loadObjIndexed("monke.obj", options).vertices);
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  ok &= check(big, MeshLoader::loadObjIndexed(big, options).vertices);
+  ok &= check("random", randomVertices(1000000));
+  return ok ? 0 : 1;
+}
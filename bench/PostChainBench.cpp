@@ -0,0 +1,305 @@
+// PostProcessor's fusion on monke's frame. Checks how chains are cut into
+// passes; that the fused CPU passes give exactly what running the effects
+// one at a time over whole float frames gives (on one thread and several);
+// that the [edges] chain is SoftwareRenderer::postProcess() pixel for
+// pixel; and that CpuBackend runs the graph passes addPasses() declares to
+// the same frame, each generated pipeline carrying its pass while the
+// default [edges] chain keeps Shaders.metal's post_fragment_main. Then
+// times a longer chain fused and one pass per effect, with the colour and
+// depth traffic each moves.
+//
+// Usage: PostChainBench [size] [--msl]   (default 1000; --msl prints the
+//                                          generated Metal for the chain)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../CpuBackend.hpp"
+#include "../MeshAsset.hpp"
+#include "../PostProcessor.hpp"
+#include "../RenderGraph.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <cstring>
+
+static bool expect(bool ok, const char *what) {
+  printf("%-58s %s\n", what, ok ? "OK" : "MISMATCH");
+  return ok;
+}
+
+template <typename Effect, typename... Args>
+static void add(PostProcessor &post, Args... args) {
+  post.add(std::unique_ptr<PostEffect>(new Effect(args...)));
+}
+
+// edges, saturation, sharpen, vignette: all fuse into one pass
+static void longChain(PostProcessor &post) {
+  add<DepthEdgeEffect>(post);
+  add<SaturationEffect>(post);
+  add<SharpenEffect>(post);
+  add<VignetteEffect>(post);
+}
+
+// The chain the slow way: each effect over a whole frame of floats, the
+// pass's input unpacked once and its output packed once, as the plan
+// says. No rings, no row bands, no effects run in place.
+static std::vector<uint32_t> reference(PostProcessor &post,
+                                       const std::vector<uint32_t> &color,
+                                       const std::vector<float> &depth,
+                                       int width, int height) {
+  std::vector<uint32_t> in = color, out(color.size());
+  std::vector<float> a(color.size() * 4), b(a.size());
+  std::vector<const float *> rows;
+  for (const std::unique_ptr<PostPass> &pass : post.passes()) {
+    for (size_t i = 0; i < in.size(); i++) {
+      uint32_t c = in[i];
+      a[4 * i] = float((c >> 16) & 0xff) * (1.0f / 255.0f);
+      a[4 * i + 1] = float((c >> 8) & 0xff) * (1.0f / 255.0f);
+      a[4 * i + 2] = float(c & 0xff) * (1.0f / 255.0f);
+      a[4 * i + 3] = float(c >> 24) * (1.0f / 255.0f);
+    }
+    for (const PostEffect *effect : pass->effects()) {
+      int r = effect->radius();
+      rows.resize(2 * r + 1);
+      PostRow row;
+      row.width = width;
+      row.height = height;
+      row.radius = r;
+      row.rows = rows.data();
+      row.depth = depth.data();
+      for (int y = 0; y < height; y++) {
+        for (int dy = -r; dy <= r; dy++) {
+          int ry = std::min(std::max(y + dy, 0), height - 1);
+          rows[dy + r] = &a[size_t(ry) * width * 4];
+        }
+        row.y = y;
+        effect->run(row, &b[size_t(y) * width * 4]);
+      }
+      a.swap(b);
+    }
+    for (size_t i = 0; i < in.size(); i++)
+      out[i] = SoftwareRenderer::packColor(a[4 * i], a[4 * i + 1],
+                                           a[4 * i + 2], a[4 * i + 3]);
+    in.swap(out);
+  }
+  return in;
+}
+
+static bool checkPlans() {
+  bool ok = true;
+  struct Case {
+    const char *what, *plan;
+    void (*build)(PostProcessor &);
+  } cases[] = {
+      {"empty chain is one copy pass", "[copy]", [](PostProcessor &) {}},
+      {"per-pixel effects fuse", "[edges+saturation+vignette]",
+       [](PostProcessor &p) {
+         add<DepthEdgeEffect>(p);
+         add<SaturationEffect>(p);
+         add<VignetteEffect>(p);
+       }},
+      {"one small gather fuses with per-pixel effects",
+       "[edges+saturation+sharpen+vignette]", longChain},
+      {"two gathers don't share a pass", "[sharpen] [blur+vignette]",
+       [](PostProcessor &p) {
+         add<SharpenEffect>(p);
+         add<BoxBlurEffect>(p, 1);
+         add<VignetteEffect>(p);
+       }},
+      {"a wide gather starts a pass", "[edges+saturation] [blur+vignette]",
+       [](PostProcessor &p) {
+         add<DepthEdgeEffect>(p);
+         add<SaturationEffect>(p);
+         add<BoxBlurEffect>(p, 4);
+         add<VignetteEffect>(p);
+       }},
+  };
+  for (const Case &c : cases) {
+    PostProcessor post;
+    c.build(post);
+    std::string plan = post.describe();
+    post.setFusion(false);
+    printf("fused %s | unfused %s\n", plan.c_str(), post.describe().c_str());
+    ok = expect(plan == c.plan, c.what) && ok;
+  }
+  return ok;
+}
+
+static bool checkChains(const std::vector<uint32_t> &color,
+                        const std::vector<float> &depth, int size) {
+  bool ok = true;
+  std::vector<uint32_t> out(color.size()), threaded(color.size());
+  void (*chains[])(PostProcessor &) = {
+      longChain,
+      [](PostProcessor &p) {
+        add<DepthEdgeEffect>(p);
+        add<BoxBlurEffect>(p, 2);
+        add<SaturationEffect>(p);
+        add<BoxBlurEffect>(p, 3);
+        add<VignetteEffect>(p);
+      },
+  };
+  for (auto build : chains) {
+    PostProcessor post;
+    build(post);
+    post.run(color.data(), depth.data(), out.data(), size, size, 1);
+    post.run(color.data(), depth.data(), threaded.data(), size, size, 3);
+    std::string what = post.describe() + " = one effect at a time";
+    ok = expect(out == reference(post, color, depth, size, size),
+                what.c_str()) &&
+         ok;
+    what = post.describe() + " on 1 and 3 threads";
+    ok = expect(out == threaded, what.c_str()) && ok;
+  }
+
+  PostProcessor edges;
+  add<DepthEdgeEffect>(edges);
+  edges.run(color.data(), depth.data(), out.data(), size, size);
+  SoftwareRenderer r(size, size);
+  std::vector<uint32_t> c = color;
+  std::vector<float> d = depth;
+  r.swapColor(c);
+  r.swapDepth(d);
+  r.postProcess();
+  ok = expect(out == r.frame(), "[edges] = SoftwareRenderer::postProcess()") &&
+       ok;
+  return ok;
+}
+
+// Renderer's frame with the long chain, on CpuBackend through the graph
+static bool checkBackend(const MeshAsset &asset,
+                         const std::vector<uint32_t> &color,
+                         const std::vector<float> &depth, int size) {
+  CpuBackend backend(size, size);
+  PostProcessor post(&backend);
+  longChain(post);
+  PipelineDesc scene;
+  scene.vertexFunction = "vertex_main";
+  scene.fragmentFunction = "fragment_main";
+  PipelineHandle scenePipeline = backend.newPipeline(scene);
+  BufferHandle vertices = backend.newBuffer(
+      asset.mesh.vertices.data(), asset.mesh.vertices.size() * sizeof(Vertex));
+  const std::vector<uint32_t> &indices = asset.lods[0].indices;
+  BufferHandle indexBuffer =
+      backend.newBuffer(indices.data(), indices.size() * sizeof(uint32_t));
+  Uniforms u = makeRotation(0.7f);
+
+  TextureDesc colorDesc;
+  colorDesc.width = colorDesc.height = size;
+  TextureDesc depthDesc = colorDesc;
+  depthDesc.format = PixelFormat::Depth32Float;
+  RenderGraph g(&backend);
+  GraphTexture sceneColor = g.createTexture("color", colorDesc);
+  GraphTexture sceneDepth = g.createTexture("depth", depthDesc);
+  GraphTexture frame =
+      g.importTexture("frame", backend.frameTarget(), colorDesc);
+  g.addPass("scene",
+            [&](RenderBackend &b, const RenderGraph &) {
+              b.setPipeline(scenePipeline);
+              b.setVertexBuffer(vertices, 0, 0);
+              b.setVertexBytes(&u, sizeof(u), 1);
+              b.drawIndexed(indices.size(), IndexType::UInt32, indexBuffer,
+                            0);
+            })
+      .clearColor(sceneColor, 0.1f, 0.1f, 0.1f, 1)
+      .clearDepth(sceneDepth, 1);
+  post.addPasses(g, sceneColor, sceneDepth, frame);
+  bool ok = expect(g.compile() && g.stats().passes == 2,
+                   "graph: scene and one fused post pass");
+  PipelineHandle chain = post.passes()[0]->pipeline();
+  ok = expect(!post.passes()[0]->builtinFunction() &&
+                  backend.program(chain) == post.passes()[0].get(),
+              "generated pipeline carries its pass") &&
+       ok;
+  {
+    PostProcessor edges(&backend);
+    add<DepthEdgeEffect>(edges);
+    const PostPass &pass = *edges.passes()[0];
+    ok = expect(pass.builtinFunction() &&
+                    !strcmp(pass.builtinFunction(), "post_fragment_main") &&
+                    pass.pipeline() &&
+                    !backend.program(pass.pipeline()),
+                "[edges] uses post_fragment_main, nothing generated") &&
+         ok;
+  }
+  backend.beginFrame();
+  g.execute();
+  backend.endFrame();
+
+  PostProcessor cpu;
+  longChain(cpu);
+  std::vector<uint32_t> out(color.size());
+  cpu.run(color.data(), depth.data(), out.data(), size, size);
+  ok = expect(backend.lastFrame() == out,
+              "CpuBackend runs the same fused pass") &&
+       ok;
+  post.clear();
+  post.passes();
+  return expect(!backend.program(chain),
+                "released pipeline drops its pass") &&
+         ok;
+}
+
+static void timeChain(const std::vector<uint32_t> &color,
+                      const std::vector<float> &depth, int size, bool msl) {
+  PostProcessor post;
+  longChain(post);
+  add<BoxBlurEffect>(post, 1);
+  add<SaturationEffect>(post, 0.9f);
+  std::vector<uint32_t> fused(color.size()), unfused(color.size());
+  // A pass reads colour and depth and writes colour, 4 bytes a pixel each
+  double pixels = double(color.size()), bytesPerPass = 12 * pixels;
+  for (int fusion = 1; fusion >= 0; fusion--) {
+    post.setFusion(fusion);
+    std::vector<uint32_t> &out = fusion ? fused : unfused;
+    size_t passes = post.passes().size();
+    double ms = bench::bestOf(5, [&] {
+      post.run(color.data(), depth.data(), out.data(), size, size);
+    });
+    printf("%-8s %zu pass(es) %8.2f ms  %6.1f MB moved  %s\n",
+           fusion ? "fused" : "unfused", passes, ms,
+           passes * bytesPerPass / 1e6, post.describe().c_str());
+  }
+  int maxDiff = 0;
+  for (size_t i = 0; i < fused.size(); i++)
+    for (int shift = 0; shift < 32; shift += 8)
+      maxDiff = std::max(maxDiff, std::abs(int((fused[i] >> shift) & 0xff) -
+                                           int((unfused[i] >> shift) & 0xff)));
+  // Fused, colour stays float between effects, over 1 included
+  printf("fused vs unfused (8-bit between passes): max diff %d LSB\n",
+         maxDiff);
+  if (msl) {
+    post.setFusion(true);
+    for (const std::unique_ptr<PostPass> &pass : post.passes())
+      printf("\n%s", pass->source().c_str());
+  }
+}
+
+int main(int argc, char **argv) {
+  int size = 1000;
+  bool msl = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--msl"))
+      msl = true;
+    else
+      size = atoi(argv[i]);
+  }
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  MeshAsset asset =
+      MeshAsset::load("monke.obj", "build/bench/monke.obj.meshcache");
+  if (asset.lods.empty() || asset.lods[0].indices.empty()) {
+    fprintf(stderr, "Could not load monke.obj\n");
+    return 1;
+  }
+
+  SoftwareRenderer r(size, size);
+  r.beginFrame();
+  const std::vector<uint32_t> &indices = asset.lods[0].indices;
+  r.drawIndexed(asset.mesh.vertices.data(), asset.mesh.vertices.size(),
+                indices.data(), indices.size(), makeRotation(0.7f));
+  std::vector<uint32_t> color = r.color();
+  std::vector<float> depth = r.depth();
+
+  bool ok = checkPlans();
+  ok = checkChains(color, depth, size) && ok;
+  ok = checkBackend(asset, color, depth, size) && ok;
+  timeChain(color, depth, size, msl);
+  return ok ? 0 : 1;
+}
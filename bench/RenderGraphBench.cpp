@@ -0,0 +1,259 @@
+// RenderGraph's compiler on the frames Renderer builds and on longer ones:
+// pass order, culling, load/store actions and aliasing, each checked
+// against what they should be; then a chain of post passes executed on
+// CpuBackend, with and without aliasing, which must give the same frame
+// and stop allocating after the first frame. Prints the memory aliasing
+// saves and the compile time.
+//
+// Usage: RenderGraphBench [chain] [size]   (default 8 post passes, 1000)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../CpuBackend.hpp"
+#include "../MeshAsset.hpp"
+#include "../RenderGraph.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+
+// Counts the textures alive, to see the pool at work
+class CountingBackend : public CpuBackend {
+public:
+  using CpuBackend::CpuBackend;
+  TextureHandle newTexture(const TextureDesc &desc) override {
+    created++;
+    alive++;
+    return CpuBackend::newTexture(desc);
+  }
+  void releaseTexture(TextureHandle texture) override {
+    alive -= bool(texture);
+    CpuBackend::releaseTexture(texture);
+  }
+  size_t created = 0, alive = 0;
+};
+
+static TextureDesc colorDesc(int size) {
+  TextureDesc d;
+  d.width = d.height = size;
+  d.format = PixelFormat::BGRA8Unorm;
+  return d;
+}
+
+static TextureDesc depthDesc(int size) {
+  TextureDesc d = colorDesc(size);
+  d.format = PixelFormat::Depth32Float;
+  return d;
+}
+
+static bool expect(bool ok, const char *what) {
+  printf("%-58s %s\n", what, ok ? "OK" : "MISMATCH");
+  return ok;
+}
+
+static bool same(const RenderGraph::Attachment &a, LoadAction load,
+                 StoreAction store) {
+  return a.load == load && a.store == store;
+}
+
+static std::string orderOf(const RenderGraph &g) {
+  std::string s;
+  for (size_t p : g.order())
+    s += (s.empty() ? "" : " ") + g.passName(p);
+  return s;
+}
+
+static void printStats(const char *name, const RenderGraph &g) {
+  const RenderGraph::Stats &s = g.stats();
+  printf("%-22s %2zu passes (%zu culled) | %2zu transients in %zu textures | "
+         "%6.1f MB -> %6.1f MB, %6.1f MB saved\n",
+         name, s.passes, s.culledPasses, s.transients, s.textures,
+         s.transientBytes / 1e6, s.allocatedBytes / 1e6, s.savedBytes() / 1e6);
+}
+
+// Renderer's frame, declared back to front: the order comes from the reads
+static bool checkRendererFrame(int size) {
+  RenderGraph g;
+  GraphTexture color = g.createTexture("color", colorDesc(size));
+  GraphTexture depth = g.createTexture("depth", depthDesc(size));
+  GraphTexture frame =
+      g.importTexture("frame", TextureHandle(), colorDesc(size));
+  g.addPass("post", nullptr).read(color).read(depth).writeColor(frame);
+  g.addPass("scene", nullptr)
+      .clearColor(color, 0.1f, 0.1f, 0.1f, 1)
+      .clearDepth(depth, 1);
+  bool ok = expect(g.compile(), "renderer frame compiles");
+  printStats("renderer frame", g);
+  ok = expect(orderOf(g) == "scene post", "scene before post") && ok;
+  const std::vector<size_t> &order = g.order();
+  size_t scene = order[0], post = order[1];
+  ok = expect(same(g.colorAttachment(scene), LoadAction::Clear,
+                   StoreAction::Store) &&
+                  same(g.depthAttachment(scene), LoadAction::Clear,
+                       StoreAction::Store),
+              "scene clears and stores colour and depth") &&
+       ok;
+  ok = expect(same(g.colorAttachment(post), LoadAction::DontCare,
+                   StoreAction::Store),
+              "post overwrites and stores the frame") &&
+       ok;
+  ok = expect(g.stats().textures == 2 && g.stats().savedBytes() == 0,
+              "colour and depth overlap: two textures, nothing aliased") &&
+       ok;
+  return ok;
+}
+
+// scene -> post 1 -> ... -> post n -> frame, each post sampling the one
+// before and the scene's depth, plus a pass nothing reads
+static void buildChain(RenderGraph &g, int size, int chain,
+                       TextureHandle frameTarget,
+                       std::vector<GraphTexture> *links = nullptr,
+                       RenderGraph::Execute scene = nullptr,
+                       PipelineHandle post = PipelineHandle()) {
+  GraphTexture color = g.createTexture("color", colorDesc(size));
+  GraphTexture depth = g.createTexture("depth", depthDesc(size));
+  GraphTexture frame = g.importTexture("frame", frameTarget, colorDesc(size));
+  GraphTexture debug = g.createTexture("debug", colorDesc(size));
+  g.addPass("debug", nullptr).read(depth).writeColor(debug);
+  g.addPass("scene", scene)
+      .clearColor(color, 0.1f, 0.1f, 0.1f, 1)
+      .clearDepth(depth, 1);
+  GraphTexture in = color;
+  for (int i = 0; i < chain; i++) {
+    GraphTexture out =
+        i + 1 < chain ? g.createTexture("link", colorDesc(size)) : frame;
+    g.addPass("post", [=](RenderBackend &b, const RenderGraph &graph) {
+       b.setPipeline(post);
+       b.setFragmentTexture(graph.texture(in), 0);
+       b.setFragmentTexture(graph.texture(depth), 1);
+       b.draw(3);
+     })
+        .read(in)
+        .read(depth)
+        .writeColor(out);
+    if (links)
+      links->push_back(in);
+    in = out;
+  }
+}
+
+static bool checkChain(int size, int chain) {
+  RenderGraph g;
+  std::vector<GraphTexture> links;
+  buildChain(g, size, chain, TextureHandle(), &links);
+  bool ok = expect(g.compile(), "post chain compiles");
+  printStats("post chain", g);
+  ok = expect(g.stats().culledPasses == 1 &&
+                  g.passName(g.order()[0]) == "scene",
+              "unread debug pass culled, scene first") &&
+       ok;
+  // Colour and the links ping-pong between two textures; depth lives
+  // throughout in a third
+  ok = expect(g.stats().textures == 3, "chain aliased into three textures") &&
+       ok;
+  bool overlap = false;
+  for (size_t i = 1; i < links.size(); i++)
+    overlap = overlap || g.slot(links[i]) == g.slot(links[i - 1]);
+  ok = expect(!overlap, "no pass reads and writes one texture") && ok;
+
+  RenderGraph keep;
+  GraphTexture color = keep.createTexture("color", colorDesc(size));
+  GraphTexture frame =
+      keep.importTexture("frame", TextureHandle(), colorDesc(size));
+  keep.addPass("post", nullptr).read(color).writeColor(frame, true);
+  keep.addPass("scene", nullptr).clearColor(color, 0, 0, 0, 1);
+  keep.addPass("overlay", nullptr).writeColor(color, true);
+  ok = expect(keep.compile() && orderOf(keep) == "scene overlay post",
+              "writers in declaration order, readers after") &&
+       ok;
+  size_t scene = keep.order()[0], overlay = keep.order()[1];
+  ok = expect(same(keep.colorAttachment(scene), LoadAction::Clear,
+                   StoreAction::Store) &&
+                  same(keep.colorAttachment(overlay), LoadAction::Load,
+                       StoreAction::Store) &&
+                  same(keep.colorAttachment(keep.order()[2]), LoadAction::Load,
+                       StoreAction::Store),
+              "kept targets load, and stores feed them") &&
+       ok;
+
+  RenderGraph cycle;
+  GraphTexture a = cycle.createTexture("a", colorDesc(size));
+  GraphTexture b = cycle.createTexture("b", colorDesc(size));
+  cycle.addPass("x", nullptr).read(a).writeColor(b);
+  cycle.addPass("y", nullptr).read(b).writeColor(a);
+  ok = expect(!cycle.compile(), "cycle rejected") && ok;
+
+  int big = 64;
+  RenderGraph timed;
+  double ms = bench::bestOf(20, [&] {
+    timed.reset();
+    buildChain(timed, size, big, TextureHandle());
+    timed.compile();
+  });
+  printf("build + compile, %d post passes: %8.1f us\n", big, ms * 1e3);
+  printStats("64-pass chain", timed);
+  return ok;
+}
+
+// The chain on CpuBackend over a real frame's targets, aliased and not
+static bool checkExecute(int size, int chain) {
+  MeshAsset asset =
+      MeshAsset::load("monke.obj", "build/bench/monke.obj.meshcache");
+  std::vector<uint32_t> frames[2];
+  bool ok = true;
+  for (int aliasing = 0; aliasing < 2; aliasing++) {
+    CountingBackend backend(size, size);
+    PipelineDesc post;
+    post.vertexFunction = "post_vertex_main";
+    post.fragmentFunction = "post_fragment_main";
+    PipelineDesc scene;
+    scene.vertexFunction = "vertex_main";
+    scene.fragmentFunction = "fragment_main";
+    PipelineHandle postPipeline = backend.newPipeline(post);
+    PipelineHandle scenePipeline = backend.newPipeline(scene);
+    BufferHandle vertices =
+        backend.newBuffer(asset.mesh.vertices.data(),
+                          asset.mesh.vertices.size() * sizeof(Vertex));
+    const std::vector<uint32_t> &indices = asset.lods[0].indices;
+    BufferHandle indexBuffer =
+        backend.newBuffer(indices.data(), indices.size() * sizeof(uint32_t));
+    Uniforms u = makeRotation(0.7f);
+
+    RenderGraph g(&backend);
+    g.setAliasing(aliasing);
+    size_t warm = 0;
+    for (int frame = 0; frame < 3; frame++) {
+      backend.beginFrame();
+      g.reset();
+      buildChain(g, size, chain, backend.frameTarget(), nullptr,
+                 [&](RenderBackend &b, const RenderGraph &) {
+                   b.setPipeline(scenePipeline);
+                   b.setVertexBuffer(vertices, 0, 0);
+                   b.setVertexBytes(&u, sizeof(u), 1);
+                   b.drawIndexed(indices.size(), IndexType::UInt32,
+                                 indexBuffer, 0);
+                 },
+                 postPipeline);
+      g.compile();
+      g.execute();
+      backend.endFrame();
+      if (frame == 0)
+        warm = backend.created;
+    }
+    frames[aliasing] = backend.lastFrame();
+    ok = expect(backend.created == warm,
+                aliasing ? "aliased: no textures made after frame 1"
+                         : "unaliased: no textures made after frame 1") &&
+         ok;
+    printf("%-22s %zu offscreen textures alive\n",
+           aliasing ? "aliased" : "unaliased", backend.alive);
+  }
+  return expect(frames[0] == frames[1], "aliased and unaliased frames match") &&
+         ok;
+}
+
+int main(int argc, char **argv) {
+  int chain = argc > 1 ? atoi(argv[1]) : 8;
+  int size = argc > 2 ? atoi(argv[2]) : 1000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = checkRendererFrame(size);
+  ok = checkChain(size, chain) && ok;
+  ok = checkExecute(256, chain) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+// MeshSimplifier LOD chains: triangles and geometric error per level, and
+// build time with one thread vs all cores.
+//
+// Error is the max RMS distance (mesh units) of a collapsed vertex from the
+// planes it has absorbed; also shown as a fraction of the bounding box
+// diagonal, and as the on-screen size (diagonal, px) up to which the level
+// is off by less than a pixel. The "with seam" run checks a hard normal
+// seam survives every level.
+//
+// Usage: SimplifyBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshSimplifier.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+
+static float diagonal(const IndexedMesh &mesh) {
+  float lo[3] = {1e30f, 1e30f, 1e30f}, hi[3] = {-1e30f, -1e30f, -1e30f};
+  for (const Vertex &v : mesh.vertices)
+    for (int k = 0; k < 3; k++) {
+      lo[k] = std::min(lo[k], v.position[k]);
+      hi[k] = std::max(hi[k], v.position[k]);
+    }
+  float d = 0;
+  for (int k = 0; k < 3; k++)
+    d += (hi[k] - lo[k]) * (hi[k] - lo[k]);
+  return std::sqrt(d);
+}
+
+// A copy of `grid` with a hard normal seam down the vertex column nearest
+// x = 0: normals lean left on the left half and right on the right half (74
+// degrees apart), so the seam column has two vertices per position.
+static float seamX = 0;
+static IndexedMesh withSeam(const IndexedMesh &grid) {
+  for (const Vertex &v : grid.vertices)
+    if (std::fabs(v.position[0]) < std::fabs(seamX) || seamX == 0)
+      seamX = v.position[0];
+  IndexedMesh mesh;
+  VertexDeduper dedup(mesh, grid.indices.size());
+  for (size_t i = 0; i < grid.indices.size(); i += 3) {
+    float cx = 0;
+    for (int k = 0; k < 3; k++)
+      cx += grid.vertices[grid.indices[i + k]].position[0];
+    for (int k = 0; k < 3; k++) {
+      Vertex v = grid.vertices[grid.indices[i + k]];
+      v.normal[0] = cx < 3 * seamX ? -0.6f : 0.6f;
+      v.normal[1] = 0.0f;
+      v.normal[2] = 0.8f;
+      dedup.add(v);
+    }
+  }
+  return mesh;
+}
+
+// The seam held if no triangle mixes the two sides' normals or ended up on
+// the other side of the seam.
+static bool seamIntact(const IndexedMesh &mesh, const MeshLod &lod) {
+  for (size_t i = 0; i < lod.indices.size(); i += 3) {
+    float cx = 0, nx = mesh.vertices[lod.indices[i]].normal[0];
+    for (int k = 0; k < 3; k++) {
+      const Vertex &v = mesh.vertices[lod.indices[i + k]];
+      cx += v.position[0];
+      if (v.normal[0] != nx)
+        return false;
+    }
+    if ((cx < 3 * seamX) != (nx < 0))
+      return false;
+  }
+  return true;
+}
+
+// Returns false if the seam tore at any level.
+static bool run(const std::string &name, const IndexedMesh &mesh,
+                bool checkSeam = false) {
+  std::vector<MeshLod> lods;
+  double serial = bench::bestOf(1, [&] {
+    lods = MeshSimplifier::buildLodChain(mesh, {0.5f, 0.25f, 0.1f, 0.02f}, 1);
+  });
+  double parallel = bench::bestOf(1, [&] {
+    lods = MeshSimplifier::buildLodChain(mesh);
+  });
+  float diag = diagonal(mesh);
+  bool intact = true;
+  printf("%s: %zu triangles | chain %.1f ms 1 thread, %.1f ms parallel\n",
+         name.c_str(), mesh.indices.size() / 3, serial, parallel);
+  for (const MeshLod &lod : lods) {
+    float px = lod.error > 0 ? diag / lod.error : 0.0f;
+    bool held = !checkSeam || seamIntact(mesh, lod);
+    intact &= held;
+    printf("  %5.1f%% -> %9zu tris (%5.2f%%) | error %.2e (%.4f%% of "
+           "diag) | <1px error up to %6.0f px%s\n",
+           lod.ratio * 100, lod.indices.size() / 3,
+           100.0 * lod.indices.size() / mesh.indices.size(), lod.error,
+           100.0 * lod.error / diag, px,
+           !checkSeam ? "" : held ? " | seam intact" : " | SEAM TORN");
+  }
+  return intact;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  MeshLoadOptions options;
+  options.useMmap = true;
+  options.parseThreads = 0;
+
+  run("monke.obj", MeshLoader::loadObjIndexed("monke.obj", options));
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  IndexedMesh grid = MeshLoader::loadObjIndexed(big, options);
+  run(big, grid);
+  return run(big + " (with seam)", withSeam(grid), true) ? 0 : 1;
+}
@@ -0,0 +1,412 @@
+// SoftwareRenderer, the headless CPU version of Renderer's two passes.
+//   1. Fill rule: a full-screen quad, and a fan of thin triangles around an
+//      off-centre point, must each touch every pixel exactly once.
+//   2. monke.obj and the generated grid, through MeshAsset with the LOD
+//      Renderer would pick at this size, spun about z over [frames]
+//      frames: ms per frame for the scene pass and the edge pass. The
+//      packed vertex path (what Renderer draws) must match the 48-byte one
+//      to within the quantization; frame 0 of each goes to build/bench/
+//      as a .ppm.
+//   3. The SIMD block kernel against the scalar per-pixel one on random
+//      triangles: the same fragments and the same bits in both targets.
+//   4. The scene pass with the scalar kernel, then the SIMD one at 1, 2, 4
+//      ... threads, for that LOD and for LOD 0: ms per frame, speedup and
+//      how many 8x8 blocks were skipped outright. Every frame must match
+//      the scalar one bit for bit.
+//   5. Hierarchical Z on a pile of overlapping monkes (see checkHiZ()).
+//   6. The fused edge pass against the shader's bilinear one, and its
+//      SIMD rows against its scalar ones, with GPix/s (see checkPost()).
+//
+// Usage: SoftRasterBench [triangles] [frames] [size]   (default 1M, 16, 1000)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshAsset.hpp"
+#include "../SoftwareRenderer.hpp"
+#include "BenchUtil.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+static Vertex clipVertex(float x, float y) {
+  Vertex v = {};
+  v.position[0] = x;
+  v.position[1] = y;
+  v.position[2] = 0.5f;
+  v.position[3] = 1.0f;
+  v.normal[2] = 1.0f;
+  v.color[0] = v.color[1] = v.color[2] = v.color[3] = 1.0f;
+  return v;
+}
+
+static bool checkFillRule(int size) {
+  SoftwareRenderer r(size, size);
+  Uniforms u = makeRotation(0.0f);
+
+  std::vector<Vertex> quad = {clipVertex(-1, -1), clipVertex(1, -1),
+                              clipVertex(1, 1), clipVertex(-1, 1)};
+  std::vector<uint32_t> quadIndices = {0, 1, 2, 0, 2, 3};
+  r.beginFrame();
+  r.drawIndexed(quad.data(), quad.size(), quadIndices.data(),
+                quadIndices.size(), u);
+  size_t quadFragments = r.stats().fragments;
+
+  // Corners of the fan land off the pixel grid and the shared edges run at
+  // every angle, so ties on the edges get exercised.
+  std::vector<Vertex> fan = {clipVertex(0.0123f, -0.0371f)};
+  const int spokes = 61;
+  for (int i = 0; i < spokes; i++) {
+    float a = 6.2831853f * i / spokes;
+    fan.push_back(clipVertex(3.0f * std::cos(a), 3.0f * std::sin(a)));
+  }
+  std::vector<uint32_t> fanIndices;
+  for (int i = 0; i < spokes; i++) {
+    fanIndices.push_back(0);
+    fanIndices.push_back(1 + i);
+    fanIndices.push_back(1 + (i + 1) % spokes);
+  }
+  r.beginFrame();
+  r.drawIndexed(fan.data(), fan.size(), fanIndices.data(), fanIndices.size(),
+                u);
+  size_t fanFragments = r.stats().fragments;
+
+  size_t pixels = size_t(size) * size;
+  bool ok = quadFragments == pixels && fanFragments == pixels;
+  printf("fill rule %dx%d: quad %zu, %d-spoke fan %zu (clipped %zu) of %zu "
+         "pixels | %s\n",
+         size, size, quadFragments, spokes, fanFragments, r.stats().clipped,
+         pixels, ok ? "OK" : "MISMATCH");
+  return ok;
+}
+
+// Random triangles one at a time through both kernels: same fragments and
+// the same colour and depth bits. Corners are often snapped to pixel
+// centres and edges so ties with the fill rule come up, some triangles are
+// slivers, some are tiny, and many need clipping.
+static bool checkKernels(int width, int height, int count) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  SoftwareRenderer simd(width, height, 1), scalar(width, height, 1);
+  scalar.setSimd(false);
+  size_t fragments = 0, blocks = 0, empty = 0;
+  int wrong = 0;
+  for (int i = 0; i < count; i++) {
+    Vertex v[3] = {};
+    float cx = unit(rng) * 2.6f - 1.3f, cy = unit(rng) * 2.6f - 1.3f;
+    float scale = i % 5 == 0 ? 0.02f : i % 5 == 1 ? 2.0f : 0.5f;
+    for (Vertex &p : v) {
+      float x = cx + (unit(rng) - 0.5f) * scale;
+      float y = cy + (unit(rng) - 0.5f) * scale;
+      if (i % 3 == 0) { // On a pixel centre or corner
+        x = std::round(x * width) / width + (i % 2 ? 1.0f / width : 0.0f);
+        y = std::round(y * height) / height;
+      }
+      if (i % 7 == 0) // Sliver
+        y = cy + (x - cx) * 0.01f;
+      float w = 0.5f + 1.5f * unit(rng);
+      p.position[0] = x * w;
+      p.position[1] = y * w;
+      p.position[2] = (unit(rng) * 1.4f - 0.2f) * w;
+      p.position[3] = w;
+      for (int k = 0; k < 3; k++) {
+        p.normal[k] = unit(rng) * 2.0f - 1.0f;
+        p.color[k] = unit(rng);
+      }
+      p.color[3] = 1.0f;
+    }
+    uint32_t indices[3] = {0, 1, 2};
+    Uniforms u = makeRotation(0.0f);
+    for (SoftwareRenderer *r : {&simd, &scalar}) {
+      r->beginFrame();
+      r->drawIndexed(v, 3, indices, 3, u);
+    }
+    bool same = simd.stats().fragments == scalar.stats().fragments &&
+                simd.stats().shaded == scalar.stats().shaded &&
+                simd.color() == scalar.color() && simd.depth() == scalar.depth();
+    wrong += !same;
+    fragments += simd.stats().fragments;
+    blocks += simd.stats().blocks;
+    empty += simd.stats().emptyBlocks;
+  }
+  printf("SIMD vs scalar kernel, %d random triangles at %dx%d: %zu fragments, "
+         "%.1f%% of %zu blocks empty | %s\n",
+         count, width, height, fragments, blocks ? 100.0 * empty / blocks : 0.0,
+         blocks, wrong ? "MISMATCH" : "identical");
+  return wrong == 0;
+}
+
+// [instances] copies of monke piled up in front of the camera, each its own
+// draw, nearest first or furthest first. Hierarchical Z on and off: ms per
+// frame, the share of triangles (per tile) and blocks it rejected, and
+// the frames must be identical.
+static bool checkHiZ(int instances, int frames, int size) {
+  MeshAsset asset = MeshAsset::load("monke.obj", "build/bench/monke.obj.meshcache");
+  const MeshLod &lod = asset.lods[0];
+  PackedMesh packed = VertexPacker::pack(asset.mesh.vertices.data(),
+                                         asset.mesh.vertices.size());
+  std::mt19937 rng(99);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  struct Instance {
+    float x, y, z, angle;
+  };
+  std::vector<Instance> scene(instances);
+  for (Instance &i : scene)
+    i = {unit(rng) - 0.5f, unit(rng) - 0.5f, 0.4f + 0.2f * unit(rng),
+         unit(rng) * 6.2831853f};
+  std::sort(scene.begin(), scene.end(),
+            [](const Instance &a, const Instance &b) { return a.z < b.z; });
+
+  bool ok = true;
+  SoftwareRenderer r(size, size);
+  for (int order = 0; order < 2; order++) {
+    std::vector<uint32_t> color[2];
+    std::vector<float> depth[2];
+    double ms[2] = {};
+    SoftwareRenderer::Stats stats;
+    bool same = true;
+    for (int frame = 0; frame < frames; frame++) {
+      for (int hiZ = 0; hiZ < 2; hiZ++) {
+        r.setHiZ(hiZ);
+        ms[hiZ] += bench::bestOf(3, [&] {
+          r.beginFrame();
+          for (int k = 0; k < instances; k++) {
+            const Instance &in = scene[order ? instances - 1 - k : k];
+            // Scale 0.3, spun by angle + frame, then moved to (x, y, z)
+            Uniforms u = makeRotation(in.angle + 0.1f * frame);
+            for (int c = 0; c < 3; c++)
+              for (int row = 0; row < 3; row++)
+                u.rotationMatrix[c][row] *= 0.3f;
+            u.rotationMatrix[3][0] = in.x;
+            u.rotationMatrix[3][1] = in.y;
+            u.rotationMatrix[3][2] = in.z;
+            r.drawIndexed(packed.vertices.data(), packed.vertices.size(),
+                          packed.info, lod.indices.data(), lod.indices.size(),
+                          u);
+          }
+        });
+        color[hiZ] = r.color();
+        depth[hiZ] = r.depth();
+      }
+      same = same && color[0] == color[1] && depth[0] == depth[1];
+      stats.add(r.stats());
+    }
+    ok = ok && same;
+    printf("%3d x monke, %-14s HiZ off %7.2f ms | on %7.2f ms | %.2fx | "
+           "%4.1f%% of tile triangles, %4.1f%% of blocks rejected, %4.1f%% "
+           "of blocks in front | %s\n",
+           instances, order ? "furthest first" : "nearest first",
+           ms[0] / frames, ms[1] / frames, ms[0] / ms[1],
+           100.0 * stats.hiZTriangles / stats.tileTriangles,
+           100.0 * stats.hiZBlocks / stats.blocks,
+           100.0 * stats.hiZFrontBlocks / stats.blocks,
+           same ? "identical" : "MISMATCH");
+  }
+  return ok;
+}
+
+// Largest per-channel difference between two BGRA8 images, and how many
+// pixels differ by more than `tolerance`
+static int maxDiff(const std::vector<uint32_t> &a,
+                   const std::vector<uint32_t> &b, int tolerance,
+                   size_t *over) {
+  int worst = 0;
+  *over = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    int pixel = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+      pixel = std::max(pixel, std::abs(int((a[i] >> shift) & 0xff) -
+                                       int((b[i] >> shift) & 0xff)));
+    worst = std::max(worst, pixel);
+    *over += pixel > tolerance;
+  }
+  return worst;
+}
+
+static void drawMonke(SoftwareRenderer &r, const MeshAsset &asset, float angle) {
+  const MeshLod &lod = asset.lods[0];
+  r.beginFrame();
+  r.drawIndexed(asset.mesh.vertices.data(), asset.mesh.vertices.size(),
+                lod.indices.data(), lod.indices.size(), makeRotation(angle));
+}
+
+// The fused postProcess() against postProcessReference(), the shader's
+// bilinear version: within one step of 8-bit rounding at 1000x1000, where
+// both look one texel away. Then the SIMD rows against the scalar ones at
+// an odd size, which must match exactly, and GPix/s for each.
+static bool checkPost() {
+  MeshAsset asset =
+      MeshAsset::load("monke.obj", "build/bench/monke.obj.meshcache");
+  SoftwareRenderer r(1000, 1000);
+  drawMonke(r, asset, 0.3f);
+  double referenceMs = bench::bestOf(3, [&] { r.postProcessReference(); });
+  std::vector<uint32_t> reference = r.frame();
+  double pixels = 1e6;
+  printf("post reference (bilinear)  1000x1000 x1  %8.3f ms | %6.3f GPix/s\n",
+         referenceMs, pixels / referenceMs * 1e-6);
+  bool ok = true;
+  unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+  for (int simd = 0; simd < 2; simd++) {
+    r.setSimd(simd);
+    for (unsigned t = 1; t <= (simd ? maxThreads : 1); t *= 2) {
+      r.setThreads(t);
+      double ms = bench::bestOf(5, [&] { r.postProcess(); });
+      size_t over;
+      int worst = maxDiff(r.frame(), reference, 1, &over);
+      ok = ok && over == 0;
+      printf("post fused %-6s          1000x1000 x%-2u %8.3f ms | %6.3f GPix/s "
+             "| max diff %d, %zu pixels over 1 | %s\n",
+             simd ? "SIMD" : "scalar", t, ms, pixels / ms * 1e-6, worst, over,
+             over ? "MISMATCH" : "OK");
+    }
+  }
+
+  SoftwareRenderer odd(1003, 517);
+  drawMonke(odd, asset, 1.1f);
+  odd.setSimd(false);
+  odd.postProcess();
+  std::vector<uint32_t> scalar = odd.frame();
+  odd.setSimd(true);
+  odd.postProcess();
+  bool same = odd.frame() == scalar;
+  printf("post fused SIMD vs scalar  1003x517: %s\n",
+         same ? "identical" : "MISMATCH");
+  return ok && same;
+}
+
+// Pixels where any channel differs by more than `tolerance`
+static size_t diffPixels(const std::vector<uint32_t> &a,
+                         const std::vector<uint32_t> &b, int tolerance) {
+  size_t count = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    bool differs = false;
+    for (int shift = 0; shift < 32; shift += 8) {
+      int x = int((a[i] >> shift) & 0xff), y = int((b[i] >> shift) & 0xff);
+      differs = differs || std::abs(x - y) > tolerance;
+    }
+    count += differs;
+  }
+  return count;
+}
+
+// Frame time for the scalar kernel on one thread, then the SIMD kernel on
+// 1, 2, 4 ... threads; every target must match the scalar one bit for bit.
+static bool scaling(const std::string &file, const MeshAsset &asset,
+                    size_t level, int frames, int size) {
+  const MeshLod &lod = asset.lods[level];
+  PackedMesh packed = VertexPacker::pack(asset.mesh.vertices.data(),
+                                         asset.mesh.vertices.size());
+  SoftwareRenderer r(size, size, 1);
+  std::vector<std::vector<uint32_t>> colors;
+  std::vector<std::vector<float>> depths;
+  bool ok = true;
+  double baseMs = 0;
+  unsigned maxThreads = std::max(4u, std::thread::hardware_concurrency());
+  for (unsigned t = 0; t <= maxThreads; t = t ? t * 2 : 1) {
+    bool scalar = t == 0;
+    r.setSimd(!scalar);
+    r.setThreads(scalar ? 1 : t);
+    double ms = 0;
+    size_t blocks = 0, empty = 0;
+    bool same = true;
+    for (int frame = 0; frame < frames; frame++) {
+      Uniforms u = makeRotation(0.05f * frame);
+      ms += bench::bestOf(3, [&] {
+        r.beginFrame();
+        r.drawIndexed(packed.vertices.data(), packed.vertices.size(),
+                      packed.info, lod.indices.data(), lod.indices.size(), u);
+      });
+      blocks += r.stats().blocks;
+      empty += r.stats().emptyBlocks;
+      if (scalar) {
+        colors.push_back(r.color());
+        depths.push_back(r.depth());
+      } else {
+        same = same && r.color() == colors[frame] && r.depth() == depths[frame];
+      }
+    }
+    ms /= frames;
+    if (scalar)
+      baseMs = ms;
+    ok = ok && same;
+    char kernel[32];
+    snprintf(kernel, sizeof(kernel), "%s x%u", scalar ? "scalar" : "SIMD",
+             r.threads());
+    printf("%-28s LOD %zu (%7zu tris) %-9s scene %8.2f ms | %5.2fx | %4.1f%% "
+           "empty blocks | %s\n",
+           file.c_str(), level, lod.indices.size() / 3, kernel, ms,
+           baseMs / ms, blocks ? 100.0 * empty / blocks : 0.0,
+           scalar ? "reference" : same ? "identical" : "MISMATCH");
+  }
+  return ok;
+}
+
+static bool run(const std::string &file, int frames, int size) {
+  std::string name = file.substr(file.find_last_of('/') + 1);
+  std::string cacheFile = "build/bench/" + name + ".meshcache";
+  MeshAsset asset = MeshAsset::load(file, cacheFile);
+  // Same LOD Renderer would draw at this drawable size
+  size_t level = MeshSimplifier::selectLod(asset.lods, size / 2.0f);
+  const MeshLod &lod = asset.lods[level];
+  const std::vector<Vertex> &vertices = asset.mesh.vertices;
+  PackedMesh packed = VertexPacker::pack(vertices.data(), vertices.size());
+
+  SoftwareRenderer r(size, size), reference(size, size);
+  double sceneMs = 0, postMs = 0;
+  size_t mismatched = 0, shaded = 0;
+  for (int frame = 0; frame < frames; frame++) {
+    Uniforms u = makeRotation(0.05f * frame);
+    sceneMs += bench::bestOf(3, [&] {
+      r.beginFrame();
+      r.drawIndexed(packed.vertices.data(), packed.vertices.size(),
+                    packed.info, lod.indices.data(), lod.indices.size(), u);
+    });
+    postMs += bench::bestOf(3, [&] { r.postProcess(); });
+    shaded += r.stats().shaded;
+
+    reference.beginFrame();
+    reference.drawIndexed(vertices.data(), vertices.size(), lod.indices.data(),
+                          lod.indices.size(), u);
+    reference.postProcess();
+    mismatched += diffPixels(r.frame(), reference.frame(), 2);
+
+    if (frame == 0) {
+      std::string ppm = "build/bench/" + name + ".ppm";
+      if (!SoftwareRenderer::writePpm(ppm, r.frame().data(), size, size))
+        fprintf(stderr, "Could not write %s\n", ppm.c_str());
+    }
+  }
+  // Quantized positions can move an edge by a fraction of a pixel, so a
+  // thin rim of pixels may differ; anything more is a decode bug.
+  double pixels = double(size) * size * frames;
+  bool ok = mismatched <= pixels * 0.005;
+  printf("%-28s LOD %zu (%zu tris) %dx%d: scene %8.2f ms | edges %7.2f ms | "
+         "%5.1f%% shaded\n",
+         file.c_str(), level, lod.indices.size() / 3, size, size,
+         sceneMs / frames, postMs / frames, 100.0 * shaded / pixels);
+  printf("%-28s packed vs 48-byte vertices: %.3f%% of pixels differ | %s\n",
+         file.c_str(), 100.0 * mismatched / pixels, ok ? "OK" : "MISMATCH");
+
+  ok = scaling(file, asset, level, frames, size) && ok;
+  if (level != 0)
+    ok = scaling(file, asset, 0, frames, size) && ok;
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  int frames = argc > 2 ? atoi(argv[2]) : 16;
+  int size = argc > 3 ? atoi(argv[3]) : 1000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  bool ok = checkFillRule(size);
+  ok = checkKernels(67, 45, 20000) && ok;
+  ok = checkKernels(3000, 3000, 40) && ok; // Past 32-bit edge values
+  ok = run("monke.obj", frames, size) && ok;
+  ok = checkHiZ(64, frames, size) && ok;
+  ok = checkPost() && ok;
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  ok = run(big, frames, size) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+// Peak memory and load time of MeshLoader::loadObj (attrib_t/shape_t, then
+// de-index) vs MeshLoader::streamObj (Vertex records straight from the
+// LoadObjWithCallback callbacks).
+//
+// Each path runs in its own child process so ru_maxrss is that path's peak
+// and nothing else's. "sink" counts the vertices and throws them away, which
+// is the floor for a caller that uploads as it goes.
+//
+// Usage: StreamLoadBench [triangles]   (default 2M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshLoader.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum Path { kLoadObj, kStreamVector, kStreamSink };
+static const char *kPathNames[] = {"loadObj", "streamObj -> vector",
+                                   "streamObj -> sink"};
+
+struct Result {
+  double ms;
+  size_t vertices;
+};
+
+static Result load(Path path, const std::string &objFile) {
+  Result r = {0, 0};
+  double t0 = bench::nowMs();
+  if (path == kLoadObj) {
+    r.vertices = MeshLoader::loadObj(objFile).size();
+  } else if (path == kStreamVector) {
+    MeshLoadOptions options;
+    options.streaming = true;
+    r.vertices = MeshLoader::loadObj(objFile, options).size();
+  } else {
+    MeshLoader::streamObj(objFile, [&](const Vertex *, size_t count) {
+      r.vertices += count;
+    });
+  }
+  r.ms = bench::nowMs() - t0;
+  return r;
+}
+
+// Run one load in a forked child; returns false if the child failed.
+static bool measure(Path path, const std::string &objFile, Result *r,
+                    double *peakMB) {
+  int fds[2];
+  if (pipe(fds) != 0)
+    return false;
+  pid_t pid = fork();
+  if (pid < 0)
+    return false;
+  if (pid == 0) {
+    close(fds[0]);
+    Result child = load(path, objFile);
+    bool ok = write(fds[1], &child, sizeof(child)) == ssize_t(sizeof(child));
+    _exit(ok ? 0 : 1);
+  }
+  close(fds[1]);
+  bool ok = read(fds[0], r, sizeof(*r)) == ssize_t(sizeof(*r));
+  close(fds[0]);
+  int status = 0;
+  struct rusage ru;
+  if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0)
+    return false;
+#ifdef __APPLE__
+  *peakMB = double(ru.ru_maxrss) / (1024.0 * 1024.0); // bytes
+#else
+  *peakMB = double(ru.ru_maxrss) / 1024.0; // KB
+#endif
+  return ok;
+}
+
+static void run(const std::string &objFile, int reps) {
+  printf("%s\n", objFile.c_str());
+  for (int p = kLoadObj; p <= kStreamSink; p++) {
+    double bestMs = 1e30, peakMB = 0;
+    Result r = {0, 0};
+    bool ok = true;
+    for (int i = 0; i < reps && ok; i++) {
+      double mb = 0;
+      ok = measure(Path(p), objFile, &r, &mb);
+      bestMs = r.ms < bestMs ? r.ms : bestMs;
+      peakMB = mb > peakMB ? mb : peakMB;
+    }
+    if (!ok) {
+      printf("  %-20s failed\n", kPathNames[p]);
+      continue;
+    }
+    printf("  %-20s %10zu verts | %9.2f ms | peak RSS %8.1f MB\n",
+           kPathNames[p], r.vertices, bestMs, peakMB);
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  fflush(stdout);
+  run("monke.obj", 5);
+
+  std::string big = "build/bench/grid_" + std::to_string(tris) + ".obj";
+  if (!bench::writeGridObj(big, tris)) {
+    fprintf(stderr, "Could not write %s\n", big.c_str());
+    return 1;
+  }
+  fflush(stdout);
+  run(big, 3);
+  return 0;
+}
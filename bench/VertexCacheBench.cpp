@@ -0,0 +1,95 @@
+// MeshOptimizer on loaded meshes: ACMR/ATVR from simulated 16-entry FIFO and
+// LRU caches before and after, plus the time per pass and per million
+// triangles (which should stay flat as the mesh grows, the passes are
+// linear). The "shuffled" run randomizes triangle order first, as a worst
+// case for files exported in a poor order.
+//
+// Usage: VertexCacheBench [triangles]   (default 1M for the generated mesh)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "../MeshOptimizer.hpp"
+#include "BenchUtil.hpp"
+#include <cstdlib>
+#include <random>
+
+// Order-independent fingerprint of the triangles, by vertex contents, so the
+// check survives optimizeVertexFetch renumbering.
+static uint64_t triangleSum(const IndexedMesh &mesh) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+    uint64_t h = 1469598103934665603ull;
+    for (int k = 0; k < 3; k++) {
+      const unsigned char *b = reinterpret_cast<const unsigned char *>(
+          &mesh.vertices[mesh.indices[i + k]]);
+      for (size_t j = 0; j < sizeof(Vertex); j++)
+        h = (h ^ b[j]) * 1099511628211ull;
+    }
+    sum += h;
+  }
+  return sum;
+}
+
+static void printStats(const char *label, const IndexedMesh &mesh) {
+  VertexCacheStats fifo = MeshOptimizer::analyzeVertexCache(mesh, 16);
+  VertexCacheStats lru = MeshOptimizer::analyzeVertexCache(
+      mesh, 16, MeshOptimizer::CacheModel::Lru);
+  printf("  %-8s FIFO16 ACMR %.3f ATVR %.3f | LRU16 ACMR %.3f ATVR %.3f\n",
+         label, fifo.acmr, fifo.atvr, lru.acmr, lru.atvr);
+}
+
+static void run(const std::string &name, const IndexedMesh &input) {
+  size_t tris = input.indices.size() / 3;
+  printf("%s: %zu triangles, %zu vertices\n", name.c_str(), tris,
+         input.vertices.size());
+  printStats("before", input);
+
+  IndexedMesh mesh = input;
+  double t0 = bench::nowMs();
+  MeshOptimizer::optimizeVertexCache(mesh);
+  double t1 = bench::nowMs();
+  printStats("tipsify", mesh);
+  MeshOptimizer::optimizeOverdraw(mesh);
+  double t2 = bench::nowMs();
+  printStats("overdraw", mesh);
+  MeshOptimizer::optimizeVertexFetch(mesh);
+  double t3 = bench::nowMs();
+
+  bool same = mesh.indices.size() == input.indices.size() &&
+              triangleSum(mesh) == triangleSum(input);
+  double perM = (t3 - t0) / (double(tris) / 1e6);
+  printf("  cache %.2f ms, overdraw %.2f ms, fetch %.2f ms (%.1f ms per "
+         "1M tris)%s\n",
+         t1 - t0, t2 - t1, t3 - t2, perM, same ? "" : " | MISMATCH");
+}
+
+static IndexedMesh shuffled(IndexedMesh mesh) {
+  std::mt19937 rng(1234);
+  size_t tris = mesh.indices.size() / 3;
+  for (size_t i = tris; i > 1; i--) {
+    size_t j = rng() % i;
+    for (int k = 0; k < 3; k++)
+      std::swap(mesh.indices[3 * (i - 1) + k], mesh.indices[3 * j + k]);
+  }
+  return mesh;
+}
+
+int main(int argc, char **argv) {
+  size_t tris = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout.setstate(std::ios::failbit); // MeshLoader's "Loaded N" chatter
+  MeshLoadOptions options;
+  options.useMmap = true;
+  options.parseThreads = 0;
+
+  run("monke.obj", MeshLoader::loadObjIndexed("monke.obj", options));
+
+  for (size_t n : {tris / 4, tris}) {
+    std::string big = "build/bench/grid_" + std::to_string(n) + ".obj";
+    if (!bench::writeGridObj(big, n)) {
+      fprintf(stderr, "Could not write %s\n", big.c_str());
+      return 1;
+    }
+    IndexedMesh grid = MeshLoader::loadObjIndexed(big, options);
+    run(big, grid);
+    run(big + " (shuffled)", shuffled(grid));
+  }
+  return 0;
+}